@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "decompress/filesystem.h"
+#include "batch.h"
+#include "inventory.h"
+#include "state.h"
+#include "metrics.h"
+#include "trace.h"
+#include "platform.h"
+#include "log.h"
+
+#define BATCH_IMAGE_EXTENSION       "IMG"
+#define BATCH_IMAGE_WINDOWS_DIR     "WINDOWS"
+
+typedef struct {
+    char *first;                    /* Windows directory, disk image, or VMOUSE.VXD */
+    char *second;                   /* MSMOUSE.VXD, NULL for a Windows directory */
+    bool success;
+    bool skipped;                   /* Unchanged since the run recorded in the state file */
+    bool alreadyPatched;            /* All drivers were patched already, which counts as success */
+    long bytes;
+    double seconds;
+    mfLogBuffer log;
+    mfStateFile inputs[MF_STATE_INPUTS];
+} mfBatchItem;
+
+typedef struct {
+    const mfBatchOptions *batch;
+    const mfPatchOptions *options;
+    mfBatchItem *items;
+    long count;
+    long capacity;
+    long done;
+    mfMutex outputLock;
+    mfState previous;               /* Loaded from the state file */
+} mfBatchState;
+
+static bool batchAddItem(mfBatchState *state, const char *first, const char *second) {
+    mfBatchItem *item;
+
+    if (state->count == state->capacity) {
+        long capacity = state->capacity ? state->capacity * 2 : 64;
+        mfBatchItem *items = realloc(state->items, capacity * sizeof(mfBatchItem));
+
+        if (items == NULL)
+            return false;
+
+        state->items = items;
+        state->capacity = capacity;
+    }
+
+    item = &state->items[state->count];
+    memset(item, 0, sizeof(mfBatchItem));
+    item->first = strdup(first);
+    item->second = second ? strdup(second) : NULL;
+
+    if (item->first == NULL || (second != NULL && item->second == NULL)) {
+        free(item->first);
+        free(item->second);
+        return false;
+    }
+
+    state->count++;
+    return true;
+}
+
+/* Splits off the next whitespace separated, optionally quoted token of a line. Returns NULL at the end of the line */
+static char *nextToken(char **cursor) {
+    char *p = *cursor;
+    char *token;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+
+    if (*p == 0x00)
+        return NULL;
+
+    if (*p == '"') {
+        token = ++p;
+
+        while (*p != 0x00 && *p != '"')
+            p++;
+    } else {
+        token = p;
+
+        while (*p != 0x00 && *p != ' ' && *p != '\t')
+            p++;
+    }
+
+    if (*p != 0x00)
+        *p++ = 0x00;
+
+    *cursor = p;
+    return token;
+}
+
+static bool batchReadManifest(mfBatchState *state, const char *manifest) {
+    long size;
+    char *text = (char *) openAndReadWholeFile(manifest, &size);
+    char *line;
+    u32 lineNumber = 0;
+    bool success = false;
+
+    if (text == NULL) {
+        printf("Error: Cannot read manifest %s\n", manifest);
+        return false;
+    }
+
+    /* Make room for the terminator */
+    line = realloc(text, size + 1);
+
+    if (line == NULL)
+        goto cleanup;
+
+    text = line;
+    text[size] = 0x00;
+
+    for (line = text; line != NULL && *line != 0x00; ) {
+        char *end = strchr(line, '\n');
+        char *cursor = line;
+        char *tokens[3];
+
+        if (end != NULL)
+            *end++ = 0x00;
+
+        if (strchr(line, '\r') != NULL)
+            *strchr(line, '\r') = 0x00;
+
+        lineNumber++;
+
+        tokens[0] = nextToken(&cursor);
+        tokens[1] = tokens[0] && tokens[0][0] != '#' ? nextToken(&cursor) : NULL;
+        tokens[2] = tokens[1] ? nextToken(&cursor) : NULL;
+
+        if (tokens[0] != NULL && tokens[0][0] != '#') {
+            if (tokens[2] != NULL) {
+                printf("Error: %s line %u: expected a Windows directory or two driver files\n", manifest, lineNumber);
+                goto cleanup;
+            }
+
+            if (!batchAddItem(state, tokens[0], tokens[1]))
+                goto cleanup;
+        }
+
+        line = end;
+    }
+
+    success = true;
+
+cleanup:
+    free(text);
+    return success;
+}
+
+static int compareItems(const void *a, const void *b) {
+    return strcmp(((const mfBatchItem *) a)->first, ((const mfBatchItem *) b)->first);
+}
+
+static bool batchReadDirectory(mfBatchState *state, const char *directory) {
+    fs_dir_t *dir = fs_dir_open(directory);
+    const char *name;
+    long firstItem = state->count;
+    bool success = true;
+
+    if (dir == NULL) {
+        printf("Error: Cannot open directory %s\n", directory);
+        return false;
+    }
+
+    while (success && (name = fs_dir_read(dir, 0)) != NULL) {
+        char *path;
+
+        if (0 == strcmp(name, ".") || 0 == strcmp(name, ".."))
+            continue;
+
+        /* Besides Windows directories, raw disk images are picked up (no filter, that would be either or) */
+
+        path = fs_path_get(directory, name, NULL);
+
+        if (path != NULL && !fs_is_dir(path) && !fs_ext_match(path, BATCH_IMAGE_EXTENSION)) {
+            fs_path_free(path);
+            continue;
+        }
+
+        if (path == NULL || !batchAddItem(state, path, NULL))
+            success = false;
+
+        fs_path_free(path);
+    }
+
+    fs_dir_close(&dir);
+
+    /* Directory order is up to the filesystem */
+    qsort(state->items + firstItem, state->count - firstItem, sizeof(mfBatchItem), compareItems);
+    return success;
+}
+
+static void batchReport(mfBatchState *state, const mfBatchItem *item) {
+    mutexLock(&state->outputLock);
+
+    state->done++;
+
+    /* An inventory prints nothing but its JSON lines to stdout */
+
+    if (state->batch->inventory) {
+        if (item->log.length > 0)
+            fputs(item->log.text, stdout);
+
+        fflush(stdout);
+        mutexUnlock(&state->outputLock);
+        return;
+    }
+
+    printf("[%ld/%ld] %-7s %s%s%s (%.2f s)\n",
+        state->done, state->count,
+        item->skipped ? "SKIPPED" : item->alreadyPatched ? "DONE" : item->success ? "OK" : "FAILED",
+        item->first, item->second ? " " : "", item->second ? item->second : "",
+        item->seconds);
+
+    if ((!item->success || state->batch->verbose) && item->log.length > 0)
+        printf("%s\n", item->log.text);
+
+    fflush(stdout);
+    mutexUnlock(&state->outputLock);
+}
+
+/* Paths of the inputs the state file records for a target: VMM32.VXD, VMOUSE.VXD and MSMOUSE.VXD, or the disk image */
+static void batchInputPaths(const mfBatchItem *item, const mfTarget *target, bool image, const char **paths) {
+    paths[0] = image ? item->first : target->vmm32Vxd;
+    paths[1] = image ? NULL : target->vmouseVxd;
+    paths[2] = image ? NULL : target->msmouseVxd;
+}
+
+/*  Whether a target can be skipped. Only the metadata of its inputs is
+    looked at, unless that changed since the recorded run. */
+static bool batchUnchanged(mfBatchState *state, mfBatchItem *item, const char **paths) {
+    const mfStateEntry *previous = stateFind(&state->previous, item->first, item->second);
+
+    stateScan(item->inputs, paths, previous ? previous->files : NULL);
+    return previous != NULL && previous->success && stateSameFiles(previous->files, item->inputs);
+}
+
+/*  One target, run as a scheduler task. While it waits for its own chunk
+    tasks, the thread may run another target, so the log capture is nested. */
+static void batchTask(void *arg, u32 index) {
+    mfBatchState *state = (mfBatchState *) arg;
+    mfBatchItem *item = &state->items[index];
+    mfLogBuffer *previousLog = logCapture(&item->log);
+    mfTarget *target = state->batch->inventory ? NULL : malloc(sizeof(mfTarget));
+    double start = timeNow();
+    double traceStart = traceBegin();
+
+    if (state->batch->inventory) {
+        /* Images are opened read-only, they may be on read-only media */
+
+        if (item->second == NULL && !fs_is_dir(item->first) && fs_file_exists(item->first))
+            item->success = inventoryRoot(item->first, NULL, BATCH_IMAGE_WINDOWS_DIR, state->options);
+        else
+            item->success = inventoryRoot(item->first, item->second, NULL, state->options);
+    } else if (target != NULL) {
+        bool ready = true;
+        bool incremental = state->batch->stateFile != NULL;
+        const char *paths[MF_STATE_INPUTS];
+
+        /* A single file is a disk image with the Windows directory in its usual place */
+        bool image = item->second == NULL && !fs_is_dir(item->first) && fs_file_exists(item->first);
+
+        memset(target, 0, sizeof(mfTarget));
+
+        if (item->second != NULL)
+            targetFromFiles(target, item->first, item->second);
+        else if (!image)
+            targetFromWindowsDir(target, item->first);
+
+        batchInputPaths(item, target, image, paths);
+
+        if (incremental && batchUnchanged(state, item, paths)) {
+            logPrintf("Unchanged since the last run\n");
+            item->skipped = true;
+            item->success = true;
+        } else {
+            if (image)
+                ready = targetFromImage(target, item->first, BATCH_IMAGE_WINDOWS_DIR, true);
+
+            if (!ready)
+                item->success = false;
+            else if (state->batch->undo)
+                item->success = undoTarget(target);
+            else
+                item->success = targetPrepare(target) && patchTarget(target, state->options);
+
+            /* Nothing left to do is as good as done, so the state file lets the next run skip it */
+            if (!item->success && !state->batch->undo && target->alreadyPatched == MF_TARGET_DRIVERS) {
+                item->alreadyPatched = true;
+                item->success = true;
+            }
+
+            targetClose(target);
+
+            /* Recorded as they are now, the files that were patched are hashed again */
+            if (incremental) {
+                mfStateFile before[MF_STATE_INPUTS];
+
+                memcpy(before, item->inputs, sizeof(before));
+                stateScan(item->inputs, paths, before);
+            }
+        }
+
+        item->bytes = target->bytesPatched;
+        free(target);
+    } else {
+        logPrintf("Error: Out of memory\n");
+    }
+
+    item->seconds = timeNow() - start;
+    traceSpan(item->skipped ? "target_skipped" : "target", item->first, traceStart, 0, (u64) item->bytes);
+    logCapture(previousLog);
+
+    batchReport(state, item);
+    logBufferFree(&item->log);
+}
+
+/* Sorts the targets by outcome for the metrics file */
+static bool batchWriteMetrics(const mfBatchState *state, double seconds) {
+    mfMetricsBatch metrics;
+
+    memset(&metrics, 0, sizeof(metrics));
+    metrics.undo = state->batch->undo;
+    metrics.seconds = seconds;
+    metrics.cache = state->batch->cache;
+
+    for (long i = 0; i < state->count; i++) {
+        const mfBatchItem *item = &state->items[i];
+
+        if (item->skipped) {
+            metrics.skipped++;
+            continue;
+        }
+
+        if (item->alreadyPatched)
+            metrics.alreadyPatched++;
+        else if (item->success)
+            metrics.patched++;
+        else
+            metrics.failed++;
+
+        metrics.bytesPatched += (u64) item->bytes;
+        metrics.latencyBuckets[statsBucket(item->seconds)]++;
+        metrics.latencySum += item->seconds;
+    }
+
+    return metricsWrite(state->batch->metricsFile, &metrics);
+}
+
+bool batchRun(const mfBatchOptions *batch, const mfPatchOptions *options, mfScheduler *sched) {
+    mfBatchState state;
+    u32 failed = 0;
+    u32 skipped = 0;
+    u32 alreadyPatched = 0;
+    bool written = true;            /* State and metrics files, they are not targets */
+    double bytes = 0.0;
+    double start;
+    double seconds;
+    bool success = false;
+
+    assert(batch != NULL);
+    assert(options != NULL);
+    assert(sched != NULL);
+
+    memset(&state, 0, sizeof(state));
+    state.batch = batch;
+    state.options = options;
+
+    if (batch->manifest != NULL && !batchReadManifest(&state, batch->manifest))
+        goto cleanup;
+
+    if (batch->directory != NULL && !batchReadDirectory(&state, batch->directory))
+        goto cleanup;
+
+    if (state.count == 0) {
+        printf("Error: Nothing to do\n");
+        goto cleanup;
+    }
+
+    if (batch->stateFile != NULL && !stateLoad(&state.previous, batch->stateFile))
+        goto cleanup;
+
+    /* The calling thread works on the batch as well while it waits */
+    fprintf(batch->inventory ? stderr : stdout, "Batch: %ld target(s) on %u thread(s)\n\n", state.count, schedWorkerCount(sched) + 1);
+
+    mutexInit(&state.outputLock);
+    start = timeNow();
+
+    schedParallelFor(sched, (u32) state.count, batchTask, &state);
+
+    seconds = timeNow() - start;
+    mutexDestroy(&state.outputLock);
+
+    for (long i = 0; i < state.count; i++) {
+        if (!state.items[i].success)
+            failed++;
+
+        if (state.items[i].skipped)
+            skipped++;
+
+        if (state.items[i].alreadyPatched)
+            alreadyPatched++;
+
+        bytes += state.items[i].bytes;
+    }
+
+    /* Targets that are not part of this run keep their entries */
+
+    if (batch->stateFile != NULL) {
+        bool saved = true;
+
+        for (long i = 0; i < state.count && saved; i++) {
+            mfStateEntry entry;
+
+            entry.first = state.items[i].first;
+            entry.second = state.items[i].second;
+            entry.success = state.items[i].success;
+            memcpy(entry.files, state.items[i].inputs, sizeof(entry.files));
+            saved = stateSet(&state.previous, &entry);
+        }
+
+        if (!saved || !stateSave(&state.previous, batch->stateFile))
+            written = false;
+    }
+
+    if (batch->metricsFile != NULL && !batchWriteMetrics(&state, seconds))
+        written = false;
+
+    if (batch->inventory) {
+        fprintf(stderr, "Inventory done: %ld target(s), %u without drivers in %.2f s\n", state.count, failed, seconds);
+        success = failed == 0 && written;
+        goto cleanup;
+    }
+
+    printf("\n");
+    printf("Batch done: %ld target(s), %ld %s, %u failed in %.2f s\n",
+        state.count, state.count - failed - skipped - alreadyPatched, batch->undo ? "restored" : "patched", failed, seconds);
+
+    if (alreadyPatched > 0)
+        printf("Already patched: %u target(s), left as they were\n", alreadyPatched);
+
+    if (skipped > 0)
+        printf("Skipped: %u target(s) unchanged since the last run\n", skipped);
+
+    if (seconds > 0.0 && bytes > 0.0)
+        printf("Throughput: %.1f targets/s, %.2f MB/s\n", state.count / seconds, bytes / seconds / (1024.0 * 1024.0));
+    else if (seconds > 0.0)
+        printf("Throughput: %.1f targets/s\n", state.count / seconds);
+
+    success = failed == 0 && written;
+
+cleanup:
+    for (long i = 0; i < state.count; i++) {
+        free(state.items[i].first);
+        free(state.items[i].second);
+    }
+
+    free(state.items);
+    stateFree(&state.previous);
+    return success;
+}
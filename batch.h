@@ -0,0 +1,38 @@
+#ifndef _MF_BATCH_H_
+#define _MF_BATCH_H_
+
+#include "util.h"
+#include "patcher.h"
+#include "sched.h"
+#include "cache.h"
+
+/*  Batch mode: patches (or restores) many targets on the task scheduler.
+
+    Targets come from a manifest file, one per line: either a Windows directory,
+    a raw FAT disk image (with the Windows directory in WINDOWS) or a
+    VMOUSE.VXD / MSMOUSE.VXD pair. Paths containing spaces are put in double
+    quotes, empty lines and lines starting with # are ignored.
+    Alternatively every subdirectory of a directory is taken as a Windows
+    directory, and every *.IMG file in it as a disk image.
+
+    With a state file, targets that were patched by an earlier run and whose
+    drivers (or image) have not changed since are skipped. A metrics file
+    for the Prometheus textfile collector can be written after the batch.
+*/
+
+typedef struct {
+    const char *manifest;           /* Manifest file, or NULL */
+    const char *directory;          /* Directory of Windows directories and images, or NULL */
+    bool undo;                      /* Restore instead of patching */
+    bool inventory;                 /* Only report what is installed, as JSON lines on stdout (see inventory.h) */
+    bool verbose;                   /* Print the output of every target, not only of failed ones */
+    const char *stateFile;          /* Skip targets whose inputs did not change since the last run (see state.h), or NULL */
+    const char *metricsFile;        /* Prometheus metrics of the batch (see metrics.h), or NULL */
+    const mfCache *cache;           /* Cache the targets use, for its hit counts in the metrics, or NULL */
+} mfBatchOptions;
+
+/*  Runs the batch with one scheduler task per target, returns false if the
+    targets could not be read or any target failed */
+bool batchRun(const mfBatchOptions *batch, const mfPatchOptions *options, mfScheduler *sched);
+
+#endif
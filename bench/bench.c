@@ -0,0 +1,627 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "util.h"
+#include "log.h"
+#include "platform.h"
+#include "sched.h"
+#include "patcher.h"
+#include "journal.h"
+#include "decompress/pew.h"
+#include "decompress/ds_decompress.h"
+#include "decompress/filesystem.h"
+
+/*  Benchmarks of the code paths unpacking and patching spend their time in.
+
+    Every benchmark is run a few times to warm up, which also decides how
+    many operations go into one sample so a sample takes long enough to be
+    measured. Then the samples are taken and printed as one JSON line per
+    benchmark: operations per sample, seconds per operation (minimum,
+    median, mean, maximum) and MB/s at the median.
+
+    The bit stream and findBytes run on generated data. The others need
+    input files: a VMM32.VXD (W4 or W3) and the two drivers. Benchmarks
+    without their input are left out. */
+
+#define BENCH_DEFAULT_WARMUP        (3)
+#define BENCH_DEFAULT_REPEAT        (10)
+#define BENCH_DEFAULT_MIN_MS        (50)
+#define BENCH_MAX_REPEAT            (10000)
+#define BENCH_RANDOM_SIZE           (1024 * 1024)
+#define BENCH_NEEDLE_SIZE           (16)
+#define BENCH_RATIO_CLASSES         (3)
+
+typedef struct {
+    const char *name;
+    bool (*setup)(void *ctx);       /* Before every operation and not timed, NULL if there is nothing to prepare */
+    bool (*run)(void *ctx);         /* One operation */
+    void (*release)(void *ctx);     /* Once all samples are taken, may be NULL */
+    void *ctx;
+    u64 bytes;                      /* Processed by one operation */
+} mfBench;
+
+typedef struct {
+    u32 warmup;
+    u32 repeat;
+    double minSeconds;              /* Shortest sample, operations are batched up to this */
+    const char *filter;
+    const char *workDir;
+    const char *vmm32Path;
+    const char *vmousePath;
+    const char *msmousePath;
+    u32 threads;
+} mfBenchOptions;
+
+typedef struct {
+    u8 *data;
+    size_t size;
+    u64 checksum;                   /* Keeps the compiler from dropping the work */
+} mfBenchBuffer;
+
+typedef struct {
+    const u8 *w4;
+    size_t w4Size;
+    u32 chunkSize;
+    u32 count;
+    u32 *offsets;                   /* Chunks of one kind */
+    u32 *sizes;                     /* Stored sizes */
+    u8 *out;
+    u64 bytes;                      /* Decompressed size of all of them */
+} mfBenchChunks;
+
+typedef struct {
+    const u8 *src;
+    size_t size;
+} mfBenchArchive;
+
+typedef struct {
+    const u8 *original;
+    long size;
+    char *path;
+    char *journalPath;
+    const mfPatchOptions *options;
+    bool vmouse;
+    mfLogBuffer log;
+} mfBenchPatch;
+
+static u64 benchRandomState = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64, the same data on every run */
+static u64 benchRandom(void) {
+    benchRandomState ^= benchRandomState << 13;
+    benchRandomState ^= benchRandomState >> 7;
+    benchRandomState ^= benchRandomState << 17;
+    return benchRandomState;
+}
+
+static int compareSeconds(const void *a, const void *b) {
+    double secondsA = *(const double *) a;
+    double secondsB = *(const double *) b;
+
+    return secondsA < secondsB ? -1 : secondsA > secondsB ? 1 : 0;
+}
+
+/* Times count operations, without the setup of each */
+static bool benchSample(const mfBench *bench, u32 count, double *seconds) {
+    *seconds = 0.0;
+
+    if (bench->setup == NULL) {
+        double start = timeNow();
+
+        for (u32 i = 0; i < count; i++) {
+            if (!bench->run(bench->ctx))
+                return false;
+        }
+
+        *seconds = timeNow() - start;
+        return true;
+    }
+
+    for (u32 i = 0; i < count; i++) {
+        double start;
+
+        if (!bench->setup(bench->ctx))
+            return false;
+
+        start = timeNow();
+
+        if (!bench->run(bench->ctx))
+            return false;
+
+        *seconds += timeNow() - start;
+    }
+
+    return true;
+}
+
+static bool benchMeasure(const mfBench *bench, const mfBenchOptions *options) {
+    double *samples = malloc(options->repeat * sizeof(double));
+    double seconds = 0.0;
+    double total = 0.0;
+    double median;
+    u32 count = 1;
+    bool success = samples != NULL;
+
+    /* Warming up also tells how long one operation takes */
+
+    for (u32 i = 0; success && i < options->warmup; i++)
+        success = benchSample(bench, 1, &seconds);
+
+    if (success && seconds < options->minSeconds)
+        count = seconds > 0.0 ? (u32) (options->minSeconds / seconds) + 1 : 1000;
+
+    for (u32 i = 0; success && i < options->repeat; i++) {
+        success = benchSample(bench, count, &samples[i]);
+        samples[i] /= count;
+        total += samples[i];
+    }
+
+    if (!success) {
+        fprintf(stderr, "Error: Benchmark %s failed\n", bench->name);
+        free(samples);
+        return false;
+    }
+
+    qsort(samples, options->repeat, sizeof(double), compareSeconds);
+    median = options->repeat % 2 ? samples[options->repeat / 2] : (samples[options->repeat / 2 - 1] + samples[options->repeat / 2]) / 2.0;
+
+    printf("{\"name\":\"%s\",\"bytes\":%llu,\"ops_per_sample\":%u,\"samples\":%u,\"min_s\":%.9f,\"median_s\":%.9f,\"mean_s\":%.9f,\"max_s\":%.9f,\"mb_s\":%.3f}\n",
+        bench->name, (unsigned long long) bench->bytes, count, options->repeat,
+        samples[0], median, total / options->repeat, samples[options->repeat - 1],
+        median > 0.0 ? (double) bench->bytes / median / (1024.0 * 1024.0) : 0.0);
+    fflush(stdout);
+
+    free(samples);
+    return true;
+}
+
+/* Runs a benchmark unless the filter leaves it out, then releases it */
+static bool benchRun(const mfBench *bench, const mfBenchOptions *options) {
+    bool success = true;
+
+    if (options->filter == NULL || strstr(bench->name, options->filter) != NULL)
+        success = benchMeasure(bench, options);
+
+    if (bench->release != NULL)
+        bench->release(bench->ctx);
+
+    return success;
+}
+
+/* Bit stream: reads in the widths the DS decoder refills its buffer with */
+static bool runBitstream(void *ctx) {
+    static const int widths[] = { 32, 9, 9, 8, 11, 15, 9, 17, 23 };
+    mfBenchBuffer *buffer = (mfBenchBuffer *) ctx;
+    bitstream_t in;
+    size_t bits = buffer->size * 8;
+    u32 sum = 0;
+    u32 i = 0;
+
+    bs_mem(&in, buffer->data, buffer->size);
+
+    while (bits >= 32) {
+        int width = widths[i++ % (sizeof(widths) / sizeof(widths[0]))];
+
+        sum += bs_read_bit_le(&in, width);
+        bits -= width;
+    }
+
+    buffer->checksum += sum;
+    return true;
+}
+
+/* findBytes over the whole buffer, the needle is at its very end */
+static bool runFindBytes(void *ctx) {
+    mfBenchBuffer *buffer = (mfBenchBuffer *) ctx;
+    const u8 *needle = buffer->data + buffer->size - BENCH_NEEDLE_SIZE;
+    u8 *found = findBytes(buffer->data, needle, buffer->size, BENCH_NEEDLE_SIZE);
+
+    buffer->checksum += (u64) (found - buffer->data);
+    return found == needle;
+}
+
+static bool runChunks(void *ctx) {
+    mfBenchChunks *chunks = (mfBenchChunks *) ctx;
+
+    for (u32 i = 0; i < chunks->count; i++) {
+        bitstream_t in;
+
+        /* Stored chunks are copied, like pe_w4_decompress_mem does */
+        if (chunks->sizes[i] == chunks->chunkSize) {
+            memcpy(chunks->out, chunks->w4 + chunks->offsets[i], chunks->chunkSize);
+            continue;
+        }
+
+        bs_mem(&in, (void *) (chunks->w4 + chunks->offsets[i]), chunks->w4Size - chunks->offsets[i]);
+
+        if (ds_decompress(&in, chunks->out, chunks->chunkSize) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+static void releaseChunks(void *ctx) {
+    mfBenchChunks *chunks = (mfBenchChunks *) ctx;
+
+    free(chunks->offsets);
+    free(chunks->sizes);
+    free(chunks->out);
+}
+
+static bool runW4ToW3(void *ctx) {
+    mfBenchArchive *archive = (mfBenchArchive *) ctx;
+    u8 *w3;
+    size_t w3Size;
+    int status = pe_w4_to_w3_mem(archive->src, archive->size, &w3, &w3Size);
+
+    free(w3);
+    return status == PE_OK;
+}
+
+static bool runW3Extract(void *ctx) {
+    mfBenchArchive *archive = (mfBenchArchive *) ctx;
+    u8 *vxd;
+    size_t vxdSize;
+    int status = pe_w3_extract_mem(archive->src, archive->size, "VMOUSE", &vxd, &vxdSize);
+
+    free(vxd);
+    return status == PE_OK;
+}
+
+/* Puts the unpatched driver back, without the journal of the last run */
+static bool setupPatch(void *ctx) {
+    mfBenchPatch *patch = (mfBenchPatch *) ctx;
+
+    fs_unlink(patch->journalPath);
+    return openAndWriteWholeFile(patch->path, patch->original, patch->size);
+}
+
+static bool runPatch(void *ctx) {
+    mfBenchPatch *patch = (mfBenchPatch *) ctx;
+    mfLogBuffer *previous = logCapture(&patch->log);
+    bool success = patch->vmouse ? patchVmouseVxd(patch->path, patch->options) : patchMsmouseVxd(patch->path, patch->options);
+
+    logCapture(previous);
+
+    if (!success)
+        fprintf(stderr, "%s", patch->log.text != NULL ? patch->log.text : "");
+
+    logBufferClear(&patch->log);
+    return success;
+}
+
+static void releasePatch(void *ctx) {
+    mfBenchPatch *patch = (mfBenchPatch *) ctx;
+
+    fs_unlink(patch->path);
+    fs_unlink(patch->journalPath);
+    fs_path_free(patch->path);
+    fs_path_free(patch->journalPath);
+    logBufferFree(&patch->log);
+}
+
+/*  Splits the chunks of a W4 archive by how well they are compressed:
+    stored, less than 2:1, up to 4:1 and more. Returns false if it is not W4. */
+static bool collectChunks(const u8 *w4, size_t w4Size, mfBenchChunks *stored, mfBenchChunks *classes) {
+    dos_header_t dos;
+    pe_header_t pe;
+    u32 header;
+    u32 chunkSize;
+    u32 chunkCount;
+
+    if (w4Size < sizeof(dos_header_t))
+        return false;
+
+    memcpy(&dos, w4, sizeof(dos));
+    header = dos.nextheader;
+
+    if (memcmp(dos.magic, MAGIC_DOS, 2) != 0 || header > w4Size - sizeof(pe_header_t))
+        return false;
+
+    memcpy(&pe, w4 + header, sizeof(pe));
+
+    if (memcmp(pe.magic, MAGIC_W4, 2) != 0)
+        return false;
+
+    chunkSize = pe.w4.chunk_size;
+    chunkCount = pe.w4.chunk_count;
+
+    if (chunkSize == 0 || header + sizeof(pe_header_t) + chunkCount * 4 > w4Size)
+        return false;
+
+    for (u32 n = 0; n <= BENCH_RATIO_CLASSES; n++) {
+        mfBenchChunks *chunks = n < BENCH_RATIO_CLASSES ? &classes[n] : stored;
+
+        memset(chunks, 0, sizeof(mfBenchChunks));
+        chunks->w4 = w4;
+        chunks->w4Size = w4Size;
+        chunks->chunkSize = chunkSize;
+        chunks->offsets = malloc(chunkCount * sizeof(u32) + 1);
+        chunks->sizes = malloc(chunkCount * sizeof(u32) + 1);
+        chunks->out = malloc(chunkSize);
+
+        if (chunks->offsets == NULL || chunks->sizes == NULL || chunks->out == NULL)
+            return false;
+    }
+
+    for (u32 i = 0; i < chunkCount; i++) {
+        u32 offset = read32(w4, header + sizeof(pe_header_t) + i * 4);
+        u32 end = i + 1 < chunkCount ? read32(w4, header + sizeof(pe_header_t) + (i + 1) * 4) : (u32) w4Size;
+        u32 size = end - offset;
+        mfBenchChunks *chunks;
+        bitstream_t in;
+        size_t outSize;
+
+        if (offset > end || end > w4Size)
+            return false;
+
+        if (size == chunkSize) {
+            chunks = stored;
+            outSize = chunkSize;
+        } else {
+            /* The last chunk may be shorter, its real size counts */
+            bs_mem(&in, (void *) (w4 + offset), w4Size - offset);
+            outSize = ds_decompress(&in, stored->out, chunkSize);
+
+            if (outSize == 0)
+                return false;
+
+            chunks = outSize < 2 * size ? &classes[0] : outSize < 4 * size ? &classes[1] : &classes[2];
+        }
+
+        chunks->offsets[chunks->count] = offset;
+        chunks->sizes[chunks->count] = size;
+        chunks->count++;
+        chunks->bytes += outSize;
+    }
+
+    return true;
+}
+
+static void printUsage(void) {
+    printf("bench [options]\n");
+    printf("\n");
+    printf("  --warmup <n>      operations before measuring (default %u)\n", BENCH_DEFAULT_WARMUP);
+    printf("  --repeat <n>      samples per benchmark (default %u)\n", BENCH_DEFAULT_REPEAT);
+    printf("  --min-ms <n>      shortest sample in ms, operations are batched up to it\n");
+    printf("                    (default %u)\n", BENCH_DEFAULT_MIN_MS);
+    printf("  --filter <text>   only run benchmarks with text in their name\n");
+    printf("  --vmm32 <file>    VMM32.VXD (W4 or W3) with VMOUSE.VXD in it\n");
+    printf("  --vmouse <file>   unpatched VMOUSE.VXD\n");
+    printf("  --msmouse <file>  unpatched MSMOUSE.VXD\n");
+    printf("  --work-dir <dir>  where the drivers are patched (default .)\n");
+    printf("  --threads <n>     also decompress W4 on n threads (default: one per processor)\n");
+    printf("\n");
+    printf("One JSON line per benchmark is written to stdout.\n");
+}
+
+int main(int argc, char *argv[]) {
+    static const char *const classNames[BENCH_RATIO_CLASSES] = {
+        "ds_decompress_ratio_lt2", "ds_decompress_ratio_2to4", "ds_decompress_ratio_ge4"
+    };
+    mfBenchOptions options;
+    mfBenchBuffer random;
+    mfBenchBuffer zeros;
+    mfBenchChunks stored;
+    mfBenchChunks classes[BENCH_RATIO_CLASSES];
+    mfBenchArchive w4 = { NULL, 0 };
+    mfBenchArchive w3 = { NULL, 0 };
+    mfPatchOptions patchOptions;
+    mfScheduler *sched = NULL;
+    u8 *vmm32 = NULL;
+    u8 *w3Data = NULL;
+    long vmm32Size = 0;
+    bool success = true;
+    int result = 1;
+
+    memset(&options, 0, sizeof(options));
+    options.warmup = BENCH_DEFAULT_WARMUP;
+    options.repeat = BENCH_DEFAULT_REPEAT;
+    options.minSeconds = BENCH_DEFAULT_MIN_MS / 1000.0;
+    options.workDir = ".";
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+
+        if (0 == strcmp("--warmup", argv[i]) && hasValue) {
+            options.warmup = (u32) strtoul(argv[++i], NULL, 10);
+        } else if (0 == strcmp("--repeat", argv[i]) && hasValue) {
+            options.repeat = (u32) strtoul(argv[++i], NULL, 10);
+        } else if (0 == strcmp("--min-ms", argv[i]) && hasValue) {
+            options.minSeconds = strtoul(argv[++i], NULL, 10) / 1000.0;
+        } else if (0 == strcmp("--filter", argv[i]) && hasValue) {
+            options.filter = argv[++i];
+        } else if (0 == strcmp("--vmm32", argv[i]) && hasValue) {
+            options.vmm32Path = argv[++i];
+        } else if (0 == strcmp("--vmouse", argv[i]) && hasValue) {
+            options.vmousePath = argv[++i];
+        } else if (0 == strcmp("--msmouse", argv[i]) && hasValue) {
+            options.msmousePath = argv[++i];
+        } else if (0 == strcmp("--work-dir", argv[i]) && hasValue) {
+            options.workDir = argv[++i];
+        } else if (0 == strcmp("--threads", argv[i]) && hasValue) {
+            options.threads = (u32) strtoul(argv[++i], NULL, 10);
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (options.repeat == 0 || options.repeat > BENCH_MAX_REPEAT) {
+        printUsage();
+        return 1;
+    }
+
+    memset(&random, 0, sizeof(random));
+    memset(&zeros, 0, sizeof(zeros));
+    memset(&stored, 0, sizeof(stored));
+    memset(classes, 0, sizeof(classes));
+
+    if (!patchOptionsInit(&patchOptions, false))
+        return 1;
+
+    /* Generated data: random bytes, and mostly zeros like the data objects of a VxD */
+
+    random.size = zeros.size = BENCH_RANDOM_SIZE;
+    random.data = malloc(random.size);
+    zeros.data = calloc(1, zeros.size);
+
+    if (random.data == NULL || zeros.data == NULL)
+        goto cleanup;
+
+    for (size_t i = 0; i < random.size; i += 8)
+        write64(random.data, (u32) i, benchRandom());
+
+    for (size_t i = 0; i < zeros.size; i += 64)
+        zeros.data[i] = (u8) benchRandom();
+
+    /* The needle is the end of the buffer, it must not turn up any earlier */
+    write64(zeros.data, (u32) zeros.size - 16, 0);
+    write64(zeros.data, (u32) zeros.size - 8, benchRandom() | 0x80);
+
+    {
+        mfBench bench = { "bs_read_bit_le", NULL, runBitstream, NULL, &random, BENCH_RANDOM_SIZE };
+        success = benchRun(&bench, &options) && success;
+    }
+
+    {
+        mfBench bench = { "findBytes_random", NULL, runFindBytes, NULL, &random, BENCH_RANDOM_SIZE };
+        success = benchRun(&bench, &options) && success;
+    }
+
+    {
+        mfBench bench = { "findBytes_zeros", NULL, runFindBytes, NULL, &zeros, BENCH_RANDOM_SIZE };
+        success = benchRun(&bench, &options) && success;
+    }
+
+    /* Archives */
+
+    if (options.vmm32Path != NULL) {
+        vmm32 = openAndReadWholeFile(options.vmm32Path, &vmm32Size);
+
+        if (vmm32 == NULL) {
+            fprintf(stderr, "Error: Cannot read %s\n", options.vmm32Path);
+            goto cleanup;
+        }
+
+        if (collectChunks(vmm32, (size_t) vmm32Size, &stored, classes)) {
+            size_t w3Size;
+
+            w4.src = vmm32;
+            w4.size = (size_t) vmm32Size;
+
+            for (u32 n = 0; n < BENCH_RATIO_CLASSES; n++) {
+                mfBench bench = { classNames[n], NULL, runChunks, NULL, &classes[n], classes[n].bytes };
+
+                if (classes[n].count > 0)
+                    success = benchRun(&bench, &options) && success;
+            }
+
+            if (stored.count > 0) {
+                mfBench bench = { "w4_chunk_stored", NULL, runChunks, NULL, &stored, stored.bytes };
+                success = benchRun(&bench, &options) && success;
+            }
+
+            if (pe_w4_to_w3_mem(w4.src, w4.size, &w3Data, &w3Size) != PE_OK) {
+                fprintf(stderr, "Error: Cannot decompress %s\n", options.vmm32Path);
+                goto cleanup;
+            }
+
+            w3.src = w3Data;
+            w3.size = w3Size;
+        } else {
+            w3.src = vmm32;
+            w3.size = (size_t) vmm32Size;
+        }
+    }
+
+    if (w4.src != NULL) {
+        mfBench bench = { "pe_w4_to_w3", NULL, runW4ToW3, NULL, &w4, w3.size };
+        success = benchRun(&bench, &options) && success;
+
+        /* The chunks on the scheduler, as the patcher decompresses them */
+
+        sched = schedCreate((options.threads ? options.threads : cpuCount()) - 1);
+
+        if (sched != NULL && schedWorkerCount(sched) > 0) {
+            mfBench parallel = { "pe_w4_to_w3_parallel", NULL, runW4ToW3, NULL, &w4, w3.size };
+
+            patcherSetScheduler(sched);
+            success = benchRun(&parallel, &options) && success;
+            patcherSetScheduler(NULL);
+        }
+    }
+
+    if (w3.src != NULL) {
+        u8 *vxd;
+        size_t vxdSize;
+        mfBench bench = { "pe_w3_extract", NULL, runW3Extract, NULL, &w3, 0 };
+
+        /* Names in the W3 directory are without extension */
+        if (pe_w3_extract_mem(w3.src, w3.size, "VMOUSE", &vxd, &vxdSize) != PE_OK) {
+            fprintf(stderr, "Error: No VMOUSE.VXD in %s\n", options.vmm32Path);
+            goto cleanup;
+        }
+
+        free(vxd);
+        bench.bytes = vxdSize;
+        success = benchRun(&bench, &options) && success;
+    }
+
+    /* Drivers, patched on disk like the command line tool does */
+
+    for (u32 n = 0; n < 2; n++) {
+        const char *path = n == 0 ? options.vmousePath : options.msmousePath;
+        mfBenchPatch patch;
+        mfBench bench = { n == 0 ? "patchVmouseVxd" : "patchMsmouseVxd", setupPatch, runPatch, releasePatch, &patch, 0 };
+        u8 *original;
+        long size;
+
+        if (path == NULL)
+            continue;
+
+        original = openAndReadWholeFile(path, &size);
+
+        if (original == NULL) {
+            fprintf(stderr, "Error: Cannot read %s\n", path);
+            goto cleanup;
+        }
+
+        memset(&patch, 0, sizeof(patch));
+        patch.original = original;
+        patch.size = size;
+        patch.options = &patchOptions;
+        patch.vmouse = n == 0;
+        patch.path = fs_path_get(options.workDir, n == 0 ? "BENCHVM.VXD" : "BENCHMS.VXD", NULL);
+        patch.journalPath = patch.path != NULL ? journalPathFor(patch.path) : NULL;
+        bench.bytes = (u64) size;
+
+        if (patch.journalPath != NULL)
+            success = benchRun(&bench, &options) && success;
+        else
+            success = false;
+
+        free(original);
+    }
+
+    result = success ? 0 : 1;
+
+cleanup:
+    releaseChunks(&stored);
+
+    for (u32 n = 0; n < BENCH_RATIO_CLASSES; n++)
+        releaseChunks(&classes[n]);
+
+    schedDestroy(sched);
+    free(w3Data);
+    free(vmm32);
+    free(random.data);
+    free(zeros.data);
+
+    /* Printed last, so the benchmarks above cannot be optimized away */
+    fprintf(stderr, "Checksum: %llx\n", (unsigned long long) (random.checksum + zeros.checksum));
+    return result;
+}
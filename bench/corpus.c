@@ -0,0 +1,940 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "util.h"
+#include "le.h"
+#include "decompress/pew.h"
+#include "decompress/ds_decompress.h"
+#include "decompress/filesystem.h"
+
+/*  Generator of synthetic drivers and VMM32.VXD archives, so the benchmarks
+    and the batch and parallel paths can run without Microsoft's files.
+
+    The drivers are structurally valid LE VxDs that contain little more than
+    what the patcher looks for (see patchdefs.c). VMOUSE.VXD has a PCOD
+    object with the end of initMouseSens and the middle of ChangeMouseSens,
+    each next to the two calls to CalculateSensitivity that get redirected.
+    VMOUSEME.VXD is the same in the layout of Windows ME, where PCOD leaves
+    too little room in its last page for the stub. MSMOUSE.VXD has the curve
+    tables in LDAT and a version resource with the FileDescription the patch
+    marker replaces. Its value is exactly as long as the description, too
+    short for the whole marker, MSMOUSEP.VXD has room for all of it.
+
+    VMM32.VXD is a W4 archive of VMM, VMOUSE and filler VxDs up to the given
+    size, compressed with a greedy DS compressor and checked by
+    decompressing every chunk again. The same archive as W3 is written as
+    VMM32W3.VXD. Every page of a filler is random bytes, sequences from a
+    small set of instructions, or repeats of earlier data, so the chunks
+    cover all the ratio classes of bench.c. Everything comes from the seed:
+    the same options give the same files. */
+
+#define CORPUS_DEFAULT_SIZE_KB      (1024)
+#define CORPUS_DEFAULT_RANDOM       (10)    /* Percent of filler pages that are random */
+#define CORPUS_DEFAULT_SEED         (866)
+#define CORPUS_MAX_SIZE_KB          (64 * 1024)
+#define CORPUS_MAX_TREE             (999)
+
+#define CORPUS_PAGE_SIZE            (4096)
+#define CORPUS_DOS_STUB_SIZE        (0x80)
+#define CORPUS_CHUNK_SIZE           (8192)
+#define CORPUS_W3_ALIGNMENT         (16)
+#define CORPUS_FILLER_PAGES         (15)    /* Code pages of one filler VxD */
+#define CORPUS_MEMBER_OVERHEAD      (0x1000)    /* Headers and data object of a filler, roughly */
+
+/* Object flags of VxD segments, on top of the ones in le.h */
+#define CORPUS_OBJECT_PRELOAD       (0x0040)
+#define CORPUS_OBJECT_32BIT         (0x2000)
+#define CORPUS_FLAGS_LOCKED_CODE    (CORPUS_OBJECT_32BIT | CORPUS_OBJECT_PRELOAD | LE_OBJECT_EXECUTABLE | LE_OBJECT_READABLE)
+#define CORPUS_FLAGS_PAGED_CODE     (CORPUS_OBJECT_32BIT | LE_OBJECT_EXECUTABLE | LE_OBJECT_READABLE)
+#define CORPUS_FLAGS_DATA           (CORPUS_OBJECT_32BIT | LE_OBJECT_WRITABLE | LE_OBJECT_READABLE)
+
+/* Limits of the DS format, see ds_decompress.h */
+#define DS_MAX_DISTANCE             (4414)
+#define DS_MAX_LENGTH               (512)
+#define DS_SHORT_DISTANCE           (64)    /* Distances below this take 6 bits, and allow matches of 2 bytes */
+#define DS_MEDIUM_DISTANCE          (320)
+#define DS_HASH_BITS                (12)
+#define DS_MAX_CHAIN                (64)    /* Candidates looked at for each match */
+
+#define VMOUSE_CODE_SIZE            (0x800)
+#define VMOUSE_CALCULATE_SENS       (0x100)
+#define VMOUSE_INIT_MOUSE_SENS      (0x300)
+#define VMOUSE_CHANGE_MOUSE_SENS    (0x500)
+#define VMOUSE_ME_PCOD_SLACK        (10)    /* Bytes left in the last page of PCOD in Windows ME */
+
+#define MSMOUSE_CURVE_LENGTH        (32)
+#define MSMOUSE_CURVE_PROFILES      (4)
+
+static const u8 dosStub[CORPUS_DOS_STUB_SIZE] = {
+    0x4D, 0x5A, 0x80, 0x00, 0x1F, 0x03, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00,
+    0xB8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00,
+    0x0E, 0x1F, 0xBA, 0x0E, 0x00, 0xB4, 0x09, 0xCD, 0x21, 0xB8, 0x01, 0x4C, 0xCD, 0x21, 0x54, 0x68,
+    0x69, 0x73, 0x20, 0x70, 0x72, 0x6F, 0x67, 0x72, 0x61, 0x6D, 0x20, 0x63, 0x61, 0x6E, 0x6E, 0x6F,
+    0x74, 0x20, 0x62, 0x65, 0x20, 0x72, 0x75, 0x6E, 0x20, 0x69, 0x6E, 0x20, 0x44, 0x4F, 0x53, 0x20,
+    0x6D, 0x6F, 0x64, 0x65, 0x2E, 0x0D, 0x0A, 0x24, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/* The patterns of patchdefs.c */
+static const u8 initMouseSensPattern[] = { 0x66, 0x8b, 0xf0, 0x89, 0x72, 0x1c, 0xf8, 0xc3 };
+static const u8 changeMouseSensPattern[] = { 0x8B, 0xF0, 0x0F, 0xB7, 0x45, 0x18, 0x3B };
+
+/* Instruction sequences the compressible filler pages are made of */
+static const u8 fillerWords[][6] = {
+    { 0x55, 0x8B, 0xEC },                   /* push ebp / mov ebp, esp */
+    { 0x8B, 0x45, 0x08 },                   /* mov eax, [ebp+8] */
+    { 0x8B, 0x4D, 0x0C },                   /* mov ecx, [ebp+0Ch] */
+    { 0x89, 0x72, 0x1C },                   /* mov [edx+1Ch], esi */
+    { 0x33, 0xC0 },                         /* xor eax, eax */
+    { 0x85, 0xC0, 0x74, 0x05 },             /* test eax, eax / jz short $+5 */
+    { 0xE8, 0x00, 0x00, 0x00, 0x00 },       /* call */
+    { 0x5D, 0xC3 },                         /* pop ebp / ret */
+    { 0xCD, 0x20, 0x01, 0x00, 0x01, 0x00 }, /* VMMCall */
+    { 0x0F, 0xB7, 0x45, 0x18 },             /* movzx eax, word ptr [ebp+18h] */
+    { 0xF8 },                               /* clc */
+    { 0x90, 0x90 },                         /* nop / nop */
+};
+static const u8 fillerWordLengths[] = { 3, 3, 3, 3, 2, 4, 5, 2, 6, 4, 1, 2 };
+
+typedef struct {
+    u8 *data;
+    u32 size;
+    u32 capacity;
+} mfCorpusBuffer;
+
+typedef struct {
+    const char *name;
+    const u8 *data;
+    u32 size;
+    u32 flags;
+} mfCorpusObject;
+
+typedef struct {
+    char name[PE_W3_FILE_NAME_SIZE + 1];
+    mfCorpusBuffer le;
+} mfCorpusMember;
+
+typedef struct {
+    bitstream_t out;
+    u16 head[1 << DS_HASH_BITS];    /* Last position + 1 with a hash, 0 if none */
+    u16 prev[CORPUS_CHUNK_SIZE];    /* Earlier position + 1 with the same hash */
+} mfDsCompressor;
+
+typedef struct {
+    const char *outDir;
+    u32 sizeKB;
+    u32 randomPercent;
+    u64 seed;
+    u32 tree;
+    bool me;                        /* VMM32 carries the Windows ME layout of VMOUSE */
+} mfCorpusOptions;
+
+static u64 corpusRandomState;
+
+/* xorshift64 */
+static u64 corpusRandom(void) {
+    corpusRandomState ^= corpusRandomState << 13;
+    corpusRandomState ^= corpusRandomState >> 7;
+    corpusRandomState ^= corpusRandomState << 17;
+    return corpusRandomState;
+}
+
+static bool bufferFill(mfCorpusBuffer *buffer, u8 value, u32 size) {
+    if (buffer->size + size > buffer->capacity) {
+        u32 capacity = buffer->capacity ? buffer->capacity : CORPUS_PAGE_SIZE;
+        u8 *grown;
+
+        while (capacity < buffer->size + size)
+            capacity *= 2;
+
+        grown = realloc(buffer->data, capacity);
+
+        if (grown == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return false;
+        }
+
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+
+    memset(&buffer->data[buffer->size], value, size);
+    buffer->size += size;
+    return true;
+}
+
+static bool bufferAppend(mfCorpusBuffer *buffer, const void *data, u32 size) {
+    if (size == 0)
+        return true;
+
+    if (!bufferFill(buffer, 0x00, size))
+        return false;
+
+    memcpy(&buffer->data[buffer->size - size], data, size);
+    return true;
+}
+
+/* Pads with zeros until the bytes since start are a multiple of alignment */
+static bool bufferAlign(mfCorpusBuffer *buffer, u32 start, u32 alignment) {
+    u32 length = buffer->size - start;
+    return bufferFill(buffer, 0x00, (alignment - length % alignment) % alignment);
+}
+
+static void bufferFree(mfCorpusBuffer *buffer) {
+    free(buffer->data);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+static u32 pagesOf(u32 size) {
+    return (size + CORPUS_PAGE_SIZE - 1) / CORPUS_PAGE_SIZE;
+}
+
+/*  LE VxD with the given objects, and the version resource after the pages
+    if there is one. There are no fixups, entries or names: the tables are
+    there but empty, the loader section ends after them. */
+static bool buildLe(mfCorpusBuffer *out, const mfCorpusObject *objects, u32 objectCount, const mfCorpusBuffer *resource) {
+    u32 pageCount = 0;
+    u32 page = 1;
+    u32 objectTable, pageMap, residentNames, entryTable, fixupPages, fixupRecords, imports, headerEnd;
+    u32 dataPages;
+    le_header_t *header;
+
+    out->size = 0;
+
+    for (u32 i = 0; i < objectCount; i++)
+        pageCount += pagesOf(objects[i].size);
+
+    /* Offsets of the tables are relative to the LE header, empty ones take a byte */
+    objectTable = LE_VXD_HEADER_SIZE;
+    pageMap = objectTable + objectCount * LE_OBJECT_TABLE_ENTRY_SIZE;
+    residentNames = pageMap + pageCount * LE_PAGE_MAP_ENTRY_SIZE;
+    entryTable = residentNames + 1;
+    fixupPages = entryTable + 1;
+    fixupRecords = fixupPages + 4 * (pageCount + 1);
+    imports = fixupRecords;
+    headerEnd = imports + 1;
+    dataPages = CORPUS_DOS_STUB_SIZE + ((headerEnd + 0xFF) & ~0xFFu);
+
+    if (!bufferAppend(out, dosStub, sizeof(dosStub))
+     || !bufferFill(out, 0x00, dataPages - CORPUS_DOS_STUB_SIZE + pageCount * CORPUS_PAGE_SIZE)
+     || (resource != NULL && !bufferAppend(out, resource->data, resource->size)))
+        return false;
+
+    header = (le_header_t *) &out->data[CORPUS_DOS_STUB_SIZE];
+    header->magic[0] = 'L';
+    header->magic[1] = 'E';
+    header->CPU_type = 2;                   /* 386 */
+    header->target_OS = 4;                  /* Windows 386 */
+    header->module_version = 0x40000;
+    header->module_type_flags = 0x38000;    /* Virtual device driver */
+    header->number_of_memory_pages = pageCount;
+    header->memory_page_size = CORPUS_PAGE_SIZE;
+    header->bytes_on_last_page = CORPUS_PAGE_SIZE;
+    header->fixup_section_size = fixupRecords - fixupPages;
+    header->loader_section_size = headerEnd - objectTable;
+    header->offset_of_object_table = objectTable;
+    header->object_table_entries = objectCount;
+    header->object_page_map_offset = pageMap;
+    header->resource_table_offset = residentNames;
+    header->resident_names_table_offset = residentNames;
+    header->entry_table_offset = entryTable;
+    header->fix_up_page_table_offset = fixupPages;
+    header->fix_up_record_table_offset = fixupRecords;
+    header->imported_modules_name_table_offset = imports;
+    header->imported_procedure_name_table_offset = imports;
+    header->data_pages_offset_from_top_of_file = dataPages;
+
+    if (resource != NULL) {
+        write32(out->data, CORPUS_DOS_STUB_SIZE + LE_VXD_RESOURCE_OFFSET, dataPages + pageCount * CORPUS_PAGE_SIZE);
+        write32(out->data, CORPUS_DOS_STUB_SIZE + LE_VXD_RESOURCE_SIZE, resource->size);
+    }
+
+    for (u32 i = 0; i < objectCount; i++) {
+        u32 entry = CORPUS_DOS_STUB_SIZE + objectTable + i * LE_OBJECT_TABLE_ENTRY_SIZE;
+        u32 count = pagesOf(objects[i].size);
+
+        write32(out->data, entry + 0x00, objects[i].size);
+        write32(out->data, entry + 0x04, page * 0x1000);
+        write32(out->data, entry + 0x08, objects[i].flags);
+        write32(out->data, entry + 0x0C, page);
+        write32(out->data, entry + 0x10, count);
+        memcpy(&out->data[entry + 0x14], objects[i].name, LE_OBJECT_NAME_LENGTH);
+
+        /* Page map entries hold the page number big endian in the middle */
+        for (u32 n = 0; n < count; n++) {
+            u32 map = CORPUS_DOS_STUB_SIZE + pageMap + (page + n - 1) * LE_PAGE_MAP_ENTRY_SIZE;
+            out->data[map + 1] = (u8) ((page + n) >> 8);
+            out->data[map + 2] = (u8) (page + n);
+        }
+
+        memcpy(&out->data[dataPages + (page - 1) * CORPUS_PAGE_SIZE], objects[i].data, objects[i].size);
+        page += count;
+    }
+
+    return true;
+}
+
+/* Starts a block of the version resource: length, value length, key and value, children follow */
+static bool versionBlockBegin(mfCorpusBuffer *out, u32 *start, const char *key, const void *value, u32 valueSize) {
+    u8 lengths[4] = { 0 };
+
+    *start = out->size;
+    write16(lengths, 2, (u16) valueSize);
+
+    return bufferAppend(out, lengths, sizeof(lengths))
+        && bufferAppend(out, key, (u32) strlen(key) + 1)
+        && bufferAlign(out, *start, 4)
+        && bufferAppend(out, value, valueSize)
+        && bufferAlign(out, *start, 4);
+}
+
+static void versionBlockEnd(mfCorpusBuffer *out, u32 start) {
+    write16(out->data, start, (u16) (out->size - start));
+}
+
+/* Version resource of a 16 bit resource table entry, like VxDs have them, with room bytes behind the description */
+static bool buildVersionResource(mfCorpusBuffer *out, const char *description, u32 room) {
+    static const u32 fixedInfo[] = {
+        0xFEEF04BD, 0x00010000,             /* Signature, structure version */
+        0x0004000A, 0x000008AE,             /* File version 4.10.2222 */
+        0x0004000A, 0x000008AE,             /* Product version */
+        0x3F, 0,                            /* Flags mask, flags */
+        4, 5,                               /* VOS_DOS_WINDOWS32, VFT_VXD */
+        0, 0, 0,
+    };
+    u8 entry[12] = { 0 };
+    u8 fixed[sizeof(fixedInfo)];
+    char value[128];
+    u32 root, stringInfo, table, string;
+    u32 valueSize = (u32) strlen(description) + 1 + room;
+
+    assert(valueSize <= sizeof(value));
+
+    /* Type and name are ordinals (0xFF and a word), then flags and size */
+    entry[0] = 0xFF;
+    write16(entry, 1, LE_RT_VERSION);
+    entry[3] = 0xFF;
+    write16(entry, 4, 1);
+    write16(entry, 6, 0x30);
+
+    for (u32 i = 0; i < sizeof(fixedInfo) / sizeof(fixedInfo[0]); i++)
+        write32(fixed, i * 4, fixedInfo[i]);
+
+    memset(value, 0x00, sizeof(value));
+    strcpy(value, description);
+
+    out->size = 0;
+
+    if (!bufferAppend(out, entry, sizeof(entry))
+     || !versionBlockBegin(out, &root, "VS_VERSION_INFO", fixed, sizeof(fixed))
+     || !versionBlockBegin(out, &stringInfo, "StringFileInfo", NULL, 0)
+     || !versionBlockBegin(out, &table, "040904E4", NULL, 0)
+     || !versionBlockBegin(out, &string, "FileDescription", value, valueSize))
+        return false;
+
+    versionBlockEnd(out, string);
+
+    if (!versionBlockBegin(out, &string, "ProductName", "Microsoft Windows", sizeof("Microsoft Windows")))
+        return false;
+
+    versionBlockEnd(out, string);
+    versionBlockEnd(out, table);
+    versionBlockEnd(out, stringInfo);
+    versionBlockEnd(out, root);
+
+    write32(out->data, 8, out->size - sizeof(entry));
+    return true;
+}
+
+/* call rel32 at offset to target */
+static void writeCall(u8 *code, u32 offset, u32 target) {
+    code[offset] = 0xE8;
+    write32(code, offset + 1, target - (offset + 5));
+}
+
+static bool buildVmouse(mfCorpusBuffer *out, bool me) {
+    u32 codeSize = me ? CORPUS_PAGE_SIZE - VMOUSE_ME_PCOD_SLACK : VMOUSE_CODE_SIZE;
+    u8 *lockedCode = malloc(5000);
+    u8 *code = malloc(codeSize);
+    u8 data[300];
+    bool success = false;
+
+    if (lockedCode == NULL || code == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        goto cleanup;
+    }
+
+    memset(lockedCode, 0xCC, 5000);
+    memset(code, 0x90, codeSize);
+    memset(data, 0x11, sizeof(data));
+
+    code[VMOUSE_CALCULATE_SENS] = 0xC3;
+
+    /* The calls are where the patch operations of patchdefs.c expect them */
+    writeCall(code, VMOUSE_INIT_MOUSE_SENS - 0x19, VMOUSE_CALCULATE_SENS);
+    writeCall(code, VMOUSE_INIT_MOUSE_SENS - 0x05, VMOUSE_CALCULATE_SENS);
+    memcpy(&code[VMOUSE_INIT_MOUSE_SENS], initMouseSensPattern, sizeof(initMouseSensPattern));
+
+    writeCall(code, VMOUSE_CHANGE_MOUSE_SENS - 0x05, VMOUSE_CALCULATE_SENS);
+    memcpy(&code[VMOUSE_CHANGE_MOUSE_SENS], changeMouseSensPattern, sizeof(changeMouseSensPattern));
+    writeCall(code, VMOUSE_CHANGE_MOUSE_SENS + 0x0F, VMOUSE_CALCULATE_SENS);
+
+    {
+        const mfCorpusObject objects[] = {
+            { "LCOD", lockedCode, 5000, CORPUS_FLAGS_LOCKED_CODE },
+            { "PCOD", code, codeSize, CORPUS_FLAGS_PAGED_CODE },
+            { "LDAT", data, sizeof(data), CORPUS_FLAGS_DATA },
+        };
+
+        success = buildLe(out, objects, 3, NULL);
+    }
+
+cleanup:
+    free(lockedCode);
+    free(code);
+    return success;
+}
+
+/* Curve table: three profiles that ramp up, then the last one the signature finds */
+static void writeCurveTable(u8 *table, u8 first) {
+    for (u32 profile = 0; profile < MSMOUSE_CURVE_PROFILES; profile++) {
+        u8 *entry = &table[profile * MSMOUSE_CURVE_LENGTH];
+
+        memset(entry, profile == MSMOUSE_CURVE_PROFILES - 1 ? 0x7F : 0x20 + profile, MSMOUSE_CURVE_LENGTH);
+        entry[0] = first;
+    }
+}
+
+static bool buildMsmouse(mfCorpusBuffer *out, u32 descriptionRoom) {
+    const u32 tableSize = MSMOUSE_CURVE_LENGTH * MSMOUSE_CURVE_PROFILES;
+    mfCorpusBuffer resource = { NULL, 0, 0 };
+    mfCorpusBuffer data = { NULL, 0, 0 };
+    u8 lockedCode[3000];
+    u8 table1[MSMOUSE_CURVE_LENGTH * MSMOUSE_CURVE_PROFILES];
+    u8 table2[MSMOUSE_CURVE_LENGTH * MSMOUSE_CURVE_PROFILES];
+    bool success = false;
+
+    memset(lockedCode, 0xCC, sizeof(lockedCode));
+    writeCurveTable(table1, 0x01);
+    writeCurveTable(table2, 0x10);
+
+    /* The first table is there twice, the second once, with data around them */
+    if (!bufferFill(&data, 0x22, 0x300) || !bufferAppend(&data, table1, tableSize)
+     || !bufferFill(&data, 0x33, 64) || !bufferAppend(&data, table1, tableSize)
+     || !bufferFill(&data, 0x44, 100) || !bufferAppend(&data, table2, tableSize)
+     || !bufferFill(&data, 0x55, 200))
+        goto cleanup;
+
+    if (!buildVersionResource(&resource, "Microsoft Mouse Mini-driver", descriptionRoom))
+        goto cleanup;
+
+    {
+        const mfCorpusObject objects[] = {
+            { "LCOD", lockedCode, sizeof(lockedCode), CORPUS_FLAGS_LOCKED_CODE },
+            { "LDAT", data.data, data.size, CORPUS_FLAGS_DATA },
+        };
+
+        success = buildLe(out, objects, 2, &resource);
+    }
+
+cleanup:
+    bufferFree(&resource);
+    bufferFree(&data);
+    return success;
+}
+
+/* One page of filler code: random, instruction sequences, or repeats of earlier pages */
+static void writeFillerPage(u8 *page, u32 index, u32 randomPercent) {
+    u32 kind = (u32) (corpusRandom() % 100) < randomPercent ? 0 : 1 + (u32) (corpusRandom() % 2);
+    u32 i = 0;
+
+    if (kind == 2 && index == 0)
+        kind = 1;
+
+    if (kind == 0) {
+        for (; i < CORPUS_PAGE_SIZE; i += 8)
+            write64(page, i, corpusRandom());
+    } else if (kind == 1) {
+        while (i < CORPUS_PAGE_SIZE) {
+            u32 word = (u32) (corpusRandom() % sizeof(fillerWordLengths));
+            u32 length = fillerWordLengths[word];
+
+            if (length > CORPUS_PAGE_SIZE - i)
+                length = CORPUS_PAGE_SIZE - i;
+
+            memcpy(&page[i], fillerWords[word], length);
+
+            /* Immediates and displacements that differ */
+            if (length > 2 && corpusRandom() % 4 == 0)
+                page[i + length - 1] = (u8) corpusRandom();
+
+            i += length;
+        }
+    } else {
+        /* Copies of the page before with a few bytes changed, like tables and padding */
+        const u8 *previous = page - CORPUS_PAGE_SIZE;
+
+        memcpy(page, previous, CORPUS_PAGE_SIZE);
+
+        for (u32 n = 0; n < 8; n++)
+            page[corpusRandom() % CORPUS_PAGE_SIZE] = (u8) corpusRandom();
+    }
+}
+
+static bool buildFiller(mfCorpusBuffer *out, u32 pages, u32 randomPercent) {
+    u8 *code = malloc(pages * CORPUS_PAGE_SIZE);
+    u8 data[CORPUS_PAGE_SIZE];
+    bool success;
+
+    if (code == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+
+    for (u32 i = 0; i < pages; i++)
+        writeFillerPage(&code[i * CORPUS_PAGE_SIZE], i, randomPercent);
+
+    /* Mostly zeros, like the data objects of real VxDs */
+    memset(data, 0x00, sizeof(data));
+
+    for (u32 i = 0; i < sizeof(data); i += 64)
+        data[i] = (u8) corpusRandom();
+
+    {
+        const mfCorpusObject objects[] = {
+            { "LCOD", code, pages * CORPUS_PAGE_SIZE, CORPUS_FLAGS_LOCKED_CODE },
+            { "LDAT", data, sizeof(data), CORPUS_FLAGS_DATA },
+        };
+
+        success = buildLe(out, objects, 2, NULL);
+    }
+
+    free(code);
+    return success;
+}
+
+/* W3 archive: the LE files without their DOS stubs, with their offsets made relative to the archive */
+static bool buildW3(mfCorpusBuffer *out, const mfCorpusMember *members, u32 count) {
+    pe_header_t header;
+    u32 offset = CORPUS_DOS_STUB_SIZE + sizeof(pe_header_t) + count * sizeof(pe_w3_file_t);
+
+    memset(&header, 0, sizeof(header));
+    header.magic[0] = 'W';
+    header.magic[1] = '3';
+    header.w3.os_hi = 4;
+    header.w3.vxd_count = (u16) count;
+
+    out->size = 0;
+
+    if (!bufferAppend(out, dosStub, sizeof(dosStub)) || !bufferAppend(out, &header, sizeof(header)))
+        return false;
+
+    for (u32 i = 0; i < count; i++) {
+        pe_w3_file_t file;
+        u32 size = members[i].le.size - CORPUS_DOS_STUB_SIZE;
+
+        memset(file.name, ' ', sizeof(file.name));
+        memcpy(file.name, members[i].name, strlen(members[i].name));
+        file.file_offset = offset;
+        file.header_size = LE_VXD_HEADER_SIZE;
+
+        if (!bufferAppend(out, &file, sizeof(file)))
+            return false;
+
+        offset += (size + CORPUS_W3_ALIGNMENT - 1) & ~(CORPUS_W3_ALIGNMENT - 1);
+    }
+
+    for (u32 i = 0; i < count; i++) {
+        u32 start = out->size;
+        le_header_t *le;
+
+        if (!bufferAppend(out, &members[i].le.data[CORPUS_DOS_STUB_SIZE], members[i].le.size - CORPUS_DOS_STUB_SIZE)
+         || !bufferAlign(out, start, CORPUS_W3_ALIGNMENT))
+            return false;
+
+        /* The other way round of what pe_w3_extract does */
+        le = (le_header_t *) &out->data[start];
+        le->data_pages_offset_from_top_of_file += start - CORPUS_DOS_STUB_SIZE;
+        le->nonresident_names_table_offset_from_top_of_file += start - CORPUS_DOS_STUB_SIZE;
+    }
+
+    return true;
+}
+
+static u32 dsHash(const u8 *data) {
+    u32 value = (u32) data[0] | ((u32) data[1] << 8) | ((u32) data[2] << 16);
+    return (value * 2654435761u) >> (32 - DS_HASH_BITS);
+}
+
+/* Match length: the position of the highest bit of length - 1 as zeros and a one, then the bits below it */
+static void dsWriteLength(bitstream_t *out, u32 length) {
+    u32 bits = 0;
+
+    while ((length - 1) >> (bits + 1))
+        bits++;
+
+    bs_write_bit_le(out, 0, (int) bits);
+    bs_write_bit_le(out, 1, 1);
+    bs_write_bit_le(out, (length - 1) - (1u << bits), (int) bits);
+}
+
+static void dsInsert(mfDsCompressor *ds, const u8 *data, u32 size, u32 position) {
+    u32 hash;
+
+    if (position + 3 > size)
+        return;
+
+    hash = dsHash(&data[position]);
+    ds->prev[position] = ds->head[hash];
+    ds->head[hash] = (u16) (position + 1);
+}
+
+/* Longest match for position in the hash chain, or one of 2 bytes close by */
+static u32 dsFindMatch(const mfDsCompressor *ds, const u8 *data, u32 size, u32 position, u32 *distance) {
+    u32 maxLength = size - position < DS_MAX_LENGTH ? size - position : DS_MAX_LENGTH;
+    u32 best = 0;
+
+    if (maxLength >= 3) {
+        u32 candidate = ds->head[dsHash(&data[position])];
+
+        for (u32 chain = 0; candidate != 0 && chain < DS_MAX_CHAIN; chain++) {
+            u32 from = candidate - 1;
+            u32 length = 0;
+
+            if (position - from > DS_MAX_DISTANCE)
+                break;
+
+            while (length < maxLength && data[from + length] == data[position + length])
+                length++;
+
+            if (length > best) {
+                best = length;
+                *distance = position - from;
+
+                if (length == maxLength)
+                    break;
+            }
+
+            candidate = ds->prev[from];
+        }
+    }
+
+    if (best >= 3 || maxLength < 2)
+        return best;
+
+    for (u32 d = 1; d < DS_SHORT_DISTANCE && d <= position; d++) {
+        if (data[position - d] == data[position] && data[position - d + 1] == data[position + 1]) {
+            *distance = d;
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+/* Compresses one chunk into out (at least twice the chunk size), returns the compressed size */
+static u32 dsCompress(mfDsCompressor *ds, const u8 *data, u32 size, u8 *out, u32 outSize) {
+    u32 position = 0;
+
+    bs_mem(&ds->out, out, outSize);
+    memset(ds->head, 0, sizeof(ds->head));
+
+    while (position < size) {
+        u32 distance = 0;
+        u32 length = dsFindMatch(ds, data, size, position, &distance);
+
+        if (length >= 2) {
+            if (distance < DS_SHORT_DISTANCE) {
+                bs_write_bit_le(&ds->out, 0, 2);
+                bs_write_bit_le(&ds->out, distance, 6);
+            } else if (distance < DS_MEDIUM_DISTANCE) {
+                bs_write_bit_le(&ds->out, 3, 3);
+                bs_write_bit_le(&ds->out, distance - DS_SHORT_DISTANCE, 8);
+            } else {
+                bs_write_bit_le(&ds->out, 7, 3);
+                bs_write_bit_le(&ds->out, distance - DS_MEDIUM_DISTANCE, 12);
+            }
+
+            dsWriteLength(&ds->out, length);
+        } else {
+            length = 1;
+            bs_write_bit_le(&ds->out, data[position] & 0x80 ? 1 : 2, 2);
+            bs_write_bit_le(&ds->out, data[position] & 0x7F, 7);
+        }
+
+        for (u32 i = 0; i < length; i++)
+            dsInsert(ds, data, size, position + i);
+
+        position += length;
+    }
+
+    /* End of the chunk: a short match with distance 0 */
+    bs_write_bit_le(&ds->out, 0, 2);
+    bs_write_bit_le(&ds->out, 0, 6);
+    bs_write_flush_le(&ds->out);
+
+    return (u32) ds->out.bs_mem.pos;
+}
+
+/* W4 archive of the W3 one, chunks that do not get smaller are stored */
+static bool buildW4(mfCorpusBuffer *out, const mfCorpusBuffer *w3) {
+    const u8 *source = &w3->data[CORPUS_DOS_STUB_SIZE];
+    u32 sourceSize = w3->size - CORPUS_DOS_STUB_SIZE;
+    u32 count = (sourceSize + CORPUS_CHUNK_SIZE - 1) / CORPUS_CHUNK_SIZE;
+    u32 table = CORPUS_DOS_STUB_SIZE + sizeof(pe_header_t);
+    mfDsCompressor *ds = malloc(sizeof(mfDsCompressor));
+    u8 *compressed = malloc(CORPUS_CHUNK_SIZE * 2);
+    u8 *check = malloc(CORPUS_CHUNK_SIZE);
+    pe_header_t header;
+    bool success = false;
+
+    if (ds == NULL || compressed == NULL || check == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        goto cleanup;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic[0] = 'W';
+    header.magic[1] = '4';
+    header.w4.os_hi = 4;
+    header.w4.chunk_size = CORPUS_CHUNK_SIZE;
+    header.w4.chunk_count = (u16) count;
+    header.w4.compression[0] = 'D';
+    header.w4.compression[1] = 'S';
+
+    out->size = 0;
+
+    if (!bufferAppend(out, w3->data, CORPUS_DOS_STUB_SIZE) || !bufferAppend(out, &header, sizeof(header))
+     || !bufferFill(out, 0x00, count * 4))
+        goto cleanup;
+
+    for (u32 i = 0; i < count; i++) {
+        const u8 *chunk = &source[i * CORPUS_CHUNK_SIZE];
+        u32 chunkSize = sourceSize - i * CORPUS_CHUNK_SIZE < CORPUS_CHUNK_SIZE ? sourceSize - i * CORPUS_CHUNK_SIZE : CORPUS_CHUNK_SIZE;
+        u32 size = dsCompress(ds, chunk, chunkSize, compressed, CORPUS_CHUNK_SIZE * 2);
+        bitstream_t in;
+
+        bs_mem(&in, compressed, size);
+
+        if (ds_decompress(&in, check, CORPUS_CHUNK_SIZE) != chunkSize || memcmp(check, chunk, chunkSize) != 0) {
+            fprintf(stderr, "Error: Chunk %u does not decompress to what was compressed\n", i);
+            goto cleanup;
+        }
+
+        write32(out->data, table + i * 4, out->size);
+
+        /* The unpacker takes full chunks of the chunk size as stored */
+        if (size >= CORPUS_CHUNK_SIZE && chunkSize == CORPUS_CHUNK_SIZE)
+            success = bufferAppend(out, chunk, chunkSize);
+        else
+            success = bufferAppend(out, compressed, size);
+
+        if (!success)
+            goto cleanup;
+    }
+
+    success = true;
+
+cleanup:
+    free(ds);
+    free(compressed);
+    free(check);
+    return success;
+}
+
+/* Fillers up to the size, with VMOUSE in the middle and VMM first */
+static bool buildMembers(mfCorpusMember **members, u32 *count, const mfCorpusBuffer *vmouse, const mfCorpusOptions *options) {
+    u64 remaining = (u64) options->sizeKB * 1024;
+    u32 capacity = (u32) (remaining / (CORPUS_FILLER_PAGES * CORPUS_PAGE_SIZE)) + 3;
+    mfCorpusMember *list = calloc(capacity, sizeof(mfCorpusMember));
+    u32 n = 0;
+    u32 middle;
+
+    *members = list;
+    *count = 0;
+
+    if (list == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+
+    remaining = remaining > vmouse->size ? remaining - vmouse->size : 0;
+
+    /* There is always VMM, even if VMOUSE alone is larger than the size */
+    do {
+        u32 pages = CORPUS_FILLER_PAGES;
+
+        if (remaining < (u64) pages * CORPUS_PAGE_SIZE + CORPUS_MEMBER_OVERHEAD)
+            pages = remaining > CORPUS_MEMBER_OVERHEAD + CORPUS_PAGE_SIZE ? (u32) ((remaining - CORPUS_MEMBER_OVERHEAD) / CORPUS_PAGE_SIZE) : 1;
+
+        if (n == 0)
+            strcpy(list[n].name, "VMM");
+        else
+            snprintf(list[n].name, sizeof(list[n].name), "FILL%04u", n % 10000);
+
+        if (!buildFiller(&list[n].le, pages, options->randomPercent)) {
+            *count = n;
+            return false;
+        }
+
+        remaining = remaining > list[n].le.size ? remaining - list[n].le.size : 0;
+        n++;
+    } while (remaining > CORPUS_MEMBER_OVERHEAD + CORPUS_PAGE_SIZE && n < capacity - 1);
+
+    middle = (n + 1) / 2;
+    memmove(&list[middle + 1], &list[middle], (n - middle) * sizeof(mfCorpusMember));
+    memset(&list[middle], 0, sizeof(mfCorpusMember));
+    strcpy(list[middle].name, "VMOUSE");
+    *count = ++n;
+
+    return bufferAppend(&list[middle].le, vmouse->data, vmouse->size);
+}
+
+static bool writeCorpusFile(const char *dir, const char *name, const mfCorpusBuffer *buffer) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    if (!openAndWriteWholeFile(path, buffer->data, buffer->size)) {
+        fprintf(stderr, "Error: Cannot write %s\n", path);
+        return false;
+    }
+
+    printf("%-40s %10u bytes\n", path, buffer->size);
+    return true;
+}
+
+static bool makeDirectory(const char *path) {
+    if (fs_mkdir(path) != 0 && !fs_is_dir(path)) {
+        fprintf(stderr, "Error: Cannot create %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+/*  Windows directories for --batch-dir, all with the same VMM32.VXD so the cache gets hits.
+    Every other one has the MSMOUSE.VXD with room for the whole marker. */
+static bool writeTree(const mfCorpusOptions *options, const mfCorpusBuffer *w4, const mfCorpusBuffer *msmouse, const mfCorpusBuffer *msmousePadded) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/TREE", options->outDir);
+
+    if (!makeDirectory(path))
+        return false;
+
+    for (u32 i = 1; i <= options->tree; i++) {
+        snprintf(path, sizeof(path), "%s/TREE/WIN%03u", options->outDir, i);
+
+        if (!makeDirectory(path))
+            return false;
+
+        snprintf(path, sizeof(path), "%s/TREE/WIN%03u/SYSTEM", options->outDir, i);
+
+        if (!makeDirectory(path) || !writeCorpusFile(path, "VMM32.VXD", w4) || !writeCorpusFile(path, "MSMOUSE.VXD", i % 2 ? msmouse : msmousePadded))
+            return false;
+    }
+
+    return true;
+}
+
+static void printUsage(void) {
+    printf("corpus --out <dir> [options]\n");
+    printf("\n");
+    printf("  --out <dir>       where the files are written, created if needed\n");
+    printf("  --size <KB>       uncompressed size of VMM32.VXD (default %u)\n", CORPUS_DEFAULT_SIZE_KB);
+    printf("  --random <n>      percent of filler pages that do not compress (default %u)\n", CORPUS_DEFAULT_RANDOM);
+    printf("  --seed <n>        seed of the filler data (default %u)\n", CORPUS_DEFAULT_SEED);
+    printf("  --me              put the Windows ME layout of VMOUSE.VXD into VMM32.VXD\n");
+    printf("  --tree <n>        also write n Windows directories to <dir>/TREE, for\n");
+    printf("                    --batch-dir\n");
+    printf("\n");
+    printf("Writes VMOUSE.VXD, VMOUSEME.VXD, MSMOUSE.VXD, MSMOUSEP.VXD, VMM32.VXD (W4)\n");
+    printf("and VMM32W3.VXD (W3).\n");
+}
+
+int main(int argc, char *argv[]) {
+    mfCorpusOptions options;
+    mfCorpusBuffer vmouse = { NULL, 0, 0 };
+    mfCorpusBuffer vmouseMe = { NULL, 0, 0 };
+    mfCorpusBuffer msmouse = { NULL, 0, 0 };
+    mfCorpusBuffer msmousePadded = { NULL, 0, 0 };
+    mfCorpusBuffer w3 = { NULL, 0, 0 };
+    mfCorpusBuffer w4 = { NULL, 0, 0 };
+    mfCorpusMember *members = NULL;
+    u32 memberCount = 0;
+    int result = 1;
+
+    memset(&options, 0, sizeof(options));
+    options.sizeKB = CORPUS_DEFAULT_SIZE_KB;
+    options.randomPercent = CORPUS_DEFAULT_RANDOM;
+    options.seed = CORPUS_DEFAULT_SEED;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+
+        if (0 == strcmp("--out", argv[i]) && hasValue) {
+            options.outDir = argv[++i];
+        } else if (0 == strcmp("--size", argv[i]) && hasValue) {
+            options.sizeKB = (u32) strtoul(argv[++i], NULL, 10);
+        } else if (0 == strcmp("--random", argv[i]) && hasValue) {
+            options.randomPercent = (u32) strtoul(argv[++i], NULL, 10);
+        } else if (0 == strcmp("--seed", argv[i]) && hasValue) {
+            options.seed = strtoull(argv[++i], NULL, 10);
+        } else if (0 == strcmp("--me", argv[i])) {
+            options.me = true;
+        } else if (0 == strcmp("--tree", argv[i]) && hasValue) {
+            options.tree = (u32) strtoul(argv[++i], NULL, 10);
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    /* W4 chunk counts are 16 bit, 64 MB is far below that */
+    if (options.outDir == NULL || options.sizeKB == 0 || options.sizeKB > CORPUS_MAX_SIZE_KB
+     || options.randomPercent > 100 || options.tree > CORPUS_MAX_TREE) {
+        printUsage();
+        return 1;
+    }
+
+    /* xorshift never leaves 0 */
+    corpusRandomState = options.seed ? options.seed : CORPUS_DEFAULT_SEED;
+
+    if (!makeDirectory(options.outDir)
+     || !buildVmouse(&vmouse, false) || !buildVmouse(&vmouseMe, true) || !buildMsmouse(&msmouse, 0) || !buildMsmouse(&msmousePadded, 7)
+     || !buildMembers(&members, &memberCount, options.me ? &vmouseMe : &vmouse, &options)
+     || !buildW3(&w3, members, memberCount) || !buildW4(&w4, &w3))
+        goto cleanup;
+
+    if (!writeCorpusFile(options.outDir, "VMOUSE.VXD", &vmouse)
+     || !writeCorpusFile(options.outDir, "VMOUSEME.VXD", &vmouseMe)
+     || !writeCorpusFile(options.outDir, "MSMOUSE.VXD", &msmouse)
+     || !writeCorpusFile(options.outDir, "MSMOUSEP.VXD", &msmousePadded)
+     || !writeCorpusFile(options.outDir, "VMM32W3.VXD", &w3)
+     || !writeCorpusFile(options.outDir, "VMM32.VXD", &w4))
+        goto cleanup;
+
+    if (options.tree > 0 && !writeTree(&options, &w4, &msmouse, &msmousePadded))
+        goto cleanup;
+
+    printf("%u drivers in VMM32.VXD, %u chunks\n", memberCount, read16(w4.data, CORPUS_DOS_STUB_SIZE + 6));
+    result = 0;
+
+cleanup:
+    for (u32 i = 0; i < memberCount; i++)
+        bufferFree(&members[i].le);
+
+    free(members);
+    bufferFree(&vmouse);
+    bufferFree(&vmouseMe);
+    bufferFree(&msmouse);
+    bufferFree(&msmousePadded);
+    bufferFree(&w3);
+    bufferFree(&w4);
+    return result;
+}
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "blockdev.h"
+#include "log.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+typedef struct {
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+} mfRawDevice;
+
+static bool rawInRange(const mfBlockDevice *dev, u64 offset, u32 size) {
+    return offset <= dev->size && size <= dev->size - offset;
+}
+
+static bool rawRead(mfBlockDevice *dev, u64 offset, void *buf, u32 size) {
+    mfRawDevice *raw = (mfRawDevice *) dev->priv;
+
+    if (!rawInRange(dev, offset, size))
+        return false;
+
+    if (dev->mapped != NULL) {
+        memcpy(buf, dev->mapped + offset, size);
+        return true;
+    }
+
+#ifdef _WIN32
+    {
+        LONG high = (LONG) (offset >> 32);
+        DWORD done = 0;
+
+        if (SetFilePointer(raw->file, (LONG) (u32) offset, &high, FILE_BEGIN) == INVALID_SET_FILE_POINTER && GetLastError() != NO_ERROR)
+            return false;
+
+        return ReadFile(raw->file, buf, size, &done, NULL) && done == size;
+    }
+#else
+    return pread(raw->fd, buf, size, (off_t) offset) == (ssize_t) size;
+#endif
+}
+
+static bool rawWrite(mfBlockDevice *dev, u64 offset, const void *buf, u32 size) {
+    mfRawDevice *raw = (mfRawDevice *) dev->priv;
+
+    if (!dev->writable || !rawInRange(dev, offset, size))
+        return false;
+
+    if (dev->mapped != NULL) {
+        memcpy(dev->mapped + offset, buf, size);
+        return true;
+    }
+
+#ifdef _WIN32
+    {
+        LONG high = (LONG) (offset >> 32);
+        DWORD done = 0;
+
+        if (SetFilePointer(raw->file, (LONG) (u32) offset, &high, FILE_BEGIN) == INVALID_SET_FILE_POINTER && GetLastError() != NO_ERROR)
+            return false;
+
+        return WriteFile(raw->file, buf, size, &done, NULL) && done == size;
+    }
+#else
+    return pwrite(raw->fd, buf, size, (off_t) offset) == (ssize_t) size;
+#endif
+}
+
+static bool rawFlush(mfBlockDevice *dev) {
+    mfRawDevice *raw = (mfRawDevice *) dev->priv;
+
+    if (!dev->writable)
+        return true;
+
+#ifdef _WIN32
+    if (dev->mapped != NULL && !FlushViewOfFile(dev->mapped, 0))
+        return false;
+
+    return FlushFileBuffers(raw->file) != 0;
+#else
+    if (dev->mapped != NULL && msync(dev->mapped, (size_t) dev->size, MS_SYNC) != 0)
+        return false;
+
+    return fsync(raw->fd) == 0;
+#endif
+}
+
+/* Maps the whole file if the address space allows, the device works without a mapping as well */
+static void rawMap(mfBlockDevice *dev) {
+    mfRawDevice *raw = (mfRawDevice *) dev->priv;
+
+#ifdef _WIN32
+    raw->mapping = dev->size ? CreateFileMappingA(raw->file, NULL, dev->writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL) : NULL;
+
+    if (raw->mapping != NULL && dev->size <= (size_t) -1)
+        dev->mapped = MapViewOfFile(raw->mapping, dev->writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+#else
+    void *mapped = dev->size && dev->size <= (size_t) -1
+        ? mmap(NULL, (size_t) dev->size, dev->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, raw->fd, 0)
+        : MAP_FAILED;
+
+    if (mapped != MAP_FAILED)
+        dev->mapped = mapped;
+#endif
+}
+
+static void rawUnmap(mfBlockDevice *dev) {
+    mfRawDevice *raw = (mfRawDevice *) dev->priv;
+
+#ifdef _WIN32
+    if (dev->mapped != NULL)
+        UnmapViewOfFile(dev->mapped);
+
+    if (raw->mapping != NULL)
+        CloseHandle(raw->mapping);
+
+    raw->mapping = NULL;
+#else
+    (void) raw;
+
+    if (dev->mapped != NULL)
+        munmap(dev->mapped, (size_t) dev->size);
+#endif
+
+    dev->mapped = NULL;
+}
+
+static bool rawResize(mfBlockDevice *dev, u64 size) {
+    mfRawDevice *raw = (mfRawDevice *) dev->priv;
+    bool success;
+
+    if (!dev->writable)
+        return false;
+
+    rawUnmap(dev);
+
+#ifdef _WIN32
+    {
+        LONG high = (LONG) (size >> 32);
+
+        success = (SetFilePointer(raw->file, (LONG) (u32) size, &high, FILE_BEGIN) != INVALID_SET_FILE_POINTER || GetLastError() == NO_ERROR)
+               && SetEndOfFile(raw->file);
+    }
+#else
+    success = ftruncate(raw->fd, (off_t) size) == 0;
+#endif
+
+    if (success)
+        dev->size = size;
+
+    rawMap(dev);
+    return success;
+}
+
+static void rawClose(mfBlockDevice *dev) {
+    mfRawDevice *raw = (mfRawDevice *) dev->priv;
+
+    rawUnmap(dev);
+
+#ifdef _WIN32
+    CloseHandle(raw->file);
+#else
+    close(raw->fd);
+#endif
+
+    free(raw);
+    free(dev);
+}
+
+mfBlockDevice *blockOpenRaw(const char *path, bool writable) {
+    mfBlockDevice *dev = calloc(1, sizeof(mfBlockDevice));
+    mfRawDevice *raw = calloc(1, sizeof(mfRawDevice));
+
+    assert(path != NULL);
+
+    if (dev == NULL || raw == NULL)
+        goto error;
+
+    dev->writable = writable;
+    dev->read = rawRead;
+    dev->write = rawWrite;
+    dev->flush = rawFlush;
+    dev->resize = rawResize;
+    dev->close = rawClose;
+    dev->priv = raw;
+
+#ifdef _WIN32
+    {
+        DWORD high = 0;
+        DWORD low;
+
+        raw->file = CreateFileA(path, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+        if (raw->file == INVALID_HANDLE_VALUE)
+            goto error;
+
+        low = GetFileSize(raw->file, &high);
+        dev->size = ((u64) high << 32) | low;
+    }
+#else
+    {
+        struct stat st;
+
+        raw->fd = open(path, writable ? O_RDWR : O_RDONLY);
+
+        if (raw->fd < 0)
+            goto error;
+
+        if (fstat(raw->fd, &st) != 0) {
+            close(raw->fd);
+            goto error;
+        }
+
+        dev->size = (u64) st.st_size;
+    }
+#endif
+
+    /* Mapping a large image can fail in a 32 bit address space, file I/O works anyway */
+    rawMap(dev);
+    return dev;
+
+error:
+    logPrintf("Error: Cannot open image %s\n", path);
+    free(raw);
+    free(dev);
+    return NULL;
+}
+
+bool blockRead(mfBlockDevice *dev, u64 offset, void *buf, u32 size) {
+    return dev->read(dev, offset, buf, size);
+}
+
+bool blockWrite(mfBlockDevice *dev, u64 offset, const void *buf, u32 size) {
+    return dev->write(dev, offset, buf, size);
+}
+
+bool blockFlush(mfBlockDevice *dev) {
+    return dev->flush(dev);
+}
+
+const u8 *blockView(mfBlockDevice *dev, u64 offset, u32 size, u8 **copy) {
+    *copy = NULL;
+
+    if (offset > dev->size || size > dev->size - offset)
+        return NULL;
+
+    if (dev->mapped != NULL)
+        return dev->mapped + offset;
+
+    *copy = malloc(size ? size : 1);
+
+    if (*copy == NULL || !blockRead(dev, offset, *copy, size)) {
+        free(*copy);
+        *copy = NULL;
+        return NULL;
+    }
+
+    return *copy;
+}
+
+bool blockResize(mfBlockDevice *dev, u64 size) {
+    return dev->resize != NULL && dev->resize(dev, size);
+}
+
+void blockClose(mfBlockDevice *dev) {
+    if (dev == NULL)
+        return;
+
+    dev->flush(dev);
+    dev->close(dev);
+}
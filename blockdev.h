@@ -0,0 +1,44 @@
+#ifndef _MF_BLOCKDEV_H_
+#define _MF_BLOCKDEV_H_
+
+#include "util.h"
+
+/*  Byte addressed access to a disk image.
+
+    Raw images are memory mapped where possible, reads and writes are then
+    plain memcpy into the mapping. If mapping fails (e.g. a 32 bit process
+    and a large image), they fall back to positioned file I/O.
+*/
+
+typedef struct mfBlockDevice mfBlockDevice;
+
+struct mfBlockDevice {
+    u64 size;
+    bool writable;
+    u8 *mapped;                     /* Whole device if it is mapped, else NULL */
+    bool (*read)(mfBlockDevice *dev, u64 offset, void *buf, u32 size);
+    bool (*write)(mfBlockDevice *dev, u64 offset, const void *buf, u32 size);
+    bool (*flush)(mfBlockDevice *dev);
+    bool (*resize)(mfBlockDevice *dev, u64 size);   /* NULL if the size is fixed */
+    void (*close)(mfBlockDevice *dev);
+    void *priv;
+};
+
+/* Opens a raw image file, NULL on error */
+mfBlockDevice *blockOpenRaw(const char *path, bool writable);
+
+bool blockRead(mfBlockDevice *dev, u64 offset, void *buf, u32 size);
+bool blockWrite(mfBlockDevice *dev, u64 offset, const void *buf, u32 size);
+bool blockFlush(mfBlockDevice *dev);
+
+/*  Bytes of the device without copying them if it is mapped. Otherwise they are
+    read into *copy, which the caller frees (NULL if nothing was copied). NULL on error */
+const u8 *blockView(mfBlockDevice *dev, u64 offset, u32 size, u8 **copy);
+
+/* Grows or shrinks the device, new space reads as zeros. Only raw files can do that */
+bool blockResize(mfBlockDevice *dev, u64 size);
+
+/* Flushes and closes the device */
+void blockClose(mfBlockDevice *dev);
+
+#endif
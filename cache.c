@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include "cache.h"
+#include "platform.h"
+#include "log.h"
+#include "decompress/filesystem.h"
+
+#define CACHE_MAGIC                 "MFC1"
+#define CACHE_EXTENSION             "MFC"
+#define CACHE_TEMP_EXTENSION        "TMP"
+#define CACHE_HEADER_SIZE           (16)    /* Magic, archive size, member size, member CRC-32 */
+#define CACHE_NAME_MAX              (64)
+#define CACHE_MAX_PENDING           (64)
+#define CACHE_WAIT_MS               (10)
+
+/* Temporary files this old were left behind by a process that died while writing them */
+#define CACHE_STALE_TEMP_SECONDS    (60 * 60)
+
+typedef struct {
+    char name[CACHE_NAME_MAX];
+    time_t used;
+    u64 size;
+} mfCacheFile;
+
+struct mfCache {
+    char *directory;
+    u64 maxBytes;
+    mfMutex mutex;                  /* Protects pending, and keeps this process' evictions apart */
+    char pending[CACHE_MAX_PENDING][CACHE_NAME_MAX];
+    volatile long hits;
+    volatile long misses;
+    volatile long tempCounter;
+};
+
+mfCache *cacheOpen(const char *directory, u64 maxBytes) {
+    mfCache *cache;
+
+    assert(directory != NULL);
+
+    if (!fs_is_dir(directory) && fs_mkdir(directory) != 0) {
+        logPrintf("Error: Cannot create cache directory %s\n", directory);
+        return NULL;
+    }
+
+    cache = calloc(1, sizeof(mfCache));
+
+    if (cache == NULL)
+        return NULL;
+
+    cache->directory = fs_path_dup(directory);
+
+    if (cache->directory == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    cache->maxBytes = maxBytes;
+    mutexInit(&cache->mutex);
+    return cache;
+}
+
+void cacheClose(mfCache *cache) {
+    if (cache == NULL)
+        return;
+
+    mutexDestroy(&cache->mutex);
+    fs_path_free(cache->directory);
+    free(cache);
+}
+
+void cacheKeyFromData(mfCacheKey *key, const u8 *archive, size_t size) {
+    assert(key != NULL);
+    assert(archive != NULL);
+
+    key->hash = hash64(archive, size);
+    key->size = (u32) size;
+}
+
+void cacheCounts(const mfCache *cache, u32 *hits, u32 *misses) {
+    assert(cache != NULL);
+
+    *hits = (u32) atomicRead((volatile long *) &cache->hits);
+    *misses = (u32) atomicRead((volatile long *) &cache->misses);
+}
+
+/* Entry name: archive hash, archive size and member, which is reduced to characters every file system takes */
+static void cacheEntryName(const mfCacheKey *key, const char *member, char *name) {
+    int length = snprintf(name, CACHE_NAME_MAX, "%08x%08x-%08x-", (u32) (key->hash >> 32), (u32) key->hash, key->size);
+
+    for (; *member != 0x00 && length < CACHE_NAME_MAX - (int) sizeof("." CACHE_EXTENSION); member++) {
+        char c = *member;
+        bool plain = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '.' || c == '_';
+
+        name[length++] = plain ? c : '_';
+    }
+
+    strcpy(name + length, "." CACHE_EXTENSION);
+}
+
+/* Reads an entry and checks it, a broken one is removed */
+static u8 *cacheRead(const char *path, const mfCacheKey *key, size_t *size) {
+    long fileSize;
+    u8 *data;
+    u8 *member;
+    u32 memberSize;
+
+    if (!fs_file_exists(path))
+        return NULL;
+
+    data = openAndReadWholeFile(path, &fileSize);
+
+    if (data == NULL)
+        return NULL;
+
+    memberSize = fileSize >= CACHE_HEADER_SIZE ? read32(data, 8) : 0;
+
+    if (fileSize < CACHE_HEADER_SIZE || 0 != memcmp(data, CACHE_MAGIC, 4) || read32(data, 4) != key->size
+     || memberSize != (u32) fileSize - CACHE_HEADER_SIZE || crc32Update(0, data + CACHE_HEADER_SIZE, memberSize) != read32(data, 12)) {
+        logPrintf("Removing broken cache entry %s\n", path);
+        fs_unlink(path);
+        free(data);
+        return NULL;
+    }
+
+    /* The payload is moved to the front, so the caller gets a buffer it can free */
+
+    memmove(data, data + CACHE_HEADER_SIZE, memberSize);
+    member = realloc(data, memberSize > 0 ? memberSize : 1);
+    *size = memberSize;
+    return member != NULL ? member : data;
+}
+
+/* Marks name as being decompressed by this thread, false if another thread already is */
+static bool cacheClaim(mfCache *cache, const char *name) {
+    int freeSlot = -1;
+
+    for (int i = 0; i < CACHE_MAX_PENDING; i++) {
+        if (0 == strcmp(cache->pending[i], name))
+            return false;
+
+        if (cache->pending[i][0] == 0x00 && freeSlot < 0)
+            freeSlot = i;
+    }
+
+    /* With all slots taken, decompressing twice is still better than waiting */
+
+    if (freeSlot >= 0)
+        strcpy(cache->pending[freeSlot], name);
+
+    return true;
+}
+
+static void cacheRelease(mfCache *cache, const char *name) {
+    for (int i = 0; i < CACHE_MAX_PENDING; i++) {
+        if (0 == strcmp(cache->pending[i], name))
+            cache->pending[i][0] = 0x00;
+    }
+}
+
+u8 *cacheBegin(mfCache *cache, const mfCacheKey *key, const char *member, size_t *size) {
+    char name[CACHE_NAME_MAX];
+    char *path;
+    u8 *data = NULL;
+
+    assert(cache != NULL);
+    assert(key != NULL);
+    assert(member != NULL);
+    assert(size != NULL);
+
+    cacheEntryName(key, member, name);
+    path = fs_path_get(cache->directory, name, NULL);
+
+    if (path == NULL)
+        return NULL;
+
+    for (;;) {
+        bool mine;
+
+        data = cacheRead(path, key, size);
+
+        if (data != NULL)
+            break;
+
+        mutexLock(&cache->mutex);
+        mine = cacheClaim(cache, name);
+        mutexUnlock(&cache->mutex);
+
+        if (mine)
+            break;
+
+        /* Another thread is decompressing the same member right now, its entry is about to appear */
+        threadSleep(CACHE_WAIT_MS);
+    }
+
+    if (data != NULL) {
+        /* The modification time is what eviction goes by */
+        utime(path, NULL);
+        atomicIncrement(&cache->hits);
+    } else {
+        atomicIncrement(&cache->misses);
+    }
+
+    fs_path_free(path);
+    return data;
+}
+
+static int compareUsed(const void *a, const void *b) {
+    const mfCacheFile *fileA = (const mfCacheFile *) a;
+    const mfCacheFile *fileB = (const mfCacheFile *) b;
+
+    return fileA->used < fileB->used ? -1 : fileA->used > fileB->used ? 1 : 0;
+}
+
+/* Removes the least recently used entries until the directory fits its size limit again */
+static void cacheEvict(mfCache *cache) {
+    fs_dir_t *dir = fs_dir_open(cache->directory);
+    mfCacheFile *files = NULL;
+    u32 count = 0;
+    u32 capacity = 0;
+    u64 total = 0;
+    time_t now = time(NULL);
+    const char *name;
+
+    if (dir == NULL)
+        return;
+
+    while ((name = fs_dir_read(dir, FS_FILTER_FILE)) != NULL) {
+        char *path;
+        struct stat st;
+        bool temp = fs_ext_match(name, CACHE_TEMP_EXTENSION);
+
+        if (!temp && (strlen(name) >= CACHE_NAME_MAX || !fs_ext_match(name, CACHE_EXTENSION)))
+            continue;
+
+        path = fs_path_get(cache->directory, name, NULL);
+
+        if (path == NULL || stat(path, &st) != 0) {
+            fs_path_free(path);
+            continue;
+        }
+
+        /* Temporary files are only ever in the way once their writer is gone */
+
+        if (temp) {
+            if (now - st.st_mtime > CACHE_STALE_TEMP_SECONDS)
+                fs_unlink(path);
+
+            fs_path_free(path);
+            continue;
+        }
+
+        fs_path_free(path);
+
+        if (count == capacity) {
+            mfCacheFile *grown = realloc(files, (capacity ? capacity * 2 : 64) * sizeof(mfCacheFile));
+
+            if (grown == NULL)
+                break;
+
+            files = grown;
+            capacity = capacity ? capacity * 2 : 64;
+        }
+
+        strcpy(files[count].name, name);
+        files[count].used = st.st_mtime;
+        files[count].size = (u64) st.st_size;
+        total += files[count].size;
+        count++;
+    }
+
+    fs_dir_close(&dir);
+
+    if (total > cache->maxBytes && count > 0) {
+        qsort(files, count, sizeof(mfCacheFile), compareUsed);
+
+        for (u32 i = 0; i < count && total > cache->maxBytes; i++) {
+            char *path = fs_path_get(cache->directory, files[i].name, NULL);
+
+            /* Another process may have evicted it already, or still be reading it (Windows) */
+            if (path != NULL && fs_unlink(path) == 0)
+                total -= files[i].size;
+            else
+                total -= files[i].size > total ? total : files[i].size;
+
+            fs_path_free(path);
+        }
+    }
+
+    free(files);
+}
+
+/* Writes the entry to a temporary file first and renames it into place */
+static bool cacheWrite(mfCache *cache, const char *name, const mfCacheKey *key, const u8 *data, size_t size) {
+    char tempName[CACHE_NAME_MAX + 32];
+    char *path = fs_path_get(cache->directory, name, NULL);
+    char *tempPath;
+    u8 header[CACHE_HEADER_SIZE];
+    FILE *f;
+    bool success;
+
+    if (path == NULL)
+        return false;
+
+    snprintf(tempName, sizeof(tempName), "%s.%x.%lx." CACHE_TEMP_EXTENSION, name, processId(), (unsigned long) atomicIncrement(&cache->tempCounter));
+    tempPath = fs_path_get(cache->directory, tempName, NULL);
+
+    if (tempPath == NULL) {
+        fs_path_free(path);
+        return false;
+    }
+
+    memcpy(header, CACHE_MAGIC, 4);
+    write32(header, 4, key->size);
+    write32(header, 8, (u32) size);
+    write32(header, 12, crc32Update(0, data, size));
+
+    f = fopen(tempPath, "wb");
+    success = f != NULL
+           && fwrite(header, 1, sizeof(header), f) == sizeof(header)
+           && fwrite(data, 1, size, f) == size;
+
+    if (f != NULL && fclose(f) != 0)
+        success = false;
+
+    /*  Where rename does not replace files (Windows), failing means another
+        worker got there first with the same contents, which is just as good */
+
+    if (!success || rename(tempPath, path) != 0)
+        fs_unlink(tempPath);
+
+    fs_path_free(tempPath);
+    fs_path_free(path);
+    return success;
+}
+
+void cacheEnd(mfCache *cache, const mfCacheKey *key, const char *member, const u8 *data, size_t size) {
+    char name[CACHE_NAME_MAX];
+
+    assert(cache != NULL);
+    assert(key != NULL);
+    assert(member != NULL);
+
+    cacheEntryName(key, member, name);
+
+    /* Written before the claim is released, so waiting threads find the entry */
+
+    if (data != NULL && size + CACHE_HEADER_SIZE <= cache->maxBytes && !cacheWrite(cache, name, key, data, size))
+        logPrintf("Warning: Cannot write cache entry %s\n", name);
+
+    mutexLock(&cache->mutex);
+    cacheRelease(cache, name);
+
+    if (data != NULL)
+        cacheEvict(cache);
+
+    mutexUnlock(&cache->mutex);
+}
@@ -0,0 +1,47 @@
+#ifndef _MF_CACHE_H_
+#define _MF_CACHE_H_
+
+#include "util.h"
+
+/*  Content addressed cache of files extracted from compressed archives
+    (VMOUSE.VXD from VMM32.VXD), so identical archives are only decompressed
+    once, however many installations or images they are in.
+
+    Entries are files in the cache directory, named after a hash and the size
+    of the archive plus the member name. They are written to a temporary file
+    and renamed into place, so other threads and processes sharing the
+    directory never see half of one. Hits refresh the modification time, and
+    once the directory grows past its size limit the least recently used
+    entries are removed.
+
+    Inside one process, only one thread decompresses a given member: the
+    others wait for it in cacheBegin and then get the cached copy.
+*/
+
+#define MF_CACHE_DEFAULT_SIZE       (256UL * 1024 * 1024)
+
+typedef struct mfCache mfCache;
+
+typedef struct {
+    u64 hash;                       /* hash64 of the whole archive */
+    u32 size;
+} mfCacheKey;
+
+/* Opens (and creates) the cache directory, maxBytes limits the size of all entries together */
+mfCache *cacheOpen(const char *directory, u64 maxBytes);
+void cacheClose(mfCache *cache);
+
+void cacheKeyFromData(mfCacheKey *key, const u8 *archive, size_t size);
+
+/*  Looks up a member of an archive. Returns a newly allocated copy if it is
+    cached. Otherwise NULL is returned and the caller has to decompress the
+    member and hand it to cacheEnd, whether that worked or not. */
+u8 *cacheBegin(mfCache *cache, const mfCacheKey *key, const char *member, size_t *size);
+
+/* Stores the member decompressed after cacheBegin missed, data is NULL if that failed */
+void cacheEnd(mfCache *cache, const mfCacheKey *key, const char *member, const u8 *data, size_t size);
+
+/* Number of lookups that were hits / misses so far */
+void cacheCounts(const mfCache *cache, u32 *hits, u32 *misses);
+
+#endif
@@ -319,9 +319,9 @@ INLINE uint32_t bs_read_bit_le(bitstream_t *bs, int cnt)
 					bs->bs_mem.bpos = 8;
 				}
 				
-				b |= (((uint32_t)bs->bs_file.byte & 0x1) << bt) << (by * 8);
-				bs->bs_file.byte >>= 1;
-				bs->bs_file.bpos--;
+				b |= (((uint32_t)bs->bs_mem.byte & 0x1) << bt) << (by * 8);
+				bs->bs_mem.byte >>= 1;
+				bs->bs_mem.bpos--;
 					
 				cnt--;
 			}
@@ -0,0 +1,551 @@
+/******************************************************************************
+ * Copyright (c) 2025 E. Voirin (oerg866)                                     *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cab.h"
+#include "inflate.h"
+#include "pew.h"
+
+#define CAB_HEADER_SIZE  36
+#define CAB_FOLDER_SIZE  8
+#define CAB_FILE_SIZE    16
+#define CAB_DATA_SIZE    8
+
+#define CAB_FLAG_PREV     0x0001
+#define CAB_FLAG_NEXT     0x0002
+#define CAB_FLAG_RESERVE  0x0004
+
+#define CAB_FOLDER_CONTINUED 0xFFFD /* 0xFFFD - 0xFFFF: file spans cabinets */
+
+#define CAB_BLOCK_MAX 32768 /* uncompressed size of one CFDATA block */
+
+static uint16_t cab_u16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t cab_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * Skip NUL terminated string in header
+ *
+ * @return: position after string, 0 if string doesn't end in cabinet
+ **/
+static size_t cab_skip_string(const cab_t *cab, size_t pos)
+{
+	const uint8_t *end;
+	
+	if(pos >= cab->size)
+	{
+		return 0;
+	}
+	
+	end = (const uint8_t*)memchr(cab->data + pos, '\0', cab->size - pos);
+	if(end == NULL)
+	{
+		return 0;
+	}
+	
+	return (size_t)(end - cab->data) + 1;
+}
+
+static int cab_parse(cab_t *cab)
+{
+	const uint8_t *h = cab->data;
+	uint32_t files_offset;
+	uint16_t flags;
+	size_t folder_reserve = 0;
+	size_t pos = CAB_HEADER_SIZE;
+	size_t i;
+	
+	if(cab->size < CAB_HEADER_SIZE || memcmp(h, "MSCF", 4) != 0)
+	{
+		return CAB_E_FORMAT;
+	}
+	
+	/* trailing data (e.g. another cabinet) isn't part of this one */
+	if(cab_u32(h + 8) < cab->size)
+	{
+		cab->size = cab_u32(h + 8);
+	}
+	
+	files_offset     = cab_u32(h + 16);
+	cab->folders_cnt = cab_u16(h + 26);
+	cab->files_cnt   = cab_u16(h + 28);
+	flags            = cab_u16(h + 30);
+	
+	if(flags & CAB_FLAG_RESERVE)
+	{
+		if(cab->size < CAB_HEADER_SIZE + 4)
+		{
+			return CAB_E_FORMAT;
+		}
+		
+		folder_reserve    = h[38];
+		cab->data_reserve = h[39];
+		pos += 4 + cab_u16(h + 36);
+	}
+	
+	/* previous / next cabinet and disk names */
+	for(i = 0; i < ((flags & CAB_FLAG_PREV) ? 2u : 0u) + ((flags & CAB_FLAG_NEXT) ? 2u : 0u); i++)
+	{
+		pos = cab_skip_string(cab, pos);
+		if(pos == 0)
+		{
+			return CAB_E_FORMAT;
+		}
+	}
+	
+	cab->folders = (cab_folder_t*)calloc(cab->folders_cnt + 1, sizeof(cab_folder_t));
+	cab->files   = (cab_file_t*)calloc(cab->files_cnt + 1, sizeof(cab_file_t));
+	if(cab->folders == NULL || cab->files == NULL)
+	{
+		return CAB_E_MALLOC;
+	}
+	
+	for(i = 0; i < cab->folders_cnt; i++)
+	{
+		if(pos > cab->size || cab->size - pos < CAB_FOLDER_SIZE + folder_reserve)
+		{
+			return CAB_E_FORMAT;
+		}
+		
+		cab->folders[i].data_offset = cab_u32(h + pos);
+		cab->folders[i].data_count  = cab_u16(h + pos + 4);
+		cab->folders[i].compression = cab_u16(h + pos + 6);
+		pos += CAB_FOLDER_SIZE + folder_reserve;
+	}
+	
+	pos = files_offset;
+	for(i = 0; i < cab->files_cnt; i++)
+	{
+		cab_file_t *file = &cab->files[i];
+		
+		if(pos > cab->size || cab->size - pos < CAB_FILE_SIZE)
+		{
+			return CAB_E_FORMAT;
+		}
+		
+		file->size          = cab_u32(h + pos);
+		file->folder_offset = cab_u32(h + pos + 4);
+		file->folder        = cab_u16(h + pos + 8);
+		file->date          = cab_u16(h + pos + 10);
+		file->time          = cab_u16(h + pos + 12);
+		file->attribs       = cab_u16(h + pos + 14);
+		file->name          = (const char*)(h + pos + CAB_FILE_SIZE);
+		
+		pos = cab_skip_string(cab, pos + CAB_FILE_SIZE);
+		if(pos == 0)
+		{
+			return CAB_E_FORMAT;
+		}
+	}
+	
+	return CAB_OK;
+}
+
+/**
+ * Open cabinet from memory, data must stay valid until cab_close
+ *
+ * @param data: whole cabinet
+ * @param size: size of data
+ * @param status: CAB_OK or error code, may be NULL
+ *
+ * @return: cabinet or NULL on error
+ **/
+cab_t *cab_open_mem(const uint8_t *data, size_t size, int *status)
+{
+	cab_t *cab;
+	int s;
+	
+	cab = (cab_t*)calloc(1, sizeof(cab_t));
+	if(cab == NULL)
+	{
+		s = CAB_E_MALLOC;
+	}
+	else
+	{
+		cab->data = data;
+		cab->size = size;
+		
+		s = cab_parse(cab);
+		if(s != CAB_OK)
+		{
+			cab_close(cab);
+			cab = NULL;
+		}
+	}
+	
+	if(status != NULL)
+	{
+		*status = s;
+	}
+	
+	return cab;
+}
+
+/**
+ * Load cabinet file to memory and open it
+ *
+ * @param path: cabinet file name
+ * @param status: CAB_OK or error code, may be NULL
+ *
+ * @return: cabinet or NULL on error
+ **/
+cab_t *cab_open(const char *path, int *status)
+{
+	FILE *fp;
+	long size;
+	uint8_t *data = NULL;
+	cab_t *cab = NULL;
+	int s = CAB_E_FOPEN;
+	
+	fp = fopen(path, "rb");
+	if(fp != NULL)
+	{
+		if(fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0)
+		{
+			data = (uint8_t*)malloc(size > 0 ? size : 1);
+			if(data == NULL)
+			{
+				s = CAB_E_MALLOC;
+			}
+			else if(fread(data, 1, size, fp) == (size_t)size)
+			{
+				cab = cab_open_mem(data, size, &s);
+				if(cab != NULL)
+				{
+					cab->owned = data;
+					data = NULL;
+				}
+			}
+		}
+		
+		fclose(fp);
+	}
+	
+	free(data);
+	
+	if(status != NULL)
+	{
+		*status = s;
+	}
+	
+	return cab;
+}
+
+void cab_close(cab_t *cab)
+{
+	if(cab != NULL)
+	{
+		free(cab->folders);
+		free(cab->files);
+		free(cab->owned);
+		free(cab);
+	}
+}
+
+static int cab_char_eq(char a, char b)
+{
+	if(a >= 'a' && a <= 'z') a -= 'a' - 'A';
+	if(b >= 'a' && b <= 'z') b -= 'a' - 'A';
+	
+	return a == b;
+}
+
+static int cab_name_eq(const char *a, const char *b)
+{
+	while(*a != '\0' && *b != '\0')
+	{
+		if(!cab_char_eq(*a, *b))
+		{
+			return 0;
+		}
+		a++;
+		b++;
+	}
+	
+	return *a == *b;
+}
+
+/**
+ * Find file in cabinet, case insensitive. Matches full name stored in
+ * cabinet or only its part after last backslash.
+ *
+ * @return: file index or -1 if not found
+ **/
+int cab_find(cab_t *cab, const char *name)
+{
+	size_t i;
+	
+	for(i = 0; i < cab->files_cnt; i++)
+	{
+		const char *stored = cab->files[i].name;
+		const char *base   = strrchr(stored, '\\');
+		
+		if(cab_name_eq(stored, name) || (base != NULL && cab_name_eq(base + 1, name)))
+		{
+			return (int)i;
+		}
+	}
+	
+	return -1;
+}
+
+typedef struct _cab_folder_job_t
+{
+	cab_t    *cab;
+	uint16_t  folder;
+	uint32_t  needed;  /* decompress at least this number of bytes */
+	uint8_t  *out;
+	int       status;
+} cab_folder_job_t;
+
+/**
+ * Decompress beginning of folder, from start of folder until the block
+ * containing needed byte. MSZIP blocks refer to data of previous blocks,
+ * so folder is always decoded from its start.
+ **/
+static int cab_folder_decode(cab_folder_job_t *job)
+{
+	const cab_t *cab = job->cab;
+	const cab_folder_t *folder = &cab->folders[job->folder];
+	size_t pos = folder->data_offset;
+	size_t out_pos = 0;
+	size_t block;
+	
+	switch(folder->compression & 0x000F)
+	{
+		case CAB_COMP_NONE:
+		case CAB_COMP_MSZIP:
+			break;
+		default:
+			return CAB_E_COMPRESSION;
+	}
+	
+	/* last block may cross needed size */
+	job->out = (uint8_t*)malloc((size_t)job->needed + CAB_BLOCK_MAX);
+	if(job->out == NULL)
+	{
+		return CAB_E_MALLOC;
+	}
+	
+	for(block = 0; block < folder->data_count && out_pos < job->needed; block++)
+	{
+		const uint8_t *data;
+		uint16_t packed;
+		uint16_t unpacked;
+		
+		if(pos > cab->size || cab->size - pos < (size_t)CAB_DATA_SIZE + cab->data_reserve)
+		{
+			return CAB_E_DATA;
+		}
+		
+		packed   = cab_u16(cab->data + pos + 4);
+		unpacked = cab_u16(cab->data + pos + 6);
+		pos += CAB_DATA_SIZE + cab->data_reserve;
+		data = cab->data + pos;
+		
+		/* unpacked == 0: block continues in next cabinet */
+		if(unpacked == 0 || unpacked > CAB_BLOCK_MAX || cab->size - pos < packed)
+		{
+			return unpacked == 0 ? CAB_E_SPANNED : CAB_E_DATA;
+		}
+		
+		if((folder->compression & 0x000F) == CAB_COMP_NONE)
+		{
+			if(packed != unpacked)
+			{
+				return CAB_E_DATA;
+			}
+			
+			memcpy(job->out + out_pos, data, unpacked);
+		}
+		else
+		{
+			size_t end = 0;
+			
+			if(packed < 2 || data[0] != 'C' || data[1] != 'K')
+			{
+				return CAB_E_DATA;
+			}
+			
+			if(inflate_raw(data + 2, packed - 2, job->out, out_pos, out_pos + unpacked, &end) != INFLATE_OK
+				|| end != out_pos + unpacked)
+			{
+				return CAB_E_DATA;
+			}
+		}
+		
+		out_pos += unpacked;
+		pos += packed;
+	}
+	
+	return out_pos >= job->needed ? CAB_OK : CAB_E_DATA;
+}
+
+static void cab_folder_task(void *arg, size_t index)
+{
+	cab_folder_job_t *job = ((cab_folder_job_t*)arg) + index;
+	
+	job->status = cab_folder_decode(job);
+}
+
+/**
+ * Extract more files at once. Every folder containing some of files is
+ * decompressed only once and folders are decompressed in parallel.
+ *
+ * @param files: file indexes (from cab_find)
+ * @param count: number of files
+ * @param outputs: on success, outputs[i] is malloc'ed content of files[i]
+ *                 (size is in cab->files[files[i]].size), NULL on error
+ *
+ * @return: CAB_OK if all files were extracted, otherwise first error
+ **/
+int cab_extract_many(cab_t *cab, const int *files, size_t count, uint8_t **outputs)
+{
+	cab_folder_job_t *jobs;
+	size_t jobs_cnt = 0;
+	size_t i, j;
+	int status = CAB_OK;
+	
+	jobs = (cab_folder_job_t*)calloc(count + 1, sizeof(cab_folder_job_t));
+	if(jobs == NULL)
+	{
+		return CAB_E_MALLOC;
+	}
+	
+	for(i = 0; i < count; i++)
+	{
+		outputs[i] = NULL;
+	}
+	
+	for(i = 0; i < count; i++)
+	{
+		const cab_file_t *file = &cab->files[files[i]];
+		uint32_t end = file->folder_offset + file->size;
+		
+		if(file->folder >= CAB_FOLDER_CONTINUED)
+		{
+			status = CAB_E_SPANNED;
+			goto cab_extract_many_cleanup;
+		}
+		
+		if(file->folder >= cab->folders_cnt || end < file->folder_offset)
+		{
+			status = CAB_E_FORMAT;
+			goto cab_extract_many_cleanup;
+		}
+		
+		for(j = 0; j < jobs_cnt; j++)
+		{
+			if(jobs[j].folder == file->folder)
+			{
+				break;
+			}
+		}
+		
+		if(j == jobs_cnt)
+		{
+			jobs[j].cab    = cab;
+			jobs[j].folder = file->folder;
+			jobs_cnt++;
+		}
+		
+		if(end > jobs[j].needed)
+		{
+			jobs[j].needed = end;
+		}
+	}
+	
+	pe_parallel_run(jobs_cnt, cab_folder_task, jobs);
+	
+	for(i = 0; i < count; i++)
+	{
+		const cab_file_t *file = &cab->files[files[i]];
+		
+		for(j = 0; jobs[j].folder != file->folder; j++);
+		
+		if(jobs[j].status != CAB_OK)
+		{
+			status = jobs[j].status;
+			break;
+		}
+		
+		outputs[i] = (uint8_t*)malloc(file->size > 0 ? file->size : 1);
+		if(outputs[i] == NULL)
+		{
+			status = CAB_E_MALLOC;
+			break;
+		}
+		
+		memcpy(outputs[i], jobs[j].out + file->folder_offset, file->size);
+	}
+	
+	cab_extract_many_cleanup:
+	if(status != CAB_OK)
+	{
+		for(i = 0; i < count; i++)
+		{
+			free(outputs[i]);
+			outputs[i] = NULL;
+		}
+	}
+	
+	for(j = 0; j < jobs_cnt; j++)
+	{
+		free(jobs[j].out);
+	}
+	free(jobs);
+	
+	return status;
+}
+
+/**
+ * Extract one file
+ *
+ * @param file: file index (from cab_find)
+ * @param status: CAB_OK or error code, may be NULL
+ *
+ * @return: malloc'ed file content (size is in cab->files[file].size) or NULL
+ **/
+uint8_t *cab_extract(cab_t *cab, int file, int *status)
+{
+	uint8_t *out = NULL;
+	int s = cab_extract_many(cab, &file, 1, &out);
+	
+	if(status != NULL)
+	{
+		*status = s;
+	}
+	
+	return out;
+}
@@ -0,0 +1,89 @@
+/******************************************************************************
+ * Copyright (c) 2025 E. Voirin (oerg866)                                     *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+*******************************************************************************/
+#ifndef __CAB_H__INCLUDED__
+#define __CAB_H__INCLUDED__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Microsoft cabinet (MSCF) reader, stored and MSZIP folders
+ *
+ * The cabinet is read from memory. Files are decompressed straight from the
+ * cabinet data, every folder that is needed is decoded only once and
+ * folders are decoded in parallel (see pe_set_parallel_for).
+ */
+
+#define CAB_OK             0
+#define CAB_E_FORMAT       1 /* not a cabinet or damaged headers */
+#define CAB_E_COMPRESSION  2 /* Quantum or LZX folder */
+#define CAB_E_DATA         3 /* damaged compressed data */
+#define CAB_E_SPANNED      4 /* file continues in another cabinet */
+#define CAB_E_MALLOC       5
+#define CAB_E_FOPEN        6
+
+#define CAB_COMP_NONE   0
+#define CAB_COMP_MSZIP  1
+
+typedef struct _cab_folder_t
+{
+	uint32_t data_offset; /* first CFDATA block */
+	uint16_t data_count;
+	uint16_t compression;
+} cab_folder_t;
+
+typedef struct _cab_file_t
+{
+	const char *name;     /* points into cabinet data */
+	uint32_t size;
+	uint32_t folder_offset;
+	uint16_t folder;
+	uint16_t date;
+	uint16_t time;
+	uint16_t attribs;
+} cab_file_t;
+
+typedef struct _cab_t
+{
+	const uint8_t *data;
+	size_t         size;
+	uint8_t       *owned;   /* data, if the cabinet was loaded from file */
+	uint8_t        data_reserve; /* per CFDATA reserved bytes */
+	uint16_t       folders_cnt;
+	cab_folder_t  *folders;
+	uint16_t       files_cnt;
+	cab_file_t    *files;
+} cab_t;
+
+cab_t *cab_open_mem(const uint8_t *data, size_t size, int *status);
+cab_t *cab_open(const char *path, int *status);
+void   cab_close(cab_t *cab);
+
+int cab_find(cab_t *cab, const char *name);
+int cab_extract_many(cab_t *cab, const int *files, size_t count, uint8_t **outputs);
+uint8_t *cab_extract(cab_t *cab, int file, int *status);
+
+#endif /* __CAB_H__INCLUDED__ */
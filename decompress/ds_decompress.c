@@ -28,6 +28,106 @@
 //#include "nocrt.h"
 
 #include "bitstream.h"
+#include "ds_decompress.h"
+
+static ds_stats_sink_t ds_stats_sink = NULL;
+static void *ds_stats_ctx = NULL;
+
+#ifdef DS_STATS
+#define DS_STAT(_stmt) _stmt
+#else
+#define DS_STAT(_stmt)
+#endif
+
+/**
+ * Tell whether the decoder was compiled with DS_STATS
+ *
+ * @return: 1 if it counts tokens, 0 if not
+ *
+ **/
+int ds_stats_compiled(void)
+{
+#ifdef DS_STATS
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Set function to be called with the statistics of every decompressed
+ * chunk. It is called from the thread that decompressed it. NULL to remove.
+ *
+ * @param sink: function, NULL to remove it
+ * @param ctx: first argument of sink
+ *
+ **/
+void ds_set_stats_sink(ds_stats_sink_t sink, void *ctx)
+{
+	ds_stats_sink = sink;
+	ds_stats_ctx = ctx;
+}
+
+/**
+ * Add statistics of a chunk to a total
+ *
+ * @param total: sum, bits_min is taken from chunk if there were no chunks yet
+ * @param chunk: statistics to add
+ *
+ **/
+void ds_stats_add(ds_stats_t *total, const ds_stats_t *chunk)
+{
+	size_t i;
+	
+	for(i = 0; i < DS_TOKEN_COUNT; i++)
+	{
+		total->tokens[i] += chunk->tokens[i];
+	}
+	
+	for(i = 0; i < DS_LENGTH_BUCKETS; i++)
+	{
+		total->length[i] += chunk->length[i];
+	}
+	
+	for(i = 0; i < DS_DISTANCE_BUCKETS; i++)
+	{
+		total->distance[i] += chunk->distance[i];
+	}
+	
+	if(total->chunks == 0 || chunk->bits_min < total->bits_min)
+	{
+		total->bits_min = chunk->bits_min;
+	}
+	
+	if(chunk->bits_max > total->bits_max)
+	{
+		total->bits_max = chunk->bits_max;
+	}
+	
+	total->match_bytes += chunk->match_bytes;
+	total->chunks      += chunk->chunks;
+	total->bits        += chunk->bits;
+	total->bytes       += chunk->bytes;
+}
+
+#ifdef DS_STATS
+/**
+ * Histogram bucket of a value, floor(log2(value))
+ *
+ **/
+static size_t ds_bucket(size_t value, size_t buckets)
+{
+	size_t bucket = 0;
+	
+	while(value > 1 && bucket < buckets - 1)
+	{
+		value >>= 1;
+		bucket++;
+	}
+	
+	return bucket;
+}
+#endif
 
 /**
  * Read block "count"
@@ -74,16 +174,10 @@ static size_t ds_count(uint32_t *ptr_buf, size_t *ptr_buf_len)
 }
 
 /**
- * Decompress DS (DriveSpace/DoubleSpace) compression in bitstream to memory block
- *
- * @param in: input bitstream
- * @param block: destination memory for recompressed data
- * @param block_size: destionation size
- * 
- * @return: number of bytes writen to 'block', 0 on failure
+ * Decoder of ds_decompress, counts into stats if compiled with DS_STATS
  *
  **/
-size_t ds_decompress(bitstream_t *in, void *block, size_t block_size)
+static size_t ds_decompress_run(bitstream_t *in, void *block, size_t block_size, ds_stats_t *stats)
 {
 	uint8_t  *ptr = (uint8_t*)block;
 	size_t    ptr_pos;
@@ -91,11 +185,15 @@ size_t ds_decompress(bitstream_t *in, void *block, size_t block_size)
 	size_t    copy_size = 0;
 	uint32_t  buf = 0;
 	size_t    buf_len = 0;
+	DS_STAT(size_t bits_read = 0;)
+	
+	(void)stats;
 	
 	for(ptr_pos = 0; ptr_pos < block_size;)
 	{
 		if(buf_len < 32)
 		{
+			DS_STAT(bits_read += 32 - buf_len;)
 			buf     |= bs_read_bit_le(in, 32-buf_len) << buf_len;
 			buf_len = 32;
 		}
@@ -104,12 +202,14 @@ size_t ds_decompress(bitstream_t *in, void *block, size_t block_size)
 		switch(buf & 0x3)
 		{
 			case 0x1: // 0b01
+				DS_STAT(stats->tokens[DS_TOKEN_LITERAL_HIGH]++;)
 				ptr[ptr_pos++] = 0x80 | ((buf >> 2) & 0x7F);
 				buf    >>= 9;
 				buf_len -= 9;
 				continue;
 				break;
 			case 0x2: // 0b10
+				DS_STAT(stats->tokens[DS_TOKEN_LITERAL_LOW]++;)
 				ptr[ptr_pos++] = (buf >> 2) & 0x7F;
 				buf    >>= 9;
 				buf_len -= 9;
@@ -122,11 +222,13 @@ size_t ds_decompress(bitstream_t *in, void *block, size_t block_size)
 				
 				if(copy_pos)
 				{
+					DS_STAT(stats->tokens[DS_TOKEN_OFFSET_6]++;)
 					copy_size = ds_count(&buf, &buf_len);
 				}
 				else
 				{
 					/* end block */
+					DS_STAT(stats->tokens[DS_TOKEN_END]++;)
 					copy_size = 0;
 				}
 				break;
@@ -138,6 +240,7 @@ size_t ds_decompress(bitstream_t *in, void *block, size_t block_size)
 						buf    >>= 11;
 						buf_len -= 11;
 						
+						DS_STAT(stats->tokens[DS_TOKEN_OFFSET_8]++;)
 						copy_size = ds_count(&buf, &buf_len);
 						break;
 					case 7: // 0b111:
@@ -151,9 +254,11 @@ size_t ds_decompress(bitstream_t *in, void *block, size_t block_size)
 							#ifdef HEAVY_DEBUG
 							printf("sector break: %d\n", ptr_pos);
 							#endif
+							DS_STAT(stats->tokens[DS_TOKEN_SECTOR_BREAK]++;)
 							continue;
 						}
 						
+						DS_STAT(stats->tokens[DS_TOKEN_OFFSET_12]++;)
 						copy_size = ds_count(&buf, &buf_len);
 						break;
 				}
@@ -162,6 +267,7 @@ size_t ds_decompress(bitstream_t *in, void *block, size_t block_size)
 		
 		if(copy_pos == 0)
 		{
+			DS_STAT(stats->bits = bits_read - buf_len;)
 			return ptr_pos; /* reach end block */
 		}
 		
@@ -177,6 +283,10 @@ size_t ds_decompress(bitstream_t *in, void *block, size_t block_size)
 		
 		if((ptr_pos + copy_size) <= block_size)
 		{
+			DS_STAT(stats->length[ds_bucket(copy_size, DS_LENGTH_BUCKETS)]++;)
+			DS_STAT(stats->distance[ds_bucket(copy_pos, DS_DISTANCE_BUCKETS)]++;)
+			DS_STAT(stats->match_bytes += copy_size;)
+			
 			while(copy_size--)
 			{
 				ptr[ptr_pos] = ptr[ptr_pos-copy_pos];
@@ -186,11 +296,48 @@ size_t ds_decompress(bitstream_t *in, void *block, size_t block_size)
 		else
 		{
 			/* overflow */
+			DS_STAT(stats->bits = bits_read - buf_len;)
 			return ptr_pos;
 		}
 	}
 	
 	/* bufer full, done */
+	DS_STAT(stats->bits = bits_read - buf_len;)
 	return ptr_pos;
 }
 
+/**
+ * Decompress DS (DriveSpace/DoubleSpace) compression in bitstream to memory block
+ *
+ * @param in: input bitstream
+ * @param block: destination memory for recompressed data
+ * @param block_size: destionation size
+ * 
+ * @return: number of bytes writen to 'block', 0 on failure
+ *
+ **/
+size_t ds_decompress(bitstream_t *in, void *block, size_t block_size)
+{
+#ifdef DS_STATS
+	ds_stats_t stats;
+	size_t size;
+	
+	memset(&stats, 0, sizeof(stats));
+	size = ds_decompress_run(in, block, block_size, &stats);
+	
+	stats.chunks   = 1;
+	stats.bits_min = stats.bits;
+	stats.bits_max = stats.bits;
+	stats.bytes    = size;
+	
+	if(ds_stats_sink != NULL)
+	{
+		ds_stats_sink(ds_stats_ctx, &stats);
+	}
+	
+	return size;
+#else
+	return ds_decompress_run(in, block, block_size, NULL);
+#endif
+}
+
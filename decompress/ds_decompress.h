@@ -0,0 +1,74 @@
+/******************************************************************************
+ * Copyright (c) 2025 E. Voirin (oerg866)                                     *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+*******************************************************************************/
+#ifndef __DS_DECOMPRESS_H__INCLUDED__
+#define __DS_DECOMPRESS_H__INCLUDED__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bitstream.h"
+
+size_t ds_decompress(bitstream_t *in, void *block, size_t block_size);
+
+/*
+ * Token and match statistics of the decoder, for tuning it and for
+ * designing compressors. They are only counted when compiled with DS_STATS
+ * defined (wmake DS_STATS=1), otherwise the sink is never called and the
+ * decoder is the same as without them.
+ */
+
+#define DS_TOKEN_LITERAL_HIGH 0 /* 0b01, literal 0x80-0xFF */
+#define DS_TOKEN_LITERAL_LOW  1 /* 0b10, literal 0x00-0x7F */
+#define DS_TOKEN_OFFSET_6     2 /* 0b00, match with distance 1-63 */
+#define DS_TOKEN_OFFSET_8     3 /* 0b011, match with distance 64-319 */
+#define DS_TOKEN_OFFSET_12    4 /* 0b111, match with distance 320-4414 */
+#define DS_TOKEN_SECTOR_BREAK 5 /* 0b111 with distance 4415 */
+#define DS_TOKEN_END          6 /* 0b00 with distance 0 */
+#define DS_TOKEN_COUNT        7
+
+/* histogram bucket n counts values from 2^n to 2^(n+1)-1 */
+#define DS_LENGTH_BUCKETS   13 /* match lengths 2-4414 */
+#define DS_DISTANCE_BUCKETS 13 /* distances 1-4414 */
+
+typedef struct _ds_stats_t
+{
+	uint64_t tokens[DS_TOKEN_COUNT];
+	uint64_t length[DS_LENGTH_BUCKETS];
+	uint64_t distance[DS_DISTANCE_BUCKETS];
+	uint64_t match_bytes; /* bytes copied by matches */
+	uint64_t chunks;      /* calls of ds_decompress */
+	uint64_t bits;        /* bits consumed from the input */
+	uint64_t bits_min;    /* fewest and most bits consumed by one chunk */
+	uint64_t bits_max;
+	uint64_t bytes;       /* bytes written */
+} ds_stats_t;
+
+typedef void (*ds_stats_sink_t)(void *ctx, const ds_stats_t *chunk);
+
+int  ds_stats_compiled(void);
+void ds_set_stats_sink(ds_stats_sink_t sink, void *ctx);
+void ds_stats_add(ds_stats_t *total, const ds_stats_t *chunk);
+
+#endif /* __DS_DECOMPRESS_H__INCLUDED__ */
@@ -23,6 +23,10 @@
  * OTHER DEALINGS IN THE SOFTWARE.                                            *
  *                                                                            *
 *******************************************************************************/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* copy_file_range */
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
@@ -31,14 +35,25 @@
 #ifdef _WIN32
 #include <windows.h>
 #include <direct.h>
+#include <io.h>
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
-//#include <dirent.h>
+#include <dirent.h>
 #endif
 
-#include <io.h>
+/* fs_file_fastcopy, it only needs the native Linux build (GNUmakefile) */
+#ifdef __linux__
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
 
 #include "filesystem.h"
 
@@ -464,7 +479,7 @@ char *fs_path_dup(const char *path)
 	if(path != NULL)
 	{
 		len = strlen(path);
-		new_path = malloc(len);
+		new_path = malloc(len+1);
 		memcpy(new_path, path, len+1);		
 	}
 	
@@ -566,9 +581,62 @@ ssize_t fs_file_copy(FILE *src, FILE *dst, size_t size)
 	return copy_size;
 }
 
+#ifdef __linux__
+/**
+ * Copy whole file without moving the data through user space. First try to
+ * share the extents (reflink on btrfs/XFS), then let the kernel copy it.
+ *
+ * @param fr: source opened for reading, nothing read yet
+ * @param fw: destination opened for writing, nothing written yet
+ *
+ * @return: number of copy bytes, negative if buffered copy is required
+ *          (destination and both file positions are reset in this case)
+ *
+ **/
+static ssize_t fs_file_fastcopy(FILE *fr, FILE *fw)
+{
+	int fdr = fileno(fr);
+	int fdw = fileno(fw);
+	struct stat st;
+	off_t left;
+	
+	if(fstat(fdr, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		return -1;
+	}
+	
+	if(ioctl(fdw, FICLONE, fdr) == 0)
+	{
+		return st.st_size;
+	}
+	
+	for(left = st.st_size; left > 0;)
+	{
+		ssize_t copied = copy_file_range(fdr, NULL, fdw, NULL, left, 0);
+		if(copied <= 0)
+		{
+			/* ENOSYS, EXDEV, EOPNOTSUPP... start over with buffered copy */
+			if(ftruncate(fdw, 0) != 0)
+			{
+				return -2;
+			}
+			lseek(fdr, 0, SEEK_SET);
+			lseek(fdw, 0, SEEK_SET);
+			return -1;
+		}
+		left -= copied;
+	}
+	
+	return st.st_size;
+}
+#endif
+
 /**
  * Copy source to destination
  * 
+ * On Linux the copy is done by reflink or in-kernel copy when the filesystem
+ * supports it, buffered copy is used only as fallback.
+ *
  * @param src: path to source file
  * @param dst: path to destination file
  *
@@ -585,9 +653,20 @@ ssize_t fs_file_fullcopy(const char *src, const char *dst)
 		FILE *fw = fopen(dst, "wb");
 		if(fw)
 		{
-			
+			#ifdef __linux__
+			result = fs_file_fastcopy(fr, fw);
+			if(result == -1)
+			{
+				result = fs_file_copy(fr, fw, 0);
+			}
+			#else
 			result = fs_file_copy(fr, fw, 0);
-			fclose(fw);
+			#endif
+			
+			if(fclose(fw) != 0)
+			{
+				result = -1;
+			}
 		}
 		
 		fclose(fr);
@@ -0,0 +1,512 @@
+/******************************************************************************
+ * Copyright (c) 2025 E. Voirin (oerg866)                                     *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+*******************************************************************************/
+#include <string.h>
+
+#include "inflate.h"
+
+/* codes up to this length are decoded by single table lookup */
+#define FAST_BITS 9
+
+#define MAX_BITS  15
+#define MAX_LCODES 288
+#define MAX_DCODES 32
+
+typedef struct _huffman_t
+{
+	uint16_t fast[1 << FAST_BITS]; /* (symbol << 4) | length, 0 if code is longer */
+	uint16_t count[MAX_BITS + 1];  /* number of codes of each length */
+	uint16_t symbol[MAX_LCODES];   /* symbols ordered by code */
+} huffman_t;
+
+typedef struct _inflate_state_t
+{
+	const uint8_t *src;
+	size_t   src_size;
+	size_t   src_pos;
+	uint32_t bitbuf;
+	int      bitcnt;
+	int      overrun;  /* bits past the end of input were requested */
+	uint8_t *dst;
+	size_t   dst_pos;
+	size_t   dst_size;
+} inflate_state_t;
+
+static const uint16_t length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+/* order of code length code lengths in dynamic block header */
+static const uint8_t clen_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static void inflate_fill(inflate_state_t *s)
+{
+	while(s->bitcnt <= 24)
+	{
+		uint32_t byte = 0;
+		if(s->src_pos < s->src_size)
+		{
+			byte = s->src[s->src_pos];
+		}
+		else
+		{
+			s->overrun++;
+		}
+		s->src_pos++;
+		s->bitbuf |= byte << s->bitcnt;
+		s->bitcnt += 8;
+	}
+}
+
+static uint32_t inflate_bits(inflate_state_t *s, int n)
+{
+	uint32_t v;
+	
+	if(n == 0)
+	{
+		return 0;
+	}
+	
+	if(s->bitcnt < n)
+	{
+		inflate_fill(s);
+	}
+	
+	v = s->bitbuf & ((1UL << n) - 1);
+	s->bitbuf >>= n;
+	s->bitcnt -= n;
+	return v;
+}
+
+/**
+ * Build canonical huffman decoding tables from code lengths
+ *
+ * @return: 0 on success, -1 if the lengths are over-subscribed
+ *
+ **/
+static int huffman_build(huffman_t *h, const uint8_t *lengths, int n)
+{
+	uint16_t offs[MAX_BITS + 2];
+	uint16_t next_code[MAX_BITS + 2];
+	int left = 1;
+	int len, sym;
+	uint32_t code = 0;
+	
+	memset(h->count, 0, sizeof(h->count));
+	memset(h->fast, 0, sizeof(h->fast));
+	
+	for(sym = 0; sym < n; sym++)
+	{
+		h->count[lengths[sym]]++;
+	}
+	
+	for(len = 1; len <= MAX_BITS; len++)
+	{
+		left <<= 1;
+		left -= h->count[len];
+		if(left < 0)
+		{
+			return -1;
+		}
+	}
+	
+	offs[1] = 0;
+	for(len = 1; len < MAX_BITS; len++)
+	{
+		offs[len + 1] = offs[len] + h->count[len];
+	}
+	
+	for(sym = 0; sym < n; sym++)
+	{
+		if(lengths[sym] != 0)
+		{
+			h->symbol[offs[lengths[sym]]++] = (uint16_t)sym;
+		}
+	}
+	
+	/* canonical codes, stream stores them starting with the most significant bit, so table index is reversed */
+	h->count[0] = 0;
+	for(len = 1; len <= MAX_BITS; len++)
+	{
+		code = (code + h->count[len - 1]) << 1;
+		next_code[len] = (uint16_t)code;
+	}
+	
+	for(sym = 0; sym < n; sym++)
+	{
+		len = lengths[sym];
+		if(len != 0 && len <= FAST_BITS)
+		{
+			uint32_t c = next_code[len];
+			uint32_t rev = 0;
+			int i;
+			
+			for(i = 0; i < len; i++)
+			{
+				rev = (rev << 1) | ((c >> i) & 1);
+			}
+			
+			for(i = rev; i < (1 << FAST_BITS); i += 1 << len)
+			{
+				h->fast[i] = (uint16_t)((sym << 4) | len);
+			}
+		}
+		
+		if(len != 0)
+		{
+			next_code[len]++;
+		}
+	}
+	
+	return 0;
+}
+
+/**
+ * Decode one symbol, table lookup for short codes and bit by bit walk
+ * of the canonical code for the long ones
+ *
+ **/
+static int huffman_decode(inflate_state_t *s, const huffman_t *h)
+{
+	uint16_t entry;
+	int code = 0, first = 0, index = 0;
+	int len;
+	
+	if(s->bitcnt < MAX_BITS)
+	{
+		inflate_fill(s);
+	}
+	
+	entry = h->fast[s->bitbuf & ((1 << FAST_BITS) - 1)];
+	if(entry != 0)
+	{
+		s->bitbuf >>= entry & 15;
+		s->bitcnt -= entry & 15;
+		return entry >> 4;
+	}
+	
+	for(len = 1; len <= MAX_BITS; len++)
+	{
+		int count;
+		
+		code |= s->bitbuf & 1;
+		s->bitbuf >>= 1;
+		s->bitcnt--;
+		
+		count = h->count[len];
+		if(code - count < first)
+		{
+			return h->symbol[index + (code - first)];
+		}
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	
+	return -1;
+}
+
+static int inflate_stored(inflate_state_t *s)
+{
+	uint32_t len, nlen;
+	
+	/* discard remaining bits of current byte, return whole bytes to input */
+	s->bitbuf >>= s->bitcnt & 7;
+	s->bitcnt -= s->bitcnt & 7;
+	s->src_pos -= s->bitcnt / 8;
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+	s->overrun = s->src_pos > s->src_size ? (int)(s->src_pos - s->src_size) : 0;
+	
+	if(s->src_pos + 4 > s->src_size)
+	{
+		return INFLATE_E_INPUT;
+	}
+	
+	len  = s->src[s->src_pos] | (s->src[s->src_pos + 1] << 8);
+	nlen = s->src[s->src_pos + 2] | (s->src[s->src_pos + 3] << 8);
+	s->src_pos += 4;
+	
+	if(len != (~nlen & 0xFFFF))
+	{
+		return INFLATE_E_DATA;
+	}
+	
+	if(s->src_pos + len > s->src_size)
+	{
+		return INFLATE_E_INPUT;
+	}
+	
+	if(s->dst_pos + len > s->dst_size)
+	{
+		return INFLATE_E_OUTPUT;
+	}
+	
+	memcpy(s->dst + s->dst_pos, s->src + s->src_pos, len);
+	s->dst_pos += len;
+	s->src_pos += len;
+	return INFLATE_OK;
+}
+
+static int inflate_codes(inflate_state_t *s, const huffman_t *lencode, const huffman_t *distcode)
+{
+	for(;;)
+	{
+		int sym = huffman_decode(s, lencode);
+		
+		if(sym < 0 || s->overrun > 4)
+		{
+			return s->overrun > 4 ? INFLATE_E_INPUT : INFLATE_E_DATA;
+		}
+		
+		if(sym < 256)
+		{
+			if(s->dst_pos >= s->dst_size)
+			{
+				return INFLATE_E_OUTPUT;
+			}
+			s->dst[s->dst_pos++] = (uint8_t)sym;
+		}
+		else if(sym == 256)
+		{
+			return INFLATE_OK;
+		}
+		else
+		{
+			uint32_t len, dist;
+			uint8_t *out, *from;
+			
+			sym -= 257;
+			if(sym >= 29)
+			{
+				return INFLATE_E_DATA;
+			}
+			len = length_base[sym] + inflate_bits(s, length_extra[sym]);
+			
+			sym = huffman_decode(s, distcode);
+			if(sym < 0 || sym >= 30)
+			{
+				return INFLATE_E_DATA;
+			}
+			dist = dist_base[sym] + inflate_bits(s, dist_extra[sym]);
+			
+			/* everything decoded before, also by earlier calls, is the dictionary */
+			if(dist > s->dst_pos)
+			{
+				return INFLATE_E_DATA;
+			}
+			
+			if(s->dst_pos + len > s->dst_size)
+			{
+				return INFLATE_E_OUTPUT;
+			}
+			
+			out  = s->dst + s->dst_pos;
+			from = out - dist;
+			s->dst_pos += len;
+			
+			if(dist >= len)
+			{
+				memcpy(out, from, len);
+			}
+			else
+			{
+				while(len-- > 0)
+				{
+					*out++ = *from++;
+				}
+			}
+		}
+	}
+}
+
+static int inflate_fixed(inflate_state_t *s)
+{
+	huffman_t lencode, distcode;
+	uint8_t lengths[MAX_LCODES];
+	int sym;
+	
+	/* rare in practice, building the tables every time is cheaper than sharing them between threads */
+	for(sym = 0; sym < 144; sym++) lengths[sym] = 8;
+	for(; sym < 256; sym++) lengths[sym] = 9;
+	for(; sym < 280; sym++) lengths[sym] = 7;
+	for(; sym < MAX_LCODES; sym++) lengths[sym] = 8;
+	huffman_build(&lencode, lengths, MAX_LCODES);
+	
+	for(sym = 0; sym < MAX_DCODES; sym++) lengths[sym] = 5;
+	huffman_build(&distcode, lengths, MAX_DCODES);
+	
+	return inflate_codes(s, &lencode, &distcode);
+}
+
+static int inflate_dynamic(inflate_state_t *s)
+{
+	huffman_t lencode, distcode;
+	uint8_t lengths[MAX_LCODES + MAX_DCODES];
+	int nlen, ndist, ncode;
+	int index;
+	
+	nlen  = inflate_bits(s, 5) + 257;
+	ndist = inflate_bits(s, 5) + 1;
+	ncode = inflate_bits(s, 4) + 4;
+	
+	if(nlen > 286 || ndist > 30)
+	{
+		return INFLATE_E_DATA;
+	}
+	
+	memset(lengths, 0, sizeof(lengths));
+	for(index = 0; index < ncode; index++)
+	{
+		lengths[clen_order[index]] = (uint8_t)inflate_bits(s, 3);
+	}
+	
+	if(huffman_build(&lencode, lengths, 19) != 0)
+	{
+		return INFLATE_E_DATA;
+	}
+	
+	index = 0;
+	while(index < nlen + ndist)
+	{
+		int sym = huffman_decode(s, &lencode);
+		int len = 0, repeat;
+		
+		if(sym < 0)
+		{
+			return INFLATE_E_DATA;
+		}
+		
+		if(sym < 16)
+		{
+			lengths[index++] = (uint8_t)sym;
+			continue;
+		}
+		
+		if(sym == 16)
+		{
+			if(index == 0)
+			{
+				return INFLATE_E_DATA;
+			}
+			len = lengths[index - 1];
+			repeat = 3 + inflate_bits(s, 2);
+		}
+		else if(sym == 17)
+		{
+			repeat = 3 + inflate_bits(s, 3);
+		}
+		else
+		{
+			repeat = 11 + inflate_bits(s, 7);
+		}
+		
+		if(index + repeat > nlen + ndist)
+		{
+			return INFLATE_E_DATA;
+		}
+		
+		while(repeat-- > 0)
+		{
+			lengths[index++] = (uint8_t)len;
+		}
+	}
+	
+	if(lengths[256] == 0)
+	{
+		return INFLATE_E_DATA;
+	}
+	
+	if(huffman_build(&lencode, lengths, nlen) != 0 || huffman_build(&distcode, lengths + nlen, ndist) != 0)
+	{
+		return INFLATE_E_DATA;
+	}
+	
+	return inflate_codes(s, &lencode, &distcode);
+}
+
+/**
+ * Decompress raw DEFLATE stream
+ *
+ * @param src: compressed data
+ * @param src_size: size of compressed data
+ * @param dst: output buffer, bytes before dst_start are used as dictionary
+ *             (MSZIP blocks refer to the data of previous blocks)
+ * @param dst_start: where to start writing
+ * @param dst_size: size of whole output buffer
+ * @param dst_end: position after the last byte written
+ *
+ * @return: INFLATE_OK or error code
+ *
+ **/
+int inflate_raw(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_start, size_t dst_size, size_t *dst_end)
+{
+	inflate_state_t s;
+	int last;
+	int status = INFLATE_OK;
+	
+	memset(&s, 0, sizeof(inflate_state_t));
+	s.src      = src;
+	s.src_size = src_size;
+	s.dst      = dst;
+	s.dst_pos  = dst_start;
+	s.dst_size = dst_size;
+	
+	do
+	{
+		int type;
+		
+		last = inflate_bits(&s, 1);
+		type = inflate_bits(&s, 2);
+		
+		switch(type)
+		{
+			case 0: status = inflate_stored(&s); break;
+			case 1: status = inflate_fixed(&s); break;
+			case 2: status = inflate_dynamic(&s); break;
+			default: status = INFLATE_E_DATA; break;
+		}
+		
+		if(status == INFLATE_OK && s.overrun > 4)
+		{
+			status = INFLATE_E_INPUT;
+		}
+	} while(!last && status == INFLATE_OK);
+	
+	*dst_end = s.dst_pos;
+	return status;
+}
@@ -0,0 +1,43 @@
+/******************************************************************************
+ * Copyright (c) 2025 E. Voirin (oerg866)                                     *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person                *
+ * obtaining a copy of this software and associated documentation             *
+ * files (the "Software"), to deal in the Software without                    *
+ * restriction, including without limitation the rights to use,               *
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell          *
+ * copies of the Software, and to permit persons to whom the                  *
+ * Software is furnished to do so, subject to the following                   *
+ * conditions:                                                                *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be             *
+ * included in all copies or substantial portions of the Software.            *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,            *
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES            *
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                   *
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT                *
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,               *
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING               *
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR              *
+ * OTHER DEALINGS IN THE SOFTWARE.                                            *
+ *                                                                            *
+*******************************************************************************/
+#ifndef __INFLATE_H__INCLUDED__
+#define __INFLATE_H__INCLUDED__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Raw DEFLATE (RFC 1951) decoder, as used by MSZIP compressed cabinets
+ */
+
+#define INFLATE_OK       0
+#define INFLATE_E_INPUT  1 /* input ended before the last block */
+#define INFLATE_E_DATA   2 /* invalid block type, code or distance */
+#define INFLATE_E_OUTPUT 3 /* output buffer too small */
+
+int inflate_raw(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_start, size_t dst_size, size_t *dst_end);
+
+#endif /* __INFLATE_H__INCLUDED__ */
@@ -24,10 +24,15 @@
  *                                                                            *
 *******************************************************************************/
 #include <stdio.h>
+#ifndef _WIN32
+#include <strings.h>
+#define strnicmp strncasecmp
+#endif
 #include "bitstream.h"
 //#include <extstring.h>
 #include "filesystem.h"
 #include "pew.h"
+#include "ds_decompress.h"
 //#include "doublespace.h"
 //#include "nocrt.h"
 
@@ -44,9 +49,40 @@ static const uint8_t dos_program_le[] =
 	0x6D, 0x6F, 0x64, 0x65, 0x2E, 0x0D, 0x0A, 0x24, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // mode...$........
 };
 
-extern size_t ds_decompress(bitstream_t *in, void *block, size_t block_size);
+static pe_parallel_for_t pe_parallel_for = NULL;
+static void *pe_parallel_ctx = NULL;
+
+static pe_probe_t pe_probe = NULL;
+static void *pe_probe_ctx = NULL;
+
+#define PE_PROBE(_step, _end, _index, _in, _out) \
+	if(pe_probe != NULL) pe_probe(pe_probe_ctx, (_step), (_end), (_index), (_in), (_out))
+
+/**
+ * Set function to be told when the archive steps (PE_PROBE_*) start and
+ * end, for measurements. NULL to remove it.
+ *
+ **/
+void pe_set_probe(pe_probe_t probe, void *ctx)
+{
+	pe_probe = probe;
+	pe_probe_ctx = ctx;
+}
+
+static int pe_read_headers(dos_header_t *dos, pe_header_t *pe, FILE *fp);
 
 int pe_read(dos_header_t *dos, pe_header_t *pe, FILE *fp)
+{
+	int result;
+	
+	PE_PROBE(PE_PROBE_READ, 0, 0, 0, 0);
+	result = pe_read_headers(dos, pe, fp);
+	PE_PROBE(PE_PROBE_READ, 1, 0, 0, 0);
+	
+	return result;
+}
+
+static int pe_read_headers(dos_header_t *dos, pe_header_t *pe, FILE *fp)
 {
 	memset(dos, 0, sizeof(dos_header_t));
 	memset(pe,  0, sizeof(pe_header_t));
@@ -205,6 +241,8 @@ size_t pe_w4_decompress(pe_w4_t *w4, void *buf, size_t chunk_id)
 		return 0;
 	}
 	
+	PE_PROBE(PE_PROBE_CHUNK, 0, chunk_id, 0, 0);
+	
 	if(fseek(w4->fp, w4->chunks[chunk_id], SEEK_SET) == 0)
 	{
 		size = w4->chunks[chunk_id+1] - w4->chunks[chunk_id];
@@ -220,57 +258,281 @@ size_t pe_w4_decompress(pe_w4_t *w4, void *buf, size_t chunk_id)
 		}
 	}
 	
+	PE_PROBE(PE_PROBE_CHUNK, 1, chunk_id,
+		w4->chunks[chunk_id+1] >= w4->chunks[chunk_id] ? w4->chunks[chunk_id+1] - w4->chunks[chunk_id] : 0, size);
+	
 	return size;
 }
 
 /**
- * Decompress W4 file and save as W3 file 
+ * Set function to run independent tasks (decompression of W4 chunks) in
+ * parallel. Without one, the tasks are run one after another.
+ *
+ * @param parallel_for: calls task(arg, 0) ... task(arg, count-1) and returns
+ *                      when all of them are done, NULL to run serially
+ * @param ctx: passed to parallel_for
  *
  **/
-int pe_w4_to_w3(pe_w4_t *w4, const char *dst)
+void pe_set_parallel_for(pe_parallel_for_t parallel_for, void *ctx)
+{
+	pe_parallel_for = parallel_for;
+	pe_parallel_ctx = ctx;
+}
+
+/**
+ * Run task(arg, 0) ... task(arg, count-1) by function set by
+ * pe_set_parallel_for or one after another if none is set
+ *
+ **/
+void pe_parallel_run(size_t count, pe_task_t task, void *arg)
 {
-	void *buf;
-	FILE *fw = fopen(dst, "wb");
 	size_t i;
-	size_t s;
-	size_t buf_size = w4->pe_pos > w4->pe->w4.chunk_size ? w4->pe_pos : w4->pe->w4.chunk_size;
-	
-	//printf("here\n");
 	
-	if(fw != NULL)
+	if(pe_parallel_for != NULL)
+	{
+		pe_parallel_for(pe_parallel_ctx, count, task, arg);
+	}
+	else
 	{
-		buf = malloc(buf_size);
-		if(buf != NULL)
+		for(i = 0; i < count; i++)
 		{
-			fseek(w4->fp, 0, SEEK_SET);
-			fread(buf,  w4->pe_pos, 1, w4->fp);
-			fwrite(buf, w4->pe_pos, 1, fw);
-			
-			for(i = 0; i < w4->pe->w4.chunk_count; i++)
-			{
-				s = pe_w4_decompress(w4, buf, i);
-				//printf("BLOCK: %d %d\n", i, s);
-				if(s != 0)
-				{
-					fwrite(buf, s, 1, fw);
-				}
-			}
-			
-			free(buf);
+			task(arg, i);
 		}
-		else
+	}
+}
+
+/**
+ * Decompress W4 chunk from W4 file loaded in memory
+ *
+ * @param src: whole W4 file
+ * @param src_size: size of W4 file
+ * @param buf: destination, at least chunk size large
+ *
+ * @return: number of bytes writen to buf, 0 on failure
+ *
+ **/
+size_t pe_w4_decompress_mem(pe_w4_t *w4, const uint8_t *src, size_t src_size, void *buf, size_t chunk_id)
+{
+	bitstream_t in;
+	size_t size;
+	
+	if(chunk_id >= w4->chunks_cnt)
+	{
+		return 0;
+	}
+	
+	if(w4->chunks[chunk_id] > w4->chunks[chunk_id+1] || w4->chunks[chunk_id+1] > src_size)
+	{
+		return 0;
+	}
+	
+	size = w4->chunks[chunk_id+1] - w4->chunks[chunk_id];
+	/* if compresed block size equals decompresed block size, this means it is raw (uncompresed) block */
+	if(size == w4->pe->w4.chunk_size)
+	{
+		memcpy(buf, src + w4->chunks[chunk_id], size);
+		return size;
+	}
+	
+	/* the bitstream may read ahead into next chunk, same as from file */
+	bs_mem(&in, (void*)(src + w4->chunks[chunk_id]), src_size - w4->chunks[chunk_id]);
+	return ds_decompress(&in, buf, w4->pe->w4.chunk_size);
+}
+
+typedef struct _pe_w4_job_t
+{
+	pe_w4_t *w4;
+	uint8_t *src;      /* whole W4 file */
+	size_t   src_size;
+	uint8_t *dst;      /* chunk_count * chunk_size */
+	size_t  *sizes;    /* decompressed size of every chunk */
+} pe_w4_job_t;
+
+static void pe_w4_decompress_task(void *arg, size_t chunk_id)
+{
+	pe_w4_job_t *job = (pe_w4_job_t*)arg;
+	
+	PE_PROBE(PE_PROBE_CHUNK, 0, chunk_id, 0, 0);
+	
+	job->sizes[chunk_id] = pe_w4_decompress_mem(job->w4, job->src, job->src_size,
+		job->dst + chunk_id * job->w4->pe->w4.chunk_size, chunk_id);
+	
+	PE_PROBE(PE_PROBE_CHUNK, 1, chunk_id,
+		job->w4->chunks[chunk_id+1] >= job->w4->chunks[chunk_id] ? job->w4->chunks[chunk_id+1] - job->w4->chunks[chunk_id] : 0,
+		job->sizes[chunk_id]);
+}
+
+static int pe_w4_to_w3_mem_run(const uint8_t *src, size_t src_size, uint8_t **dst, size_t *dst_size);
+
+/**
+ * Decompress W4 file in memory to W3 file in memory
+ *
+ * Chunks are independent so they are decompressed by function set by
+ * pe_set_parallel_for, straight to their place in output.
+ *
+ * @param src: whole W4 file
+ * @param src_size: size of W4 file
+ * @param dst: malloc'ed W3 file on success
+ * @param dst_size: size of W3 file
+ *
+ * @return: PE_OK on success
+ **/
+int pe_w4_to_w3_mem(const uint8_t *src, size_t src_size, uint8_t **dst, size_t *dst_size)
+{
+	int status;
+	
+	PE_PROBE(PE_PROBE_W4_TO_W3, 0, 0, 0, 0);
+	status = pe_w4_to_w3_mem_run(src, src_size, dst, dst_size);
+	PE_PROBE(PE_PROBE_W4_TO_W3, 1, 0, src_size, *dst_size);
+	
+	return status;
+}
+
+static int pe_w4_to_w3_mem_run(const uint8_t *src, size_t src_size, uint8_t **dst, size_t *dst_size)
+{
+	dos_header_t dos;
+	pe_header_t  pe;
+	pe_w4_job_t  job;
+	pe_w4_t     *w4;
+	size_t chunk_size;
+	size_t chunk_count;
+	size_t pos;
+	size_t i;
+	int status = PE_OK;
+	
+	*dst = NULL;
+	*dst_size = 0;
+	
+	if(src_size < sizeof(dos_header_t))
+	{
+		return PE_ERROR_FREAD;
+	}
+	
+	memcpy(&dos, src, sizeof(dos_header_t));
+	if(memcmp(dos.magic, MAGIC_DOS, 2) != 0 || dos.nextheader > src_size || src_size - dos.nextheader < sizeof(pe_header_t))
+	{
+		return PE_NO_MZ_FILE;
+	}
+	
+	memcpy(&pe, src + dos.nextheader, sizeof(pe_header_t));
+	if(memcmp(pe.magic, MAGIC_W4, 2) != 0)
+	{
+		return PE_UNKNOWN;
+	}
+	
+	chunk_size  = pe.w4.chunk_size;
+	chunk_count = pe.w4.chunk_count;
+	
+	if(src_size - dos.nextheader - sizeof(pe_header_t) < chunk_count * sizeof(uint32_t))
+	{
+		return PE_ERROR_FREAD;
+	}
+	
+	w4 = (pe_w4_t*)malloc(sizeof(pe_w4_t) + sizeof(uint32_t)*(chunk_count + 1));
+	if(w4 == NULL)
+	{
+		return PE_ERROR_MALLOC;
+	}
+	
+	w4->pe         = &pe;
+	w4->pe_pos     = dos.nextheader;
+	w4->fp         = NULL;
+	w4->chunks_cnt = chunk_count;
+	memcpy(&(w4->chunks[0]), src + dos.nextheader + sizeof(pe_header_t), chunk_count * sizeof(uint32_t));
+	w4->chunks[chunk_count] = (uint32_t)src_size; /* last chunk ends with file */
+	
+	memset(&job, 0, sizeof(pe_w4_job_t));
+	job.w4       = w4;
+	job.src      = (uint8_t*)src;
+	job.src_size = src_size;
+	job.dst      = (uint8_t*)malloc(w4->pe_pos + chunk_count * chunk_size + 1);
+	job.sizes    = (size_t*)calloc(chunk_count + 1, sizeof(size_t));
+	
+	if(job.dst == NULL || job.sizes == NULL)
+	{
+		status = PE_ERROR_MALLOC;
+		goto pe_w4_to_w3_mem_cleanup;
+	}
+	
+	/* W3 file starts with the headers of W4 file */
+	memcpy(job.dst, src, w4->pe_pos);
+	job.dst += w4->pe_pos;
+	
+	pe_parallel_run(chunk_count, pe_w4_decompress_task, &job);
+	
+	job.dst -= w4->pe_pos;
+	
+	/* only last chunk should be shorter, move up what follows a short or failed one */
+	pos = w4->pe_pos;
+	for(i = 0; i < chunk_count; i++)
+	{
+		if(job.sizes[i] != 0)
 		{
-			return PE_ERROR_MALLOC;
+			memmove(job.dst + pos, job.dst + w4->pe_pos + i * chunk_size, job.sizes[i]);
+			pos += job.sizes[i];
 		}
-		
-		fclose(fw);
 	}
-	else
+	
+	*dst      = job.dst;
+	*dst_size = pos;
+	job.dst   = NULL;
+	
+	pe_w4_to_w3_mem_cleanup:
+	free(job.dst);
+	free(job.sizes);
+	pe_w4_free(w4);
+	
+	return status;
+}
+
+/**
+ * Decompress W4 file and save as W3 file 
+ *
+ **/
+int pe_w4_to_w3(pe_w4_t *w4, const char *dst)
+{
+	FILE    *fw;
+	uint8_t *src;
+	size_t   src_size = w4->chunks[w4->chunks_cnt]; /* end of file */
+	uint8_t *w3 = NULL;
+	size_t   w3_size = 0;
+	int status;
+	
+	src = (uint8_t*)malloc(src_size > 0 ? src_size : 1);
+	if(src == NULL)
 	{
-		return PE_ERROR_FOPEN;
+		return PE_ERROR_MALLOC;
 	}
 	
-	return PE_OK;
+	if(fseek(w4->fp, 0, SEEK_SET) != 0 || fread(src, 1, src_size, w4->fp) != src_size || src_size < w4->pe_pos)
+	{
+		status = PE_ERROR_FREAD;
+	}
+	else if((status = pe_w4_to_w3_mem(src, src_size, &w3, &w3_size)) == PE_OK)
+	{
+		fw = fopen(dst, "wb");
+		if(fw == NULL)
+		{
+			status = PE_ERROR_FOPEN;
+		}
+		else
+		{
+			if(fwrite(w3, 1, w3_size, fw) != w3_size)
+			{
+				status = PE_ERROR_FWRITE;
+			}
+			
+			if(fclose(fw) != 0)
+			{
+				status = PE_ERROR_FWRITE;
+			}
+		}
+	}
+	
+	free(src);
+	free(w3);
+	
+	return status;
 }
 
 /**
@@ -300,6 +562,8 @@ int pe_w4_check(pe_w4_t *w4)
 	return PE_OK;
 }
 
+static int pe_w3_extract_run(pe_w3_t *w3, const char *file, const char *dst);
+
 /**
  * Extract VXD form W3 (*.VXD extension too) file.
  *
@@ -307,6 +571,17 @@ int pe_w4_check(pe_w4_t *w4)
  *
  **/
 int pe_w3_extract(pe_w3_t *w3, const char *file, const char *dst)
+{
+	int result;
+	
+	PE_PROBE(PE_PROBE_EXTRACT, 0, 0, 0, 0);
+	result = pe_w3_extract_run(w3, file, dst);
+	PE_PROBE(PE_PROBE_EXTRACT, 1, 0, w3->file_size, 0);
+	
+	return result;
+}
+
+static int pe_w3_extract_run(pe_w3_t *w3, const char *file, const char *dst)
 {
 	uint8_t sname[PE_W3_FILE_NAME_SIZE+1];
 	size_t len;
@@ -381,3 +656,129 @@ int pe_w3_extract(pe_w3_t *w3, const char *file, const char *dst)
 	
 	return result;
 }
+
+static int pe_w3_extract_mem_run(const uint8_t *src, size_t src_size, const char *file, uint8_t **dst, size_t *dst_size);
+
+/**
+ * Extract VXD from W3 file loaded in memory
+ *
+ * @param src: whole W3 file
+ * @param src_size: size of W3 file
+ * @param file: file name in archive (names are without file extension)
+ * @param dst: malloc'ed VXD (LE) file on success
+ * @param dst_size: size of VXD file
+ *
+ * @return: PE_OK on success
+ **/
+int pe_w3_extract_mem(const uint8_t *src, size_t src_size, const char *file, uint8_t **dst, size_t *dst_size)
+{
+	int status;
+	
+	PE_PROBE(PE_PROBE_EXTRACT, 0, 0, 0, 0);
+	status = pe_w3_extract_mem_run(src, src_size, file, dst, dst_size);
+	PE_PROBE(PE_PROBE_EXTRACT, 1, 0, src_size, *dst_size);
+	
+	return status;
+}
+
+static int pe_w3_extract_mem_run(const uint8_t *src, size_t src_size, const char *file, uint8_t **dst, size_t *dst_size)
+{
+	dos_header_t dos;
+	pe_header_t  pe;
+	pe_w3_file_t entry;
+	le_header_t  le_header;
+	uint8_t sname[PE_W3_FILE_NAME_SIZE+1];
+	size_t table;
+	size_t len;
+	size_t i;
+	size_t next_file;
+	
+	*dst = NULL;
+	*dst_size = 0;
+	
+	if(src_size < sizeof(dos_header_t))
+	{
+		return PE_ERROR_FREAD;
+	}
+	
+	memcpy(&dos, src, sizeof(dos_header_t));
+	if(memcmp(dos.magic, MAGIC_DOS, 2) != 0 || dos.nextheader > src_size || src_size - dos.nextheader < sizeof(pe_header_t))
+	{
+		return PE_NO_MZ_FILE;
+	}
+	
+	memcpy(&pe, src + dos.nextheader, sizeof(pe_header_t));
+	if(memcmp(pe.magic, MAGIC_W3, 2) != 0)
+	{
+		return PE_UNKNOWN;
+	}
+	
+	table = dos.nextheader + sizeof(pe_header_t);
+	if((src_size - table) / sizeof(pe_w3_file_t) < pe.w3.vxd_count)
+	{
+		return PE_ERROR_FREAD;
+	}
+	
+	len = strlen(file);
+	if(len > PE_W3_FILE_NAME_SIZE)
+	{
+		len = PE_W3_FILE_NAME_SIZE;
+	}
+	memcpy(sname, file, len);
+	/* space padding */
+	for(;len < PE_W3_FILE_NAME_SIZE;len++)
+	{
+		sname[len] = ' ';
+	}
+	sname[PE_W3_FILE_NAME_SIZE] = '\0';
+	
+	for(i = 0; i < pe.w3.vxd_count; i++)
+	{
+		memcpy(&entry, src + table + i * sizeof(pe_w3_file_t), sizeof(pe_w3_file_t));
+		
+		if(strnicmp((char*)sname, (char*)entry.name, PE_W3_FILE_NAME_SIZE) == 0)
+		{
+			if(i+1 < pe.w3.vxd_count)
+			{
+				pe_w3_file_t next;
+				
+				memcpy(&next, src + table + (i+1) * sizeof(pe_w3_file_t), sizeof(pe_w3_file_t));
+				next_file = next.file_offset;
+			}
+			else
+			{
+				next_file = src_size;
+			}
+			
+			if(entry.file_offset > next_file || next_file > src_size || next_file - entry.file_offset < sizeof(le_header_t))
+			{
+				return PE_ERROR_FREAD;
+			}
+			
+			*dst_size = sizeof(dos_program_le) + (next_file - entry.file_offset);
+			*dst = (uint8_t*)malloc(*dst_size);
+			if(*dst == NULL)
+			{
+				*dst_size = 0;
+				return PE_ERROR_MALLOC;
+			}
+			
+			memcpy(&le_header, src + entry.file_offset, sizeof(le_header_t));
+			le_header.data_pages_offset_from_top_of_file += sizeof(dos_program_le);
+			le_header.data_pages_offset_from_top_of_file -= entry.file_offset;
+			
+			/* WARNING: by documentation this SHOULD BY recalculate too */
+			le_header.nonresident_names_table_offset_from_top_of_file += sizeof(dos_program_le);
+			le_header.nonresident_names_table_offset_from_top_of_file -= entry.file_offset;
+			
+			memcpy(*dst, dos_program_le, sizeof(dos_program_le));
+			memcpy(*dst + sizeof(dos_program_le), &le_header, sizeof(le_header_t));
+			memcpy(*dst + sizeof(dos_program_le) + sizeof(le_header_t), src + entry.file_offset + sizeof(le_header_t),
+				next_file - entry.file_offset - sizeof(le_header_t));
+			
+			return PE_OK;
+		}
+	}
+	
+	return PE_ERROR_NO_FOUND;
+}
@@ -186,10 +186,29 @@ int      pe_w4_check(pe_w4_t *w4);
 pe_w3_t *pe_w3_read(dos_header_t *dos, pe_header_t *pe, FILE *fp);
 void pe_w3_free(pe_w3_t *w4);
 
+typedef void (*pe_task_t)(void *arg, size_t index);
+typedef void (*pe_parallel_for_t)(void *ctx, size_t count, pe_task_t task, void *arg);
+
+void pe_set_parallel_for(pe_parallel_for_t parallel_for, void *ctx);
+void pe_parallel_run(size_t count, pe_task_t task, void *arg);
+
+/* steps reported to the probe, once when they start (end = 0) and once when they are done */
+#define PE_PROBE_READ     0 /* pe_read, headers of an archive file */
+#define PE_PROBE_W4_TO_W3 1 /* whole W4 archive, in = W4 size, out = W3 size */
+#define PE_PROBE_CHUNK    2 /* one W4 chunk, index = chunk, in = stored size, out = decompressed size (in == out: raw chunk) */
+#define PE_PROBE_EXTRACT  3 /* one file from W3 archive, in = W3 size, out = extracted size */
+
+typedef void (*pe_probe_t)(void *ctx, int step, int end, size_t index, size_t in, size_t out);
+
+void pe_set_probe(pe_probe_t probe, void *ctx);
+
 size_t pe_w4_decompress(pe_w4_t *w4, void *buf, size_t chunk_id);
+size_t pe_w4_decompress_mem(pe_w4_t *w4, const uint8_t *src, size_t src_size, void *buf, size_t chunk_id);
 int pe_w4_to_w3(pe_w4_t *w4, const char *dst);
+int pe_w4_to_w3_mem(const uint8_t *src, size_t src_size, uint8_t **dst, size_t *dst_size);
 // int pe_w3_to_w4(pe_w3_t *w3, const char *dst);
 int pe_w3_extract(pe_w3_t *w3, const char *file, const char *dst);
+int pe_w3_extract_mem(const uint8_t *src, size_t src_size, const char *file, uint8_t **dst, size_t *dst_size);
 
 
 #endif /* __W4_H__INCLUDED__ */
@@ -26,13 +26,77 @@
 #include "unpacker.h"
 
 #include "pew.h"
+#include "cab.h"
 
 #include <malloc.h>
 
+/**
+ * Extract driver from Microsoft cabinet (Windows 98/ME install CABs)
+ *
+ * @param src: path to cabinet
+ * @param infilename: file to extract, *.VXD is assumed without extension
+ * @param out: path to extact (with filename)
+ *
+ * @return: PATCH_OK on success otherwise one of PATCH_E_* error code
+ **/
+static int wx_unpack_cab(const char *src, const char *infilename, const char *out)
+{
+	cab_t   *cab;
+	uint8_t *data;
+	char    *name;
+	FILE    *fw;
+	int      file;
+	int      status = PATCH_E_READ;
+	
+	cab = cab_open(src, NULL);
+	if(cab == NULL)
+	{
+		return PATCH_E_READ;
+	}
+	
+	if(strchr(infilename, '.') != NULL)
+	{
+		name = fs_path_dup(infilename);
+	}
+	else
+	{
+		name = fs_path_get(NULL, infilename, "VXD");
+	}
+	
+	if(name == NULL)
+	{
+		status = PATCH_E_MEM;
+	}
+	else if((file = cab_find(cab, name)) < 0)
+	{
+		status = PATCH_E_NOTFOUNDINCAB;
+	}
+	else if((data = cab_extract(cab, file, NULL)) != NULL)
+	{
+		fw = fopen(out, "wb");
+		if(fw == NULL)
+		{
+			status = PATCH_E_WRITE;
+		}
+		else
+		{
+			status = fwrite(data, 1, cab->files[file].size, fw) == cab->files[file].size ? PATCH_OK : PATCH_E_WRITE;
+			fclose(fw);
+		}
+		
+		free(data);
+	}
+	
+	fs_path_free(name);
+	cab_close(cab);
+	
+	return status;
+}
+
 /**
  * Extract driver form VMM32.VXD or diffent W3/W4 file.
  * 
- * @param src: path to W3/W4 file
+ * @param src: path to W3/W4 file or cabinet
  * @param infilename: driver in archive to extract (without *.VXD extension)
  * @param out: path to extact (with filename)
  * @param tmpname: path to temporary file in writeable location
@@ -151,6 +215,11 @@ int wx_unpack(const char *src, const char *infilename, const char *out, const ch
 				} // wx_to_w3
 			}
 		}
+		else if(t == PE_NO_IS_MSCAB && !exist_temp)
+		{
+			fclose(fp);
+			status = wx_unpack_cab(src, infilename, out);
+		}
 		else
 		{
 			fclose(fp);
@@ -332,3 +401,92 @@ void vxd_filelist_close(vxd_filelist_t *list)
 	free(list);
 }
 
+/**
+ * Extract driver from VMM32.VXD (W3/W4) or cabinet loaded in memory, nothing
+ * is written to disk.
+ *
+ * @param src: whole W3/W4 file or cabinet
+ * @param src_size: size of src
+ * @param infilename: driver to extract (*.VXD is assumed without extension)
+ * @param out: malloc'ed driver on success
+ * @param out_size: size of driver
+ *
+ * @return: PATCH_OK on success otherwise one of PATCH_E_* error code
+ **/
+int wx_unpack_mem(const uint8_t *src, size_t src_size, const char *infilename, uint8_t **out, size_t *out_size)
+{
+	uint8_t *w3 = NULL;
+	size_t   w3_size = 0;
+	char    *name;
+	int      t;
+	int      status;
+	
+	*out = NULL;
+	*out_size = 0;
+	
+	if(src_size >= 4 && memcmp(src, MAGIC_MSCAB, 4) == 0)
+	{
+		cab_t *cab = cab_open_mem(src, src_size, NULL);
+		int file;
+		
+		if(cab == NULL)
+		{
+			return PATCH_E_READ;
+		}
+		
+		name = strchr(infilename, '.') != NULL ? fs_path_dup(infilename) : fs_path_get(NULL, infilename, "VXD");
+		if(name == NULL)
+		{
+			status = PATCH_E_MEM;
+		}
+		else if((file = cab_find(cab, name)) < 0)
+		{
+			status = PATCH_E_NOTFOUNDINCAB;
+		}
+		else if((*out = cab_extract(cab, file, NULL)) != NULL)
+		{
+			*out_size = cab->files[file].size;
+			status = PATCH_OK;
+		}
+		else
+		{
+			status = PATCH_E_READ;
+		}
+		
+		fs_path_free(name);
+		cab_close(cab);
+		
+		return status;
+	}
+	
+	/* names in W3 directory are without extension */
+	name = fs_path_get(NULL, infilename, "");
+	if(name == NULL)
+	{
+		return PATCH_E_MEM;
+	}
+	
+	t = pe_w4_to_w3_mem(src, src_size, &w3, &w3_size);
+	if(t == PE_OK)
+	{
+		t = pe_w3_extract_mem(w3, w3_size, name, out, out_size);
+		free(w3);
+	}
+	else if(t == PE_UNKNOWN)
+	{
+		/* not W4, maybe W3 already */
+		t = pe_w3_extract_mem(src, src_size, name, out, out_size);
+	}
+	
+	fs_path_free(name);
+	
+	switch(t)
+	{
+		case PE_OK:            return PATCH_OK;
+		case PE_ERROR_MALLOC:  return PATCH_E_MEM;
+		case PE_ERROR_NO_FOUND: return PATCH_E_NOTFOUND;
+		case PE_UNKNOWN:
+		case PE_NO_MZ_FILE:    return PATCH_E_WRONG_TYPE;
+		default:               return PATCH_E_READ;
+	}
+}
@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
 #include "filesystem.h"
 
@@ -58,6 +59,7 @@
  */
  
 int wx_unpack(const char *src, const char *infilename, const char *out, const char *tmpname);
+int wx_unpack_mem(const uint8_t *src, size_t src_size, const char *infilename, uint8_t **out, size_t *out_size);
 int wx_to_w3(const char *in, const char *out);
 int wx_to_w4(const char *in, const char *out);
 
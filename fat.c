@@ -0,0 +1,849 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <assert.h>
+
+#include "fat.h"
+#include "log.h"
+#include "platform.h"
+
+#define MBR_PARTITION_TABLE         (0x1BE)
+#define MBR_PARTITION_COUNT         (4)
+#define MBR_SECTOR_SIZE             (512)
+
+#define FAT_BOOT_SIGNATURE          (0x1FE)
+#define FAT_NAME_LENGTH             (11)
+#define FAT_DELETED                 (0xE5)
+#define FAT_KANJI_E5                (0x05)
+
+#define FAT_FSINFO_LEAD_SIGNATURE   (0x41615252)
+#define FAT_FSINFO_STRUCT_SIGNATURE (0x61417272)
+#define FAT_FSINFO_FREE_COUNT       (488)
+#define FAT_FSINFO_NEXT_FREE        (492)
+#define FAT_FSINFO_UNKNOWN          (0xFFFFFFFF)
+
+/* Directory entry fields */
+#define FAT_ENTRY_ATTRIBUTES        (11)
+#define FAT_ENTRY_CREATE_TIME       (14)
+#define FAT_ENTRY_CREATE_DATE       (16)
+#define FAT_ENTRY_ACCESS_DATE       (18)
+#define FAT_ENTRY_CLUSTER_HIGH      (20)
+#define FAT_ENTRY_WRITE_TIME        (22)
+#define FAT_ENTRY_WRITE_DATE        (24)
+#define FAT_ENTRY_CLUSTER_LOW       (26)
+#define FAT_ENTRY_SIZE              (28)
+
+static bool isFatPartitionType(u8 type) {
+    switch (type) {
+        case 0x01: case 0x04: case 0x06: case 0x0B: case 0x0C: case 0x0E:   /* FAT12/16/32, CHS and LBA */
+        case 0x11: case 0x14: case 0x16: case 0x1B: case 0x1C: case 0x1E:   /* Same, hidden */
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool isPowerOfTwo(u32 value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+static u64 volumeToDevice(const mfFat *fat, u64 offset) {
+    return fat->volumeOffset + offset;
+}
+
+static u64 clusterOffset(const mfFat *fat, u32 cluster) {
+    return volumeToDevice(fat, fat->dataOffset + (u64) (cluster - 2) * fat->clusterSize);
+}
+
+static bool isValidCluster(const mfFat *fat, u32 cluster) {
+    return cluster >= 2 && cluster < fat->clusterCount + 2;
+}
+
+static u32 endOfChain(const mfFat *fat) {
+    return fat->type == 12 ? 0xFFF : fat->type == 16 ? 0xFFFF : 0x0FFFFFFF;
+}
+
+static bool isEndOfChain(const mfFat *fat, u32 value) {
+    return value >= (endOfChain(fat) & ~7u);
+}
+
+/* Parses the boot sector of a volume, returns false if it does not look like FAT */
+static bool fatParseBootSector(mfFat *fat, u64 volumeOffset) {
+    u8 boot[MBR_SECTOR_SIZE];
+    u32 sectorsPerCluster;
+    u32 reservedSectors;
+    u32 totalSectors;
+    u32 fatSectors;
+    u32 rootSectors;
+    u32 dataSectors;
+
+    if (!blockRead(fat->dev, volumeOffset, boot, sizeof(boot)))
+        return false;
+
+    if (boot[FAT_BOOT_SIGNATURE] != 0x55 || boot[FAT_BOOT_SIGNATURE + 1] != 0xAA || (boot[0] != 0xEB && boot[0] != 0xE9))
+        return false;
+
+    fat->volumeOffset = volumeOffset;
+    fat->bytesPerSector = read16(boot, 0x0B);
+    sectorsPerCluster = boot[0x0D];
+    reservedSectors = read16(boot, 0x0E);
+    fat->fatCount = boot[0x10];
+    fat->rootEntryCount = read16(boot, 0x11);
+    totalSectors = read16(boot, 0x13) ? read16(boot, 0x13) : read32(boot, 0x20);
+    fatSectors = read16(boot, 0x16) ? read16(boot, 0x16) : read32(boot, 0x24);
+
+    if (!isPowerOfTwo(fat->bytesPerSector) || fat->bytesPerSector < 512 || fat->bytesPerSector > 4096
+     || !isPowerOfTwo(sectorsPerCluster) || reservedSectors == 0 || fat->fatCount == 0 || fatSectors == 0)
+        return false;
+
+    rootSectors = (fat->rootEntryCount * FAT_DIR_ENTRY_SIZE + fat->bytesPerSector - 1) / fat->bytesPerSector;
+
+    if (reservedSectors + fat->fatCount * fatSectors + rootSectors >= totalSectors)
+        return false;
+
+    dataSectors = totalSectors - reservedSectors - fat->fatCount * fatSectors - rootSectors;
+
+    fat->clusterSize = sectorsPerCluster * fat->bytesPerSector;
+    fat->clusterCount = dataSectors / sectorsPerCluster;
+    fat->fatOffset = reservedSectors * fat->bytesPerSector;
+    fat->fatSize = fatSectors * fat->bytesPerSector;
+    fat->rootOffset = fat->fatOffset + fat->fatCount * fat->fatSize;
+    fat->dataOffset = (u64) fat->rootOffset + rootSectors * fat->bytesPerSector;
+
+    /* The type is defined by the cluster count, nothing else */
+
+    if (fat->clusterCount < 4085) {
+        fat->type = 12;
+    } else if (fat->clusterCount < 65525) {
+        fat->type = 16;
+    } else {
+        fat->type = 32;
+        fat->rootCluster = read32(boot, 0x2C);
+        fat->fsInfoOffset = read16(boot, 0x30) * fat->bytesPerSector;
+
+        if (!isValidCluster(fat, fat->rootCluster))
+            return false;
+    }
+
+    /* The FAT has to be able to address every cluster */
+
+    if ((u64) (fat->clusterCount + 2) * fat->type / 8 > fat->fatSize)
+        return false;
+
+    fat->nextFree = 2;
+    return true;
+}
+
+bool fatOpen(mfFat *fat, mfBlockDevice *dev) {
+    u8 mbr[MBR_SECTOR_SIZE];
+
+    assert(fat != NULL);
+    assert(dev != NULL);
+
+    memset(fat, 0, sizeof(mfFat));
+    fat->dev = dev;
+
+    /* Floppy style images start with the boot sector right away */
+
+    if (fatParseBootSector(fat, 0))
+        return true;
+
+    if (!blockRead(dev, 0, mbr, sizeof(mbr)) || mbr[FAT_BOOT_SIGNATURE] != 0x55 || mbr[FAT_BOOT_SIGNATURE + 1] != 0xAA) {
+        logPrintf("Error: No FAT file system or partition table found\n");
+        return false;
+    }
+
+    for (u32 i = 0; i < MBR_PARTITION_COUNT; i++) {
+        const u8 *partition = mbr + MBR_PARTITION_TABLE + i * 16;
+
+        if (!isFatPartitionType(partition[4]))
+            continue;
+
+        memset(fat, 0, sizeof(mfFat));
+        fat->dev = dev;
+
+        if (fatParseBootSector(fat, (u64) read32(partition, 8) * MBR_SECTOR_SIZE))
+            return true;
+    }
+
+    logPrintf("Error: No FAT partition found\n");
+    return false;
+}
+
+static bool fatGet(mfFat *fat, u32 cluster, u32 *value) {
+    u8 buf[4] = { 0, };
+    u64 offset;
+
+    if (fat->type == 12) {
+        offset = fat->fatOffset + cluster + cluster / 2;
+
+        if (!blockRead(fat->dev, volumeToDevice(fat, offset), buf, 2))
+            return false;
+
+        *value = (cluster & 1) ? read16(buf, 0) >> 4 : read16(buf, 0) & 0xFFF;
+    } else if (fat->type == 16) {
+        if (!blockRead(fat->dev, volumeToDevice(fat, fat->fatOffset + (u64) cluster * 2), buf, 2))
+            return false;
+
+        *value = read16(buf, 0);
+    } else {
+        if (!blockRead(fat->dev, volumeToDevice(fat, fat->fatOffset + (u64) cluster * 4), buf, 4))
+            return false;
+
+        *value = read32(buf, 0) & 0x0FFFFFFF;
+    }
+
+    return true;
+}
+
+/* Sets a FAT entry in every copy of the FAT */
+static bool fatSet(mfFat *fat, u32 cluster, u32 value) {
+    for (u32 copy = 0; copy < fat->fatCount; copy++) {
+        u64 base = fat->fatOffset + (u64) copy * fat->fatSize;
+        u8 buf[4];
+
+        if (fat->type == 12) {
+            u64 offset = volumeToDevice(fat, base + cluster + cluster / 2);
+            u16 packed;
+
+            if (!blockRead(fat->dev, offset, buf, 2))
+                return false;
+
+            packed = read16(buf, 0);
+            packed = (cluster & 1) ? (u16) ((packed & 0x000F) | (value << 4)) : (u16) ((packed & 0xF000) | (value & 0xFFF));
+            write16(buf, 0, packed);
+
+            if (!blockWrite(fat->dev, offset, buf, 2))
+                return false;
+        } else if (fat->type == 16) {
+            write16(buf, 0, (u16) value);
+
+            if (!blockWrite(fat->dev, volumeToDevice(fat, base + (u64) cluster * 2), buf, 2))
+                return false;
+        } else {
+            u64 offset = volumeToDevice(fat, base + (u64) cluster * 4);
+
+            /* The upper 4 bits are reserved and have to be preserved */
+            if (!blockRead(fat->dev, offset, buf, 4))
+                return false;
+
+            write32(buf, 0, (read32(buf, 0) & 0xF0000000) | (value & 0x0FFFFFFF));
+
+            if (!blockWrite(fat->dev, offset, buf, 4))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* Keeps the FAT32 free cluster count up to date, if the volume keeps one */
+static void fatAdjustFreeCount(mfFat *fat, i32 delta) {
+    u8 info[512];
+    u64 offset;
+    u32 freeCount;
+
+    if (fat->type != 32 || fat->fsInfoOffset == 0)
+        return;
+
+    offset = volumeToDevice(fat, fat->fsInfoOffset);
+
+    if (!blockRead(fat->dev, offset, info, sizeof(info))
+     || read32(info, 0) != FAT_FSINFO_LEAD_SIGNATURE
+     || read32(info, 484) != FAT_FSINFO_STRUCT_SIGNATURE)
+        return;
+
+    freeCount = read32(info, FAT_FSINFO_FREE_COUNT);
+
+    if (freeCount != FAT_FSINFO_UNKNOWN)
+        write32(info, FAT_FSINFO_FREE_COUNT, freeCount - delta);
+
+    write32(info, FAT_FSINFO_NEXT_FREE, fat->nextFree);
+    blockWrite(fat->dev, offset, info, sizeof(info));
+}
+
+/* Finds a free cluster and marks it as end of chain */
+static bool fatAllocate(mfFat *fat, u32 *cluster) {
+    for (u32 i = 0; i < fat->clusterCount; i++) {
+        u32 candidate = 2 + (fat->nextFree - 2 + i) % fat->clusterCount;
+        u32 value;
+
+        if (!fatGet(fat, candidate, &value))
+            return false;
+
+        if (value != 0)
+            continue;
+
+        if (!fatSet(fat, candidate, endOfChain(fat)))
+            return false;
+
+        fat->nextFree = candidate + 1 < fat->clusterCount + 2 ? candidate + 1 : 2;
+        *cluster = candidate;
+        return true;
+    }
+
+    logPrintf("Error: No free space left in the image\n");
+    return false;
+}
+
+/* Frees a cluster chain, returns the number of clusters freed */
+static u32 fatFreeChain(mfFat *fat, u32 cluster) {
+    u32 freed = 0;
+
+    while (isValidCluster(fat, cluster) && freed < fat->clusterCount) {
+        u32 next;
+
+        if (!fatGet(fat, cluster, &next) || !fatSet(fat, cluster, 0))
+            break;
+
+        freed++;
+        cluster = next;
+    }
+
+    return freed;
+}
+
+static bool fatZeroCluster(mfFat *fat, u32 cluster) {
+    u8 zero[512] = { 0, };
+
+    for (u32 done = 0; done < fat->clusterSize; done += sizeof(zero)) {
+        if (!blockWrite(fat->dev, clusterOffset(fat, cluster) + done, zero, sizeof(zero)))
+            return false;
+    }
+
+    return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Directories                                                               */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+    u32 cluster;                    /* Current cluster, 0 for the FAT12/16 root directory */
+    u32 index;                      /* Entry index within the cluster (or root directory) */
+    u32 steps;                      /* Clusters visited, guards against loops */
+} mfFatDirIterator;
+
+static void dirIteratorInit(const mfFat *fat, u32 firstCluster, mfFatDirIterator *it) {
+    it->cluster = firstCluster == 0 && fat->type == 32 ? fat->rootCluster : firstCluster;
+    it->index = 0;
+    it->steps = 0;
+}
+
+/* Reads the next directory entry, returns false at the end of the directory's space */
+static bool dirIteratorNext(mfFat *fat, mfFatDirIterator *it, u8 *entry, u64 *offset) {
+    if (it->cluster == 0) {
+        if (it->index >= fat->rootEntryCount)
+            return false;
+
+        *offset = volumeToDevice(fat, fat->rootOffset + (u64) it->index * FAT_DIR_ENTRY_SIZE);
+    } else {
+        if (it->index == fat->clusterSize / FAT_DIR_ENTRY_SIZE) {
+            u32 next;
+
+            if (!fatGet(fat, it->cluster, &next) || !isValidCluster(fat, next) || ++it->steps > fat->clusterCount)
+                return false;
+
+            it->cluster = next;
+            it->index = 0;
+        }
+
+        if (!isValidCluster(fat, it->cluster))
+            return false;
+
+        *offset = clusterOffset(fat, it->cluster) + (u64) it->index * FAT_DIR_ENTRY_SIZE;
+    }
+
+    it->index++;
+    return blockRead(fat->dev, *offset, entry, FAT_DIR_ENTRY_SIZE);
+}
+
+/* Converts a path component to the padded 11 character directory entry form */
+static bool toShortName(const char *component, u32 length, char *shortName) {
+    u32 dot = length;
+    u32 baseLength;
+    u32 extLength;
+
+    for (u32 i = 0; i < length; i++) {
+        if (component[i] == '.')
+            dot = i;
+    }
+
+    baseLength = dot;
+    extLength = dot < length ? length - dot - 1 : 0;
+
+    if (baseLength == 0 || baseLength > 8 || extLength > 3)
+        return false;
+
+    memset(shortName, ' ', FAT_NAME_LENGTH);
+
+    for (u32 i = 0; i < baseLength; i++) {
+        shortName[i] = (char) toupper((u8) component[i]);
+    }
+
+    for (u32 i = 0; i < extLength; i++) {
+        shortName[8 + i] = (char) toupper((u8) component[dot + 1 + i]);
+    }
+
+    return true;
+}
+
+static void entryFromRaw(mfFat *fat, const u8 *raw, u64 offset, mfFatEntry *entry) {
+    u32 n = 0;
+
+    memset(entry, 0, sizeof(mfFatEntry));
+
+    for (u32 i = 0; i < 8 && raw[i] != ' '; i++) {
+        entry->name[n++] = (char) (i == 0 && raw[i] == FAT_KANJI_E5 ? FAT_DELETED : raw[i]);
+    }
+
+    if (raw[8] != ' ') {
+        entry->name[n++] = '.';
+
+        for (u32 i = 8; i < FAT_NAME_LENGTH && raw[i] != ' '; i++) {
+            entry->name[n++] = (char) raw[i];
+        }
+    }
+
+    entry->attributes = raw[FAT_ENTRY_ATTRIBUTES];
+    entry->firstCluster = read16(raw, FAT_ENTRY_CLUSTER_LOW);
+
+    if (fat->type == 32)
+        entry->firstCluster |= (u32) read16(raw, FAT_ENTRY_CLUSTER_HIGH) << 16;
+
+    entry->size = read32(raw, FAT_ENTRY_SIZE);
+    entry->entryOffset = offset;
+}
+
+/* Looks for a name in a directory. Returns false if it is not there */
+static bool dirFind(mfFat *fat, u32 dirCluster, const char *shortName, mfFatEntry *entry) {
+    mfFatDirIterator it;
+    u8 raw[FAT_DIR_ENTRY_SIZE];
+    u64 offset;
+
+    dirIteratorInit(fat, dirCluster, &it);
+
+    while (dirIteratorNext(fat, &it, raw, &offset)) {
+        if (raw[0] == 0x00)
+            break;                  /* End of directory */
+
+        if (raw[0] == FAT_DELETED || raw[FAT_ENTRY_ATTRIBUTES] == FAT_ATTR_LONG_NAME || (raw[FAT_ENTRY_ATTRIBUTES] & FAT_ATTR_VOLUME_ID))
+            continue;
+
+        if ((raw[0] == FAT_KANJI_E5 ? FAT_DELETED : raw[0]) == (u8) shortName[0] && 0 == memcmp(raw + 1, shortName + 1, FAT_NAME_LENGTH - 1)) {
+            entryFromRaw(fat, raw, offset, entry);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool isSeparator(char c) {
+    return c == '\\' || c == '/';
+}
+
+/*  Walks a path. With parentOnly, stops before the last component and returns
+    its short name in lastName. */
+static bool fatWalk(mfFat *fat, const char *path, bool parentOnly, mfFatEntry *entry, char *lastName) {
+    const char *p = path;
+
+    memset(entry, 0, sizeof(mfFatEntry));
+    entry->attributes = FAT_ATTR_DIRECTORY;     /* Root directory */
+
+    for (;;) {
+        const char *start;
+        u32 length;
+        char shortName[FAT_NAME_LENGTH];
+
+        while (isSeparator(*p))
+            p++;
+
+        if (*p == 0x00)
+            return !parentOnly;
+
+        start = p;
+
+        while (*p != 0x00 && !isSeparator(*p))
+            p++;
+
+        length = (u32) (p - start);
+
+        if (length == 1 && start[0] == '.')
+            continue;
+
+        if (!toShortName(start, length, shortName))
+            return false;
+
+        while (isSeparator(*p))
+            p++;
+
+        if (parentOnly && *p == 0x00) {
+            memcpy(lastName, shortName, FAT_NAME_LENGTH);
+            return (entry->attributes & FAT_ATTR_DIRECTORY) != 0;
+        }
+
+        if (!(entry->attributes & FAT_ATTR_DIRECTORY) || !dirFind(fat, entry->firstCluster, shortName, entry))
+            return false;
+    }
+}
+
+bool fatLookup(mfFat *fat, const char *path, mfFatEntry *entry) {
+    assert(fat != NULL);
+    assert(path != NULL);
+    assert(entry != NULL);
+
+    return fatWalk(fat, path, false, entry, NULL);
+}
+
+static void fatTimestamp(u16 *date, u16 *dosTime) {
+    struct tm tm;
+
+    if (!timeLocal(&tm) || tm.tm_year < 80) {
+        *date = (1 << 5) | 1;       /* 1980-01-01 */
+        *dosTime = 0;
+        return;
+    }
+
+    *date = (u16) (((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+    *dosTime = (u16) ((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+}
+
+/* Writes size, first cluster and modification time back to the directory entry */
+static bool fatUpdateEntry(mfFat *fat, const mfFatEntry *entry) {
+    u8 raw[FAT_DIR_ENTRY_SIZE];
+    u16 date;
+    u16 dosTime;
+
+    if (entry->entryOffset == 0 || !blockRead(fat->dev, entry->entryOffset, raw, sizeof(raw)))
+        return false;
+
+    fatTimestamp(&date, &dosTime);
+
+    raw[FAT_ENTRY_ATTRIBUTES] = entry->attributes;
+    write16(raw, FAT_ENTRY_CLUSTER_LOW, (u16) entry->firstCluster);
+    write16(raw, FAT_ENTRY_CLUSTER_HIGH, fat->type == 32 ? (u16) (entry->firstCluster >> 16) : 0);
+    write32(raw, FAT_ENTRY_SIZE, entry->size);
+    write16(raw, FAT_ENTRY_WRITE_DATE, date);
+    write16(raw, FAT_ENTRY_WRITE_TIME, dosTime);
+    write16(raw, FAT_ENTRY_ACCESS_DATE, date);
+
+    return blockWrite(fat->dev, entry->entryOffset, raw, sizeof(raw));
+}
+
+/* Finds a free entry in a directory, growing it by a cluster if it is full */
+static bool dirFindFreeSlot(mfFat *fat, u32 dirCluster, u64 *slot) {
+    mfFatDirIterator it;
+    u8 raw[FAT_DIR_ENTRY_SIZE];
+    u64 offset;
+    u32 newCluster;
+
+    dirIteratorInit(fat, dirCluster, &it);
+
+    while (dirIteratorNext(fat, &it, raw, &offset)) {
+        if (raw[0] == 0x00 || raw[0] == FAT_DELETED) {
+            *slot = offset;
+            return true;
+        }
+    }
+
+    if (it.cluster == 0) {
+        logPrintf("Error: Root directory is full\n");
+        return false;
+    }
+
+    /* it.cluster is the last cluster of the directory now */
+
+    if (!fatAllocate(fat, &newCluster))
+        return false;
+
+    if (!fatZeroCluster(fat, newCluster) || !fatSet(fat, it.cluster, newCluster)) {
+        fatSet(fat, newCluster, 0);
+        return false;
+    }
+
+    fatAdjustFreeCount(fat, 1);
+    *slot = clusterOffset(fat, newCluster);
+    return true;
+}
+
+static bool fatCreate(mfFat *fat, const char *path, u8 attributes, mfFatEntry *entry) {
+    mfFatEntry parent;
+    char shortName[FAT_NAME_LENGTH];
+    u8 raw[FAT_DIR_ENTRY_SIZE];
+    u64 slot;
+    u16 date;
+    u16 dosTime;
+
+    if (!fatWalk(fat, path, true, &parent, shortName)) {
+        logPrintf("Error: Cannot create %s, invalid path\n", path);
+        return false;
+    }
+
+    if (dirFind(fat, parent.firstCluster, shortName, entry)) {
+        logPrintf("Error: %s exists already\n", path);
+        return false;
+    }
+
+    if (!dirFindFreeSlot(fat, parent.firstCluster, &slot))
+        return false;
+
+    fatTimestamp(&date, &dosTime);
+
+    memset(raw, 0, sizeof(raw));
+    memcpy(raw, shortName, FAT_NAME_LENGTH);
+
+    if ((u8) raw[0] == FAT_DELETED)
+        raw[0] = FAT_KANJI_E5;
+
+    raw[FAT_ENTRY_ATTRIBUTES] = attributes;
+    write16(raw, FAT_ENTRY_CREATE_DATE, date);
+    write16(raw, FAT_ENTRY_CREATE_TIME, dosTime);
+    write16(raw, FAT_ENTRY_WRITE_DATE, date);
+    write16(raw, FAT_ENTRY_WRITE_TIME, dosTime);
+    write16(raw, FAT_ENTRY_ACCESS_DATE, date);
+
+    if (!blockWrite(fat->dev, slot, raw, sizeof(raw)))
+        return false;
+
+    entryFromRaw(fat, raw, slot, entry);
+    return true;
+}
+
+bool fatCreateFile(mfFat *fat, const char *path, mfFatEntry *entry) {
+    assert(fat != NULL);
+    assert(path != NULL);
+    assert(entry != NULL);
+
+    return fatCreate(fat, path, FAT_ATTR_ARCHIVE, entry);
+}
+
+bool fatCreateDirectory(mfFat *fat, const char *path, mfFatEntry *entry) {
+    mfFatEntry parent;
+    char lastName[FAT_NAME_LENGTH];
+    u8 dots[2 * FAT_DIR_ENTRY_SIZE];
+    u32 cluster;
+
+    assert(fat != NULL);
+    assert(path != NULL);
+    assert(entry != NULL);
+
+    if (!fatWalk(fat, path, true, &parent, lastName) || !fatCreate(fat, path, FAT_ATTR_DIRECTORY, entry))
+        return false;
+
+    if (!fatAllocate(fat, &cluster))
+        return false;
+
+    fatAdjustFreeCount(fat, 1);
+
+    /* Every directory but the root starts with . and .. */
+
+    memset(dots, 0, sizeof(dots));
+    memset(dots, ' ', FAT_NAME_LENGTH);
+    memset(dots + FAT_DIR_ENTRY_SIZE, ' ', FAT_NAME_LENGTH);
+    dots[0] = '.';
+    dots[FAT_DIR_ENTRY_SIZE] = '.';
+    dots[FAT_DIR_ENTRY_SIZE + 1] = '.';
+    dots[FAT_ENTRY_ATTRIBUTES] = FAT_ATTR_DIRECTORY;
+    dots[FAT_DIR_ENTRY_SIZE + FAT_ENTRY_ATTRIBUTES] = FAT_ATTR_DIRECTORY;
+    write16(dots, FAT_ENTRY_CLUSTER_LOW, (u16) cluster);
+    write16(dots, FAT_ENTRY_CLUSTER_HIGH, fat->type == 32 ? (u16) (cluster >> 16) : 0);
+    write16(dots, FAT_DIR_ENTRY_SIZE + FAT_ENTRY_CLUSTER_LOW, (u16) parent.firstCluster);
+    write16(dots, FAT_DIR_ENTRY_SIZE + FAT_ENTRY_CLUSTER_HIGH, fat->type == 32 ? (u16) (parent.firstCluster >> 16) : 0);
+
+    if (!fatZeroCluster(fat, cluster) || !blockWrite(fat->dev, clusterOffset(fat, cluster), dots, sizeof(dots)))
+        return false;
+
+    entry->firstCluster = cluster;
+    return fatUpdateEntry(fat, entry);
+}
+
+bool fatDelete(mfFat *fat, const char *path) {
+    mfFatEntry entry;
+    u8 deleted = FAT_DELETED;
+    u32 freed;
+
+    assert(fat != NULL);
+    assert(path != NULL);
+
+    if (!fatLookup(fat, path, &entry) || entry.entryOffset == 0 || (entry.attributes & FAT_ATTR_DIRECTORY))
+        return false;
+
+    if (!blockWrite(fat->dev, entry.entryOffset, &deleted, 1))
+        return false;
+
+    freed = fatFreeChain(fat, entry.firstCluster);
+    fatAdjustFreeCount(fat, -(i32) freed);
+    return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* File data                                                                 */
+/* ------------------------------------------------------------------------- */
+
+u8 *fatReadFile(mfFat *fat, const mfFatEntry *entry, long *size) {
+    u8 *data;
+    u32 cluster = entry->firstCluster;
+    u32 done = 0;
+
+    assert(fat != NULL);
+    assert(entry != NULL);
+    assert(size != NULL);
+
+    *size = -1;
+    data = malloc(entry->size ? entry->size : 1);
+
+    if (data == NULL)
+        return NULL;
+
+    while (done < entry->size) {
+        u32 length = entry->size - done < fat->clusterSize ? entry->size - done : fat->clusterSize;
+
+        if (!isValidCluster(fat, cluster) || !blockRead(fat->dev, clusterOffset(fat, cluster), data + done, length) || !fatGet(fat, cluster, &cluster)) {
+            logPrintf("Error: Broken cluster chain in %s\n", entry->name);
+            free(data);
+            return NULL;
+        }
+
+        done += length;
+    }
+
+    *size = (long) entry->size;
+    return data;
+}
+
+/* Follows the cluster chain to offset and reads or writes from there, without going past the end of the file */
+static bool fatAccess(mfFat *fat, const mfFatEntry *entry, u32 offset, u8 *data, u32 size, bool write) {
+    u32 cluster = entry->firstCluster;
+
+    if (offset > entry->size || size > entry->size - offset)
+        return false;
+
+    for (u32 skip = offset / fat->clusterSize; skip > 0; skip--) {
+        if (!isValidCluster(fat, cluster) || !fatGet(fat, cluster, &cluster))
+            return false;
+    }
+
+    offset %= fat->clusterSize;
+
+    while (size > 0) {
+        u32 length = fat->clusterSize - offset < size ? fat->clusterSize - offset : size;
+        u64 position = clusterOffset(fat, cluster) + offset;
+
+        if (!isValidCluster(fat, cluster))
+            return false;
+
+        if (write ? !blockWrite(fat->dev, position, data, length) : !blockRead(fat->dev, position, data, length))
+            return false;
+
+        data += length;
+        size -= length;
+        offset = 0;
+
+        if (size > 0 && !fatGet(fat, cluster, &cluster))
+            return false;
+    }
+
+    return true;
+}
+
+bool fatReadAt(mfFat *fat, const mfFatEntry *entry, u32 offset, void *buf, u32 size) {
+    assert(fat != NULL);
+    assert(entry != NULL);
+
+    return fatAccess(fat, entry, offset, (u8 *) buf, size, false);
+}
+
+bool fatWriteAt(mfFat *fat, mfFatEntry *entry, u32 offset, const void *buf, u32 size) {
+    assert(fat != NULL);
+    assert(entry != NULL);
+
+    entry->attributes |= FAT_ATTR_ARCHIVE;
+
+    return fatAccess(fat, entry, offset, (u8 *) buf, size, true) && fatUpdateEntry(fat, entry);
+}
+
+bool fatWriteFile(mfFat *fat, mfFatEntry *entry, const u8 *data, u32 size) {
+    u32 needed = (size + fat->clusterSize - 1) / fat->clusterSize;
+    u32 *clusters = NULL;
+    u32 existing = 0;
+    u32 allocated = 0;
+    u32 cluster;
+    u32 freed = 0;
+    bool success = false;
+
+    assert(fat != NULL);
+    assert(entry != NULL);
+
+    clusters = malloc((needed ? needed : 1) * sizeof(u32));
+
+    if (clusters == NULL)
+        return false;
+
+    /* Reuse the existing chain as far as it goes */
+
+    cluster = entry->firstCluster;
+
+    while (existing < needed && isValidCluster(fat, cluster)) {
+        clusters[existing++] = cluster;
+
+        if (!fatGet(fat, cluster, &cluster))
+            goto cleanup;
+    }
+
+    /* Allocate the rest before anything is written, so running out of space changes nothing */
+
+    while (existing + allocated < needed) {
+        if (!fatAllocate(fat, &clusters[existing + allocated]))
+            goto rollback;
+
+        allocated++;
+    }
+
+    for (u32 i = 0; i + 1 < needed; i++) {
+        if (!fatSet(fat, clusters[i], clusters[i + 1]))
+            goto cleanup;
+    }
+
+    /* Cut off and free what is left of a longer chain */
+
+    if (needed > 0) {
+        u32 rest;
+
+        if (!fatGet(fat, clusters[needed - 1], &rest) || !fatSet(fat, clusters[needed - 1], endOfChain(fat)))
+            goto cleanup;
+
+        if (existing == needed && !isEndOfChain(fat, rest))
+            freed = fatFreeChain(fat, rest);
+    } else {
+        freed = fatFreeChain(fat, entry->firstCluster);
+    }
+
+    fatAdjustFreeCount(fat, (i32) allocated - (i32) freed);
+
+    for (u32 i = 0; i < needed; i++) {
+        u32 offset = i * fat->clusterSize;
+        u32 length = size - offset < fat->clusterSize ? size - offset : fat->clusterSize;
+
+        if (!blockWrite(fat->dev, clusterOffset(fat, clusters[i]), data + offset, length))
+            goto cleanup;
+    }
+
+    entry->firstCluster = needed ? clusters[0] : 0;
+    entry->size = size;
+    entry->attributes |= FAT_ATTR_ARCHIVE;
+
+    success = fatUpdateEntry(fat, entry);
+    goto cleanup;
+
+rollback:
+    for (u32 i = 0; i < allocated; i++) {
+        fatSet(fat, clusters[existing + i], 0);
+    }
+
+cleanup:
+    free(clusters);
+    return success;
+}
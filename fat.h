@@ -0,0 +1,73 @@
+#ifndef _MF_FAT_H_
+#define _MF_FAT_H_
+
+#include "util.h"
+#include "blockdev.h"
+
+/*  Small FAT12/16/32 driver on top of a block device.
+
+    Only 8.3 names are looked at, long file name entries are skipped (and left
+    alone). Paths may use \ or / as separator. All FAT copies are kept in sync
+    when clusters are allocated or freed.
+*/
+
+#define FAT_ATTR_READ_ONLY          (0x01)
+#define FAT_ATTR_HIDDEN             (0x02)
+#define FAT_ATTR_SYSTEM             (0x04)
+#define FAT_ATTR_VOLUME_ID          (0x08)
+#define FAT_ATTR_DIRECTORY          (0x10)
+#define FAT_ATTR_ARCHIVE            (0x20)
+#define FAT_ATTR_LONG_NAME          (0x0F)
+
+#define FAT_DIR_ENTRY_SIZE          (32)
+
+typedef struct {
+    mfBlockDevice *dev;
+    u64 volumeOffset;               /* Device offset of the boot sector */
+    u32 type;                       /* 12, 16 or 32 */
+    u32 bytesPerSector;
+    u32 clusterSize;                /* In bytes */
+    u32 fatCount;
+    u32 fatOffset;                  /* Volume offset of the first FAT */
+    u32 fatSize;                    /* Bytes per FAT */
+    u32 rootOffset;                 /* Volume offset of the FAT12/16 root directory */
+    u32 rootEntryCount;             /* FAT12/16 */
+    u32 rootCluster;                /* FAT32 */
+    u64 dataOffset;                 /* Volume offset of cluster 2 */
+    u32 clusterCount;               /* Valid clusters are 2 .. clusterCount + 1 */
+    u32 fsInfoOffset;               /* Volume offset of the FAT32 FSInfo sector, 0 if there is none */
+    u32 nextFree;                   /* Where to start looking for free clusters */
+} mfFat;
+
+typedef struct {
+    char name[13];                  /* NAME.EXT */
+    u8 attributes;
+    u32 firstCluster;               /* 0 for empty files and the root directory */
+    u32 size;
+    u64 entryOffset;                /* Device offset of the directory entry, 0 for the root directory */
+} mfFatEntry;
+
+/* Mounts the first FAT partition of a partitioned image, or an image without partition table */
+bool fatOpen(mfFat *fat, mfBlockDevice *dev);
+
+/* Finds a file or directory, names are matched case insensitively */
+bool fatLookup(mfFat *fat, const char *path, mfFatEntry *entry);
+
+/* Reads a whole file into a newly allocated buffer */
+u8 *fatReadFile(mfFat *fat, const mfFatEntry *entry, long *size);
+
+/* Replaces the contents of a file, growing or shrinking its cluster chain as needed */
+bool fatWriteFile(mfFat *fat, mfFatEntry *entry, const u8 *data, u32 size);
+
+/* Reads / overwrites part of a file in place, neither can go past the end of the file */
+bool fatReadAt(mfFat *fat, const mfFatEntry *entry, u32 offset, void *buf, u32 size);
+bool fatWriteAt(mfFat *fat, mfFatEntry *entry, u32 offset, const void *buf, u32 size);
+
+/* Creates an empty file or a directory, the parent directory has to exist */
+bool fatCreateFile(mfFat *fat, const char *path, mfFatEntry *entry);
+bool fatCreateDirectory(mfFat *fat, const char *path, mfFatEntry *entry);
+
+/* Deletes a file and frees its clusters */
+bool fatDelete(mfFat *fat, const char *path);
+
+#endif
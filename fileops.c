@@ -0,0 +1,95 @@
+#include <stdio.h>
+
+#include "fileops.h"
+#include "stats.h"
+#include "decompress/filesystem.h"
+
+static u8 *hostRead(const mfFileOps *ops, const char *path, long *size) {
+    double start = statsBegin();
+    u8 *data = openAndReadWholeFile(path, size);
+
+    (void) ops;
+    statsEnd(MF_STAT_FILE_READ, start, 0, data != NULL ? (u64) *size : 0);
+    return data;
+}
+
+static bool hostWrite(const mfFileOps *ops, const char *path, const u8 *data, long size) {
+    double start = statsBegin();
+    bool success = openAndWriteWholeFile(path, data, size);
+
+    (void) ops;
+    statsEnd(MF_STAT_FILE_WRITE, start, (u64) size, 0);
+    return success;
+}
+
+static bool hostExists(const mfFileOps *ops, const char *path) {
+    (void) ops;
+    return fs_file_exists(path) != 0;
+}
+
+static bool hostRemove(const mfFileOps *ops, const char *path) {
+    (void) ops;
+    return fs_unlink(path) == 0;
+}
+
+/* Shares extents instead of copying data where the filesystem can */
+static bool hostCopy(const mfFileOps *ops, const char *from, const char *to) {
+    (void) ops;
+    return fs_file_fullcopy(from, to) >= 0;
+}
+
+static bool hostMakeDirectory(const mfFileOps *ops, const char *path) {
+    (void) ops;
+    fs_mkdir(path);
+    return fs_is_dir(path) != 0;
+}
+
+static long hostSize(const mfFileOps *ops, const char *path) {
+    (void) ops;
+    return (long) fs_file_size(path);
+}
+
+static bool hostAccess(const char *path, u32 offset, void *buf, u32 length, bool write) {
+    double start = statsBegin();
+    FILE *file = fopen(path, write ? "r+b" : "rb");
+    bool success;
+
+    if (file == NULL)
+        return false;
+
+    success = fseek(file, (long) offset, SEEK_SET) == 0
+           && (write ? fwrite(buf, 1, length, file) : fread(buf, 1, length, file)) == length;
+
+    if (fclose(file) != 0)
+        success = false;
+
+    if (write)
+        statsEnd(MF_STAT_FILE_WRITE, start, length, 0);
+    else
+        statsEnd(MF_STAT_FILE_READ, start, 0, length);
+
+    return success;
+}
+
+static bool hostReadAt(const mfFileOps *ops, const char *path, u32 offset, void *buf, u32 length) {
+    (void) ops;
+    return hostAccess(path, offset, buf, length, false);
+}
+
+static bool hostWriteAt(const mfFileOps *ops, const char *path, u32 offset, const void *buf, u32 length) {
+    (void) ops;
+    return hostAccess(path, offset, (void *) buf, length, true);
+}
+
+const mfFileOps hostFileOps = {
+    hostRead,
+    hostWrite,
+    hostExists,
+    hostRemove,
+    hostCopy,
+    hostMakeDirectory,
+    hostSize,
+    hostReadAt,
+    hostWriteAt,
+    NULL,
+};
@@ -0,0 +1,31 @@
+#ifndef _MF_FILEOPS_H_
+#define _MF_FILEOPS_H_
+
+#include "util.h"
+
+/*  The few file operations the patcher needs, so the same code can work on
+    the host file system or on files inside a disk image. */
+
+typedef struct mfFileOps mfFileOps;
+
+struct mfFileOps {
+    /* Reads a whole file into a newly allocated buffer, NULL on error */
+    u8 *(*read)(const mfFileOps *ops, const char *path, long *size);
+    /* Replaces the contents of a file, creating it if necessary */
+    bool (*write)(const mfFileOps *ops, const char *path, const u8 *data, long size);
+    bool (*exists)(const mfFileOps *ops, const char *path);
+    bool (*remove)(const mfFileOps *ops, const char *path);
+    bool (*copy)(const mfFileOps *ops, const char *from, const char *to);
+    /* Creates a directory, succeeds if it exists already */
+    bool (*makeDirectory)(const mfFileOps *ops, const char *path);
+    /* Size of a file, -1 if it does not exist */
+    long (*size)(const mfFileOps *ops, const char *path);
+    /* Reads / overwrites part of an existing file in place, without changing its size */
+    bool (*readAt)(const mfFileOps *ops, const char *path, u32 offset, void *buf, u32 length);
+    bool (*writeAt)(const mfFileOps *ops, const char *path, u32 offset, const void *buf, u32 length);
+    void *ctx;
+};
+
+extern const mfFileOps hostFileOps;
+
+#endif
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "image.h"
+#include "vdisk.h"
+#include "stats.h"
+#include "log.h"
+
+static mfFat *fatOf(const mfFileOps *ops) {
+    return &((mfImage *) ops->ctx)->fat;
+}
+
+static u8 *imageRead(const mfFileOps *ops, const char *path, long *size) {
+    double start = statsBegin();
+    mfFatEntry entry;
+    u8 *data;
+
+    *size = -1;
+
+    if (!fatLookup(fatOf(ops), path, &entry) || (entry.attributes & FAT_ATTR_DIRECTORY)) {
+        logPrintf("Error: %s not found in image\n", path);
+        return NULL;
+    }
+
+    data = fatReadFile(fatOf(ops), &entry, size);
+    statsEnd(MF_STAT_FILE_READ, start, 0, data != NULL ? (u64) *size : 0);
+    return data;
+}
+
+static bool imageWrite(const mfFileOps *ops, const char *path, const u8 *data, long size) {
+    mfFatEntry entry;
+    double start;
+
+    if (!fatLookup(fatOf(ops), path, &entry) && !fatCreateFile(fatOf(ops), path, &entry))
+        return false;
+
+    if (entry.attributes & FAT_ATTR_DIRECTORY) {
+        logPrintf("Error: %s is a directory\n", path);
+        return false;
+    }
+
+    start = statsBegin();
+
+    if (!fatWriteFile(fatOf(ops), &entry, data, (u32) size)) {
+        logPrintf("Error writing %s to image\n", path);
+        return false;
+    }
+
+    statsEnd(MF_STAT_FILE_WRITE, start, (u64) size, 0);
+    return true;
+}
+
+static bool imageExists(const mfFileOps *ops, const char *path) {
+    mfFatEntry entry;
+    return fatLookup(fatOf(ops), path, &entry);
+}
+
+static bool imageRemove(const mfFileOps *ops, const char *path) {
+    return fatDelete(fatOf(ops), path);
+}
+
+static bool imageCopy(const mfFileOps *ops, const char *from, const char *to) {
+    long size;
+    u8 *data = imageRead(ops, from, &size);
+    bool success;
+
+    if (data == NULL)
+        return false;
+
+    success = imageWrite(ops, to, data, size);
+    free(data);
+    return success;
+}
+
+static bool imageMakeDirectory(const mfFileOps *ops, const char *path) {
+    mfFatEntry entry;
+
+    if (fatLookup(fatOf(ops), path, &entry))
+        return (entry.attributes & FAT_ATTR_DIRECTORY) != 0;
+
+    return fatCreateDirectory(fatOf(ops), path, &entry);
+}
+
+static long imageSize(const mfFileOps *ops, const char *path) {
+    mfFatEntry entry;
+
+    if (!fatLookup(fatOf(ops), path, &entry) || (entry.attributes & FAT_ATTR_DIRECTORY))
+        return -1;
+
+    return (long) entry.size;
+}
+
+static bool imageReadAt(const mfFileOps *ops, const char *path, u32 offset, void *buf, u32 length) {
+    double start = statsBegin();
+    mfFatEntry entry;
+    bool success = fatLookup(fatOf(ops), path, &entry) && !(entry.attributes & FAT_ATTR_DIRECTORY)
+                && fatReadAt(fatOf(ops), &entry, offset, buf, length);
+
+    statsEnd(MF_STAT_FILE_READ, start, 0, length);
+    return success;
+}
+
+static bool imageWriteAt(const mfFileOps *ops, const char *path, u32 offset, const void *buf, u32 length) {
+    double start = statsBegin();
+    mfFatEntry entry;
+    bool success = fatLookup(fatOf(ops), path, &entry) && !(entry.attributes & FAT_ATTR_DIRECTORY)
+                && fatWriteAt(fatOf(ops), &entry, offset, buf, length);
+
+    statsEnd(MF_STAT_FILE_WRITE, start, length, 0);
+    return success;
+}
+
+mfImage *imageOpen(const char *path, bool writable) {
+    mfImage *image;
+
+    assert(path != NULL);
+
+    image = calloc(1, sizeof(mfImage));
+
+    if (image == NULL)
+        return NULL;
+
+    image->dev = blockOpen(path, writable);
+
+    if (image->dev == NULL) {
+        logPrintf("Error: Cannot open image %s\n", path);
+        goto error;
+    }
+
+    if (!fatOpen(&image->fat, image->dev)) {
+        logPrintf("Error: %s does not contain a FAT file system\n", path);
+        goto error;
+    }
+
+    image->ops.read = imageRead;
+    image->ops.write = imageWrite;
+    image->ops.exists = imageExists;
+    image->ops.remove = imageRemove;
+    image->ops.copy = imageCopy;
+    image->ops.makeDirectory = imageMakeDirectory;
+    image->ops.size = imageSize;
+    image->ops.readAt = imageReadAt;
+    image->ops.writeAt = imageWriteAt;
+    image->ops.ctx = image;
+
+    logPrintf("Image: %s, FAT%u, %u byte clusters\n", path, image->fat.type, image->fat.clusterSize);
+    return image;
+
+error:
+    if (image->dev != NULL)
+        blockClose(image->dev);
+
+    free(image);
+    return NULL;
+}
+
+void imageClose(mfImage *image) {
+    if (image == NULL)
+        return;
+
+    blockClose(image->dev);
+    free(image);
+}
@@ -0,0 +1,26 @@
+#ifndef _MF_IMAGE_H_
+#define _MF_IMAGE_H_
+
+#include "util.h"
+#include "blockdev.h"
+#include "fat.h"
+#include "fileops.h"
+
+/*  A FAT disk image (raw or in a virtual disk container), opened for patching
+    the files inside it.
+
+    Not thread safe: one image must only be used by one target at a time. */
+
+typedef struct {
+    mfBlockDevice *dev;
+    mfFat fat;
+    mfFileOps ops;                  /* File operations on the files inside the image */
+} mfImage;
+
+/* Opens an image (for writing, unless only reading from it) and mounts its FAT file system, NULL on error */
+mfImage *imageOpen(const char *path, bool writable);
+
+/* Flushes all changes to the image file and closes it */
+void imageClose(mfImage *image);
+
+#endif
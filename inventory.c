@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "inventory.h"
+#include "le.h"
+#include "version.h"
+#include "log.h"
+
+#define INVENTORY_READ_SIZE         (32 * 1024)
+#define INVENTORY_MAX_RESOURCE      (64 * 1024)
+
+#define MZ_NEXT_HEADER_OFFSET       (0x3C)
+
+typedef struct {
+    const char *path;
+    bool present;
+    long size;
+    u32 crc;
+    char format[3];                 /* LE, W3 or W4, empty if the file is neither */
+    char version[24];               /* File version from the version resource, empty if there is none */
+    const char *state;
+} mfInventoryFile;
+
+static bool inventoryCrc(const mfFileOps *ops, const char *path, long size, u32 *crc) {
+    u8 *buf = malloc(INVENTORY_READ_SIZE);
+    bool success = buf != NULL;
+
+    *crc = 0;
+
+    for (long offset = 0; offset < size && success; offset += INVENTORY_READ_SIZE) {
+        u32 length = size - offset < INVENTORY_READ_SIZE ? (u32) (size - offset) : INVENTORY_READ_SIZE;
+
+        success = ops->readAt(ops, path, (u32) offset, buf, length);
+
+        if (success)
+            *crc = crc32Update(*crc, buf, length);
+    }
+
+    free(buf);
+    return success;
+}
+
+/* Reads the start of the file up to the end of the LE headers, NULL if it is not an LE file */
+static u8 *inventoryLeHeaders(const mfFileOps *ops, const char *path, u32 fileSize, u32 *size) {
+    u8 *headers = NULL;
+    u32 have = 0;
+    u32 needed = fileSize < 64 ? fileSize : 64;
+
+    while (needed > have && needed <= fileSize) {
+        u8 *grown = realloc(headers, needed);
+
+        if (grown == NULL || !ops->readAt(ops, path, have, grown + have, needed - have)) {
+            free(grown != NULL ? grown : headers);
+            return NULL;
+        }
+
+        headers = grown;
+        have = needed;
+        needed = leHeadersSize(headers, have);
+
+        if (needed != 0 && needed <= have) {
+            *size = have;
+            return headers;
+        }
+    }
+
+    free(headers);
+    return NULL;
+}
+
+/* Reads the format from the headers and the version from the version resource, if there is one */
+static void inventoryHeaders(const mfFileOps *ops, const char *path, mfInventoryFile *file) {
+    u8 mz[MZ_NEXT_HEADER_OFFSET + 4];
+    u8 magic[2];
+    u32 headerOffset;
+    u32 headersSize;
+    u8 *headers;
+    leFile le;
+    u32 resourceOffset;
+    u32 resourceSize;
+    u8 *resource;
+    mfVersionInfo info;
+
+    if (file->size < (long) sizeof(mz) || !ops->readAt(ops, path, 0, mz, sizeof(mz)) || 0 != memcmp(mz, MAGIC_DOS, 2))
+        return;
+
+    headerOffset = read32(mz, MZ_NEXT_HEADER_OFFSET);
+
+    if (headerOffset > (u32) file->size || (u32) file->size - headerOffset < 2 || !ops->readAt(ops, path, headerOffset, magic, 2))
+        return;
+
+    if (0 == memcmp(magic, MAGIC_LE, 2) || 0 == memcmp(magic, "W3", 2) || 0 == memcmp(magic, "W4", 2))
+        memcpy(file->format, magic, 2);
+
+    headers = inventoryLeHeaders(ops, path, (u32) file->size, &headersSize);
+
+    if (headers == NULL)
+        return;
+
+    if (leOpenHeaders(&le, headers, headersSize, file->size) && leVersionResource(&le, &resourceOffset, &resourceSize)
+     && resourceSize <= INVENTORY_MAX_RESOURCE) {
+        resource = malloc(resourceSize);
+
+        if (resource != NULL && ops->readAt(ops, path, resourceOffset, resource, resourceSize)
+         && versionParse(&info, resource, resourceSize, resourceOffset))
+            versionFormat(&info, file->version, sizeof(file->version));
+
+        free(resource);
+    }
+
+    leClose(&le);
+    free(headers);
+}
+
+static const char *inventoryState(mfPatchResult result) {
+    switch (result) {
+        case MF_PATCH_OK:
+        case MF_PATCH_NO_SPACE:         return "unpatched";
+        case MF_PATCH_ALREADY_PATCHED:  return "patched";
+        default:                        return "unsupported";
+    }
+}
+
+/* Looks at one file, plan is NULL for files that are not patched (VMM32.VXD) */
+static void inventoryFile(const mfFileOps *ops, const char *path, const mfPatchPlan *plan, mfInventoryFile *file) {
+    memset(file, 0, sizeof(mfInventoryFile));
+    file->path = path;
+    file->state = "missing";
+
+    if (path[0] == 0x00 || !ops->exists(ops, path))
+        return;
+
+    file->size = ops->size(ops, path);
+    file->present = file->size >= 0;
+
+    if (!file->present)
+        return;
+
+    if (!inventoryCrc(ops, path, file->size, &file->crc)) {
+        file->state = "unreadable";
+        return;
+    }
+
+    inventoryHeaders(ops, path, file);
+    file->state = plan != NULL ? inventoryState(patchProbeFile(ops, path, plan)) : NULL;
+}
+
+static void logJsonString(const char *text) {
+    char *escaped = malloc(strlen(text) * 6 + 1);
+    char *out = escaped;
+
+    if (escaped == NULL) {
+        logPrintf("null");
+        return;
+    }
+
+    for (; *text != 0x00; text++) {
+        unsigned char c = (unsigned char) *text;
+
+        if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = (char) c;
+        } else if (c < 0x20) {
+            out += sprintf(out, "\\u%04x", c);
+        } else {
+            *out++ = (char) c;
+        }
+    }
+
+    *out = 0x00;
+    logPrintf("\"%s\"", escaped);
+    free(escaped);
+}
+
+static void logJsonFile(const char *name, const mfInventoryFile *file) {
+    logPrintf("\"%s\":{\"path\":", name);
+    logJsonString(file->path);
+    logPrintf(",\"present\":%s", file->present ? "true" : "false");
+
+    if (file->present) {
+        logPrintf(",\"size\":%ld,\"crc32\":\"%08x\"", file->size, file->crc);
+
+        if (file->format[0] != 0x00)
+            logPrintf(",\"format\":\"%s\"", file->format);
+
+        if (file->version[0] != 0x00)
+            logPrintf(",\"version\":\"%s\"", file->version);
+    }
+
+    if (file->state != NULL)
+        logPrintf(",\"state\":\"%s\"", file->state);
+
+    logPrintf("}");
+}
+
+bool inventoryRoot(const char *path, const char *msmouseVxd, const char *imageWindowsDir, const mfPatchOptions *options) {
+    mfTarget *target = malloc(sizeof(mfTarget));
+    mfInventoryFile vmouse;
+    mfInventoryFile msmouse;
+    mfInventoryFile vmm32;
+    mfLogBuffer quiet = {0};
+    mfLogBuffer *previousLog;
+    bool ready = true;
+
+    assert(path != NULL);
+    assert(options != NULL);
+
+    if (target == NULL)
+        return false;
+
+    /* Whatever the image code and the patch engine have to say is not part of the JSON line */
+
+    previousLog = logCapture(&quiet);
+
+    if (msmouseVxd != NULL)
+        targetFromFiles(target, path, msmouseVxd);
+    else if (imageWindowsDir != NULL)
+        ready = targetFromImage(target, path, imageWindowsDir, false);
+    else
+        targetFromWindowsDir(target, path);
+
+    if (ready) {
+        inventoryFile(target->ops, target->vmouseVxd, &options->vmousePlan, &vmouse);
+        inventoryFile(target->ops, target->msmouseVxd, &options->msmousePlan, &msmouse);
+        inventoryFile(target->ops, target->vmm32Vxd, NULL, &vmm32);
+
+        if (!vmouse.present && vmm32.present)
+            vmouse.state = "in_vmm32";
+    }
+
+    logCapture(previousLog);
+    logBufferFree(&quiet);
+
+    logPrintf("{\"root\":");
+    logJsonString(path);
+
+    if (!ready) {
+        logPrintf(",\"error\":\"cannot open image\"}\n");
+    } else {
+        logPrintf(",");
+        logJsonFile("vmouse", &vmouse);
+        logPrintf(",");
+        logJsonFile("msmouse", &msmouse);
+
+        /* A driver pair has no VMM32.VXD */
+        if (vmm32.path[0] != 0x00) {
+            logPrintf(",");
+            logJsonFile("vmm32", &vmm32);
+        }
+
+        logPrintf("}\n");
+
+        ready = vmouse.present || msmouse.present || vmm32.present;
+    }
+
+    targetClose(target);
+    free(target);
+    return ready;
+}
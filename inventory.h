@@ -0,0 +1,27 @@
+#ifndef _MF_INVENTORY_H_
+#define _MF_INVENTORY_H_
+
+#include "util.h"
+#include "patcher.h"
+
+/*  Read-only inventory of installed mouse drivers.
+
+    For one root (a Windows directory, a disk image or a driver pair), one JSON
+    line is logged with VMOUSE.VXD, MSMOUSE.VXD and VMM32.VXD: whether they are
+    there, their size, CRC-32, format / version and patch state. The state comes
+    from running the patch plans without writing anything, so only the headers,
+    the version resource and the searched objects are read, plus one pass over
+    each file for the CRC. Nothing is extracted, backed up or written.
+
+    "state" is one of "patched", "unpatched", "unsupported", "missing",
+    "unreadable" or "in_vmm32" (VMOUSE.VXD only exists inside VMM32.VXD, which
+    is never patched itself).
+*/
+
+/*  Logs the inventory of a Windows directory, of the Windows directory
+    imageWindowsDir inside the disk image path (if imageWindowsDir is given),
+    or of the driver pair path / msmouseVxd (if that is given).
+    Returns false if the root cannot be opened or has none of the drivers. */
+bool inventoryRoot(const char *path, const char *msmouseVxd, const char *imageWindowsDir, const mfPatchOptions *options);
+
+#endif
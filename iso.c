@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "iso.h"
+#include "log.h"
+
+#define ISO_SECTOR_SIZE             (2048)
+#define ISO_FIRST_DESCRIPTOR        (16)
+#define ISO_MAX_DESCRIPTORS         (64)
+
+#define ISO_TYPE_PRIMARY            (1)
+#define ISO_TYPE_SUPPLEMENTARY      (2)
+#define ISO_TYPE_TERMINATOR         (255)
+
+/* Volume descriptor fields */
+#define ISO_VD_ID                   (1)
+#define ISO_VD_ESCAPES              (88)
+#define ISO_VD_BLOCK_SIZE           (128)
+#define ISO_VD_ROOT                 (156)
+
+/* Directory record fields */
+#define ISO_DR_LENGTH               (0)
+#define ISO_DR_EXTENT               (2)
+#define ISO_DR_SIZE                 (10)
+#define ISO_DR_FLAGS                (25)
+#define ISO_DR_NAME_LENGTH          (32)
+#define ISO_DR_NAME                 (33)
+
+#define ISO_FLAG_DIRECTORY          (0x02)
+
+static bool isSeparator(char c) {
+    return c == '\\' || c == '/';
+}
+
+/* Joliet names are UCS-2 big endian, anything outside ASCII cannot be one of our names anyway */
+static void recordName(const u8 *record, bool joliet, char *name) {
+    u32 length = record[ISO_DR_NAME_LENGTH];
+    const u8 *raw = record + ISO_DR_NAME;
+    u32 n = 0;
+
+    if (joliet) {
+        for (u32 i = 0; i + 1 < length && n < ISO_NAME_MAX - 1; i += 2) {
+            u16 c = (u16) ((raw[i] << 8) | raw[i + 1]);
+            name[n++] = c >= 0x20 && c < 0x80 ? (char) c : '_';
+        }
+    } else {
+        for (u32 i = 0; i < length && n < ISO_NAME_MAX - 1; i++) {
+            name[n++] = (char) raw[i];
+        }
+    }
+
+    name[n] = 0x00;
+
+    /* FILE.EXT;1 -> FILE.EXT, DIR. -> DIR */
+
+    if (strchr(name, ';') != NULL)
+        *strchr(name, ';') = 0x00;
+
+    n = (u32) strlen(name);
+
+    if (n > 1 && name[n - 1] == '.')
+        name[n - 1] = 0x00;
+}
+
+/* Fills an entry from a directory record, false if the record is broken */
+static bool entryFromRecord(mfIso *iso, const u8 *record, mfIsoEntry *entry) {
+    u32 extent = read32(record, ISO_DR_EXTENT);
+
+    memset(entry, 0, sizeof(mfIsoEntry));
+
+    recordName(record, iso->joliet, entry->name);
+    entry->directory = (record[ISO_DR_FLAGS] & ISO_FLAG_DIRECTORY) != 0;
+    entry->offset = (u64) extent * iso->blockSize;
+    entry->size = read32(record, ISO_DR_SIZE);
+
+    return entry->offset <= iso->dev->size && entry->size <= iso->dev->size - entry->offset;
+}
+
+bool isoList(mfIso *iso, const mfIsoEntry *dir, bool (*visit)(void *ctx, const mfIsoEntry *entry), void *ctx) {
+    u8 sector[ISO_SECTOR_SIZE];
+
+    assert(iso != NULL);
+    assert(dir != NULL);
+    assert(visit != NULL);
+
+    if (!dir->directory)
+        return false;
+
+    /* Records never cross a sector boundary, the rest of a sector is zero filled */
+
+    for (u32 done = 0; done < dir->size; done += ISO_SECTOR_SIZE) {
+        u32 length = dir->size - done < ISO_SECTOR_SIZE ? dir->size - done : ISO_SECTOR_SIZE;
+        u32 pos = 0;
+
+        if (!blockRead(iso->dev, dir->offset + done, sector, length))
+            return false;
+
+        while (pos < length && sector[pos + ISO_DR_LENGTH] != 0) {
+            const u8 *record = sector + pos;
+            u32 recordLength = record[ISO_DR_LENGTH];
+            mfIsoEntry entry;
+
+            if (recordLength < ISO_DR_NAME || pos + recordLength > length || ISO_DR_NAME + record[ISO_DR_NAME_LENGTH] > recordLength) {
+                logPrintf("Error: Broken directory record in ISO image\n");
+                return false;
+            }
+
+            pos += recordLength;
+
+            /* . and .. */
+            if (record[ISO_DR_NAME_LENGTH] == 1 && record[ISO_DR_NAME] <= 1)
+                continue;
+
+            if (!entryFromRecord(iso, record, &entry))
+                continue;
+
+            if (!visit(ctx, &entry))
+                return true;
+        }
+    }
+
+    return true;
+}
+
+typedef struct {
+    const char *name;
+    u32 length;
+    mfIsoEntry *entry;
+    bool found;
+} mfIsoFind;
+
+static bool nameEquals(const char *a, const char *b, u32 length) {
+    for (u32 i = 0; i < length; i++) {
+        if (toupper((u8) a[i]) != toupper((u8) b[i]))
+            return false;
+    }
+
+    return b[length] == 0x00;
+}
+
+static bool findVisit(void *ctx, const mfIsoEntry *entry) {
+    mfIsoFind *find = (mfIsoFind *) ctx;
+
+    if (!nameEquals(find->name, entry->name, find->length))
+        return true;
+
+    *find->entry = *entry;
+    find->found = true;
+    return false;
+}
+
+bool isoLookup(mfIso *iso, const char *path, mfIsoEntry *entry) {
+    const char *p = path;
+
+    assert(iso != NULL);
+    assert(path != NULL);
+    assert(entry != NULL);
+
+    *entry = iso->root;
+
+    for (;;) {
+        mfIsoFind find;
+        mfIsoEntry dir;
+
+        while (isSeparator(*p))
+            p++;
+
+        if (*p == 0x00)
+            return true;
+
+        find.name = p;
+
+        while (*p != 0x00 && !isSeparator(*p))
+            p++;
+
+        find.length = (u32) (p - find.name);
+        find.entry = entry;
+        find.found = false;
+
+        if (find.length == 1 && find.name[0] == '.')
+            continue;
+
+        dir = *entry;
+
+        if (!isoList(iso, &dir, findVisit, &find) || !find.found)
+            return false;
+    }
+}
+
+const u8 *isoData(mfIso *iso, const mfIsoEntry *entry, u8 **copy) {
+    assert(iso != NULL);
+    assert(entry != NULL);
+    assert(copy != NULL);
+
+    return blockView(iso->dev, entry->offset, entry->size, copy);
+}
+
+/* Takes the root directory from the primary descriptor, or the Joliet one if there is one */
+static bool isoReadDescriptors(mfIso *iso) {
+    u8 vd[ISO_SECTOR_SIZE];
+    bool found = false;
+
+    for (u32 i = 0; i < ISO_MAX_DESCRIPTORS; i++) {
+        bool joliet;
+
+        if (!blockRead(iso->dev, (u64) (ISO_FIRST_DESCRIPTOR + i) * ISO_SECTOR_SIZE, vd, sizeof(vd)) || 0 != memcmp(vd + ISO_VD_ID, "CD001", 5))
+            break;
+
+        if (vd[0] == ISO_TYPE_TERMINATOR)
+            break;
+
+        /* Joliet escape sequences for UCS-2 levels 1 to 3 */
+        joliet = vd[0] == ISO_TYPE_SUPPLEMENTARY && vd[ISO_VD_ESCAPES] == '%' && vd[ISO_VD_ESCAPES + 1] == '/'
+              && (vd[ISO_VD_ESCAPES + 2] == '@' || vd[ISO_VD_ESCAPES + 2] == 'C' || vd[ISO_VD_ESCAPES + 2] == 'E');
+
+        if ((vd[0] != ISO_TYPE_PRIMARY || found) && !joliet)
+            continue;
+
+        iso->blockSize = read16(vd, ISO_VD_BLOCK_SIZE);
+        iso->joliet = joliet;
+
+        if (iso->blockSize == 0 || !entryFromRecord(iso, vd + ISO_VD_ROOT, &iso->root) || !iso->root.directory)
+            return false;
+
+        found = true;
+
+        if (joliet)
+            break;
+    }
+
+    return found;
+}
+
+mfIso *isoOpen(const char *path) {
+    mfIso *iso = calloc(1, sizeof(mfIso));
+
+    assert(path != NULL);
+
+    if (iso == NULL)
+        return NULL;
+
+    iso->dev = blockOpenRaw(path, false);
+
+    if (iso->dev == NULL) {
+        free(iso);
+        return NULL;
+    }
+
+    if (!isoReadDescriptors(iso)) {
+        logPrintf("Error: %s is not an ISO9660 image\n", path);
+        isoClose(iso);
+        return NULL;
+    }
+
+    return iso;
+}
+
+void isoClose(mfIso *iso) {
+    if (iso == NULL)
+        return;
+
+    blockClose(iso->dev);
+    free(iso);
+}
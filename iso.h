@@ -0,0 +1,45 @@
+#ifndef _MF_ISO_H_
+#define _MF_ISO_H_
+
+#include "util.h"
+#include "blockdev.h"
+
+/*  Read only ISO9660 file system, with Joliet names if the image has them.
+
+    The image is memory mapped, so file contents can be handed out as pointers
+    into the mapping: only the pages that are actually read are loaded. Paths
+    may use \ or / as separator, names are matched case insensitively and
+    without the ;1 version suffix.
+*/
+
+#define ISO_NAME_MAX                (256)
+
+typedef struct {
+    char name[ISO_NAME_MAX];
+    bool directory;
+    u64 offset;                     /* Device offset of the data */
+    u32 size;
+} mfIsoEntry;
+
+typedef struct {
+    mfBlockDevice *dev;
+    u32 blockSize;
+    bool joliet;
+    mfIsoEntry root;
+} mfIso;
+
+/* Opens an ISO9660 image, NULL on error */
+mfIso *isoOpen(const char *path);
+
+void isoClose(mfIso *iso);
+
+/* Finds a file or directory */
+bool isoLookup(mfIso *iso, const char *path, mfIsoEntry *entry);
+
+/* Calls visit for every entry of a directory (without . and ..) until it returns false */
+bool isoList(mfIso *iso, const mfIsoEntry *dir, bool (*visit)(void *ctx, const mfIsoEntry *entry), void *ctx);
+
+/* Contents of a file, see blockView: *copy is only set if the image could not be mapped */
+const u8 *isoData(mfIso *iso, const mfIsoEntry *entry, u8 **copy);
+
+#endif
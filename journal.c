@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "journal.h"
+#include "log.h"
+#include "decompress/filesystem.h"
+
+static const char journalMagic[4] = { 'M', 'F', 'J', '1' };
+
+/* Differences closer than this are stored as one range, saves the per-range overhead */
+#define JOURNAL_MERGE_GAP       (8)
+
+char *journalPathFor(const char *fname) {
+    assert(fname != NULL);
+    return fs_path_get3(fname, NULL, JOURNAL_EXTENSION);
+}
+
+/* Adds a range, original points at its first byte */
+static bool journalAddRange(mfJournal *journal, const u8 *original, u32 offset, u32 length) {
+    mfJournalRange *ranges = realloc(journal->ranges, (journal->rangeCount + 1) * sizeof(mfJournalRange));
+
+    if (ranges == NULL)
+        return false;
+
+    journal->ranges = ranges;
+    ranges[journal->rangeCount].offset = offset;
+    ranges[journal->rangeCount].length = length;
+    ranges[journal->rangeCount].original = malloc(length);
+
+    if (ranges[journal->rangeCount].original == NULL)
+        return false;
+
+    memcpy(ranges[journal->rangeCount].original, original, length);
+    journal->rangeCount++;
+    return true;
+}
+
+bool journalAddDiff(mfJournal *journal, u32 offset, const u8 *original, const u8 *patched, u32 length) {
+    u32 i = 0;
+
+    assert(journal != NULL);
+    assert(original != NULL);
+    assert(patched != NULL);
+
+    while (i < length) {
+        u32 start;
+        u32 end;
+
+        if (original[i] == patched[i]) {
+            i++;
+            continue;
+        }
+
+        /* Extend the range over small runs of identical bytes */
+
+        start = i;
+        end = i + 1;
+
+        for (i = end; i < length && i - end < JOURNAL_MERGE_GAP; i++) {
+            if (original[i] != patched[i])
+                end = i + 1;
+        }
+
+        if (!journalAddRange(journal, original + start, offset + start, end - start))
+            return false;
+
+        i = end;
+    }
+
+    return true;
+}
+
+bool journalRecordDiff(mfJournal *journal, const char *fname, const u8 *original, long originalSize, const u8 *patched, long patchedSize) {
+    long common = originalSize < patchedSize ? originalSize : patchedSize;
+
+    assert(journal != NULL);
+    assert(original != NULL);
+    assert(patched != NULL);
+
+    memset(journal, 0, sizeof(mfJournal));
+
+    journal->path = fs_path_dup(fname);
+    journal->originalSize = (u32) originalSize;
+    journal->originalCrc = crc32Update(0, original, originalSize);
+    journal->patchedSize = (u32) patchedSize;
+    journal->patchedCrc = crc32Update(0, patched, patchedSize);
+
+    if (journal->path == NULL || !journalAddDiff(journal, 0, original, patched, (u32) common))
+        return false;
+
+    /* Anything the patched file lost at the end has to be restored as well */
+
+    if (originalSize > common && !journalAddRange(journal, original + common, common, originalSize - common))
+        return false;
+
+    return true;
+}
+
+/* Size of the fixed part: magic, 4 sizes / CRCs and the path length */
+#define JOURNAL_HEADER_SIZE     (4 + 4 * 4 + 2)
+
+u8 *journalEncode(const mfJournal *journal, long *size) {
+    u16 pathLength = (u16) strlen(journal->path);
+    long encodedSize = JOURNAL_HEADER_SIZE + pathLength + 4;
+    u8 *data;
+    u32 pos;
+
+    assert(journal != NULL);
+    assert(size != NULL);
+
+    for (u32 i = 0; i < journal->rangeCount; i++) {
+        encodedSize += 8 + journal->ranges[i].length;
+    }
+
+    data = malloc(encodedSize);
+
+    if (data == NULL)
+        return NULL;
+
+    memcpy(data, journalMagic, sizeof(journalMagic));
+    write32(data, 4, journal->originalSize);
+    write32(data, 8, journal->originalCrc);
+    write32(data, 12, journal->patchedSize);
+    write32(data, 16, journal->patchedCrc);
+    write16(data, 20, pathLength);
+    memcpy(data + JOURNAL_HEADER_SIZE, journal->path, pathLength);
+
+    pos = JOURNAL_HEADER_SIZE + pathLength;
+    write32(data, pos, journal->rangeCount);
+    pos += 4;
+
+    for (u32 i = 0; i < journal->rangeCount; i++) {
+        const mfJournalRange *range = &journal->ranges[i];
+
+        write32(data, pos, range->offset);
+        write32(data, pos + 4, range->length);
+        memcpy(data + pos + 8, range->original, range->length);
+        pos += 8 + range->length;
+    }
+
+    *size = encodedSize;
+    return data;
+}
+
+bool journalDecode(mfJournal *journal, const u8 *data, long size) {
+    u16 pathLength;
+    u32 pos;
+
+    assert(journal != NULL);
+    assert(data != NULL);
+
+    memset(journal, 0, sizeof(mfJournal));
+
+    if (size < JOURNAL_HEADER_SIZE || 0 != memcmp(data, journalMagic, sizeof(journalMagic)))
+        return false;
+
+    journal->originalSize = read32(data, 4);
+    journal->originalCrc = read32(data, 8);
+    journal->patchedSize = read32(data, 12);
+    journal->patchedCrc = read32(data, 16);
+    pathLength = read16(data, 20);
+
+    pos = JOURNAL_HEADER_SIZE + pathLength;
+
+    if ((long) pos + 4 > size)
+        goto error;
+
+    journal->path = calloc(pathLength + 1, 1);
+
+    if (journal->path == NULL)
+        goto error;
+
+    memcpy(journal->path, data + JOURNAL_HEADER_SIZE, pathLength);
+
+    journal->rangeCount = read32(data, pos);
+    pos += 4;
+
+    /* Every range takes at least 8 bytes, don't let a broken count allocate the world */
+    if (journal->rangeCount > (u32) (size - pos) / 8)
+        goto error;
+
+    journal->ranges = calloc(journal->rangeCount, sizeof(mfJournalRange));
+
+    if (journal->rangeCount > 0 && journal->ranges == NULL)
+        goto error;
+
+    for (u32 i = 0; i < journal->rangeCount; i++) {
+        mfJournalRange *range = &journal->ranges[i];
+
+        if ((long) pos + 8 > size)
+            goto error;
+
+        range->offset = read32(data, pos);
+        range->length = read32(data, pos + 4);
+        pos += 8;
+
+        if (range->offset + range->length > journal->originalSize || range->offset + range->length < range->offset
+         || range->length > (u32) (size - pos))
+            goto error;
+
+        range->original = malloc(range->length);
+
+        if (range->original == NULL)
+            goto error;
+
+        memcpy(range->original, data + pos, range->length);
+        pos += range->length;
+    }
+
+    return true;
+
+error:
+    journalFree(journal);
+    return false;
+}
+
+bool journalWrite(const mfFileOps *ops, const mfJournal *journal, const char *journalPath) {
+    long size;
+    u8 *data;
+    bool success;
+
+    assert(ops != NULL);
+    assert(journalPath != NULL);
+
+    data = journalEncode(journal, &size);
+
+    if (data == NULL)
+        return false;
+
+    success = ops->write(ops, journalPath, data, size);
+    free(data);
+    return success;
+}
+
+bool journalRead(const mfFileOps *ops, mfJournal *journal, const char *journalPath) {
+    long size;
+    u8 *data;
+    bool success;
+
+    assert(ops != NULL);
+    assert(journalPath != NULL);
+
+    memset(journal, 0, sizeof(mfJournal));
+    data = ops->read(ops, journalPath, &size);
+
+    if (data == NULL)
+        return false;
+
+    success = journalDecode(journal, data, size);
+
+    if (!success)
+        logPrintf("Error: %s is not a valid mousefix journal\n", journalPath);
+
+    free(data);
+    return success;
+}
+
+void journalFree(mfJournal *journal) {
+    if (journal == NULL)
+        return;
+
+    for (u32 i = 0; i < journal->rangeCount && journal->ranges != NULL; i++) {
+        free(journal->ranges[i].original);
+    }
+
+    free(journal->ranges);
+    free(journal->path);
+    memset(journal, 0, sizeof(mfJournal));
+}
+
+u8 *journalRestore(const mfJournal *journal, const char *fname, const u8 *data, long dataSize) {
+    u8 *restored;
+
+    assert(journal != NULL);
+    assert(data != NULL);
+
+    /* Only replay onto exactly the file we produced, anything else would corrupt it */
+
+    if ((u32) dataSize != journal->patchedSize || crc32Update(0, data, dataSize) != journal->patchedCrc) {
+        logPrintf("Error: %s was modified since it was patched, not restoring\n", fname);
+        return NULL;
+    }
+
+    restored = calloc(journal->originalSize ? journal->originalSize : 1, 1);
+
+    if (restored == NULL)
+        return NULL;
+
+    memcpy(restored, data, journal->originalSize < (u32) dataSize ? journal->originalSize : (u32) dataSize);
+
+    for (u32 i = 0; i < journal->rangeCount; i++) {
+        memcpy(restored + journal->ranges[i].offset, journal->ranges[i].original, journal->ranges[i].length);
+    }
+
+    if (crc32Update(0, restored, journal->originalSize) != journal->originalCrc) {
+        logPrintf("Error: Journal for %s does not reproduce the original file\n", fname);
+        free(restored);
+        return NULL;
+    }
+
+    return restored;
+}
+
+bool journalUndo(const mfFileOps *ops, const char *fname) {
+    mfJournal journal = {0};
+    char *journalPath = journalPathFor(fname);
+    u8 *data = NULL;
+    u8 *restored = NULL;
+    long dataSize = 0;
+    bool success = false;
+
+    logPrintf("Restoring %s\n", fname);
+
+    if (journalPath == NULL)
+        goto cleanup;
+
+    if (!ops->exists(ops, journalPath)) {
+        logPrintf("Error: No journal found for %s (%s)\n", fname, journalPath);
+        goto cleanup;
+    }
+
+    if (!journalRead(ops, &journal, journalPath))
+        goto cleanup;
+
+    data = ops->read(ops, fname, &dataSize);
+
+    if (data == NULL)
+        goto cleanup;
+
+    restored = journalRestore(&journal, fname, data, dataSize);
+
+    if (restored == NULL)
+        goto cleanup;
+
+    if (!ops->write(ops, fname, restored, journal.originalSize))
+        goto cleanup;
+
+    logPrintf("Restored %u range(s), original CRC32 %08x\n", journal.rangeCount, journal.originalCrc);
+
+    ops->remove(ops, journalPath);
+    success = true;
+
+cleanup:
+    journalFree(&journal);
+    fs_path_free(journalPath);
+    free(data);
+    free(restored);
+    return success;
+}
@@ -0,0 +1,59 @@
+#ifndef _MF_JOURNAL_H_
+#define _MF_JOURNAL_H_
+
+#include "util.h"
+#include "fileops.h"
+
+/*  Undo journal for patched files.
+
+    Instead of a full copy of the original file, only the byte ranges that a patch
+    changed are recorded, together with the file path and CRC32 of the file before
+    and after patching. The journal lives next to the patched file with the
+    extension replaced by .MFJ (e.g. VMOUSE.VXD -> VMOUSE.MFJ), on whatever
+    the file operations point at (host file system or disk image).
+*/
+
+#define JOURNAL_EXTENSION       "MFJ"
+
+typedef struct {
+    u32 offset;
+    u32 length;
+    u8 *original;
+} mfJournalRange;
+
+typedef struct {
+    char *path;
+    u32 originalSize;
+    u32 originalCrc;
+    u32 patchedSize;
+    u32 patchedCrc;
+    u32 rangeCount;
+    mfJournalRange *ranges;
+} mfJournal;
+
+/* Returns the journal path for a given target file, free with fs_path_free */
+char *journalPathFor(const char *fname);
+
+/* Fills a journal with all ranges that differ between the original and patched data */
+bool journalRecordDiff(mfJournal *journal, const char *fname, const u8 *original, long originalSize, const u8 *patched, long patchedSize);
+
+/*  Adds the ranges that differ between length bytes of original and patched data
+    found at offset, for journals that are filled piece by piece */
+bool journalAddDiff(mfJournal *journal, u32 offset, const u8 *original, const u8 *patched, u32 length);
+
+/* Serializes a journal into a newly allocated buffer / parses one, without any file I/O */
+u8 *journalEncode(const mfJournal *journal, long *size);
+bool journalDecode(mfJournal *journal, const u8 *data, long size);
+
+bool journalWrite(const mfFileOps *ops, const mfJournal *journal, const char *journalPath);
+bool journalRead(const mfFileOps *ops, mfJournal *journal, const char *journalPath);
+void journalFree(mfJournal *journal);
+
+/*  Rebuilds the original file from the patched data, NULL if the data is not
+    exactly what the journal was recorded against */
+u8 *journalRestore(const mfJournal *journal, const char *fname, const u8 *data, long dataSize);
+
+/* Restores a file from its journal and removes the journal afterwards */
+bool journalUndo(const mfFileOps *ops, const char *fname);
+
+#endif
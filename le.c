@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "le.h"
+#include "log.h"
+
+#define MZ_NEXT_HEADER_OFFSET       (0x3C)
+
+u32 lePageNumber(const leFile *le, u32 pageMapIndex) {
+    const u8 *entry;
+
+    if (pageMapIndex == 0 || pageMapIndex > le->pageCount)
+        return 0;
+
+    /* 24 bit page number, high byte first, followed by the flags */
+    entry = le->data + le->pageMapOffset + (pageMapIndex - 1) * LE_PAGE_MAP_ENTRY_SIZE;
+    return ((u32) entry[0] << 16) | ((u32) entry[1] << 8) | entry[2];
+}
+
+u32 lePageFileOffset(const leFile *le, u32 pageNumber) {
+    assert(pageNumber > 0);
+    return le->dataPagesOffset + (pageNumber - 1) * le->pageSize;
+}
+
+static bool leReadObject(leFile *le, u32 index, leObject *object) {
+    u64 entryOffset = (u64) le->leOffset + le->header->offset_of_object_table + (u64) index * LE_OBJECT_TABLE_ENTRY_SIZE;
+    const u8 *entry;
+    u32 firstPage;
+
+    /* All header fields come straight from the file, sum them up in 64 bits so they can't wrap */
+
+    if (entryOffset + LE_OBJECT_TABLE_ENTRY_SIZE > (u64) le->dataSize)
+        return false;
+
+    entry = le->data + entryOffset;
+
+    memset(object, 0, sizeof(leObject));
+    object->number = index + 1;
+    object->virtualSize = read32(entry, 0x00);
+    object->relocationBase = read32(entry, 0x04);
+    object->flags = read32(entry, 0x08);
+    object->pageTableIndex = read32(entry, 0x0C);
+    object->pageCount = read32(entry, 0x10);
+    memcpy(object->name, entry + 0x14, LE_OBJECT_NAME_LENGTH);
+    object->tableEntryOffset = (u32) entryOffset;
+    object->paddedSize = object->pageCount * le->pageSize;
+
+    /* Objects without pages (e.g. uninitialized data) are not in the file at all */
+
+    if (object->pageCount == 0)
+        return true;
+
+    if (object->pageTableIndex == 0 || (u64) object->pageTableIndex + object->pageCount - 1 > le->pageCount)
+        return false;
+
+    firstPage = lePageNumber(le, object->pageTableIndex);
+
+    if (firstPage == 0)
+        return false;
+
+    object->contiguous = true;
+
+    for (u32 i = 1; i < object->pageCount; i++) {
+        if (lePageNumber(le, object->pageTableIndex + i) != firstPage + i)
+            object->contiguous = false;
+    }
+
+    if ((u64) le->dataPagesOffset + (u64) (firstPage - 1) * le->pageSize > (u64) le->fileSize)
+        return false;
+
+    object->fileOffset = lePageFileOffset(le, firstPage);
+    object->fileSize = object->virtualSize < object->paddedSize ? object->virtualSize : object->paddedSize;
+
+    if (object->fileSize > (u32) le->fileSize - object->fileOffset)
+        object->fileSize = (u32) le->fileSize - object->fileOffset;
+
+    object->data = object->fileOffset < (u32) le->dataSize ? le->data + object->fileOffset : NULL;
+    return true;
+}
+
+u32 leHeadersSize(const u8 *data, u32 size) {
+    const le_header_t *header;
+    u32 leOffset;
+    u64 needed;
+    u64 end;
+
+    assert(data != NULL);
+
+    if (size < MZ_NEXT_HEADER_OFFSET + 4)
+        return MZ_NEXT_HEADER_OFFSET + 4;
+
+    if (0 != memcmp(data, MAGIC_DOS, 2))
+        return 0;
+
+    leOffset = read32(data, MZ_NEXT_HEADER_OFFSET);
+
+    if (leOffset > 0x7FFFFFFF - sizeof(le_header_t))
+        return 0;
+
+    needed = leOffset + sizeof(le_header_t);
+
+    if (size < needed)
+        return (u32) needed;
+
+    if (0 != memcmp(data + leOffset, MAGIC_LE, 2))
+        return 0;
+
+    /*  The object table and page map both sit in the loader section, right behind
+        the header. So do the VxD header extension and the resource table. */
+
+    header = (const le_header_t *) (data + leOffset);
+
+    if (header->offset_of_object_table >= LE_VXD_HEADER_SIZE && needed < (u64) leOffset + LE_VXD_HEADER_SIZE)
+        needed = (u64) leOffset + LE_VXD_HEADER_SIZE;
+
+    if (header->resource_table_entries > 0xFFFF)
+        return 0;
+
+    if (header->object_table_entries > 0xFFFF || header->number_of_memory_pages > 0xFFFFFF)
+        return 0;
+
+    end = (u64) leOffset + header->offset_of_object_table + header->object_table_entries * LE_OBJECT_TABLE_ENTRY_SIZE;
+    needed = end > needed ? end : needed;
+    end = (u64) leOffset + header->object_page_map_offset + header->number_of_memory_pages * LE_PAGE_MAP_ENTRY_SIZE;
+    needed = end > needed ? end : needed;
+    end = (u64) leOffset + header->resource_table_offset + header->resource_table_entries * LE_RESOURCE_ENTRY_SIZE;
+    needed = end > needed ? end : needed;
+
+    return needed > 0x7FFFFFFF ? 0 : (u32) needed;
+}
+
+bool leOpen(leFile *le, u8 *data, long dataSize) {
+    return leOpenHeaders(le, data, dataSize, dataSize);
+}
+
+bool leOpenHeaders(leFile *le, u8 *data, long dataSize, long fileSize) {
+    assert(le != NULL);
+    assert(data != NULL);
+
+    memset(le, 0, sizeof(leFile));
+    le->data = data;
+    le->dataSize = dataSize;
+    le->fileSize = fileSize;
+
+    if (dataSize < MZ_NEXT_HEADER_OFFSET + 4 || 0 != memcmp(data, MAGIC_DOS, 2))
+        return false;
+
+    le->leOffset = read32(data, MZ_NEXT_HEADER_OFFSET);
+
+    if ((u64) le->leOffset + sizeof(le_header_t) > (u64) dataSize || 0 != memcmp(data + le->leOffset, MAGIC_LE, 2))
+        return false;
+
+    le->header = (le_header_t *) (data + le->leOffset);
+    le->pageSize = le->header->memory_page_size;
+    le->pageCount = le->header->number_of_memory_pages;
+    le->dataPagesOffset = le->header->data_pages_offset_from_top_of_file;
+    le->pageMapOffset = le->leOffset + le->header->object_page_map_offset;
+    le->objectCount = le->header->object_table_entries;
+
+    if (le->pageSize == 0 || (u64) le->leOffset + le->header->object_page_map_offset + (u64) le->pageCount * LE_PAGE_MAP_ENTRY_SIZE > (u64) dataSize)
+        return false;
+
+    le->objects = calloc(le->objectCount ? le->objectCount : 1, sizeof(leObject));
+
+    if (le->objects == NULL)
+        return false;
+
+    for (u32 i = 0; i < le->objectCount; i++) {
+        if (!leReadObject(le, i, &le->objects[i])) {
+            leClose(le);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void leClose(leFile *le) {
+    if (le == NULL)
+        return;
+
+    free(le->objects);
+    le->objects = NULL;
+    le->objectCount = 0;
+}
+
+bool leVersionResource(const leFile *le, u32 *offset, u32 *size) {
+    u64 entryOffset;
+
+    assert(le != NULL && le->header != NULL);
+
+    *offset = 0;
+    *size = 0;
+
+    /* Win9x VxDs point at their version resource from the VxD header, their resource table is empty */
+
+    if (le->header->offset_of_object_table >= LE_VXD_HEADER_SIZE && (u64) le->leOffset + LE_VXD_HEADER_SIZE <= (u64) le->dataSize) {
+        *offset = read32(le->data, le->leOffset + LE_VXD_RESOURCE_OFFSET);
+        *size = read32(le->data, le->leOffset + LE_VXD_RESOURCE_SIZE);
+    }
+
+    /* Entries: type, name, size, object and offset inside the object */
+
+    entryOffset = (u64) le->leOffset + le->header->resource_table_offset;
+
+    for (u32 i = 0; *size == 0 && i < le->header->resource_table_entries; i++, entryOffset += LE_RESOURCE_ENTRY_SIZE) {
+        const u8 *entry;
+        u16 objectNumber;
+
+        if (entryOffset + LE_RESOURCE_ENTRY_SIZE > (u64) le->dataSize)
+            break;
+
+        entry = le->data + entryOffset;
+
+        objectNumber = read16(entry, 8);
+
+        if (read16(entry, 0) != LE_RT_VERSION || objectNumber == 0 || objectNumber > le->objectCount || !le->objects[objectNumber - 1].contiguous)
+            continue;
+
+        *offset = le->objects[objectNumber - 1].fileOffset + read32(entry, 10);
+        *size = read32(entry, 4);
+    }
+
+    return *size > 0 && *offset <= (u32) le->fileSize && *size <= (u32) le->fileSize - *offset;
+}
+
+const leObject *leFindObject(const leFile *le, const char *name) {
+    assert(le != NULL);
+    assert(name != NULL);
+
+    for (u32 i = 0; i < le->objectCount; i++) {
+        if (0 == strncmp(le->objects[i].name, name, LE_OBJECT_NAME_LENGTH))
+            return &le->objects[i];
+    }
+
+    return NULL;
+}
+
+/* Where a byte at an old file offset ends up after leGrowObject inserted its data */
+typedef struct {
+    u32 pageMapInsert;              /* Page map entries are inserted here */
+    u32 fixupPageTableInsert;       /* Fixup page table entries are inserted here */
+    u32 pagesInsert;                /* New pages go here, right behind the last page of the object */
+    u32 tableBytes;                 /* Bytes inserted at each of the two table positions */
+    u32 pageBytes;                  /* The new pages, plus padding if the old last page was short */
+} leGrowLayout;
+
+static u32 leGrowShift(const leGrowLayout *layout, u32 offset) {
+    if (offset >= layout->pagesInsert)
+        return offset + 2 * layout->tableBytes + layout->pageBytes;
+    if (offset >= layout->fixupPageTableInsert)
+        return offset + 2 * layout->tableBytes;
+    if (offset >= layout->pageMapInsert)
+        return offset + layout->tableBytes;
+    return offset;
+}
+
+/* Moves an LE header relative offset, 0 means the table does not exist */
+static void leGrowShiftRelative(const leGrowLayout *layout, u32 leOffset, uint32_t *field) {
+    if (*field != 0)
+        *field = leGrowShift(layout, leOffset + *field) - leOffset;
+}
+
+static void leGrowShiftAbsolute(const leGrowLayout *layout, uint32_t *field) {
+    if (*field != 0)
+        *field = leGrowShift(layout, *field);
+}
+
+static void leWritePageMapEntry(u8 *entry, u32 pageNumber) {
+    entry[0] = (u8) (pageNumber >> 16);
+    entry[1] = (u8) (pageNumber >> 8);
+    entry[2] = (u8) pageNumber;
+    entry[3] = 0;                   /* Regular page */
+}
+
+bool leGrowObject(u8 **data, long *dataSize, u32 objectNumber, u32 extraPages) {
+    leFile le;
+    const leObject *object;
+    leGrowLayout layout;
+    le_header_t *header;
+    u32 insertIndex;                /* 0-based page map index of the first new entry */
+    u32 lastPage;                   /* Physical page number of the object's last page */
+    u32 lastPageSize;
+    u32 paddingBytes = 0;
+    u32 fixupValue;
+    u32 vxdResourceOffset;
+    long newSize;
+    u8 *out = NULL;
+    u8 *dst;
+
+    assert(data != NULL && *data != NULL);
+    assert(dataSize != NULL);
+
+    if (extraPages == 0)
+        return true;
+
+    if (!leOpen(&le, *data, *dataSize))
+        return false;
+
+    if (objectNumber == 0 || objectNumber > le.objectCount)
+        goto error;
+
+    object = &le.objects[objectNumber - 1];
+    header = le.header;
+
+    if (object->pageCount == 0 || !object->contiguous || header->perpage_checksum_table_offset != 0 || header->fix_up_page_table_offset == 0) {
+        logPrintf("Object %s cannot be grown\n", object->name);
+        goto error;
+    }
+
+    /*  The new pages are inserted physically right behind the object so it stays
+        contiguous, all pages behind them are renumbered. If the object ends with
+        the last page of the file, that page may be short and is padded first. */
+
+    insertIndex = object->pageTableIndex - 1 + object->pageCount;
+    lastPage = lePageNumber(&le, insertIndex);
+    lastPageSize = le.pageSize;
+
+    if (lastPage == le.pageCount && header->bytes_on_last_page != 0) {
+        lastPageSize = header->bytes_on_last_page;
+        paddingBytes = le.pageSize - lastPageSize;
+    }
+
+    layout.pageMapInsert = le.pageMapOffset + insertIndex * LE_PAGE_MAP_ENTRY_SIZE;
+    layout.fixupPageTableInsert = le.leOffset + header->fix_up_page_table_offset + insertIndex * sizeof(u32);
+    layout.pagesInsert = lePageFileOffset(&le, lastPage) + lastPageSize;
+    layout.tableBytes = extraPages * LE_PAGE_MAP_ENTRY_SIZE;
+    layout.pageBytes = paddingBytes + extraPages * le.pageSize;
+
+    if (layout.pageMapInsert > layout.fixupPageTableInsert
+     || layout.fixupPageTableInsert + sizeof(u32) > le.dataPagesOffset
+     || layout.pagesInsert > (u32) *dataSize) {
+        logPrintf("Unsupported LE layout, cannot grow object %s\n", object->name);
+        goto error;
+    }
+
+    /* Fixups of the new pages start and end where the ones of the following page start: there are none */
+
+    fixupValue = read32(*data, layout.fixupPageTableInsert);
+
+    newSize = *dataSize + 2 * layout.tableBytes + layout.pageBytes;
+    out = calloc(newSize, 1);
+
+    if (out == NULL)
+        goto error;
+
+    /* Copy everything over, opening gaps at the insert positions */
+
+    dst = out;
+    memcpy(dst, *data, layout.pageMapInsert);
+    dst += layout.pageMapInsert;
+
+    for (u32 i = 0; i < extraPages; i++) {
+        leWritePageMapEntry(dst, lastPage + 1 + i);
+        dst += LE_PAGE_MAP_ENTRY_SIZE;
+    }
+
+    memcpy(dst, *data + layout.pageMapInsert, layout.fixupPageTableInsert - layout.pageMapInsert);
+    dst += layout.fixupPageTableInsert - layout.pageMapInsert;
+
+    for (u32 i = 0; i < extraPages; i++) {
+        write32(dst, 0, fixupValue);
+        dst += sizeof(u32);
+    }
+
+    memcpy(dst, *data + layout.fixupPageTableInsert, layout.pagesInsert - layout.fixupPageTableInsert);
+    dst += layout.pagesInsert - layout.fixupPageTableInsert;
+
+    dst += layout.pageBytes;        /* Zeroed by calloc */
+
+    memcpy(dst, *data + layout.pagesInsert, *dataSize - layout.pagesInsert);
+
+    /* Renumber the pages that moved behind the new ones */
+
+    for (u32 i = 0; i < le.pageCount; i++) {
+        u32 pageNumber = lePageNumber(&le, i + 1);
+        u32 entryIndex = i < insertIndex ? i : i + extraPages;
+
+        if (pageNumber > lastPage)
+            leWritePageMapEntry(out + le.pageMapOffset + entryIndex * LE_PAGE_MAP_ENTRY_SIZE, pageNumber + extraPages);
+    }
+
+    /* Fix up the header, it has not moved */
+
+    header = (le_header_t *) (out + le.leOffset);
+
+    leGrowShiftRelative(&layout, le.leOffset, &header->object_iterate_data_map_offset);
+    leGrowShiftRelative(&layout, le.leOffset, &header->resource_table_offset);
+    leGrowShiftRelative(&layout, le.leOffset, &header->resident_names_table_offset);
+    leGrowShiftRelative(&layout, le.leOffset, &header->entry_table_offset);
+    leGrowShiftRelative(&layout, le.leOffset, &header->module_directives_table_offset);
+    leGrowShiftRelative(&layout, le.leOffset, &header->fix_up_page_table_offset);
+    leGrowShiftRelative(&layout, le.leOffset, &header->fix_up_record_table_offset);
+    leGrowShiftRelative(&layout, le.leOffset, &header->imported_modules_name_table_offset);
+    leGrowShiftRelative(&layout, le.leOffset, &header->imported_procedure_name_table_offset);
+    leGrowShiftAbsolute(&layout, &header->data_pages_offset_from_top_of_file);
+    leGrowShiftAbsolute(&layout, &header->nonresident_names_table_offset_from_top_of_file);
+    leGrowShiftAbsolute(&layout, &header->debug_information_offset);
+
+    /* VxD headers carry the file offset of the version resource behind the LE header */
+
+    if (header->offset_of_object_table >= LE_VXD_HEADER_SIZE) {
+        vxdResourceOffset = read32(out, le.leOffset + LE_VXD_RESOURCE_OFFSET);
+        leGrowShiftAbsolute(&layout, &vxdResourceOffset);
+        write32(out, le.leOffset + LE_VXD_RESOURCE_OFFSET, vxdResourceOffset);
+    }
+
+    header->number_of_memory_pages += extraPages;
+    header->loader_section_size += layout.tableBytes;
+    header->fixup_section_size += layout.tableBytes;
+
+    if (paddingBytes != 0)
+        header->bytes_on_last_page = le.pageSize;
+
+    /*  The object gets the new page map entries, everything behind it moves up.
+        VxD objects are always relocated, so a relocation base overlapping the
+        next object does not matter. */
+
+    for (u32 i = 0; i < le.objectCount; i++) {
+        u8 *entry = out + le.objects[i].tableEntryOffset;
+
+        if (i == objectNumber - 1)
+            write32(entry, 0x10, le.objects[i].pageCount + extraPages);
+        else if (le.objects[i].pageCount > 0 && le.objects[i].pageTableIndex > insertIndex)
+            write32(entry, 0x0C, le.objects[i].pageTableIndex + extraPages);
+    }
+
+    leClose(&le);
+    free(*data);
+    *data = out;
+    *dataSize = newSize;
+    return true;
+
+error:
+    leClose(&le);
+    free(out);
+    return false;
+}
@@ -0,0 +1,94 @@
+#ifndef _MF_LE_H_
+#define _MF_LE_H_
+
+#include "util.h"
+#include "decompress/pew.h"
+
+/*  Read-only model of an LE (VxD) file over an in-memory buffer.
+
+    leOpen parses the header, object table and object page map once and
+    points into the caller's buffer, nothing is copied. The buffer has to
+    stay alive (and must not be reallocated) while the model is used.
+*/
+
+#define LE_OBJECT_TABLE_ENTRY_SIZE  (0x18)
+#define LE_PAGE_MAP_ENTRY_SIZE      (4)
+#define LE_OBJECT_NAME_LENGTH       (4)
+
+/* Windows VxD extension of the LE header */
+#define LE_VXD_HEADER_SIZE          (0xC4)
+#define LE_VXD_RESOURCE_OFFSET      (0xB8)  /* File offset of the version resource */
+#define LE_VXD_RESOURCE_SIZE        (0xBC)
+
+#define LE_RESOURCE_ENTRY_SIZE      (14)
+#define LE_RT_VERSION               (16)
+
+/* Object flags */
+#define LE_OBJECT_READABLE          (0x0001)
+#define LE_OBJECT_WRITABLE          (0x0002)
+#define LE_OBJECT_EXECUTABLE        (0x0004)
+
+typedef struct {
+    u32 number;                     /* 1-based object number */
+    char name[LE_OBJECT_NAME_LENGTH + 1];   /* VxD object name (e.g. LCOD, PCOD), from the reserved field */
+    u32 virtualSize;
+    u32 relocationBase;
+    u32 flags;
+    u32 pageTableIndex;             /* 1-based index into the page map */
+    u32 pageCount;
+    u32 tableEntryOffset;           /* File offset of the object table entry */
+    u32 fileOffset;                 /* File offset of the first page */
+    u32 fileSize;                   /* Bytes of the object that are backed by the file */
+    u32 paddedSize;                 /* pageCount * page size */
+    bool contiguous;                /* All pages follow each other in the file */
+    u8 *data;                       /* Points into the file buffer at fileOffset, NULL if only the headers were given */
+} leObject;
+
+typedef struct {
+    u8 *data;
+    long dataSize;
+    long fileSize;                  /* Same as dataSize, unless only the headers were given */
+    u32 leOffset;
+    le_header_t *header;            /* Points into the file buffer */
+    u32 pageSize;
+    u32 pageCount;
+    u32 dataPagesOffset;
+    u32 pageMapOffset;              /* File offset of the page map */
+    u32 objectCount;
+    leObject *objects;
+} leFile;
+
+/* Parses the LE structures of a file buffer, returns false if it is not a valid LE file */
+bool leOpen(leFile *le, u8 *data, long dataSize);
+
+/*  Same, but data only holds the start of a file of fileSize bytes, enough of
+    it for the header, object table and page map (see leHeadersSize) */
+bool leOpenHeaders(leFile *le, u8 *data, long dataSize, long fileSize);
+
+/*  How many bytes at the start of a file leOpenHeaders needs, judging by the
+    first size bytes of it. Call again with more data while the result is larger
+    than size. 0 if it is not an LE file. */
+u32 leHeadersSize(const u8 *data, u32 size);
+
+void leClose(leFile *le);
+
+/*  File offset and size of the version resource: where the VxD header points,
+    or the RT_VERSION entry of the LE resource table. false if there is none. */
+bool leVersionResource(const leFile *le, u32 *offset, u32 *size);
+
+/* Finds an object by its name, NULL if there is none */
+const leObject *leFindObject(const leFile *le, const char *name);
+
+/* Physical page number (1-based) for an entry of the page map (1-based), 0 if out of range */
+u32 lePageNumber(const leFile *le, u32 pageMapIndex);
+
+/* File offset of a physical page (1-based) */
+u32 lePageFileOffset(const leFile *le, u32 pageNumber);
+
+/*  Grows an object by appending pages to the file: the page map and fixup page
+    table get entries for the new pages, all offsets behind them are moved.
+    The object's virtual size is left alone. *data is reallocated, any leFile
+    opened on the old buffer is invalid afterwards. */
+bool leGrowObject(u8 **data, long *dataSize, u32 objectNumber, u32 extraPages);
+
+#endif
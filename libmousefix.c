@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "libmousefix.h"
+#include "decompress/unpacker.h"
+#include "decompress/pew.h"
+#include "patch.h"
+#include "patchdefs.h"
+#include "log.h"
+
+struct mfLib {
+    mfLibConfig config;
+    mfPatchPlan plans[2];           /* Indexed by mfDriver */
+};
+
+static void *heapAlloc(void *ctx, size_t size) {
+    (void) ctx;
+    return malloc(size ? size : 1);
+}
+
+static void heapFree(void *ctx, void *ptr) {
+    (void) ctx;
+    free(ptr);
+}
+
+/*  Every call collects the output of the patch engine on its own thread, the
+    previous capture (e.g. of a batch worker calling the library) is restored */
+typedef struct {
+    mfLogBuffer buffer;
+    mfLogBuffer *previous;
+} mfLibLog;
+
+static void libLogBegin(mfLibLog *log) {
+    memset(&log->buffer, 0, sizeof(mfLogBuffer));
+    log->previous = logCapture(&log->buffer);
+}
+
+/* The output of trial runs (verify, detect) is dropped */
+static void libLogEnd(const mfLib *lib, mfLibLog *log, bool forward) {
+    logCapture(log->previous);
+
+    if (forward && lib->config.log != NULL && log->buffer.length > 0)
+        lib->config.log(lib->config.logCtx, log->buffer.text);
+
+    logBufferFree(&log->buffer);
+}
+
+/* Hands an internal heap buffer to the caller, allocated with the caller's allocator */
+static mfLibResult libReturn(const mfLib *lib, const u8 *data, size_t size, uint8_t **out, size_t *outSize) {
+    *out = lib->config.alloc(lib->config.allocCtx, size ? size : 1);
+
+    if (*out == NULL)
+        return MF_LIB_NO_MEMORY;
+
+    memcpy(*out, data, size);
+    *outSize = size;
+    return MF_LIB_OK;
+}
+
+static mfLibResult fromPatchResult(mfPatchResult result) {
+    switch (result) {
+        case MF_PATCH_OK:               return MF_LIB_OK;
+        case MF_PATCH_ALREADY_PATCHED:  return MF_LIB_ALREADY_PATCHED;
+        case MF_PATCH_NOT_FOUND:        return MF_LIB_UNSUPPORTED;
+        case MF_PATCH_NO_SPACE:         return MF_LIB_NO_SPACE;
+        case MF_PATCH_BAD_FILE:         return MF_LIB_BAD_FILE;
+    }
+    return MF_LIB_BAD_FILE;
+}
+
+/* Applies a plan to a heap copy of data (the engine may grow it), the copy is returned in *patched */
+static mfLibResult libApply(const mfPatchPlan *plan, const uint8_t *data, size_t size, u8 **patched, long *patchedSize) {
+    mfPatchResult result;
+
+    *patched = NULL;
+    *patchedSize = 0;
+
+    if (size == 0 || size > 0x7FFFFFFF)
+        return MF_LIB_BAD_FILE;
+
+    *patched = malloc(size);
+
+    if (*patched == NULL)
+        return MF_LIB_NO_MEMORY;
+
+    memcpy(*patched, data, size);
+    *patchedSize = (long) size;
+
+    result = patchPlanApply(plan, patched, patchedSize);
+
+    if (result != MF_PATCH_OK) {
+        free(*patched);
+        *patched = NULL;
+    }
+
+    return fromPatchResult(result);
+}
+
+mfLib *mfLibCreate(const mfLibConfig *config) {
+    mfLib *lib;
+    mfLibLog log;
+    bool compiled;
+
+    if (config != NULL && (config->alloc == NULL) != (config->free == NULL))
+        return NULL;
+
+    lib = config != NULL && config->alloc != NULL ? config->alloc(config->allocCtx, sizeof(mfLib)) : malloc(sizeof(mfLib));
+
+    if (lib == NULL)
+        return NULL;
+
+    memset(lib, 0, sizeof(mfLib));
+
+    if (config != NULL)
+        lib->config = *config;
+
+    if (lib->config.alloc == NULL) {
+        lib->config.alloc = heapAlloc;
+        lib->config.free = heapFree;
+    }
+
+    libLogBegin(&log);
+    compiled = patchPlanCompile(&lib->plans[MF_DRIVER_VMOUSE], &vmousePatchDesc)
+            && patchPlanCompile(&lib->plans[MF_DRIVER_MSMOUSE], &msmousePatchDesc);
+    libLogEnd(lib, &log, true);
+
+    if (!compiled) {
+        mfLibDestroy(lib);
+        return NULL;
+    }
+
+    return lib;
+}
+
+void mfLibDestroy(mfLib *lib) {
+    if (lib == NULL)
+        return;
+
+    lib->config.free(lib->config.allocCtx, lib);
+}
+
+mfDriverState mfLibVerify(const mfLib *lib, mfDriver driver, const uint8_t *data, size_t size) {
+    mfLibLog log;
+    mfLibResult result;
+    u8 *patched;
+    long patchedSize;
+
+    assert(lib != NULL);
+    assert(data != NULL);
+
+    if (driver != MF_DRIVER_VMOUSE && driver != MF_DRIVER_MSMOUSE)
+        return MF_STATE_UNSUPPORTED;
+
+    /* The patch checks whether it was applied before it changes anything, so a trial run on a copy tells */
+
+    libLogBegin(&log);
+    result = libApply(&lib->plans[driver], data, size, &patched, &patchedSize);
+    libLogEnd(lib, &log, false);
+
+    free(patched);
+
+    switch (result) {
+        case MF_LIB_OK:                 return MF_STATE_UNPATCHED;
+        case MF_LIB_ALREADY_PATCHED:    return MF_STATE_PATCHED;
+        default:                        return MF_STATE_UNSUPPORTED;
+    }
+}
+
+mfVariant mfLibDetect(const mfLib *lib, const uint8_t *data, size_t size) {
+    u32 nextHeader;
+
+    assert(lib != NULL);
+    assert(data != NULL);
+
+    if (size >= 4 && 0 == memcmp(data, MAGIC_MSCAB, 4))
+        return MF_VARIANT_CABINET;
+
+    if (size < sizeof(dos_header_t) || 0 != memcmp(data, MAGIC_DOS, 2))
+        return MF_VARIANT_UNKNOWN;
+
+    nextHeader = read32(data, offsetof(dos_header_t, nextheader));
+
+    if (nextHeader > size || size - nextHeader < sizeof(pe_header_t))
+        return MF_VARIANT_UNKNOWN;
+
+    if (0 == memcmp(data + nextHeader, MAGIC_W3, 2))
+        return MF_VARIANT_VXD_ARCHIVE;
+
+    if (0 == memcmp(data + nextHeader, MAGIC_W4, 2))
+        return MF_VARIANT_VXD_ARCHIVE_W4;
+
+    if (0 != memcmp(data + nextHeader, MAGIC_LE, 2))
+        return MF_VARIANT_UNKNOWN;
+
+    if (mfLibVerify(lib, MF_DRIVER_VMOUSE, data, size) != MF_STATE_UNSUPPORTED)
+        return MF_VARIANT_VMOUSE;
+
+    if (mfLibVerify(lib, MF_DRIVER_MSMOUSE, data, size) != MF_STATE_UNSUPPORTED)
+        return MF_VARIANT_MSMOUSE;
+
+    return MF_VARIANT_VXD;
+}
+
+mfLibResult mfLibExtract(const mfLib *lib, const uint8_t *archive, size_t archiveSize, const char *member, uint8_t **out, size_t *outSize) {
+    mfLibLog log;
+    uint8_t *extracted = NULL;
+    size_t extractedSize = 0;
+    mfLibResult result;
+    int status;
+
+    assert(lib != NULL);
+    assert(archive != NULL);
+    assert(member != NULL);
+    assert(out != NULL && outSize != NULL);
+
+    *out = NULL;
+    *outSize = 0;
+
+    libLogBegin(&log);
+    status = wx_unpack_mem(archive, archiveSize, member, &extracted, &extractedSize);
+    libLogEnd(lib, &log, true);
+
+    switch (status) {
+        case PATCH_OK:
+            result = libReturn(lib, extracted, extractedSize, out, outSize);
+            break;
+        case PATCH_E_MEM:
+            result = MF_LIB_NO_MEMORY;
+            break;
+        case PATCH_E_NOTFOUND:
+        case PATCH_E_NOTFOUNDINCAB:
+            result = MF_LIB_NOT_FOUND;
+            break;
+        default:
+            result = MF_LIB_BAD_FILE;
+            break;
+    }
+
+    free(extracted);
+    return result;
+}
+
+static mfLibResult libPatch(const mfLib *lib, mfDriver driver, const uint8_t *data, size_t size, uint8_t **out, size_t *outSize) {
+    mfLibLog log;
+    mfLibResult result;
+    u8 *patched;
+    long patchedSize;
+
+    assert(lib != NULL);
+    assert(data != NULL);
+    assert(out != NULL && outSize != NULL);
+
+    *out = NULL;
+    *outSize = 0;
+
+    libLogBegin(&log);
+    result = libApply(&lib->plans[driver], data, size, &patched, &patchedSize);
+    libLogEnd(lib, &log, true);
+
+    if (result == MF_LIB_OK)
+        result = libReturn(lib, patched, (size_t) patchedSize, out, outSize);
+
+    free(patched);
+    return result;
+}
+
+mfLibResult mfLibPatchVmouse(const mfLib *lib, const uint8_t *data, size_t size, uint8_t **out, size_t *outSize) {
+    return libPatch(lib, MF_DRIVER_VMOUSE, data, size, out, outSize);
+}
+
+mfLibResult mfLibPatchMsmouse(const mfLib *lib, const uint8_t *data, size_t size, uint8_t **out, size_t *outSize) {
+    return libPatch(lib, MF_DRIVER_MSMOUSE, data, size, out, outSize);
+}
+
+void mfLibFree(const mfLib *lib, void *ptr) {
+    assert(lib != NULL);
+
+    if (ptr != NULL)
+        lib->config.free(lib->config.allocCtx, ptr);
+}
+
+const char *mfLibResultString(mfLibResult result) {
+    switch (result) {
+        case MF_LIB_OK:                 return "OK";
+        case MF_LIB_ALREADY_PATCHED:    return "already patched";
+        case MF_LIB_UNSUPPORTED:        return "unsupported driver";
+        case MF_LIB_NO_SPACE:           return "not enough space for the patch";
+        case MF_LIB_BAD_FILE:           return "invalid file";
+        case MF_LIB_NOT_FOUND:          return "not found in archive";
+        case MF_LIB_NO_MEMORY:          return "out of memory";
+    }
+    return "unknown";
+}
@@ -0,0 +1,90 @@
+#ifndef _MF_LIBMOUSEFIX_H_
+#define _MF_LIBMOUSEFIX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  libmousefix: the patcher as a library over memory buffers.
+
+    Nothing is read from or written to files. Input buffers belong to the
+    caller and are never modified, every buffer handed back is allocated with
+    the caller's allocator and released with mfLibFree. A library handle only
+    holds the allocator and the compiled patches and is not changed after
+    mfLibCreate, so one handle can be used from any number of threads.
+
+    The progress output the command line tool prints is collected per call
+    and passed to the log callback, nothing goes to stdout.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    void *(*alloc)(void *ctx, size_t size);     /* NULL for malloc / free */
+    void (*free)(void *ctx, void *ptr);
+    void *allocCtx;
+    void (*log)(void *ctx, const char *text);   /* Output of one call, may be NULL */
+    void *logCtx;
+} mfLibConfig;
+
+typedef struct mfLib mfLib;
+
+typedef enum {
+    MF_LIB_OK = 0,
+    MF_LIB_ALREADY_PATCHED,
+    MF_LIB_UNSUPPORTED,             /* Not the expected driver, or an unknown version of it */
+    MF_LIB_NO_SPACE,
+    MF_LIB_BAD_FILE,
+    MF_LIB_NOT_FOUND,               /* Member is not in the archive */
+    MF_LIB_NO_MEMORY,
+} mfLibResult;
+
+typedef enum {
+    MF_VARIANT_UNKNOWN = 0,
+    MF_VARIANT_VXD_ARCHIVE,         /* VMM32.VXD, uncompressed (W3) */
+    MF_VARIANT_VXD_ARCHIVE_W4,      /* VMM32.VXD, compressed (W4) */
+    MF_VARIANT_CABINET,             /* Install cabinet (MSCF) */
+    MF_VARIANT_VXD,                 /* Some other LE driver */
+    MF_VARIANT_VMOUSE,
+    MF_VARIANT_MSMOUSE,
+} mfVariant;
+
+typedef enum {
+    MF_DRIVER_VMOUSE = 0,
+    MF_DRIVER_MSMOUSE,
+} mfDriver;
+
+typedef enum {
+    MF_STATE_UNSUPPORTED = 0,       /* Cannot be patched */
+    MF_STATE_UNPATCHED,
+    MF_STATE_PATCHED,
+} mfDriverState;
+
+/* NULL config for the C heap and no log. NULL on error */
+mfLib *mfLibCreate(const mfLibConfig *config);
+void mfLibDestroy(mfLib *lib);
+
+/* Tells archives, cabinets and the two drivers apart */
+mfVariant mfLibDetect(const mfLib *lib, const uint8_t *data, size_t size);
+
+/* Extracts a driver (e.g. "VMOUSE.VXD") from VMM32.VXD (W3 or W4) or a cabinet */
+mfLibResult mfLibExtract(const mfLib *lib, const uint8_t *archive, size_t archiveSize, const char *member, uint8_t **out, size_t *outSize);
+
+/* Patches a copy of the driver. The patched file can be larger than the original */
+mfLibResult mfLibPatchVmouse(const mfLib *lib, const uint8_t *data, size_t size, uint8_t **out, size_t *outSize);
+mfLibResult mfLibPatchMsmouse(const mfLib *lib, const uint8_t *data, size_t size, uint8_t **out, size_t *outSize);
+
+/* Checks whether a driver carries the patch */
+mfDriverState mfLibVerify(const mfLib *lib, mfDriver driver, const uint8_t *data, size_t size);
+
+/* Releases a buffer returned by the library */
+void mfLibFree(const mfLib *lib, void *ptr);
+
+const char *mfLibResultString(mfLibResult result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "log.h"
+#include "platform.h"
+
+static MF_THREAD_LOCAL mfLogBuffer *captureBuffer = NULL;
+
+static bool logBufferReserve(mfLogBuffer *buffer, size_t size) {
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+    char *text;
+
+    if (size <= buffer->capacity)
+        return true;
+
+    while (capacity < size)
+        capacity *= 2;
+
+    text = realloc(buffer->text, capacity);
+
+    if (text == NULL)
+        return false;
+
+    buffer->text = text;
+    buffer->capacity = capacity;
+    return true;
+}
+
+void logPrintf(const char *fmt, ...) {
+    mfLogBuffer *buffer = captureBuffer;
+    va_list args;
+    int length;
+
+    va_start(args, fmt);
+
+    if (buffer == NULL) {
+        vprintf(fmt, args);
+        va_end(args);
+        return;
+    }
+
+    length = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    if (length < 0 || !logBufferReserve(buffer, buffer->length + length + 1))
+        return;
+
+    va_start(args, fmt);
+    vsnprintf(buffer->text + buffer->length, length + 1, fmt, args);
+    va_end(args);
+
+    buffer->length += length;
+}
+
+mfLogBuffer *logCapture(mfLogBuffer *buffer) {
+    mfLogBuffer *previous = captureBuffer;
+    captureBuffer = buffer;
+    return previous;
+}
+
+void logBufferClear(mfLogBuffer *buffer) {
+    buffer->length = 0;
+
+    if (buffer->text != NULL)
+        buffer->text[0] = 0x00;
+}
+
+void logBufferFree(mfLogBuffer *buffer) {
+    free(buffer->text);
+    buffer->text = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
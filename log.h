@@ -0,0 +1,27 @@
+#ifndef _MF_LOG_H_
+#define _MF_LOG_H_
+
+#include "util.h"
+
+/*  Progress output of the patcher.
+
+    logPrintf goes straight to stdout, unless the calling thread captures its
+    output into a buffer. Batch workers do that so the output of items that are
+    processed at the same time does not get mixed up.
+*/
+
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;
+} mfLogBuffer;
+
+void logPrintf(const char *fmt, ...);
+
+/* Captures the output of the calling thread into buffer, NULL goes back to stdout. Returns the previous buffer */
+mfLogBuffer *logCapture(mfLogBuffer *buffer);
+
+void logBufferClear(mfLogBuffer *buffer);
+void logBufferFree(mfLogBuffer *buffer);
+
+#endif
@@ -7,522 +7,332 @@
 #include <assert.h>
 
 #include "decompress/unpacker.h"
-
-typedef uint8_t u8;
-typedef uint16_t u16;
-typedef uint32_t u32;
-typedef int16_t i16;
-typedef int32_t i32;
-
-typedef struct {
-    u32 leOffset;
-    u32 objectTableOffset;
-    u32 objectTableCount;
-    u32 pcodTableEntryOffset;
-    u32 pcodOffset;
-    u32 pcodSize;
-    u32 pcodPaddedSize;
-    u32 pcodPageCount;
-    u32 pcodFirstPageIndex;
-    u8 *pcodData;
-    u32 pcodPatchOffset;
-    u8 *pcodPatchData;
-    u32 pageSize;
-    u32 pageDataStart;
-} mfContext;
-
-#define VXD_OBJ_TABLE_ENTRY_SIZE    (0x18)
-#define VXD_PAGE_TABLE_ENTRY_SIZE   (8)
-
-#define MSMOUSE_CURVE_LENGTH        (32)
-
-static void write8 (u8 *data, u32 offset, u8  value)    { memcpy (&data[offset], (u8*) &value, sizeof(value)); }
-static void write16(u8 *data, u32 offset, u16 value)    { memcpy (&data[offset], (u8*) &value, sizeof(value)); }
-static void write32(u8 *data, u32 offset, u32 value)    { memcpy (&data[offset], (u8*) &value, sizeof(value)); }
-
-static u8   read8  (u8 *data, u32 offset)               { return *((u8*)  (&data[offset])); }
-static u16  read16 (u8 *data, u32 offset)               { return *((u16*) (&data[offset])); }
-static u32  read32 (u8 *data, u32 offset)               { return *((u32*) (&data[offset])); }
-
-static u32  getAbsoluteTargetFromCallInstruction32(u8 *data, u32 eip) {
-    u8 *dataAtCallInstruction = data + eip;
-
-    assert(data != NULL);
-    assert(dataAtCallInstruction[0] == 0xe8);
-
-    return eip + read32(dataAtCallInstruction, 1) + sizeof(u32) + 1;
-}
-
-static u32  calcDestinationFromCallInstruction32(u32 eip, u32 target) {
-    return target - (eip + sizeof(u32) + 1);
-}
-
-static void patchCall32(u8 *data, u32 eip, u32 newTarget) {
-    u8 *dataAtCallInstruction = data + eip;
-
-    assert(data != NULL);
-    assert(dataAtCallInstruction[0] == 0xe8);
-
-    printf("Patching call at %x to %x, ", eip, getAbsoluteTargetFromCallInstruction32(data, eip));
-    write32(dataAtCallInstruction, 1, calcDestinationFromCallInstruction32(eip, newTarget));
-    printf("new target: %x\n", getAbsoluteTargetFromCallInstruction32(data, eip));
-
-}
-
-static long filesize(FILE *f) {
-    long cur = ftell(f);
-    long ret = 0;
-    fseek(f, 0, SEEK_END);
-    ret = ftell(f);
-    fseek(f, cur, SEEK_SET);
-    return ret;
-}
-
-static u8 *openAndReadWholeFile(const char *fname, long *size) {
-    FILE *in = NULL;
-    u8 *data = NULL;
-
-    assert(fname != NULL);
-    assert(size != NULL);
-
-    in = fopen(fname, "rb");
-
-    if (in == NULL) {
-        goto error;
-    }
-
-    *size = filesize(in);
-
-    if (*size <= 0)
-        goto error;
-    
-    data = calloc(*size, 1);
-
-    if (data == NULL)
-        goto error;
-
-    if (fread(data, 1, *size, in) != *size)
-        goto error;
-
-    fclose(in);
-    return data;
-
-error:
-    perror("Error reading file");
-    free(data);
-    fclose(in);
-    *size = -1;
-    return NULL;
+#include "util.h"
+#include "patcher.h"
+#include "batch.h"
+#include "media.h"
+#include "pipe.h"
+#include "inventory.h"
+#include "cache.h"
+#include "stats.h"
+#include "trace.h"
+#include "decompress/pew.h"
+#include "decompress/ds_decompress.h"
+#include "sched.h"
+#include "platform.h"
+
+static void printUsage(void) {
+    printf("mousefix [options] <windows_dir>\n");
+    printf("mousefix [options] <vmouse.vxd> <msmouse.vxd>\n");
+    printf("\n");
+    printf("  --undo            restore the files from their undo journals (*.MFJ)\n");
+    printf("  --full-backup     also keep a full copy of each original file (*.BAK)\n");
+    printf("  --lowmem          patch the files in place, only reading the pages that are\n");
+    printf("                    searched or changed instead of the whole file\n");
+    printf("  --cache <dir>     keep drivers extracted from VMM32.VXD in dir, so identical\n");
+    printf("                    VMM32.VXD files are only decompressed once\n");
+    printf("  --cache-size <n>  size limit of the cache in MB (default 256), the least\n");
+    printf("                    recently used drivers are removed beyond it\n");
+    printf("  --stats           print how often and how long every stage of unpacking and\n");
+    printf("                    patching ran at the end (--stats-json: as one JSON line)\n");
+    printf("  --ds-stats        print the token, match length and distance histograms of\n");
+    printf("                    the DS decoder at the end (needs a DS_STATS build)\n");
+    printf("  --trace <file>    write every stage, chunk and target with the thread it ran\n");
+    printf("                    on to file, for chrome://tracing or Perfetto\n");
+    printf("\n");
+    printf("mousefix [options] --image <disk.img> [windows_dir_in_image]\n");
+    printf("\n");
+    printf("  --image <file>    patch the drivers inside a raw FAT12/16/32 disk image\n");
+    printf("                    (windows_dir_in_image defaults to WINDOWS)\n");
+    printf("\n");
+    printf("mousefix [options] --media <cab_dir_or_iso> <out_dir>\n");
+    printf("\n");
+    printf("  --media <source>  patch the drivers in Windows 98 / ME install cabinets\n");
+    printf("                    (one .CAB, a directory of them or a CD image), write them\n");
+    printf("                    to out_dir\n");
+    printf("\n");
+    printf("mousefix --pipe [--member <name>] [--extract-only] < in > out\n");
+    printf("\n");
+    printf("  --pipe            patch a driver read from stdin and write it to stdout, or\n");
+    printf("                    extract and patch one from VMM32.VXD or a cabinet\n");
+    printf("  --member <name>   driver to take from an archive (default VMOUSE.VXD)\n");
+    printf("  --extract-only    write the extracted driver without patching it\n");
+    printf("\n");
+    printf("mousefix --inventory <windows_dir> | <vmouse.vxd> <msmouse.vxd>\n");
+    printf("mousefix --inventory --image <disk.img> [windows_dir_in_image]\n");
+    printf("mousefix --inventory --batch <manifest> | --batch-dir <dir>\n");
+    printf("\n");
+    printf("  --inventory       only report the drivers and whether they are patched, as\n");
+    printf("                    one JSON line per target, without writing anything\n");
+    printf("\n");
+    printf("mousefix [options] --batch <manifest>\n");
+    printf("mousefix [options] --batch-dir <dir>\n");
+    printf("\n");
+    printf("  --batch <file>    patch every Windows directory or driver pair listed in file\n");
+    printf("  --batch-dir <dir> patch every Windows directory inside dir\n");
+    printf("  --threads <n>     number of threads (default: one per processor)\n");
+    printf("  --verbose         print the output of every target, not only of failed ones\n");
+    printf("  --state <file>    remember the drivers of every target in file, and skip the\n");
+    printf("                    targets that were patched and have not changed since\n");
+    printf("  --metrics <file>  write metrics of the batch for the Prometheus textfile\n");
+    printf("                    collector to file (replaced as a whole, name it *.prom)\n");
+    printf("\n");
 }
 
-static bool openAndWriteWholeFile(const char *fname, const u8 *data, long size) {
-    FILE *file = NULL;
-
-    assert(fname != NULL);
-    assert(data != NULL);
-    assert(size > 0);
-
-    file = fopen(fname, "wb");
-
-    if (file == NULL) {
-        goto error;
-    }
-
-    if (fwrite(data, 1, size, file) != size)
-        goto error;
-
-    fclose(file);
-    return true;
-
-error:
-    perror("Error writing file");
-    
-    if (file != NULL)
-        fclose(file);
-    return false;
-}
+int main(int argc, char *argv[]) {
+    char windowsDir[PATH_MAX] =  { 0, };
 
-/* Finds a byte pattern in some data, returns NULL if not found */
-u8 *findBytes(const u8 *haystack, const u8 *needle, size_t haystackSize, size_t needleSize) {
-    const u8 *ceiling = haystack + haystackSize;
-    
-    assert(haystack != NULL);
-    assert(needle != NULL); 
-    assert(needleSize <= haystackSize);
-    assert(needleSize != 0);
-    
-    while (haystack + needleSize <= ceiling) {
-        if (0 == memcmp(haystack, needle, needleSize)) {
-            return (u8*) haystack;
+    const char *args[2] = { NULL, NULL };
+    int argCount = 0;
+
+    bool undo = false;
+    bool fullBackup = false;
+    bool lowMemory = false;
+    u32 threads = 0;
+    const char *image = NULL;
+    const char *media = NULL;
+    const char *cacheDir = NULL;
+    u64 cacheSize = MF_CACHE_DEFAULT_SIZE;
+    mfCache *cache = NULL;
+    bool stats = false;
+    bool statsJson = false;
+    bool dsStats = false;
+    const char *traceFile = NULL;
+    bool pipe = false;
+    bool inventory = false;
+    mfPipeOptions pipeOptions = {0};
+    mfBatchOptions batch = {0};
+    mfPatchOptions options;
+    mfTarget target = {0};
+    mfScheduler *sched = NULL;
+    int result = -1;
+
+    /* Options first, whatever is left are the paths */
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+
+        if (0 == strcmp("/?", argv[i]) || 0 == strcmp("--help", argv[i])) {
+            printUsage();
+            return -1;
+        } else if (0 == strcmp("--undo", argv[i])) {
+            undo = true;
+        } else if (0 == strcmp("--full-backup", argv[i])) {
+            fullBackup = true;
+        } else if (0 == strcmp("--lowmem", argv[i])) {
+            lowMemory = true;
+        } else if (0 == strcmp("--stats", argv[i])) {
+            stats = true;
+        } else if (0 == strcmp("--stats-json", argv[i])) {
+            stats = true;
+            statsJson = true;
+        } else if (0 == strcmp("--metrics", argv[i]) && hasValue) {
+            batch.metricsFile = argv[++i];
+        } else if (0 == strcmp("--ds-stats", argv[i])) {
+            dsStats = true;
+        } else if (0 == strcmp("--trace", argv[i]) && hasValue) {
+            traceFile = argv[++i];
+        } else if (0 == strcmp("--cache", argv[i]) && hasValue) {
+            cacheDir = argv[++i];
+        } else if (0 == strcmp("--cache-size", argv[i]) && hasValue) {
+            cacheSize = (u64) strtoul(argv[++i], NULL, 10) * 1024 * 1024;
+        } else if (0 == strcmp("--batch", argv[i]) && hasValue) {
+            batch.manifest = argv[++i];
+        } else if (0 == strcmp("--batch-dir", argv[i]) && hasValue) {
+            batch.directory = argv[++i];
+        } else if (0 == strcmp("--image", argv[i]) && hasValue) {
+            image = argv[++i];
+        } else if (0 == strcmp("--media", argv[i]) && hasValue) {
+            media = argv[++i];
+        } else if (0 == strcmp("--pipe", argv[i])) {
+            pipe = true;
+        } else if (0 == strcmp("--member", argv[i]) && hasValue) {
+            pipeOptions.member = argv[++i];
+        } else if (0 == strcmp("--inventory", argv[i])) {
+            inventory = true;
+        } else if (0 == strcmp("--extract-only", argv[i])) {
+            pipeOptions.extractOnly = true;
+        } else if (0 == strcmp("--threads", argv[i]) && hasValue) {
+            threads = (u32) strtoul(argv[++i], NULL, 10);
+        } else if (0 == strcmp("--verbose", argv[i])) {
+            batch.verbose = true;
+        } else if (0 == strcmp("--state", argv[i]) && hasValue) {
+            batch.stateFile = argv[++i];
+        } else if (argCount < 2) {
+            args[argCount++] = argv[i];
+        } else {
+            printUsage();
+            return -1;
         }
-        haystack++;
     }
 
-    return NULL;
-}
-
-/* Patch VMOUSE.VXD to fix mouse being faster in Windows than in DOS */
-bool patchVmouseVxd(const char *fname) {
-    mfContext ctx = {0};
-    u8 *data = NULL;
-    long dataSize = 0;
+    /* stdout carries the patched file in pipe mode, and nothing but JSON lines for an inventory */
 
-    char fname_bak[] = "VMOUSE.BAK";
+    fprintf(pipe || inventory ? stderr : stdout, "MouseFix - Windows 98 SE / ME Mouse Driver patcher - V0.2\n");
+    fprintf(pipe || inventory ? stderr : stdout, "(C) 2025 E. Voirin (oerg866)\n");
+    fprintf(pipe || inventory ? stderr : stdout, "VMM32 Unpacker code (c) 2022 Jaroslav Hensl\n");
+    fprintf(pipe || inventory ? stderr : stdout, "---------------------------------------------------------\n");
+    fprintf(pipe || inventory ? stderr : stdout, "\n");
 
-    /* Open and read VMOUSE VXD file */
+    if (!patchOptionsInit(&options, fullBackup))
+        return -1;
 
-    printf("Patching %s\n", fname);
-    data = openAndReadWholeFile(fname, &dataSize);
+    options.lowMemory = lowMemory;
 
-    if (data == NULL)
-        goto cleanup;
+    /* Batch targets and VMM32 chunks share the threads, this one helps out while waiting */
 
-    /* File is read, check if it is already patched */
+    sched = schedCreate((threads ? threads : cpuCount()) - 1);
 
-    if (NULL != findBytes(data, (const u8*) "Oerg866", dataSize, 7)) {
-        printf("ERROR: File %s is already patched!\n", fname);
-        goto cleanup;
-    }
+    if (sched == NULL)
+        return -1;
 
-    /* Back up the file before doing anything */
-    
-    openAndWriteWholeFile(fname_bak, data, dataSize);
+    patcherSetScheduler(sched);
 
-    /* Open file header */
+    /* Before any work is handed to the other threads, the metrics have histograms of the stages */
+    if (stats || batch.metricsFile != NULL)
+        statsEnable();
 
-    ctx.leOffset = read16(data, 0x3C);
-    if (0 != memcmp(&data[ctx.leOffset], "LE", 2)) {
-        printf("Header check failed\n");
+    if (dsStats && !statsDsEnable()) {
+        fprintf(stderr, "Error: --ds-stats needs MouseFix built with DS_STATS (wmake DS_STATS=1)\n");
+        dsStats = false;
         goto cleanup;
     }
 
-    /* Valid LE File, get object table */
-
-    ctx.objectTableOffset = ctx.leOffset + read32(data, ctx.leOffset + 0x40);
-    ctx.objectTableCount = read32(data, ctx.leOffset + 0x44);
-
-    /* Size of 1 data / code page and offset of first page */
+    if (traceFile != NULL && !traceOpen(traceFile))
+        goto cleanup;
 
-    ctx.pageSize = read32(data, ctx.leOffset + 0x28);
-    ctx.pageDataStart = read32(data, ctx.leOffset + 0x80);
+    if (stats || traceFile != NULL || batch.metricsFile != NULL)
+        pe_set_probe(statsProbe, NULL);
 
+    if (cacheDir != NULL) {
+        cache = cacheOpen(cacheDir, cacheSize);
 
-    /* Find PCOD object */
+        if (cache == NULL)
+            goto cleanup;
 
-    for (u32 i = 0; i < ctx.objectTableCount; i++) {
-        u32 tableEntryOffset = ctx.objectTableOffset + i * VXD_OBJ_TABLE_ENTRY_SIZE;
-        u8 *entry = data + tableEntryOffset;
-        if (0 == memcmp(entry + 0x14, "PCOD", 4)) {
-            printf("PCOD object found at %08x\n", tableEntryOffset);
-            ctx.pcodTableEntryOffset = tableEntryOffset;
-            break;
-        }
+        patcherSetCache(cache);
+        batch.cache = cache;
     }
 
-    /* PCOD object found, let's find it in the file */
-
-    ctx.pcodSize = read32(data, ctx.pcodTableEntryOffset + 0);
-    ctx.pcodPageCount = read32(data, ctx.pcodTableEntryOffset + 0x10);
-    ctx.pcodPaddedSize = ctx.pageSize * ctx.pcodPageCount;
-    ctx.pcodFirstPageIndex = read32(data, ctx.pcodTableEntryOffset + 0x0C);
-
-    printf("PCOD object size: %x, padded size: %x, page table index %x\n", ctx.pcodSize, ctx.pcodPaddedSize, ctx.pcodFirstPageIndex);
-
-    /* Find the page in the file, page index is 1-based */
-
-    ctx.pcodOffset = ctx.pageDataStart + ctx.pageSize * (ctx.pcodFirstPageIndex - 1);
-    ctx.pcodData = data + ctx.pcodOffset;
-    ctx.pcodPatchOffset = ctx.pcodOffset + ctx.pcodSize;
-    ctx.pcodPatchData = data + ctx.pcodPatchOffset;
-
-    printf("PCOD Absolute offset in file: %x\n", ctx.pcodOffset);
-
-    /* We need enough space, 64 bytes to be sure */
-
-    if ((ctx.pcodPaddedSize - ctx.pcodSize) < 64) {
-        printf("ERROR: Not enough padding in PCOD page to patch the file\n");
-        goto cleanup;
-    }
+    if (pipe) {
+        if (argCount != 0 || image != NULL || media != NULL || batch.manifest != NULL || batch.directory != NULL || undo || inventory) {
+            printUsage();
+            goto cleanup;
+        }
 
-    /* increase size of pcod segment so we can put our patch in */
-    
-    ctx.pcodSize += 64;
-    write32(data, ctx.pcodTableEntryOffset, ctx.pcodSize);
-
-    /* Find binary patterns */
-    
-    /*  End of initMouseSens function, the only part of it that is unique and overlaps between 98SE and ME
-        PCOD:C000238F                 mov     si, ax
-        PCOD:C0002392                 mov     [edx+1Ch], esi
-        PCOD:C0002395                 clc
-        PCOD:C0002396                 retn
-    */
-    const u8 initMouseSensPattern[] = { 0x66, 0x8b, 0xf0, 0x89, 0x72, 0x1c, 0xf8, 0xc3 };
-
-    /*  Middle of ChangeMouseSens function, right inbetween the two calls to modify
-        PCOD:C000147C                 mov     esi, eax
-        PCOD:C000147E                 movzx   eax, word ptr [ebp+18h]
-        PCOD:C0001482                 cmp     eax, edi
-        PCOD:C0001484                 jb      short loc_C0001488
-        PCOD:C0001486                 mov     eax, edi
-        PCOD:C0001488
-        PCOD:C0001488 loc_C0001488:                           ; CODE XREF: PCOD:C0001484↑j
-        PCOD:C0001488                 mov     [edx+6Fh], al
-    */
-    const u8 changeMouseSensPattern[] = { 0x8B, 0xF0, 0x0F, 0xB7, 0x45, 0x18, 0x3B };
-
-    u8 *initMouseSensCode = findBytes(ctx.pcodData, initMouseSensPattern, ctx.pcodSize, sizeof(initMouseSensPattern));
-    u8 *changeMouseSensCode = findBytes(ctx.pcodData, changeMouseSensPattern, ctx.pcodSize, sizeof(changeMouseSensPattern));
-
-    if (initMouseSensCode == NULL || changeMouseSensCode == NULL) {
-        printf("Function not found in file.\n");
+        result = pipeRun(&pipeOptions) ? 0 : -1;
         goto cleanup;
     }
 
-    /* Patch the 4 calls */
-
-    u32 callsToPatch[4];
-
-    callsToPatch[0] = initMouseSensCode - data - 0x19; /* Init Mouse Sens: call for X axis */
-    callsToPatch[1] = initMouseSensCode - data - 0x05; /* Init Mouse Sens: call for Y axis */
-    callsToPatch[2] = changeMouseSensCode - data - 0x05; /* Change Mouse Sens: Call for X axis */
-    callsToPatch[3] = changeMouseSensCode - data + 0x0f; /* Change Mouse Sens: Call for Y axis */
-
-    u32 originalCallDest = getAbsoluteTargetFromCallInstruction32(data, callsToPatch[0]);
-
-    printf("Original CalculateMouseSpeed Function Location: %x\n", originalCallDest);
-
-    for (int i = 0; i < 4; i++) {
-        patchCall32(data, callsToPatch[i], ctx.pcodPatchOffset);
-    }
+    if (batch.manifest != NULL || batch.directory != NULL) {
+        /* The state is about patched targets, restoring or looking at them must not end up in it */
+        if (argCount != 0 || image != NULL || media != NULL || (batch.stateFile != NULL && (undo || inventory)) || (batch.metricsFile != NULL && inventory)) {
+            printUsage();
+            goto cleanup;
+        }
 
-    u8 patchCode[] = {
-        0x53,                           /* push ebx */
-        0x83, 0x7b, 0x0c, 0x01,         /* cmp dword ptr [ebx+0Ch], 1 */
-        0x74, 0x02,                     /* jz short NoSysVM */
-        0xd1, 0xe0,                     /* shl eax, 1 */
-        /* NoSysVM: */
-        0xe8, 0x00, 0x00, 0x00, 0x00,   /* call CalculateSensitivity ; We need to patch this Offset */
-        0x5b,                           /* pop ebx */
-        0xc3,                           /* ret */
-        /* Signature to detect if file is already patched */
-        0x4F, 0x65, 0x72, 0x67, 0x38, 0x36, 0x36 /* ASCII 'Oerg866' */
-    };
-
-    /* Copy the patch code into the patch offset in the pcod object */
-    memcpy(ctx.pcodPatchData, patchCode, sizeof(patchCode));
-
-    /* Our patch code has a call to the original function, so we need to patch in that address */
-    patchCall32(data, ctx.pcodPatchOffset + 0x09, originalCallDest);
-
-    if (!openAndWriteWholeFile(fname, data, dataSize)) {
-        printf("Error writing the patched data to the file!\n");
+        batch.undo = undo;
+        batch.inventory = inventory;
+        result = batchRun(&batch, &options, sched) ? 0 : -1;
         goto cleanup;
     }
 
-    return true;
+    /* Metrics are about batches */
 
-cleanup:
-    free(data);
-    return false;
-}
-
-
-static void msmouseOverwriteAccelProfiles(u8 *mouseCurveDataTable, const u8 *newCurve) {
-    for (int i = 0; i < 4; i++) {
-        u8 *curveToPatch = mouseCurveDataTable + MSMOUSE_CURVE_LENGTH * i;
-        memcpy(curveToPatch, newCurve, MSMOUSE_CURVE_LENGTH);
-    }
-}
-
-static u8 *msmouseFindAndPatchAccelCurveTable(u8 *data, long dataSize, const u8 *curveToFind, const u8* unacceleratedCurve) {
-    u8 *curveTable = findBytes(data, curveToFind, dataSize, MSMOUSE_CURVE_LENGTH);
-
-    if (curveTable == NULL) {
-        printf("Mouse acceleration curves not found!\n");
-        return NULL;
-    }
-
-    curveTable -= 3 * MSMOUSE_CURVE_LENGTH;
-
-    printf("Patching mouse acceleration curve table at %x\n", curveTable - data);
-
-    msmouseOverwriteAccelProfiles(curveTable, unacceleratedCurve);
-
-    return curveTable;
-}
-
-static bool patchMsmouseVxd(const char *fname) {
-    const char patchMarker[] = "MSMINI Unaccelerated by Oerg866";
-    const char fname_bak[] = "MSMOUSE.BAK";
-    u8 *data = NULL;
-    long dataSize = 0;
-
-
-    assert(fname != NULL);
-
-    printf("Patching %s\n", fname);
-
-    data = openAndReadWholeFile(fname, &dataSize);
-
-    if (data == NULL)
-        goto cleanup;
-
-    /* Find version information */
-
-    char *fileDescription = (char *) findBytes(data, (const u8 *)"FileDescription", dataSize, strlen("FileDescription") + 1);
-
-    if (fileDescription == NULL)
-        goto cleanup;
-
-    /* Check for patch marker */
-
-    fileDescription += strlen("FileDescription") + 1;
-
-    printf("Driver: %s\n", fileDescription);
-
-    if (0 == strcmp(fileDescription, patchMarker)) {
-        printf("Error: File %s is already patched!\n", fname);
+    if (batch.metricsFile != NULL) {
+        printUsage();
         goto cleanup;
     }
 
-    /* Back up the file before doing anything */
-    
-    openAndWriteWholeFile(fname_bak, data, dataSize);
-
-    /* Find mouse acceleration curves to patch*/
+    /* Read-only, so there is nothing to prepare, undo or patch */
 
-    u8 mouseCurveTable1Entry4[] = { 0x01, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F };
-    u8 mouseCurveTable2Entry4[] = { 0x10, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F };
-
-    u8 mouseCurveTable1Unaccel[] = { 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01 };
-    u8 mouseCurveTable2Unaccel[] = { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 };
-
-    
-
-    /* The first curve table exists twice */
-
-    u8 *mouseCurveData = data;
-
-    long leftAfterSearch = dataSize;
-
-    for (int i = 0; i < 2; i++) {
-        mouseCurveData = msmouseFindAndPatchAccelCurveTable(mouseCurveData, leftAfterSearch, mouseCurveTable1Entry4, mouseCurveTable1Unaccel) + MSMOUSE_CURVE_LENGTH;
-        leftAfterSearch = dataSize - (mouseCurveData - data);
-
-        if (leftAfterSearch < 0 || mouseCurveData == NULL)
+    if (inventory) {
+        if (undo || media != NULL || argCount > (image != NULL ? 1 : 2) || (image == NULL && argCount == 0)) {
+            printUsage();
             goto cleanup;
+        }
 
-        mouseCurveData += MSMOUSE_CURVE_LENGTH * 4;
-    }
-
-    /* Second curve only once */
+        if (image != NULL)
+            result = inventoryRoot(image, NULL, argCount == 1 ? args[0] : "WINDOWS", &options) ? 0 : -1;
+        else
+            result = inventoryRoot(args[0], argCount == 2 ? args[1] : NULL, NULL, &options) ? 0 : -1;
 
-    if (msmouseFindAndPatchAccelCurveTable(data, dataSize, mouseCurveTable2Entry4, mouseCurveTable2Unaccel) == NULL)
         goto cleanup;
+    }
 
-    /* Add marker so we know the file is patched */
-    sprintf(fileDescription, "%s", patchMarker);
+    /* Install media: the drivers are patched in memory, nothing to undo */
 
-    /* Write out patched file */
+    if (media != NULL) {
+        if (argCount != 1 || image != NULL || undo) {
+            printUsage();
+            goto cleanup;
+        }
 
-    if (!openAndWriteWholeFile(fname, data, dataSize))
+        result = mediaPatch(media, args[0], &options) ? 0 : -1;
         goto cleanup;
+    }
 
-    free(data);
-    return true;
-
-
-cleanup:
-    free(data);
-    return false;
-}
-
-int main(int argc, char *argv[]) {
-    char vmouseVxd[PATH_MAX] = { 0, };
-    char msmouseVxd[PATH_MAX] = { 0, };
-    char vmm32Vxd[PATH_MAX] = { 0, };
-    char vmm32Subdir[PATH_MAX] = {0, };
-    char windowsDir[PATH_MAX] =  { 0, };
-
-    const char vmouseVxdSub[] = "\\SYSTEM\\VMM32\\VMOUSE.VXD";
-    const char vmm32VxdSub[] = "\\SYSTEM\\VMM32.VXD";
-    const char vmm32SubdirSub[] = "\\SYSTEM\\VMM32";
-    const char msmouseVxdSub[] = "\\SYSTEM\\MSMOUSE.VXD";
-
-    bool customFilenames = false;
+    if (image != NULL) {
+        if (argCount > 1) {
+            printUsage();
+            goto cleanup;
+        }
 
-    printf("MouseFix - Windows 98 SE / ME Mouse Driver patcher - V0.2\n");
-    printf("(C) 2025 E. Voirin (oerg866)\n");
-    printf("VMM32 Unpacker code (c) 2022 Jaroslav Hensl\n");
-    printf("---------------------------------------------------------\n");
-    printf("\n");
+        if (!targetFromImage(&target, image, argCount == 1 ? args[0] : "WINDOWS", true))
+            goto cleanup;
 
-    if (argc == 2) {
-        strncpy(windowsDir, argv[1], PATH_MAX);
+        printf("Using Windows directory: %s in %s\n", target.windowsDir, image);
+    } else if (argCount == 2) {
+        /* Custom filenames for both */
+        targetFromFiles(&target, args[0], args[1]);
     } else {
-        if (getenv("WINDIR") != NULL) {
-            strncpy(windowsDir, getenv("WINDIR"), PATH_MAX);
+        /* Craft the full path for both files from the Windows directory */
+
+        if (argCount == 1) {
+            strncpy(windowsDir, args[0], PATH_MAX - 1);
+        } else {
+            if (getenv("WINDIR") != NULL) {
+                strncpy(windowsDir, getenv("WINDIR"), PATH_MAX - 1);
+            }
         }
-    }
 
-    /* Check if we supplied custom filenames for both, if not craft the full path for both files */
-
-    if (argc == 3) {
-        strncpy(vmouseVxd, argv[1], PATH_MAX);
-        strncpy(msmouseVxd, argv[2], PATH_MAX);
-        customFilenames = true;
-    } else {
         printf("Using Windows directory: %s\n", windowsDir);
-
-        snprintf(vmouseVxd, PATH_MAX, "%s%s", windowsDir, vmouseVxdSub);
-        snprintf(msmouseVxd, PATH_MAX, "%s%s", windowsDir, msmouseVxdSub);
-        snprintf(vmm32Vxd, PATH_MAX, "%s%s", windowsDir, vmm32VxdSub);
-        snprintf(vmm32Subdir, PATH_MAX, "%s%s", windowsDir, vmm32SubdirSub);
+        targetFromWindowsDir(&target, windowsDir);
     }
 
-    if (!fs_file_exists(msmouseVxd)) {
-        printf("Error: MSMOUSE not found in expected path (%s)\n", msmouseVxd);
-        return -1;
+    /* Undo replays the journals, nothing needs to be extracted for that */
+
+    if (undo) {
+        result = undoTarget(&target) ? 0 : -1;
+        goto cleanup;
     }
 
-    /* if we are operating on a windows directory, we need to treat vmouse special*/
+    if (!targetPrepare(&target))
+        goto cleanup;
 
-    if (!fs_file_exists(vmouseVxd) && !customFilenames && fs_file_exists(vmm32Vxd)) {
-        
-        /* VMOUSE does not exist but VMM32 does, so we can extract it */
-        
-        printf("VMOUSE not found, attempting to extract from VMM32.VXD\n");
+    /* Do the actual patching */
 
-        fs_mkdir(vmm32Subdir);        
-        wx_unpack(vmm32Vxd, "VMOUSE.VXD", vmouseVxd, "tmp.tmp");
-    }
+    patchTarget(&target, &options);
+    result = 0;
 
-    if (!fs_file_exists(vmouseVxd)) {
-        printf("Error: VMOUSE not found in expected path (%s)\n", msmouseVxd);
-        return -1;
-    }
+cleanup:
+    pe_set_probe(NULL, NULL);
 
-    /* Rudimentary usage :-) */
+    if (stats)
+        statsPrint(pipe || inventory ? stderr : stdout, statsJson);
 
-    if (argc == 2 && 0 == strcmp("/?", argv[1])) {
-        printf("mousefix <windows_dir>\n");
-        printf("mousefix <vmouse.vxd> <msmouse.vxd>\n");
-        printf("\n");
-        return -1;
+    if (dsStats) {
+        ds_set_stats_sink(NULL, NULL);
+        statsDsPrint(pipe || inventory ? stderr : stdout, statsJson);
     }
 
-    /* Do the actual patching */
-
-    if (!patchVmouseVxd(vmouseVxd)) {
-        printf("VMOUSE.VXD patching failed!\n");
-    }
-    
-    printf("\n");
-    
-    if (!patchMsmouseVxd(msmouseVxd)) {
-        printf("MSMOUSE.VXD patching failed!\n");
-    }
+    if (!traceClose())
+        result = -1;
 
-    return 0;
+    targetClose(&target);
+    patcherSetScheduler(NULL);
+    patcherSetCache(NULL);
+    cacheClose(cache);
+    schedDestroy(sched);
+    return result;
 }
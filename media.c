@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "decompress/filesystem.h"
+#include "decompress/cab.h"
+#include "media.h"
+#include "iso.h"
+#include "trace.h"
+#include "log.h"
+
+#define MEDIA_CAB_EXTENSION     "CAB"
+#define MEDIA_ISO_EXTENSION     "ISO"
+#define MEDIA_DRIVER_COUNT      2
+
+/* Directories on an install CD that hold the cabinets, tried in this order */
+static const char *mediaCabinetDirs[] = { "WIN98", "WIN9X", "WIN95", "" };
+
+typedef struct {
+    const char *name;
+    const mfPatchPlan *plan;
+    u8 *data;                       /* Extracted driver, NULL until found */
+    long size;
+    char *source;                   /* Cabinet or file it was found in */
+} mfMediaDriver;
+
+typedef struct {
+    char *path;                     /* Host path, or path inside the ISO image */
+    mfIsoEntry entry;               /* Files inside an ISO image */
+    bool cabinet;                   /* Else a loose driver file */
+} mfMediaItem;
+
+typedef struct {
+    mfIso *iso;                     /* NULL for a host directory or cabinet */
+    const char *isoDir;             /* Cabinet directory in the ISO image */
+    mfMediaDriver *drivers;
+    mfMediaItem *items;
+    long count;
+    long capacity;
+    bool success;
+} mfMediaSource;
+
+static bool isDriverName(const mfMediaDriver *drivers, size_t count, const char *name) {
+    for (size_t i = 0; i < count; i++) {
+        const char *a = drivers[i].name;
+        const char *b = name;
+
+        while (*a != 0x00 && toupper((u8) *a) == toupper((u8) *b)) {
+            a++;
+            b++;
+        }
+
+        if (*a == 0x00 && *b == 0x00)
+            return true;
+    }
+
+    return false;
+}
+
+/* Adds a cabinet or loose driver, anything else is skipped unless it is given explicitly */
+static bool mediaAddItem(mfMediaSource *source, const char *dir, const char *name, const mfIsoEntry *entry, bool given) {
+    mfMediaItem *item;
+    bool cabinet = fs_ext_match(name, MEDIA_CAB_EXTENSION) != 0;
+
+    if (!cabinet && !isDriverName(source->drivers, MEDIA_DRIVER_COUNT, name)) {
+        if (!given)
+            return true;
+
+        cabinet = true;
+    }
+
+    if (source->count == source->capacity) {
+        long capacity = source->capacity ? source->capacity * 2 : 16;
+        mfMediaItem *items = realloc(source->items, capacity * sizeof(mfMediaItem));
+
+        if (items == NULL)
+            return false;
+
+        source->items = items;
+        source->capacity = capacity;
+    }
+
+    item = &source->items[source->count];
+    memset(item, 0, sizeof(mfMediaItem));
+    item->path = dir != NULL ? fs_path_get(dir, name, NULL) : fs_path_dup(name);
+    item->cabinet = cabinet;
+
+    if (entry != NULL)
+        item->entry = *entry;
+
+    if (item->path == NULL)
+        return false;
+
+    source->count++;
+    return true;
+}
+
+static bool isoVisit(void *ctx, const mfIsoEntry *entry) {
+    mfMediaSource *source = (mfMediaSource *) ctx;
+
+    if (entry->directory)
+        return true;
+
+    source->success = mediaAddItem(source, *source->isoDir ? source->isoDir : NULL, entry->name, entry, false);
+    return source->success;
+}
+
+/* Loose drivers first, they are used as they are. Then cabinets in name order */
+static int compareItems(const void *a, const void *b) {
+    const mfMediaItem *itemA = (const mfMediaItem *) a;
+    const mfMediaItem *itemB = (const mfMediaItem *) b;
+
+    if (itemA->cabinet != itemB->cabinet)
+        return itemA->cabinet ? 1 : -1;
+
+    return strcmp(itemA->path, itemB->path);
+}
+
+/* Collects the cabinets and loose drivers of the cabinet directory on a CD image */
+static bool mediaListIso(mfMediaSource *source, const char *path) {
+    mfIsoEntry dir;
+
+    source->iso = isoOpen(path);
+
+    if (source->iso == NULL)
+        return false;
+
+    for (size_t i = 0; i < sizeof(mediaCabinetDirs) / sizeof(mediaCabinetDirs[0]); i++) {
+        if (!isoLookup(source->iso, mediaCabinetDirs[i], &dir) || !dir.directory)
+            continue;
+
+        source->isoDir = mediaCabinetDirs[i];
+        source->success = true;
+
+        if (!isoList(source->iso, &dir, isoVisit, source) || !source->success)
+            return false;
+
+        if (source->count > 0) {
+            logPrintf("Using %s in %s\n", *mediaCabinetDirs[i] ? mediaCabinetDirs[i] : "root directory", path);
+            return true;
+        }
+    }
+
+    return true;
+}
+
+/* Collects the cabinets and loose drivers of a host directory, or takes source as a single cabinet */
+static bool mediaListHost(mfMediaSource *source, const char *path) {
+    fs_dir_t *dir;
+    const char *name;
+    bool success = true;
+
+    if (!fs_is_dir(path)) {
+        return mediaAddItem(source, NULL, path, NULL, true);
+    }
+
+    dir = fs_dir_open(path);
+
+    if (dir == NULL) {
+        logPrintf("Error: Cannot open directory %s\n", path);
+        return false;
+    }
+
+    while (success && (name = fs_dir_read(dir, FS_FILTER_FILE)) != NULL) {
+        success = mediaAddItem(source, path, name, NULL, false);
+    }
+
+    fs_dir_close(&dir);
+    return success;
+}
+
+/* Extracts the drivers that have not been found yet from one cabinet */
+static bool mediaExtract(const char *path, const u8 *data, u32 size, mfMediaDriver *drivers) {
+    int files[MEDIA_DRIVER_COUNT];
+    u8 *outputs[MEDIA_DRIVER_COUNT];
+    mfMediaDriver *wanted[MEDIA_DRIVER_COUNT];
+    size_t count = 0;
+    int status;
+    double start = traceBegin();
+    cab_t *cab = cab_open_mem(data, size, &status);
+
+    if (cab == NULL) {
+        logPrintf("Warning: Skipping %s, not a readable cabinet (error %d)\n", path, status);
+        return true;
+    }
+
+    for (size_t i = 0; i < MEDIA_DRIVER_COUNT; i++) {
+        int file;
+
+        if (drivers[i].data != NULL || (file = cab_find(cab, drivers[i].name)) < 0)
+            continue;
+
+        files[count] = file;
+        wanted[count] = &drivers[i];
+        count++;
+    }
+
+    /* Both drivers are usually in the same cabinet, one pass over each folder extracts them */
+
+    status = count ? cab_extract_many(cab, files, count, outputs) : CAB_OK;
+
+    if (status != CAB_OK) {
+        logPrintf("Error: Cannot extract from %s (error %d)\n", path, status);
+        cab_close(cab);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        wanted[i]->data = outputs[i];
+        wanted[i]->size = (long) cab->files[files[i]].size;
+        wanted[i]->source = fs_path_dup(path);
+        logPrintf("Found %s in %s\n", wanted[i]->name, path);
+    }
+
+    cab_close(cab);
+    traceSpan("cab_extract", path, start, size, 0);
+    return true;
+}
+
+/* Takes a loose driver file as it is */
+static bool mediaTakeLoose(const char *path, const u8 *data, u32 size, mfMediaDriver *drivers) {
+    char *name = fs_basename(path);
+
+    for (size_t i = 0; i < MEDIA_DRIVER_COUNT && name != NULL; i++) {
+        if (drivers[i].data != NULL || !isDriverName(&drivers[i], 1, name))
+            continue;
+
+        drivers[i].data = malloc(size ? size : 1);
+
+        if (drivers[i].data == NULL)
+            break;
+
+        memcpy(drivers[i].data, data, size);
+        drivers[i].size = (long) size;
+        drivers[i].source = fs_path_dup(path);
+        logPrintf("Found %s\n", path);
+    }
+
+    fs_path_free(name);
+    return true;
+}
+
+/*  Hands the bytes of one item to the cabinet reader. Cabinets on the host and
+    in the ISO image are memory mapped, only the headers and the folders holding
+    the drivers are read from disk. */
+static bool mediaProcessItem(mfMediaSource *source, const mfMediaItem *item) {
+    mfBlockDevice *dev = NULL;
+    const u8 *data;
+    u8 *copy = NULL;
+    u32 size;
+    bool success;
+
+    if (source->iso != NULL) {
+        data = isoData(source->iso, &item->entry, &copy);
+        size = item->entry.size;
+    } else {
+        dev = blockOpenRaw(item->path, false);
+
+        if (dev == NULL)
+            return false;
+
+        size = dev->size <= 0xFFFFFFFF ? (u32) dev->size : 0;
+        data = blockView(dev, 0, size, &copy);
+    }
+
+    if (data == NULL) {
+        logPrintf("Error: Cannot read %s\n", item->path);
+        success = false;
+    } else if (item->cabinet) {
+        success = mediaExtract(item->path, data, size, source->drivers);
+    } else {
+        success = mediaTakeLoose(item->path, data, size, source->drivers);
+    }
+
+    free(copy);
+    blockClose(dev);
+    return success;
+}
+
+static bool mediaPatchDriver(mfMediaDriver *driver, const char *outDir) {
+    char *outPath;
+    mfPatchResult result;
+    bool success = false;
+
+    if (driver->data == NULL) {
+        logPrintf("Error: %s was not found in any cabinet\n", driver->name);
+        return false;
+    }
+
+    result = patchPlanApply(driver->plan, &driver->data, &driver->size);
+
+    if (result == MF_PATCH_ALREADY_PATCHED) {
+        logPrintf("ERROR: %s in %s is already patched!\n", driver->name, driver->source);
+        return false;
+    }
+
+    if (result != MF_PATCH_OK) {
+        logPrintf("ERROR: Cannot patch %s: %s\n", driver->name, patchResultString(result));
+        return false;
+    }
+
+    outPath = fs_path_get(outDir, driver->name, NULL);
+
+    if (outPath != NULL && hostFileOps.write(&hostFileOps, outPath, driver->data, driver->size)) {
+        logPrintf("Patched %s written to %s\n", driver->name, outPath);
+        success = true;
+    } else {
+        logPrintf("Error: Cannot write %s\n", outPath ? outPath : driver->name);
+    }
+
+    fs_path_free(outPath);
+    return success;
+}
+
+bool mediaPatch(const char *path, const char *outDir, const mfPatchOptions *options) {
+    mfMediaDriver drivers[MEDIA_DRIVER_COUNT] = {
+        { "VMOUSE.VXD", NULL, NULL, 0, NULL },
+        { "MSMOUSE.VXD", NULL, NULL, 0, NULL },
+    };
+    mfMediaSource source;
+    bool success;
+
+    assert(path != NULL);
+    assert(outDir != NULL);
+    assert(options != NULL);
+
+    drivers[0].plan = &options->vmousePlan;
+    drivers[1].plan = &options->msmousePlan;
+
+    memset(&source, 0, sizeof(source));
+    source.drivers = drivers;
+
+    if (!fs_is_dir(path) && fs_ext_match(path, MEDIA_ISO_EXTENSION))
+        success = mediaListIso(&source, path);
+    else
+        success = mediaListHost(&source, path);
+
+    if (success && source.count == 0)
+        logPrintf("Error: No cabinets in %s\n", path);
+
+    if (source.count > 0)
+        qsort(source.items, source.count, sizeof(mfMediaItem), compareItems);
+
+    for (long i = 0; i < source.count && success; i++) {
+        if (drivers[0].data != NULL && drivers[1].data != NULL)
+            break;
+
+        success = mediaProcessItem(&source, &source.items[i]);
+    }
+
+    if (success && !hostFileOps.makeDirectory(&hostFileOps, outDir)) {
+        logPrintf("Error: Cannot create directory %s\n", outDir);
+        success = false;
+    }
+
+    for (size_t i = 0; i < MEDIA_DRIVER_COUNT; i++) {
+        if (success)
+            success = mediaPatchDriver(&drivers[i], outDir);
+
+        free(drivers[i].data);
+        fs_path_free(drivers[i].source);
+    }
+
+    for (long i = 0; i < source.count; i++)
+        fs_path_free(source.items[i].path);
+
+    free(source.items);
+    isoClose(source.iso);
+    return success;
+}
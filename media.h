@@ -0,0 +1,22 @@
+#ifndef _MF_MEDIA_H_
+#define _MF_MEDIA_H_
+
+#include "util.h"
+#include "patcher.h"
+
+/*  Patching the drivers on Windows 98 / ME install media.
+
+    VMOUSE.VXD and MSMOUSE.VXD are taken straight out of the install cabinets
+    (WIN98_*.CAB, WIN_*.CAB), patched in memory and written to an output
+    directory, without expanding the cabinets first. Loose copies of the
+    drivers next to the cabinets take precedence.
+
+    In a CD image (*.ISO), the cabinets are looked for in WIN98, WIN9X, WIN95
+    or the root directory. The image and the cabinets are memory mapped, so
+    only the directories, cabinet headers and folders holding the drivers are
+    actually read. */
+
+/* path is a cabinet, a directory with cabinets or an ISO image. Returns false if either driver could not be patched */
+bool mediaPatch(const char *path, const char *outDir, const mfPatchOptions *options);
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "metrics.h"
+
+#define METRICS_PREFIX              "mousefix_batch_"
+
+/* The collector only reads *.prom files, so it never picks up the temporary one */
+#define METRICS_TEMP_EXTENSION      ".tmp"
+
+static bool writeHeader(FILE *f, const char *name, const char *type, const char *help) {
+    return fprintf(f, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n", name, help, name, type) > 0;
+}
+
+/* One histogram series from bucket counts that are not cumulative yet, label may be NULL */
+static bool writeHistogram(FILE *f, const char *name, const char *label, const u64 *buckets, double sum) {
+    u64 count = 0;
+    bool success = true;
+
+    for (u32 i = 0; success && i < MF_STAT_BUCKETS; i++) {
+        count += buckets[i];
+
+        if (i < MF_STAT_BUCKETS - 1)
+            success = fprintf(f, METRICS_PREFIX "%s_bucket{%s%sle=\"%g\"} %llu\n", name, label ? label : "", label ? "," : "",
+                statsBucketBound(i), (unsigned long long) count) > 0;
+        else
+            success = fprintf(f, METRICS_PREFIX "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, label ? label : "", label ? "," : "",
+                (unsigned long long) count) > 0;
+    }
+
+    if (label != NULL)
+        return success
+            && fprintf(f, METRICS_PREFIX "%s_sum{%s} %.6f\n", name, label, sum) > 0
+            && fprintf(f, METRICS_PREFIX "%s_count{%s} %llu\n", name, label, (unsigned long long) count) > 0;
+
+    return success
+        && fprintf(f, METRICS_PREFIX "%s_sum %.6f\n", name, sum) > 0
+        && fprintf(f, METRICS_PREFIX "%s_count %llu\n", name, (unsigned long long) count) > 0;
+}
+
+static bool writeMetrics(FILE *f, const mfMetricsBatch *batch) {
+    mfStatValue values[MF_STAT_COUNT];
+    u64 decompressed;
+    bool success;
+
+    statsGet(values);
+    decompressed = values[MF_STAT_W4_CHUNK_DS].bytesOut + values[MF_STAT_W4_CHUNK_RAW].bytesOut;
+
+    success = writeHeader(f, "targets_total", "counter", "Targets of the batch by outcome.")
+           && fprintf(f, METRICS_PREFIX "targets_total{outcome=\"%s\"} %u\n", batch->undo ? "restored" : "patched", batch->patched) > 0
+           && fprintf(f, METRICS_PREFIX "targets_total{outcome=\"already_patched\"} %u\n", batch->alreadyPatched) > 0
+           && fprintf(f, METRICS_PREFIX "targets_total{outcome=\"failed\"} %u\n", batch->failed) > 0
+           && fprintf(f, METRICS_PREFIX "targets_total{outcome=\"skipped\"} %u\n", batch->skipped) > 0
+           && writeHeader(f, "processed_total", "counter", "Targets that were run, all but the skipped ones.")
+           && fprintf(f, METRICS_PREFIX "processed_total %u\n", batch->patched + batch->alreadyPatched + batch->failed) > 0
+           && writeHeader(f, "read_bytes_total", "counter", "Bytes of driver files read for patching.")
+           && fprintf(f, METRICS_PREFIX "read_bytes_total %llu\n", (unsigned long long) batch->bytesPatched) > 0
+           && writeHeader(f, "decompressed_bytes_total", "counter", "Bytes decompressed from VMM32.VXD chunks.")
+           && fprintf(f, METRICS_PREFIX "decompressed_bytes_total %llu\n", (unsigned long long) decompressed) > 0
+           && writeHeader(f, "written_bytes_total", "counter", "Bytes written to drivers, journals, backups and images.")
+           && fprintf(f, METRICS_PREFIX "written_bytes_total %llu\n", (unsigned long long) values[MF_STAT_FILE_WRITE].bytesIn) > 0;
+
+    if (success && batch->cache != NULL) {
+        u32 hits;
+        u32 misses;
+
+        cacheCounts(batch->cache, &hits, &misses);
+
+        success = writeHeader(f, "cache_hits_total", "counter", "Drivers taken from the extraction cache.")
+               && fprintf(f, METRICS_PREFIX "cache_hits_total %u\n", hits) > 0
+               && writeHeader(f, "cache_misses_total", "counter", "Drivers that had to be extracted.")
+               && fprintf(f, METRICS_PREFIX "cache_misses_total %u\n", misses) > 0;
+    }
+
+    success = success
+           && writeHeader(f, "target_duration_seconds", "histogram", "Time taken by each target that was run.")
+           && writeHistogram(f, "target_duration_seconds", NULL, batch->latencyBuckets, batch->latencySum)
+           && writeHeader(f, "stage_duration_seconds", "histogram", "Time taken by each run of a stage of unpacking and patching.");
+
+    for (u32 i = 0; success && i < MF_STAT_COUNT; i++) {
+        char label[64];
+
+        snprintf(label, sizeof(label), "stage=\"%s\"", statsName((mfStat) i));
+        success = writeHistogram(f, "stage_duration_seconds", label, values[i].buckets, values[i].seconds);
+    }
+
+    return success
+        && writeHeader(f, "duration_seconds", "gauge", "Time taken by the whole batch.")
+        && fprintf(f, METRICS_PREFIX "duration_seconds %.6f\n", batch->seconds) > 0
+        && writeHeader(f, "last_run_timestamp_seconds", "gauge", "When the batch finished.")
+        && fprintf(f, METRICS_PREFIX "last_run_timestamp_seconds %lu\n", (unsigned long) time(NULL)) > 0;
+}
+
+bool metricsWrite(const char *path, const mfMetricsBatch *batch) {
+    char *tempPath;
+    FILE *f;
+    bool success;
+
+    assert(path != NULL);
+    assert(batch != NULL);
+
+    tempPath = malloc(strlen(path) + sizeof(METRICS_TEMP_EXTENSION));
+
+    if (tempPath == NULL)
+        return false;
+
+    strcpy(tempPath, path);
+    strcat(tempPath, METRICS_TEMP_EXTENSION);
+
+    f = fopen(tempPath, "w");
+    success = f != NULL && writeMetrics(f, batch);
+
+    if (f != NULL && fclose(f) != 0)
+        success = false;
+
+    /* Where rename does not replace files (Windows), the old one has to go first */
+
+    if (success && rename(tempPath, path) != 0) {
+        remove(path);
+        success = rename(tempPath, path) == 0;
+    }
+
+    if (!success) {
+        printf("Error: Cannot write metrics %s\n", path);
+        remove(tempPath);
+    }
+
+    free(tempPath);
+    return success;
+}
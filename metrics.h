@@ -0,0 +1,31 @@
+#ifndef _MF_METRICS_H_
+#define _MF_METRICS_H_
+
+#include "util.h"
+#include "stats.h"
+#include "cache.h"
+
+/*  Metrics of a batch run for the Prometheus textfile collector.
+
+    The file describes the last batch: how its targets turned out, the bytes
+    decompressed and written, cache hits, and histograms of how long targets
+    and the stages of stats.h took (the stages are only counted once
+    statsEnable has been called). It is written to a temporary file first
+    and renamed over the old one, so the collector never sees half of it. */
+
+typedef struct {
+    bool undo;                      /* Targets were restored, not patched */
+    u32 patched;                    /* Targets that were patched (or restored) */
+    u32 alreadyPatched;             /* Targets whose drivers were all patched already */
+    u32 failed;                     /* Targets that failed for any other reason */
+    u32 skipped;                    /* Targets unchanged since the last run */
+    u64 bytesPatched;               /* Bytes of the driver files read for patching */
+    double seconds;                 /* Duration of the whole batch */
+    u64 latencyBuckets[MF_STAT_BUCKETS];    /* Durations of the targets that ran, see statsBucket */
+    double latencySum;
+    const mfCache *cache;           /* Cache the targets used, NULL if there was none */
+} mfMetricsBatch;
+
+bool metricsWrite(const char *path, const mfMetricsBatch *batch);
+
+#endif
@@ -0,0 +1,947 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "patch.h"
+#include "le.h"
+#include "version.h"
+#include "stats.h"
+#include "log.h"
+
+#define MF_MAX_OPS                  (32)
+
+#define MF_MAX_REGIONS              (16)
+
+#define MF_MAX_VERSION_RESOURCE     (64 * 1024)
+
+typedef struct {
+    u32 start;
+    u32 end;
+} mfRegion;
+
+typedef struct {
+    u32 count;
+    mfRegion regions[MF_MAX_REGIONS];
+} mfRegionSet;
+
+typedef struct {
+    u32 count;
+    u32 offsets[MF_MAX_MATCHES];
+} mfMatches;
+
+typedef struct {
+    u8 *data;                   /* Whole file, NULL when patching a paged file */
+    long dataSize;
+    mfPagedFile *paged;
+    leFile le;
+    bool isLe;
+    mfMatches matches[MF_MAX_SIGNATURES];
+    bool haveCave;
+    u32 caveOffset;
+    bool haveVersion;
+    u8 *versionData;            /* The version resource, read if the plan refers to its strings */
+    mfVersionInfo version;
+    u32 growObject;             /* Set with MF_PATCH_NO_SPACE if growing this object by growPages would help */
+    u32 growPages;
+} mfApplyContext;
+
+static bool pagedRead(mfPagedFile *file, u32 offset, void *buf, u32 size) {
+    if (offset > file->size || size > file->size - offset || !file->read(file->ctx, offset, buf, size))
+        return false;
+
+    file->bytesRead += size;
+    return true;
+}
+
+static mfPatchPage *findPage(mfPagedFile *file, u32 start) {
+    for (u32 i = 0; i < file->pageCount; i++) {
+        if (file->pages[i].offset == start)
+            return &file->pages[i];
+    }
+
+    return NULL;
+}
+
+/* Adds the page at start to the cache, taking its contents from data or reading them if data is NULL */
+static mfPatchPage *addPage(mfPagedFile *file, u32 start, const u8 *data) {
+    mfPatchPage *pages = realloc(file->pages, (file->pageCount + 1) * sizeof(mfPatchPage));
+    mfPatchPage *page;
+
+    if (pages == NULL)
+        return NULL;
+
+    file->pages = pages;
+    page = &pages[file->pageCount];
+    memset(page, 0, sizeof(mfPatchPage));
+    page->offset = start;
+    page->length = file->size - start < MF_PAGE_SIZE ? file->size - start : MF_PAGE_SIZE;
+    page->data = malloc(MF_PAGE_SIZE);
+
+    if (page->data != NULL && data != NULL)
+        memcpy(page->data, data, page->length);
+    else if (page->data == NULL || !pagedRead(file, start, page->data, page->length)) {
+        free(page->data);
+        return NULL;
+    }
+
+    file->pageCount++;
+    return page;
+}
+
+/* Gets the page of a paged file that contains offset, reading it in the first time */
+static mfPatchPage *pageAt(mfPagedFile *file, u32 offset) {
+    u32 start = offset - offset % MF_PAGE_SIZE;
+    mfPatchPage *page = findPage(file, start);
+
+    return page != NULL ? page : addPage(file, start, NULL);
+}
+
+/*  Points at length bytes at offset, or as many of them as are in one page of
+    a paged file (*available). NULL if they cannot be read. */
+static u8 *bytesAt(mfApplyContext *ctx, u32 offset, u32 length, u32 *available, mfPatchPage **page) {
+    *page = NULL;
+    *available = length;
+
+    if (ctx->data != NULL)
+        return ctx->data + offset;
+
+    *page = pageAt(ctx->paged, offset);
+
+    if (*page == NULL)
+        return NULL;
+
+    if (*available > (*page)->offset + (*page)->length - offset)
+        *available = (*page)->offset + (*page)->length - offset;
+
+    return (*page)->data + (offset - (*page)->offset);
+}
+
+static bool readBytes(mfApplyContext *ctx, u32 offset, void *buf, u32 length) {
+    while (length > 0) {
+        mfPatchPage *page;
+        u32 available;
+        const u8 *src = bytesAt(ctx, offset, length, &available, &page);
+
+        if (src == NULL)
+            return false;
+
+        memcpy(buf, src, available);
+        buf = (u8 *) buf + available;
+        offset += available;
+        length -= available;
+    }
+
+    return true;
+}
+
+static bool writeBytes(mfApplyContext *ctx, u32 offset, const void *buf, u32 length) {
+    while (length > 0) {
+        mfPatchPage *page;
+        u32 available;
+        u8 *dst = bytesAt(ctx, offset, length, &available, &page);
+
+        if (dst == NULL)
+            return false;
+
+        /* Keep what the page looked like before the first change, for the undo journal */
+        if (page != NULL && page->original == NULL) {
+            page->original = malloc(MF_PAGE_SIZE);
+
+            if (page->original == NULL)
+                return false;
+
+            memcpy(page->original, page->data, page->length);
+        }
+
+        memcpy(dst, buf, available);
+        buf = (const u8 *) buf + available;
+        offset += available;
+        length -= available;
+    }
+
+    return true;
+}
+
+static bool equalBytes(mfApplyContext *ctx, u32 offset, const u8 *data, u32 length) {
+    while (length > 0) {
+        mfPatchPage *page;
+        u32 available;
+        const u8 *src = bytesAt(ctx, offset, length, &available, &page);
+
+        if (src == NULL || 0 != memcmp(src, data, available))
+            return false;
+
+        data += available;
+        offset += available;
+        length -= available;
+    }
+
+    return true;
+}
+
+static bool isCallInstruction(mfApplyContext *ctx, u32 eip) {
+    u8 opcode;
+    return readBytes(ctx, eip, &opcode, 1) && opcode == 0xe8;
+}
+
+static u32 getAbsoluteTargetFromCallInstruction32(const u8 *call, u32 eip) {
+    assert(call[0] == 0xe8);
+
+    return eip + read32(call, 1) + sizeof(u32) + 1;
+}
+
+static u32 calcDestinationFromCallInstruction32(u32 eip, u32 target) {
+    return target - (eip + sizeof(u32) + 1);
+}
+
+static bool patchCall32(mfApplyContext *ctx, u32 eip, u32 newTarget) {
+    u8 call[5];
+
+    if (!readBytes(ctx, eip, call, sizeof(call)))
+        return false;
+
+    logPrintf("Patching call at %x to %x, ", eip, getAbsoluteTargetFromCallInstruction32(call, eip));
+    write32(call, 1, calcDestinationFromCallInstruction32(eip, newTarget));
+    logPrintf("new target: %x\n", getAbsoluteTargetFromCallInstruction32(call, eip));
+
+    return writeBytes(ctx, eip, call, sizeof(call));
+}
+
+static bool addRegion(mfRegionSet *set, u32 start, u32 end) {
+    if (set->count >= MF_MAX_REGIONS)
+        return false;
+
+    if (start < end) {
+        set->regions[set->count].start = start;
+        set->regions[set->count].end = end;
+        set->count++;
+    }
+
+    return true;
+}
+
+static bool addObjectRegion(mfRegionSet *set, const leObject *object) {
+    /* Searching has to stay within the object, so its pages must follow each other */
+    if (object->pageCount > 0 && !object->contiguous) {
+        logPrintf("%s object is not contiguous\n", object->name);
+        return false;
+    }
+
+    return addRegion(set, object->fileOffset, object->fileOffset + object->fileSize);
+}
+
+/* Gets the part(s) of the file to search a signature in */
+static bool getRegions(const mfApplyContext *ctx, const char *object, mfRegionSet *set) {
+    set->count = 0;
+
+    if (object == NULL)
+        return addRegion(set, 0, (u32) ctx->dataSize);
+
+    if (!ctx->isLe) {
+        logPrintf("Not an LE file, cannot search in objects\n");
+        return false;
+    }
+
+    if (0 == strcmp(object, MF_ALL_OBJECTS)) {
+        for (u32 i = 0; i < ctx->le.objectCount; i++) {
+            if (!addObjectRegion(set, &ctx->le.objects[i]))
+                return false;
+        }
+        return true;
+    }
+
+    if (leFindObject(&ctx->le, object) == NULL) {
+        logPrintf("%s object not found\n", object);
+        return false;
+    }
+
+    return addObjectRegion(set, leFindObject(&ctx->le, object));
+}
+
+static bool inRegions(const mfRegionSet *set, u32 pos, u32 length) {
+    for (u32 i = 0; i < set->count; i++) {
+        if (pos >= set->regions[i].start && pos + length <= set->regions[i].end)
+            return true;
+    }
+    return false;
+}
+
+static int compareRegions(const void *a, const void *b) {
+    const mfRegion *ra = (const mfRegion *) a;
+    const mfRegion *rb = (const mfRegion *) b;
+    return ra->start < rb->start ? -1 : ra->start > rb->start ? 1 : 0;
+}
+
+bool patchPlanCompile(mfPatchPlan *plan, const mfPatchDesc *desc) {
+    u8 count[256] = {0};
+    u8 fill[256];
+    u32 caves = 0;
+
+    assert(plan != NULL);
+    assert(desc != NULL);
+
+    memset(plan, 0, sizeof(mfPatchPlan));
+
+    if (desc->signatureCount > MF_MAX_SIGNATURES || desc->opCount > MF_MAX_OPS) {
+        logPrintf("Patch %s: too many signatures or operations\n", desc->name);
+        return false;
+    }
+
+    for (u32 i = 0; i < desc->signatureCount; i++) {
+        const mfSignature *sig = &desc->signatures[i];
+
+        if (sig->length == 0 || sig->pattern == NULL || sig->maxMatches > MF_MAX_MATCHES || sig->minMatches > sig->maxMatches) {
+            logPrintf("Patch %s: invalid signature %s\n", desc->name, sig->name);
+            return false;
+        }
+
+        count[sig->pattern[0]]++;
+    }
+
+    for (u32 i = 0; i < desc->opCount; i++) {
+        const mfPatchOp *op = &desc->ops[i];
+        const mfAnchor *anchors[2] = { &op->at, &op->target };
+
+        if (op->type == MF_OP_RESERVE_CAVE && caves++ > 0) {
+            logPrintf("Patch %s: only one cave is supported\n", desc->name);
+            return false;
+        }
+
+        for (int a = 0; a < 2; a++) {
+            if (anchors[a]->type == MF_ANCHOR_MATCH && anchors[a]->signature >= desc->signatureCount) {
+                logPrintf("Patch %s: operation %u refers to unknown signature\n", desc->name, i);
+                return false;
+            }
+
+            if (anchors[a]->type == MF_ANCHOR_VERSION_STRING && anchors[a]->key == NULL) {
+                logPrintf("Patch %s: operation %u refers to a version string without key\n", desc->name, i);
+                return false;
+            }
+        }
+    }
+
+    /* Bucket the signatures by their first byte so the scan only compares candidates */
+
+    for (int b = 0; b < 256; b++) {
+        plan->bucketStart[b + 1] = plan->bucketStart[b] + count[b];
+        fill[b] = plan->bucketStart[b];
+    }
+
+    for (u32 i = 0; i < desc->signatureCount; i++) {
+        plan->bucketSignatures[fill[desc->signatures[i].pattern[0]]++] = (u8) i;
+    }
+
+    plan->desc = desc;
+    return true;
+}
+
+/*  Looks for signatures starting in [from, to). window holds the file from
+    windowStart on, up to where the longest signature starting before to ends. */
+static void scanWindow(const mfPatchPlan *plan, mfApplyContext *ctx, const mfRegionSet *regions, const u8 *window, u32 windowStart, u32 from, u32 to) {
+    const mfPatchDesc *desc = plan->desc;
+
+    for (u32 pos = from; pos < to; pos++) {
+        const u8 *data = window + (pos - windowStart);
+        u8 first = data[0];
+
+        for (u32 b = plan->bucketStart[first]; b < plan->bucketStart[first + 1]; b++) {
+            u32 s = plan->bucketSignatures[b];
+            const mfSignature *sig = &desc->signatures[s];
+            mfMatches *matches = &ctx->matches[s];
+
+            if (!inRegions(&regions[s], pos, sig->length))
+                continue;
+
+            if (0 != memcmp(data, sig->pattern, sig->length))
+                continue;
+
+            if (matches->count < MF_MAX_MATCHES)
+                matches->offsets[matches->count] = pos;
+
+            matches->count++;
+        }
+    }
+}
+
+/* Loads the page at start into buf, from the cache if it is there, returns its length or 0 if it cannot be read */
+static u32 loadPage(mfPagedFile *file, u32 start, u8 *buf) {
+    const mfPatchPage *page = findPage(file, start);
+    u32 length = file->size - start < MF_PAGE_SIZE ? file->size - start : MF_PAGE_SIZE;
+
+    if (page != NULL)
+        memcpy(buf, page->data, length);
+    else if (!pagedRead(file, start, buf, length))
+        return 0;
+
+    return length;
+}
+
+static u32 matchTotal(const mfPatchPlan *plan, const mfApplyContext *ctx) {
+    u32 total = 0;
+
+    for (u32 i = 0; i < plan->desc->signatureCount; i++)
+        total += ctx->matches[i].count;
+
+    return total;
+}
+
+/*  A paged file is streamed through a window of two pages, so signatures can
+    run into the next page. Every page is read once: cached pages are copied,
+    and pages a signature is found in are added to the cache, as the patch
+    comes back to them. The other pages are not kept. */
+static bool scanPaged(const mfPatchPlan *plan, mfApplyContext *ctx, const mfRegionSet *regions, u32 start, u32 end, u32 maxLength) {
+    mfPagedFile *file = ctx->paged;
+    u8 *window = malloc(2 * MF_PAGE_SIZE);
+    u32 pageStart = start - start % MF_PAGE_SIZE;
+    u32 have = 0;                   /* Bytes in the window, from pageStart on */
+    bool success = true;
+
+    assert(maxLength <= MF_PAGE_SIZE);
+
+    if (window == NULL)
+        return false;
+
+    for (; pageStart < end && success; pageStart += MF_PAGE_SIZE) {
+        u32 from = start > pageStart ? start : pageStart;
+        u32 to = end - pageStart < MF_PAGE_SIZE ? end : pageStart + MF_PAGE_SIZE;
+        u32 windowEnd = end - to < maxLength ? end : to + maxLength;
+        u32 matches;
+
+        while (success && pageStart + have < windowEnd) {
+            u32 length = loadPage(file, pageStart + have, window + have);
+
+            success = length > 0;
+            have += length;
+        }
+
+        if (!success)
+            break;
+
+        matches = matchTotal(plan, ctx);
+        scanWindow(plan, ctx, regions, window, pageStart, from, to);
+
+        if (matchTotal(plan, ctx) != matches && findPage(file, pageStart) == NULL)
+            success = addPage(file, pageStart, window) != NULL;
+
+        /* The next page moves to the front */
+
+        if (have > MF_PAGE_SIZE) {
+            memmove(window, window + MF_PAGE_SIZE, have - MF_PAGE_SIZE);
+            have -= MF_PAGE_SIZE;
+        } else {
+            have = 0;
+        }
+    }
+
+    free(window);
+    return success;
+}
+
+/* Finds all signatures of the plan in one pass over the union of their regions */
+static bool findSignatures(const mfPatchPlan *plan, mfApplyContext *ctx) {
+    const mfPatchDesc *desc = plan->desc;
+    mfRegionSet regions[MF_MAX_SIGNATURES];
+    mfRegion scan[MF_MAX_SIGNATURES * MF_MAX_REGIONS];
+    u32 scanCount = 0;
+    u32 merged = 0;
+    u32 maxLength = 0;
+
+    for (u32 i = 0; i < desc->signatureCount; i++) {
+        if (!getRegions(ctx, desc->signatures[i].object, &regions[i]))
+            return false;
+
+        if (desc->signatures[i].length > maxLength)
+            maxLength = desc->signatures[i].length;
+
+        for (u32 r = 0; r < regions[i].count; r++) {
+            scan[scanCount++] = regions[i].regions[r];
+        }
+    }
+
+    /* Merge overlapping regions so no byte is looked at twice */
+
+    qsort(scan, scanCount, sizeof(mfRegion), compareRegions);
+
+    for (u32 i = 0; i < scanCount; i++) {
+        if (merged > 0 && scan[i].start <= scan[merged - 1].end) {
+            if (scan[i].end > scan[merged - 1].end)
+                scan[merged - 1].end = scan[i].end;
+        } else {
+            scan[merged++] = scan[i];
+        }
+    }
+
+    for (u32 r = 0; r < merged; r++) {
+        if (ctx->data != NULL) {
+            scanWindow(plan, ctx, regions, ctx->data, 0, scan[r].start, scan[r].end);
+        } else if (!scanPaged(plan, ctx, regions, scan[r].start, scan[r].end, maxLength)) {
+            logPrintf("Cannot read %x bytes at %x\n", scan[r].end - scan[r].start, scan[r].start);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static u32 anchorCount(const mfApplyContext *ctx, const mfAnchor *anchor) {
+    if (anchor->type == MF_ANCHOR_MATCH && anchor->occurrence == MF_EVERY_MATCH)
+        return ctx->matches[anchor->signature].count;
+    return 1;
+}
+
+/* Resolves an anchor to a file offset, checks that length bytes from there are inside the file */
+static bool resolveAnchor(const mfApplyContext *ctx, const mfAnchor *anchor, u32 occurrence, u32 length, u32 *offset) {
+    long base;
+    long position;
+
+    if (anchor->type == MF_ANCHOR_CAVE) {
+        if (!ctx->haveCave)
+            return false;
+        base = ctx->caveOffset;
+    } else if (anchor->type == MF_ANCHOR_VERSION_STRING) {
+        mfVersionString value;
+
+        if (!ctx->haveVersion || !versionFindString(&ctx->version, anchor->key, &value))
+            return false;
+
+        /* Whatever is written there has to fit into the node of the value */
+
+        if (anchor->offset < 0 || (u32) anchor->offset > value.capacity || length > value.capacity - (u32) anchor->offset) {
+            logPrintf("%s has room for %u bytes, not %u\n", anchor->key, value.capacity, (u32) anchor->offset + length);
+            return false;
+        }
+
+        base = value.offset;
+    } else {
+        const mfMatches *matches = &ctx->matches[anchor->signature];
+        u32 index = anchor->occurrence == MF_EVERY_MATCH ? occurrence : anchor->occurrence;
+
+        if (index >= matches->count || index >= MF_MAX_MATCHES)
+            return false;
+
+        base = matches->offsets[index];
+    }
+
+    position = base + anchor->offset;
+
+    if (position < 0 || position + (long) length > ctx->dataSize)
+        return false;
+
+    *offset = (u32) position;
+    return true;
+}
+
+/*  Markers are strings. In a version string that is shorter than the marker,
+    only the start of the marker fits, plus its terminator. Returns the length
+    to write or compare, op->length if all of it fits or there is no such string. */
+static u32 markerLength(const mfApplyContext *ctx, const mfPatchOp *op) {
+    mfVersionString value;
+    u32 room;
+
+    if (op->at.type != MF_ANCHOR_VERSION_STRING || op->at.offset < 0 || !ctx->haveVersion || !versionFindString(&ctx->version, op->at.key, &value))
+        return op->length;
+
+    if ((u32) op->at.offset >= value.capacity)
+        return op->length;
+
+    /* Without room for one character and the terminator, resolveAnchor refuses the string */
+    room = value.capacity - (u32) op->at.offset;
+    return room >= 2 && room < op->length ? room : op->length;
+}
+
+/* Compares a marker that may have been cut to length bytes by markerLength */
+static bool equalMarker(mfApplyContext *ctx, u32 offset, const mfPatchOp *op, u32 length) {
+    const u8 terminator = 0x00;
+
+    if (length == op->length)
+        return equalBytes(ctx, offset, op->data, length);
+
+    return equalBytes(ctx, offset, op->data, length - 1) && equalBytes(ctx, offset + length - 1, &terminator, 1);
+}
+
+static bool writeMarker(mfApplyContext *ctx, u32 offset, const mfPatchOp *op, u32 length) {
+    const u8 terminator = 0x00;
+
+    if (length == op->length)
+        return writeBytes(ctx, offset, op->data, length);
+
+    logPrintf("Marker shortened to %u of %u bytes, %s has no room for all of it\n", length, op->length, op->at.key);
+    return writeBytes(ctx, offset, op->data, length - 1) && writeBytes(ctx, offset + length - 1, &terminator, 1);
+}
+
+/* Reads and parses the version resource, if any operation of the plan refers to one of its strings */
+static void loadVersion(const mfPatchPlan *plan, mfApplyContext *ctx) {
+    const mfPatchDesc *desc = plan->desc;
+    bool needed = false;
+    u32 offset;
+    u32 size;
+
+    for (u32 i = 0; i < desc->opCount; i++) {
+        if (desc->ops[i].at.type == MF_ANCHOR_VERSION_STRING || desc->ops[i].target.type == MF_ANCHOR_VERSION_STRING)
+            needed = true;
+    }
+
+    if (!needed)
+        return;
+
+    if (!ctx->isLe || !leVersionResource(&ctx->le, &offset, &size) || size > MF_MAX_VERSION_RESOURCE) {
+        logPrintf("No version resource\n");
+        return;
+    }
+
+    ctx->versionData = malloc(size);
+
+    if (ctx->versionData == NULL || !readBytes(ctx, offset, ctx->versionData, size) || !versionParse(&ctx->version, ctx->versionData, size, offset)) {
+        logPrintf("Invalid version resource\n");
+        return;
+    }
+
+    ctx->haveVersion = true;
+}
+
+/* Checks the preconditions and applies the operations, once the signatures were searched for */
+static mfPatchResult applyOps(const mfPatchPlan *plan, mfApplyContext *ctx) {
+    const mfPatchDesc *desc = plan->desc;
+    long dataSize = ctx->dataSize;
+    const leObject *caveObject = NULL;
+    u32 caveLength = 0;
+    u32 caveSpace;
+    u32 positions[MF_MAX_OPS][MF_MAX_MATCHES];
+    u32 targets[MF_MAX_OPS];
+
+    loadVersion(plan, ctx);
+
+    /* Preconditions first, an already patched file is not an error in the signatures */
+
+    for (u32 i = 0; i < desc->opCount; i++) {
+        const mfPatchOp *op = &desc->ops[i];
+
+        if (op->type == MF_OP_REJECT_IF_FOUND && ctx->matches[op->at.signature].count > 0) {
+            logPrintf("Signature %s found\n", desc->signatures[op->at.signature].name);
+            return MF_PATCH_ALREADY_PATCHED;
+        }
+
+        if (op->type == MF_OP_REJECT_IF_EQUAL) {
+            u32 length = markerLength(ctx, op);
+
+            for (u32 n = 0; n < anchorCount(ctx, &op->at); n++) {
+                u32 offset;
+
+                if (resolveAnchor(ctx, &op->at, n, length, &offset) && equalMarker(ctx, offset, op, length))
+                    return MF_PATCH_ALREADY_PATCHED;
+            }
+        }
+    }
+
+    for (u32 i = 0; i < desc->signatureCount; i++) {
+        const mfSignature *sig = &desc->signatures[i];
+        bool isPrecondition = false;
+
+        for (u32 o = 0; o < desc->opCount; o++) {
+            if (desc->ops[o].type == MF_OP_REJECT_IF_FOUND && desc->ops[o].at.signature == i)
+                isPrecondition = true;
+        }
+
+        if (isPrecondition)
+            continue;
+
+        if (ctx->matches[i].count < sig->minMatches || ctx->matches[i].count > sig->maxMatches) {
+            logPrintf("Signature %s found %u time(s), expected %u to %u\n", sig->name, ctx->matches[i].count, sig->minMatches, sig->maxMatches);
+            return MF_PATCH_NOT_FOUND;
+        }
+    }
+
+    /* Reserve the cave before anything refers to it */
+
+    for (u32 i = 0; i < desc->opCount; i++) {
+        const mfPatchOp *op = &desc->ops[i];
+
+        if (op->type != MF_OP_RESERVE_CAVE)
+            continue;
+
+        caveObject = ctx->isLe ? leFindObject(&ctx->le, op->object) : NULL;
+
+        if (caveObject == NULL || !caveObject->contiguous || caveObject->pageCount == 0) {
+            logPrintf("%s object not found\n", op->object);
+            return MF_PATCH_BAD_FILE;
+        }
+
+        logPrintf("%s object size: %x, padded size: %x, file offset %x\n", op->object, caveObject->virtualSize, caveObject->paddedSize, caveObject->fileOffset);
+
+        /* The last page of the file can be shorter than the page size */
+        caveSpace = caveObject->paddedSize;
+
+        if (caveObject->fileOffset + caveSpace > (u32) dataSize)
+            caveSpace = (u32) dataSize - caveObject->fileOffset;
+
+        if (caveObject->virtualSize > caveSpace || caveSpace - caveObject->virtualSize < op->length) {
+            u32 missing = caveObject->virtualSize + op->length - caveSpace;
+
+            logPrintf("Not enough padding in %s to patch the file\n", op->object);
+            ctx->growObject = caveObject->number;
+            ctx->growPages = (missing + ctx->le.pageSize - 1) / ctx->le.pageSize;
+            return MF_PATCH_NO_SPACE;
+        }
+
+        ctx->haveCave = true;
+        ctx->caveOffset = caveObject->fileOffset + caveObject->virtualSize;
+        caveLength = op->length;
+    }
+
+    /* Resolve every anchor before touching the data, so a mismatch never leaves a half patched buffer */
+
+    for (u32 i = 0; i < desc->opCount; i++) {
+        const mfPatchOp *op = &desc->ops[i];
+        u32 length = op->length * (op->repeat ? op->repeat : 1);
+
+        switch (op->type) {
+            case MF_OP_WRITE:
+            case MF_OP_MARKER:
+            case MF_OP_REDIRECT_CALL:
+            case MF_OP_CALL_ORIGINAL:
+                break;
+            default:
+                continue;
+        }
+
+        if (op->type == MF_OP_REDIRECT_CALL || op->type == MF_OP_CALL_ORIGINAL)
+            length = 5;
+
+        if (op->type == MF_OP_MARKER)
+            length = markerLength(ctx, op);
+
+        for (u32 n = 0; n < anchorCount(ctx, &op->at) && n < MF_MAX_MATCHES; n++) {
+            if (!resolveAnchor(ctx, &op->at, n, length, &positions[i][n])) {
+                logPrintf("Patch position for operation %u is outside of the file\n", i);
+                return MF_PATCH_BAD_FILE;
+            }
+
+            /* Calls inside the cave are only written by the patch itself */
+            if (op->at.type == MF_ANCHOR_MATCH && (op->type == MF_OP_REDIRECT_CALL || op->type == MF_OP_CALL_ORIGINAL) && !isCallInstruction(ctx, positions[i][n])) {
+                logPrintf("No call instruction at %x\n", positions[i][n]);
+                return MF_PATCH_NOT_FOUND;
+            }
+        }
+
+        if (op->type == MF_OP_REDIRECT_CALL && !resolveAnchor(ctx, &op->target, 0, 0, &targets[i]))
+            return MF_PATCH_BAD_FILE;
+
+        if (op->type == MF_OP_CALL_ORIGINAL) {
+            u32 originalCall;
+            u8 call[5];
+
+            if (op->target.type != MF_ANCHOR_MATCH || !resolveAnchor(ctx, &op->target, 0, sizeof(call), &originalCall)
+             || !readBytes(ctx, originalCall, call, sizeof(call)) || call[0] != 0xe8) {
+                logPrintf("No original call for operation %u\n", i);
+                return MF_PATCH_NOT_FOUND;
+            }
+
+            targets[i] = getAbsoluteTargetFromCallInstruction32(call, originalCall);
+            logPrintf("Original call target: %x\n", targets[i]);
+        }
+    }
+
+    /* Everything checks out, apply */
+
+    for (u32 i = 0; i < desc->opCount; i++) {
+        const mfPatchOp *op = &desc->ops[i];
+
+        if (op->type == MF_OP_RESERVE_CAVE) {
+            u8 virtualSize[4];
+
+            write32(virtualSize, 0, caveObject->virtualSize + caveLength);
+
+            if (!writeBytes(ctx, caveObject->tableEntryOffset, virtualSize, sizeof(virtualSize)))
+                return MF_PATCH_BAD_FILE;
+
+            continue;
+        }
+
+        for (u32 n = 0; n < anchorCount(ctx, &op->at) && n < MF_MAX_MATCHES; n++) {
+            u32 pos = positions[i][n];
+
+            switch (op->type) {
+                case MF_OP_WRITE:
+                    logPrintf("Writing %u bytes at %x\n", op->length * (op->repeat ? op->repeat : 1), pos);
+                    for (u32 r = 0; r < (op->repeat ? op->repeat : 1); r++) {
+                        if (!writeBytes(ctx, pos + r * op->length, op->data, op->length))
+                            return MF_PATCH_BAD_FILE;
+                    }
+                    break;
+                case MF_OP_MARKER:
+                    if (!writeMarker(ctx, pos, op, markerLength(ctx, op)))
+                        return MF_PATCH_BAD_FILE;
+                    break;
+                case MF_OP_REDIRECT_CALL:
+                case MF_OP_CALL_ORIGINAL:
+                    if (!isCallInstruction(ctx, pos)) {
+                        logPrintf("No call instruction at %x\n", pos);
+                        return MF_PATCH_BAD_FILE;
+                    }
+                    if (!patchCall32(ctx, pos, targets[i]))
+                        return MF_PATCH_BAD_FILE;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    return MF_PATCH_OK;
+}
+
+static mfPatchResult applyPlan(const mfPatchPlan *plan, mfApplyContext *ctx) {
+    double start = statsBegin();
+    mfPatchResult result;
+    bool found = findSignatures(plan, ctx);
+
+    statsEnd(MF_STAT_SIGNATURE_SEARCH, start, (u64) ctx->dataSize, 0);
+
+    if (!found)
+        return MF_PATCH_BAD_FILE;
+
+    start = statsBegin();
+    result = applyOps(plan, ctx);
+    statsEnd(MF_STAT_PATCH_APPLY, start, 0, 0);
+    return result;
+}
+
+mfPatchResult patchPlanApply(const mfPatchPlan *plan, u8 **data, long *dataSize) {
+    mfApplyContext ctx;
+    mfPatchResult result;
+
+    assert(plan != NULL && plan->desc != NULL);
+    assert(data != NULL && *data != NULL);
+    assert(dataSize != NULL);
+
+    for (u32 attempt = 0; ; attempt++) {
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.data = *data;
+        ctx.dataSize = *dataSize;
+        ctx.isLe = leOpen(&ctx.le, *data, *dataSize);
+
+        result = applyPlan(plan, &ctx);
+
+        leClose(&ctx.le);
+        free(ctx.versionData);
+
+        /*  Nothing has been written when the cave did not fit. Grow the object
+            once and start over, all offsets behind the page map have moved. */
+
+        if (result != MF_PATCH_NO_SPACE || ctx.growPages == 0 || attempt > 0)
+            break;
+
+        logPrintf("Growing object %u by %u page(s)\n", ctx.growObject, ctx.growPages);
+
+        if (!leGrowObject(data, dataSize, ctx.growObject, ctx.growPages)) {
+            logPrintf("ERROR: Cannot grow object %u\n", ctx.growObject);
+            break;
+        }
+    }
+
+    return result;
+}
+
+/* Reads from a paged file through its page cache, so the pages are not read again later */
+static bool copyPages(mfPagedFile *file, u32 offset, u8 *buf, u32 size) {
+    if (offset > file->size || size > file->size - offset)
+        return false;
+
+    while (size > 0) {
+        mfPatchPage *page = pageAt(file, offset);
+        u32 available;
+
+        if (page == NULL)
+            return false;
+
+        available = page->offset + page->length - offset;
+
+        if (available > size)
+            available = size;
+
+        memcpy(buf, page->data + (offset - page->offset), available);
+        buf += available;
+        offset += available;
+        size -= available;
+    }
+
+    return true;
+}
+
+/* Reads the start of a paged file, up to the end of the LE object table and page map */
+static u8 *readHeaders(mfPagedFile *file, u32 *size) {
+    u8 *headers = NULL;
+    u32 have = 0;
+    u32 needed = file->size < 64 ? file->size : 64;
+
+    while (needed > have && needed <= file->size) {
+        u8 *grown = realloc(headers, needed);
+
+        if (grown == NULL || !copyPages(file, have, grown + have, needed - have)) {
+            free(grown != NULL ? grown : headers);
+            return NULL;
+        }
+
+        headers = grown;
+        have = needed;
+        needed = leHeadersSize(headers, have);
+
+        if (needed != 0 && needed <= have) {
+            *size = have;
+            return headers;
+        }
+    }
+
+    free(headers);
+    return NULL;
+}
+
+mfPatchResult patchPlanApplyPaged(const mfPatchPlan *plan, mfPagedFile *file) {
+    mfApplyContext ctx;
+    mfPatchResult result;
+    u8 *headers;
+    u32 headersSize = 0;
+
+    assert(plan != NULL && plan->desc != NULL);
+    assert(file != NULL && file->read != NULL);
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.paged = file;
+    ctx.dataSize = file->size;
+
+    headers = readHeaders(file, &headersSize);
+    ctx.isLe = headers != NULL && leOpenHeaders(&ctx.le, headers, headersSize, file->size);
+
+    result = applyPlan(plan, &ctx);
+
+    leClose(&ctx.le);
+    free(ctx.versionData);
+    free(headers);
+    return result;
+}
+
+void patchPagedFree(mfPagedFile *file) {
+    if (file == NULL)
+        return;
+
+    for (u32 i = 0; i < file->pageCount; i++) {
+        free(file->pages[i].data);
+        free(file->pages[i].original);
+    }
+
+    free(file->pages);
+    file->pages = NULL;
+    file->pageCount = 0;
+}
+
+const char *patchResultString(mfPatchResult result) {
+    switch (result) {
+        case MF_PATCH_OK:               return "OK";
+        case MF_PATCH_ALREADY_PATCHED:  return "already patched";
+        case MF_PATCH_NOT_FOUND:        return "patch locations not found";
+        case MF_PATCH_NO_SPACE:         return "not enough space for the patch";
+        case MF_PATCH_BAD_FILE:         return "invalid file";
+    }
+    return "unknown";
+}
@@ -0,0 +1,128 @@
+#ifndef _MF_PATCH_H_
+#define _MF_PATCH_H_
+
+#include "util.h"
+
+/*  Data driven patch engine.
+
+    A patch is described by a set of byte signatures and a list of operations
+    (preconditions, byte writes, call redirections...) that refer to positions
+    relative to where those signatures were found ("anchors").
+
+    A description is compiled once into a plan. Applying a plan to a file buffer
+    finds all signatures in a single pass, resolves and checks every anchor and
+    only then starts modifying the buffer.
+*/
+
+#define MF_MAX_SIGNATURES       (16)
+#define MF_MAX_MATCHES          (4)
+
+/* Signature object that searches all LE objects, but not headers, fixups or resources */
+#define MF_ALL_OBJECTS          "*"
+
+/* Anchor occurrence that applies an operation to every match of the signature */
+#define MF_EVERY_MATCH          (0xFF)
+
+typedef enum {
+    MF_ANCHOR_MATCH = 0,        /* Where a signature was found, plus offset */
+    MF_ANCHOR_CAVE,             /* Start of the space reserved by MF_OP_RESERVE_CAVE, plus offset */
+    MF_ANCHOR_VERSION_STRING,   /* Value of a string in the version resource, plus offset. Never goes past the space of the value */
+} mfAnchorType;
+
+typedef struct {
+    u8 type;                    /* mfAnchorType */
+    u8 signature;               /* Index of the signature for MF_ANCHOR_MATCH */
+    u8 occurrence;              /* Which match to use, or MF_EVERY_MATCH */
+    i32 offset;                 /* Relative to the match / cave / value */
+    const char *key;            /* String for MF_ANCHOR_VERSION_STRING (e.g. FileDescription) */
+} mfAnchor;
+
+typedef struct {
+    const char *name;
+    const u8 *pattern;
+    u32 length;
+    const char *object;         /* LE object to search in, MF_ALL_OBJECTS or NULL for the whole file */
+    u8 minMatches;              /* Fewer matches than this means the driver is not supported */
+    u8 maxMatches;              /* More matches than this means the signature is ambiguous */
+} mfSignature;
+
+typedef enum {
+    MF_OP_REJECT_IF_FOUND = 0,  /* Precondition: signature must not be present (e.g. already patched) */
+    MF_OP_REJECT_IF_EQUAL,      /* Precondition: bytes at anchor must not equal data (as cut by MF_OP_MARKER in a short version string) */
+    MF_OP_RESERVE_CAVE,         /* Grow an object by length bytes into its page padding, appending pages if needed */
+    MF_OP_WRITE,                /* Write data at anchor, repeat times */
+    MF_OP_REDIRECT_CALL,        /* Point the near call at anchor to the target anchor */
+    MF_OP_CALL_ORIGINAL,        /* Point the near call at anchor to where the call at target originally went */
+    MF_OP_MARKER,               /* Write data as string at anchor, cut to the room of a version string value */
+} mfOpType;
+
+typedef struct {
+    u8 type;                    /* mfOpType */
+    mfAnchor at;
+    mfAnchor target;
+    const u8 *data;
+    u32 length;
+    u32 repeat;
+    const char *object;         /* Object for MF_OP_RESERVE_CAVE */
+} mfPatchOp;
+
+typedef struct {
+    const char *name;
+    const mfSignature *signatures;
+    u32 signatureCount;
+    const mfPatchOp *ops;
+    u32 opCount;
+} mfPatchDesc;
+
+typedef struct {
+    const mfPatchDesc *desc;
+    u8 bucketStart[257];        /* Signatures sorted by first byte, bucket for byte b is [bucketStart[b], bucketStart[b + 1]) */
+    u8 bucketSignatures[MF_MAX_SIGNATURES];
+} mfPatchPlan;
+
+typedef enum {
+    MF_PATCH_OK = 0,
+    MF_PATCH_ALREADY_PATCHED,
+    MF_PATCH_NOT_FOUND,
+    MF_PATCH_NO_SPACE,
+    MF_PATCH_BAD_FILE,
+} mfPatchResult;
+
+/*  A file that is patched without reading all of it: the LE header and tables,
+    the searched objects (streamed, one page at a time) and the pages that are
+    checked or changed. Only the latter are kept, as pages of MF_PAGE_SIZE. */
+
+#define MF_PAGE_SIZE            (4096)
+
+typedef struct {
+    u32 offset;                 /* Multiple of MF_PAGE_SIZE */
+    u32 length;                 /* Less than MF_PAGE_SIZE only at the end of the file */
+    u8 *data;
+    u8 *original;               /* Contents before the first change, NULL if the page is unchanged */
+} mfPatchPage;
+
+typedef struct {
+    bool (*read)(void *ctx, u32 offset, void *buf, u32 size);
+    void *ctx;
+    u32 size;
+    u32 bytesRead;
+    u32 pageCount;
+    mfPatchPage *pages;
+} mfPagedFile;
+
+/* Checks a description and compiles it into a plan, returns false if the description is invalid */
+bool patchPlanCompile(mfPatchPlan *plan, const mfPatchDesc *desc);
+
+/*  Applies a plan to a file buffer. Usually in place, but if a cave does not fit
+    into the padding of its object, the object is grown and *data is reallocated. */
+mfPatchResult patchPlanApply(const mfPatchPlan *plan, u8 **data, long *dataSize);
+
+/*  Applies a plan to a paged file, the changes end up in the pages that have
+    an original. Objects are never grown: MF_PATCH_NO_SPACE means the whole
+    file has to be patched with patchPlanApply instead. */
+mfPatchResult patchPlanApplyPaged(const mfPatchPlan *plan, mfPagedFile *file);
+void patchPagedFree(mfPagedFile *file);
+
+const char *patchResultString(mfPatchResult result);
+
+#endif
@@ -0,0 +1,140 @@
+#include "patchdefs.h"
+
+#define ARRAY_SIZE(x)               (sizeof(x) / sizeof((x)[0]))
+
+#define MSMOUSE_CURVE_LENGTH        (32)
+#define MSMOUSE_CURVE_PROFILES      (4)
+
+#define AT_CAVE(offset)             { MF_ANCHOR_CAVE, 0, 0, (offset) }
+#define AT_MATCH(sig, offset)       { MF_ANCHOR_MATCH, (sig), 0, (offset) }
+#define AT_EVERY_MATCH(sig, offset) { MF_ANCHOR_MATCH, (sig), MF_EVERY_MATCH, (offset) }
+#define AT_VERSION_STRING(key, offset) { MF_ANCHOR_VERSION_STRING, 0, 0, (offset), (key) }
+#define NO_ANCHOR                   { MF_ANCHOR_MATCH, 0, 0, 0 }
+
+/* ------------------------------------------------------------------------- */
+/* VMOUSE.VXD                                                                */
+/* ------------------------------------------------------------------------- */
+
+/* Signature to detect if file is already patched, ASCII 'Oerg866' */
+static const u8 vmousePatchMarker[] = { 0x4F, 0x65, 0x72, 0x67, 0x38, 0x36, 0x36 };
+
+/*  End of initMouseSens function, the only part of it that is unique and overlaps between 98SE and ME
+    PCOD:C000238F                 mov     si, ax
+    PCOD:C0002392                 mov     [edx+1Ch], esi
+    PCOD:C0002395                 clc
+    PCOD:C0002396                 retn
+*/
+static const u8 initMouseSensPattern[] = { 0x66, 0x8b, 0xf0, 0x89, 0x72, 0x1c, 0xf8, 0xc3 };
+
+/*  Middle of ChangeMouseSens function, right inbetween the two calls to modify
+    PCOD:C000147C                 mov     esi, eax
+    PCOD:C000147E                 movzx   eax, word ptr [ebp+18h]
+    PCOD:C0001482                 cmp     eax, edi
+    PCOD:C0001484                 jb      short loc_C0001488
+    PCOD:C0001486                 mov     eax, edi
+    PCOD:C0001488
+    PCOD:C0001488 loc_C0001488:                           ; CODE XREF: PCOD:C0001484↑j
+    PCOD:C0001488                 mov     [edx+6Fh], al
+*/
+static const u8 changeMouseSensPattern[] = { 0x8B, 0xF0, 0x0F, 0xB7, 0x45, 0x18, 0x3B };
+
+/*  Placed at the end of PCOD, called instead of CalculateSensitivity:
+    doubles the base value for everything but the system VM, then calls the original */
+static const u8 vmouseSensitivityStub[] = {
+    0x53,                           /* push ebx */
+    0x83, 0x7b, 0x0c, 0x01,         /* cmp dword ptr [ebx+0Ch], 1 */
+    0x74, 0x02,                     /* jz short NoSysVM */
+    0xd1, 0xe0,                     /* shl eax, 1 */
+    /* NoSysVM: */
+    0xe8, 0x00, 0x00, 0x00, 0x00,   /* call CalculateSensitivity ; Patched to the original target */
+    0x5b,                           /* pop ebx */
+    0xc3,                           /* ret */
+    /* Signature to detect if file is already patched */
+    0x4F, 0x65, 0x72, 0x67, 0x38, 0x36, 0x36 /* ASCII 'Oerg866' */
+};
+
+enum {
+    VMOUSE_SIG_MARKER = 0,
+    VMOUSE_SIG_INIT_MOUSE_SENS,
+    VMOUSE_SIG_CHANGE_MOUSE_SENS,
+};
+
+static const mfSignature vmouseSignatures[] = {
+    /* name                 pattern                 length                          object  min max */
+    /* The marker is part of the stub, which becomes part of PCOD once patched */
+    { "patchMarker",        vmousePatchMarker,      sizeof(vmousePatchMarker),      "PCOD", 0,  MF_MAX_MATCHES },
+    { "initMouseSens",      initMouseSensPattern,   sizeof(initMouseSensPattern),   "PCOD", 1,  1 },
+    { "changeMouseSens",    changeMouseSensPattern, sizeof(changeMouseSensPattern), "PCOD", 1,  1 },
+};
+
+static const mfPatchOp vmouseOps[] = {
+    /* type                     at                                              target                                          data                    length                          repeat  object */
+    { MF_OP_REJECT_IF_FOUND,    AT_MATCH(VMOUSE_SIG_MARKER, 0),                 NO_ANCHOR,                                      NULL,                   0,                              0,      NULL },
+
+    /* 64 bytes at the end of PCOD for the stub, to be sure */
+    { MF_OP_RESERVE_CAVE,       NO_ANCHOR,                                      NO_ANCHOR,                                      NULL,                   64,                             0,      "PCOD" },
+    { MF_OP_WRITE,              AT_CAVE(0),                                     NO_ANCHOR,                                      vmouseSensitivityStub,  sizeof(vmouseSensitivityStub),  1,      NULL },
+
+    /* Init Mouse Sens: calls for X and Y axis */
+    { MF_OP_REDIRECT_CALL,      AT_MATCH(VMOUSE_SIG_INIT_MOUSE_SENS, -0x19),    AT_CAVE(0),                                     NULL,                   0,                              0,      NULL },
+    { MF_OP_REDIRECT_CALL,      AT_MATCH(VMOUSE_SIG_INIT_MOUSE_SENS, -0x05),    AT_CAVE(0),                                     NULL,                   0,                              0,      NULL },
+
+    /* Change Mouse Sens: calls for X and Y axis */
+    { MF_OP_REDIRECT_CALL,      AT_MATCH(VMOUSE_SIG_CHANGE_MOUSE_SENS, -0x05),  AT_CAVE(0),                                     NULL,                   0,                              0,      NULL },
+    { MF_OP_REDIRECT_CALL,      AT_MATCH(VMOUSE_SIG_CHANGE_MOUSE_SENS, 0x0f),   AT_CAVE(0),                                     NULL,                   0,                              0,      NULL },
+
+    /* The stub calls the original CalculateSensitivity */
+    { MF_OP_CALL_ORIGINAL,      AT_CAVE(0x09),                                  AT_MATCH(VMOUSE_SIG_INIT_MOUSE_SENS, -0x19),    NULL,                   0,                              0,      NULL },
+};
+
+const mfPatchDesc vmousePatchDesc = {
+    "VMOUSE",
+    vmouseSignatures, ARRAY_SIZE(vmouseSignatures),
+    vmouseOps, ARRAY_SIZE(vmouseOps),
+};
+
+/* ------------------------------------------------------------------------- */
+/* MSMOUSE.VXD                                                               */
+/* ------------------------------------------------------------------------- */
+
+static const char msmousePatchMarker[] = "MSMINI Unaccelerated by Oerg866";
+
+/*  Profile settings are 32 bytes each, 4 profiles per table. The last profile
+    is unique enough to find the tables with. */
+static const u8 mouseCurveTable1Entry4[] = { 0x01, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F };
+static const u8 mouseCurveTable2Entry4[] = { 0x10, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F };
+
+static const u8 mouseCurveTable1Unaccel[] = { 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01 };
+static const u8 mouseCurveTable2Unaccel[] = { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 };
+
+enum {
+    MSMOUSE_SIG_CURVE_TABLE_1 = 0,
+    MSMOUSE_SIG_CURVE_TABLE_2,
+};
+
+static const mfSignature msmouseSignatures[] = {
+    /* name                 pattern                 length                          object          min max */
+    /*  The first curve table exists twice, second one only once. Locked data shares
+        the object with locked code in VxDs, so the tables can be in any object */
+    { "curveTable1",        mouseCurveTable1Entry4, sizeof(mouseCurveTable1Entry4), MF_ALL_OBJECTS, 2,  2 },
+    { "curveTable2",        mouseCurveTable2Entry4, sizeof(mouseCurveTable2Entry4), MF_ALL_OBJECTS, 1,  1 },
+};
+
+/* Tables start 3 profiles before the one we searched for */
+#define CURVE_TABLE_START           (-3 * MSMOUSE_CURVE_LENGTH)
+
+static const mfPatchOp msmouseOps[] = {
+    /* type                     at                                                                  target      data                                length                          repeat                  object */
+    { MF_OP_REJECT_IF_EQUAL,    AT_VERSION_STRING("FileDescription", 0),                            NO_ANCHOR,  (const u8 *) msmousePatchMarker,    sizeof(msmousePatchMarker),     0,                      NULL },
+    { MF_OP_WRITE,              AT_EVERY_MATCH(MSMOUSE_SIG_CURVE_TABLE_1, CURVE_TABLE_START),       NO_ANCHOR,  mouseCurveTable1Unaccel,            MSMOUSE_CURVE_LENGTH,           MSMOUSE_CURVE_PROFILES, NULL },
+    { MF_OP_WRITE,              AT_MATCH(MSMOUSE_SIG_CURVE_TABLE_2, CURVE_TABLE_START),             NO_ANCHOR,  mouseCurveTable2Unaccel,            MSMOUSE_CURVE_LENGTH,           MSMOUSE_CURVE_PROFILES, NULL },
+
+    /* Add marker so we know the file is patched, it replaces the driver description in the version resource */
+    { MF_OP_MARKER,             AT_VERSION_STRING("FileDescription", 0),                            NO_ANCHOR,  (const u8 *) msmousePatchMarker,    sizeof(msmousePatchMarker),     0,                      NULL },
+};
+
+const mfPatchDesc msmousePatchDesc = {
+    "MSMOUSE",
+    msmouseSignatures, ARRAY_SIZE(msmouseSignatures),
+    msmouseOps, ARRAY_SIZE(msmouseOps),
+};
@@ -0,0 +1,12 @@
+#ifndef _MF_PATCHDEFS_H_
+#define _MF_PATCHDEFS_H_
+
+#include "patch.h"
+
+/* VMOUSE.VXD: fix mouse being faster in Windows than in DOS */
+extern const mfPatchDesc vmousePatchDesc;
+
+/* MSMOUSE.VXD: replace the acceleration curves with unaccelerated ones */
+extern const mfPatchDesc msmousePatchDesc;
+
+#endif
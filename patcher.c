@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <assert.h>
+
+#include "decompress/unpacker.h"
+#include "decompress/pew.h"
+#include "decompress/filesystem.h"
+#include "patcher.h"
+#include "journal.h"
+#include "patchdefs.h"
+#include "image.h"
+#include "trace.h"
+#include "log.h"
+
+#define BACKUP_EXTENSION            "BAK"
+
+static mfCache *extractCache = NULL;
+
+/* Copies the file to <name>.BAK next to it */
+static bool backupFile(const mfFileOps *ops, const char *fname) {
+    char *backupPath = fs_path_get3(fname, NULL, BACKUP_EXTENSION);
+    bool success = false;
+
+    if (backupPath == NULL)
+        return false;
+
+    if (!ops->copy(ops, fname, backupPath)) {
+        logPrintf("Error: Could not back up %s to %s\n", fname, backupPath);
+    } else {
+        logPrintf("Backup: %s\n", backupPath);
+        success = true;
+    }
+
+    fs_path_free(backupPath);
+    return success;
+}
+
+/* Writes the undo journal next to the file, nothing may be patched if this fails */
+static bool writeJournal(const mfFileOps *ops, const char *fname, const mfJournal *journal) {
+    char *journalPath = journalPathFor(fname);
+    bool success = false;
+
+    if (journalPath == NULL)
+        return false;
+
+    if (!journalWrite(ops, journal, journalPath)) {
+        logPrintf("Error: Could not write undo journal %s, not patching\n", journalPath);
+    } else {
+        logPrintf("Undo journal: %s (%u range(s))\n", journalPath, journal->rangeCount);
+        success = true;
+    }
+
+    fs_path_free(journalPath);
+    return success;
+}
+
+/* Journals the changed ranges next to the file, then writes out the patched data */
+static bool writePatchedFile(const mfFileOps *ops, const char *fname, const u8 *original, long originalSize, const u8 *data, long dataSize) {
+    mfJournal journal = {0};
+    bool success = false;
+
+    if (!journalRecordDiff(&journal, fname, original, originalSize, data, dataSize))
+        goto cleanup;
+
+    if (!writeJournal(ops, fname, &journal))
+        goto cleanup;
+
+    if (!ops->write(ops, fname, data, dataSize)) {
+        logPrintf("Error writing the patched data to the file!\n");
+        goto cleanup;
+    }
+
+    success = true;
+
+cleanup:
+    journalFree(&journal);
+    return success;
+}
+
+/* Logs why a file could not be patched, returns true if it can be. Already patched files are counted in the target if given. */
+static bool checkPatchResult(const char *fname, mfPatchResult result, mfTarget *target) {
+    if (result == MF_PATCH_ALREADY_PATCHED) {
+        logPrintf("ERROR: File %s is already patched!\n", fname);
+
+        if (target != NULL)
+            target->alreadyPatched++;
+
+        return false;
+    }
+
+    if (result != MF_PATCH_OK) {
+        logPrintf("ERROR: Cannot patch %s: %s\n", fname, patchResultString(result));
+        return false;
+    }
+
+    return true;
+}
+
+/*  Applies a compiled patch plan to the contents of a file, journals the changes
+    and writes it back. Takes ownership of data. target may be NULL. */
+static bool patchData(const mfFileOps *ops, const char *fname, const mfPatchPlan *plan, const mfPatchOptions *options, u8 *data, long dataSize, mfTarget *target) {
+    u8 *original = NULL;
+    long originalSize;
+    mfPatchResult result;
+
+    /* Keep the original around so the changed ranges can be journaled */
+
+    original = malloc(dataSize ? dataSize : 1);
+
+    if (original == NULL)
+        goto cleanup;
+
+    memcpy(original, data, dataSize);
+
+    originalSize = dataSize;
+    result = patchPlanApply(plan, &data, &dataSize);
+
+    if (!checkPatchResult(fname, result, target))
+        goto cleanup;
+
+    /* Back up only once we know the file is going to be patched (an extracted file has nothing to back up) */
+
+    if (options->fullBackup && ops->exists(ops, fname) && !backupFile(ops, fname))
+        goto cleanup;
+
+    if (!writePatchedFile(ops, fname, original, originalSize, data, dataSize))
+        goto cleanup;
+
+    free(original);
+    free(data);
+    return true;
+
+cleanup:
+    free(original);
+    free(data);
+    return false;
+}
+
+typedef struct {
+    const mfFileOps *ops;
+    const char *fname;
+} mfPagedSource;
+
+static bool readPagedSource(void *ctx, u32 offset, void *buf, u32 size) {
+    const mfPagedSource *source = (const mfPagedSource *) ctx;
+    return source->ops->readAt(source->ops, source->fname, offset, buf, size);
+}
+
+static void pagedFileInit(mfPagedFile *file, mfPagedSource *source, const mfFileOps *ops, const char *fname, long size) {
+    source->ops = ops;
+    source->fname = fname;
+
+    memset(file, 0, sizeof(mfPagedFile));
+    file->read = readPagedSource;
+    file->ctx = source;
+    file->size = (u32) size;
+}
+
+/* CRC-32 of a paged file before and after patching, the pages that are not cached are read one at a time */
+static bool crcPagedFile(mfPagedFile *file, u32 *originalCrc, u32 *patchedCrc) {
+    u8 *buf = malloc(MF_PAGE_SIZE);
+    bool success = buf != NULL;
+
+    *originalCrc = 0;
+    *patchedCrc = 0;
+
+    for (u32 offset = 0; offset < file->size && success; offset += MF_PAGE_SIZE) {
+        u32 length = file->size - offset < MF_PAGE_SIZE ? file->size - offset : MF_PAGE_SIZE;
+        const mfPatchPage *page = NULL;
+
+        for (u32 i = 0; i < file->pageCount; i++) {
+            if (file->pages[i].offset == offset)
+                page = &file->pages[i];
+        }
+
+        if (page != NULL) {
+            *originalCrc = crc32Update(*originalCrc, page->original != NULL ? page->original : page->data, length);
+            *patchedCrc = crc32Update(*patchedCrc, page->data, length);
+        } else if (file->read(file->ctx, offset, buf, length)) {
+            file->bytesRead += length;
+            *originalCrc = crc32Update(*originalCrc, buf, length);
+            *patchedCrc = crc32Update(*patchedCrc, buf, length);
+        } else {
+            success = false;
+        }
+    }
+
+    free(buf);
+    return success;
+}
+
+/* Journals the changed pages of a paged file, then writes just those back */
+static bool writePatchedPages(const mfFileOps *ops, const char *fname, mfPagedFile *file) {
+    mfJournal journal = {0};
+    bool success = false;
+
+    journal.path = fs_path_dup(fname);
+    journal.originalSize = file->size;
+    journal.patchedSize = file->size;
+
+    if (journal.path == NULL || !crcPagedFile(file, &journal.originalCrc, &journal.patchedCrc))
+        goto cleanup;
+
+    for (u32 i = 0; i < file->pageCount; i++) {
+        const mfPatchPage *page = &file->pages[i];
+
+        if (page->original != NULL && !journalAddDiff(&journal, page->offset, page->original, page->data, page->length))
+            goto cleanup;
+    }
+
+    if (!writeJournal(ops, fname, &journal))
+        goto cleanup;
+
+    for (u32 i = 0; i < file->pageCount; i++) {
+        const mfPatchPage *page = &file->pages[i];
+
+        if (page->original != NULL && !ops->writeAt(ops, fname, page->offset, page->data, page->length)) {
+            logPrintf("Error writing the patched data to the file!\n");
+            goto cleanup;
+        }
+    }
+
+    success = true;
+
+cleanup:
+    journalFree(&journal);
+    return success;
+}
+
+/*  Patches a file in place, only reading the pages the patch needs. Sets
+    *wholeFile instead if the file has to be read and patched as a whole. */
+static bool patchFilePaged(const mfFileOps *ops, const char *fname, const mfPatchPlan *plan, const mfPatchOptions *options, mfTarget *target, bool *wholeFile) {
+    mfPagedSource source;
+    mfPagedFile file;
+    mfPatchResult result;
+    long size = ops->size(ops, fname);
+    bool success = false;
+
+    *wholeFile = false;
+
+    if (size < 0) {
+        logPrintf("Error: Cannot open %s\n", fname);
+        return false;
+    }
+
+    pagedFileInit(&file, &source, ops, fname, size);
+    result = patchPlanApplyPaged(plan, &file);
+
+    /* Growing an object moves every page behind it, that takes the whole file */
+
+    if (result == MF_PATCH_NO_SPACE) {
+        logPrintf("%s has to grow, patching the whole file\n", fname);
+        *wholeFile = true;
+        goto cleanup;
+    }
+
+    if (!checkPatchResult(fname, result, target))
+        goto cleanup;
+
+    if (options->fullBackup && !backupFile(ops, fname))
+        goto cleanup;
+
+    success = writePatchedPages(ops, fname, &file);
+
+cleanup:
+    /* Everything that was read, including the checksum pass over the whole file */
+    logPrintf("Read %u of %u bytes, %u page(s) cached\n", file.bytesRead, file.size, file.pageCount);
+
+    if (target != NULL)
+        target->bytesPatched += file.bytesRead;
+
+    patchPagedFree(&file);
+    return success;
+}
+
+mfPatchResult patchProbeFile(const mfFileOps *ops, const char *fname, const mfPatchPlan *plan) {
+    mfPagedSource source;
+    mfPagedFile file;
+    mfPatchResult result;
+    long size;
+
+    assert(ops != NULL && ops->size != NULL && ops->readAt != NULL);
+    assert(fname != NULL);
+    assert(plan != NULL);
+
+    size = ops->size(ops, fname);
+
+    if (size < 0)
+        return MF_PATCH_BAD_FILE;
+
+    pagedFileInit(&file, &source, ops, fname, size);
+    result = patchPlanApplyPaged(plan, &file);
+    patchPagedFree(&file);
+    return result;
+}
+
+/* Reads a file and patches it, accounts the bytes read and the outcome in the target if given */
+static bool patchFile(const mfFileOps *ops, const char *fname, const mfPatchPlan *plan, const mfPatchOptions *options, mfTarget *target) {
+    u8 *data;
+    long dataSize = 0;
+
+    assert(fname != NULL);
+    assert(plan != NULL);
+    assert(options != NULL);
+
+    logPrintf("Patching %s\n", fname);
+
+    if (options->lowMemory && ops->readAt != NULL && ops->writeAt != NULL && ops->size != NULL) {
+        bool wholeFile;
+        bool success = patchFilePaged(ops, fname, plan, options, target, &wholeFile);
+
+        if (!wholeFile)
+            return success;
+    }
+
+    data = ops->read(ops, fname, &dataSize);
+
+    if (data == NULL)
+        return false;
+
+    if (target != NULL)
+        target->bytesPatched += dataSize;
+
+    return patchData(ops, fname, plan, options, data, dataSize, target);
+}
+
+/* Patch VMOUSE.VXD to fix mouse being faster in Windows than in DOS */
+bool patchVmouseVxd(const char *fname, const mfPatchOptions *options) {
+    return patchFile(&hostFileOps, fname, &options->vmousePlan, options, NULL);
+}
+
+/* Patch MSMOUSE.VXD to remove mouse acceleration */
+bool patchMsmouseVxd(const char *fname, const mfPatchOptions *options) {
+    return patchFile(&hostFileOps, fname, &options->msmousePlan, options, NULL);
+}
+
+typedef struct {
+    pe_task_t task;
+    void *arg;
+} mfPeTask;
+
+static void runPeTask(void *arg, u32 index) {
+    mfPeTask *peTask = (mfPeTask *) arg;
+    peTask->task(peTask->arg, index);
+}
+
+static void peParallelFor(void *ctx, size_t count, pe_task_t task, void *arg) {
+    mfPeTask peTask;
+
+    peTask.task = task;
+    peTask.arg = arg;
+    schedParallelFor((mfScheduler *) ctx, (u32) count, runPeTask, &peTask);
+}
+
+void patcherSetScheduler(mfScheduler *sched) {
+    pe_set_parallel_for(sched ? peParallelFor : NULL, sched);
+}
+
+void patcherSetCache(mfCache *cache) {
+    extractCache = cache;
+}
+
+bool patchOptionsInit(mfPatchOptions *options, bool fullBackup) {
+    assert(options != NULL);
+
+    memset(options, 0, sizeof(mfPatchOptions));
+    options->fullBackup = fullBackup;
+
+    return patchPlanCompile(&options->vmousePlan, &vmousePatchDesc)
+        && patchPlanCompile(&options->msmousePlan, &msmousePatchDesc);
+}
+
+void targetFromWindowsDir(mfTarget *target, const char *windowsDir) {
+    /* Joined with the separator of the host, the native POSIX build patches directory trees too */
+    const char vmouseVxdSub[] = PATH_SEPARATOR "SYSTEM" PATH_SEPARATOR "VMM32" PATH_SEPARATOR "VMOUSE.VXD";
+    const char vmm32VxdSub[] = PATH_SEPARATOR "SYSTEM" PATH_SEPARATOR "VMM32.VXD";
+    const char vmm32SubdirSub[] = PATH_SEPARATOR "SYSTEM" PATH_SEPARATOR "VMM32";
+    const char msmouseVxdSub[] = PATH_SEPARATOR "SYSTEM" PATH_SEPARATOR "MSMOUSE.VXD";
+
+    assert(target != NULL);
+    assert(windowsDir != NULL);
+
+    memset(target, 0, sizeof(mfTarget));
+    target->ops = &hostFileOps;
+    strncpy(target->windowsDir, windowsDir, PATH_MAX - 1);
+
+    snprintf(target->vmouseVxd, PATH_MAX, "%s%s", windowsDir, vmouseVxdSub);
+    snprintf(target->msmouseVxd, PATH_MAX, "%s%s", windowsDir, msmouseVxdSub);
+    snprintf(target->vmm32Vxd, PATH_MAX, "%s%s", windowsDir, vmm32VxdSub);
+    snprintf(target->vmm32Subdir, PATH_MAX, "%s%s", windowsDir, vmm32SubdirSub);
+}
+
+void targetFromFiles(mfTarget *target, const char *vmouseVxd, const char *msmouseVxd) {
+    assert(target != NULL);
+
+    memset(target, 0, sizeof(mfTarget));
+    target->ops = &hostFileOps;
+    strncpy(target->vmouseVxd, vmouseVxd, PATH_MAX - 1);
+    strncpy(target->msmouseVxd, msmouseVxd, PATH_MAX - 1);
+}
+
+bool targetFromImage(mfTarget *target, const char *imagePath, const char *windowsDir, bool writable) {
+    assert(target != NULL);
+    assert(imagePath != NULL);
+    assert(windowsDir != NULL);
+
+    memset(target, 0, sizeof(mfTarget));
+    target->image = imageOpen(imagePath, writable);
+
+    if (target->image == NULL)
+        return false;
+
+    target->ops = &target->image->ops;
+    strncpy(target->imagePath, imagePath, PATH_MAX - 1);
+    strncpy(target->windowsDir, windowsDir, PATH_MAX - 1);
+
+    /* / works on every host, so the journal path can be derived with the usual path functions */
+    snprintf(target->vmouseVxd, PATH_MAX, "%s/SYSTEM/VMM32/VMOUSE.VXD", windowsDir);
+    snprintf(target->msmouseVxd, PATH_MAX, "%s/SYSTEM/MSMOUSE.VXD", windowsDir);
+    snprintf(target->vmm32Vxd, PATH_MAX, "%s/SYSTEM/VMM32.VXD", windowsDir);
+    snprintf(target->vmm32Subdir, PATH_MAX, "%s/SYSTEM/VMM32", windowsDir);
+    return true;
+}
+
+void targetClose(mfTarget *target) {
+    assert(target != NULL);
+
+    imageClose(target->image);
+    target->image = NULL;
+
+    free(target->vmouseData);
+    target->vmouseData = NULL;
+}
+
+/* Extracts VMOUSE.VXD from VMM32.VXD into memory, it is written out once patched */
+static bool extractVmouse(mfTarget *target) {
+    const mfFileOps *ops = target->ops;
+    u8 *vmm32;
+    long vmm32Size;
+    u8 *vmouse = NULL;
+    size_t vmouseSize = 0;
+    mfCacheKey key;
+    int status;
+    double start = traceBegin();
+
+    vmm32 = ops->read(ops, target->vmm32Vxd, &vmm32Size);
+
+    if (vmm32 == NULL)
+        return false;
+
+    /* Identical VMM32.VXD files are only decompressed once, whichever installation they are in */
+
+    if (extractCache != NULL) {
+        cacheKeyFromData(&key, vmm32, (size_t) vmm32Size);
+        vmouse = cacheBegin(extractCache, &key, "VMOUSE.VXD", &vmouseSize);
+    }
+
+    if (vmouse != NULL) {
+        logPrintf("Using cached VMOUSE.VXD for this VMM32.VXD\n");
+        status = PATCH_OK;
+    } else {
+        status = wx_unpack_mem(vmm32, (size_t) vmm32Size, "VMOUSE.VXD", &vmouse, &vmouseSize);
+
+        if (extractCache != NULL)
+            cacheEnd(extractCache, &key, "VMOUSE.VXD", status == PATCH_OK ? vmouse : NULL, vmouseSize);
+    }
+
+    free(vmm32);
+    traceSpan("extract", target->vmm32Vxd, start, (u64) vmm32Size, status == PATCH_OK ? (u64) vmouseSize : 0);
+
+    if (status != PATCH_OK) {
+        logPrintf("Error: Cannot extract VMOUSE.VXD from %s (error %d)\n", target->vmm32Vxd, status);
+        return false;
+    }
+
+    target->vmouseData = vmouse;
+    target->vmouseSize = (long) vmouseSize;
+    return true;
+}
+
+bool targetPrepare(mfTarget *target) {
+    const mfFileOps *ops;
+
+    assert(target != NULL);
+
+    ops = target->ops;
+
+    if (!ops->exists(ops, target->msmouseVxd)) {
+        logPrintf("Error: MSMOUSE not found in expected path (%s)\n", target->msmouseVxd);
+        return false;
+    }
+
+    /* if we are operating on a windows directory, we need to treat vmouse special*/
+
+    if (!ops->exists(ops, target->vmouseVxd) && target->windowsDir[0] != 0x00 && ops->exists(ops, target->vmm32Vxd)) {
+
+        /* VMOUSE does not exist but VMM32 does, so we can extract it */
+
+        logPrintf("VMOUSE not found, attempting to extract from VMM32.VXD\n");
+
+        return extractVmouse(target);
+    }
+
+    if (!ops->exists(ops, target->vmouseVxd)) {
+        logPrintf("Error: VMOUSE not found in expected path (%s)\n", target->vmouseVxd);
+        return false;
+    }
+
+    return true;
+}
+
+bool patchTarget(mfTarget *target, const mfPatchOptions *options) {
+    bool success = true;
+    double start = traceBegin();
+
+    assert(target != NULL);
+    assert(options != NULL);
+
+    target->bytesPatched = 0;
+    target->alreadyPatched = 0;
+
+    if (target->vmouseData != NULL) {
+        /* Extracted by targetPrepare: patched in memory and written once, into the new VMM32 directory */
+
+        u8 *data = target->vmouseData;
+
+        target->vmouseData = NULL;
+        target->bytesPatched += target->vmouseSize;
+        logPrintf("Patching %s (extracted from %s)\n", target->vmouseVxd, target->vmm32Vxd);
+
+        if (!target->ops->makeDirectory(target->ops, target->vmm32Subdir)
+         || !patchData(target->ops, target->vmouseVxd, &options->vmousePlan, options, data, target->vmouseSize, target)) {
+            logPrintf("VMOUSE.VXD patching failed!\n");
+            success = false;
+        }
+    } else if (!patchFile(target->ops, target->vmouseVxd, &options->vmousePlan, options, target)) {
+        logPrintf("VMOUSE.VXD patching failed!\n");
+        success = false;
+    }
+
+    traceSpan("patch", target->vmouseVxd, start, 0, 0);
+    logPrintf("\n");
+    start = traceBegin();
+
+    if (!patchFile(target->ops, target->msmouseVxd, &options->msmousePlan, options, target)) {
+        logPrintf("MSMOUSE.VXD patching failed!\n");
+        success = false;
+    }
+
+    traceSpan("patch", target->msmouseVxd, start, 0, 0);
+
+    return success;
+}
+
+bool undoTarget(const mfTarget *target) {
+    bool success = true;
+
+    assert(target != NULL);
+
+    if (!journalUndo(target->ops, target->vmouseVxd)) {
+        logPrintf("VMOUSE.VXD restore failed!\n");
+        success = false;
+    }
+
+    logPrintf("\n");
+
+    if (!journalUndo(target->ops, target->msmouseVxd)) {
+        logPrintf("MSMOUSE.VXD restore failed!\n");
+        success = false;
+    }
+
+    return success;
+}
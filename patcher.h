@@ -0,0 +1,77 @@
+#ifndef _MF_PATCHER_H_
+#define _MF_PATCHER_H_
+
+#include <limits.h>
+
+#include "util.h"
+#include "patch.h"
+#include "sched.h"
+#include "fileops.h"
+#include "image.h"
+#include "cache.h"
+
+/*  Patching of one Windows installation (or one pair of driver files).
+    Everything here reports through logPrintf and keeps its state in the
+    target, so several targets can be patched from different threads. */
+
+typedef struct {
+    bool fullBackup;                /* Also keep a full copy of the original next to the file */
+    bool lowMemory;                 /* Patch files in place, reading only the pages that are searched or changed */
+    mfPatchPlan vmousePlan;
+    mfPatchPlan msmousePlan;
+} mfPatchOptions;
+
+typedef struct {
+    const mfFileOps *ops;           /* Where the files below live */
+    mfImage *image;                 /* Disk image the files are in, NULL for host files */
+    char imagePath[PATH_MAX];
+    char windowsDir[PATH_MAX];      /* Empty if the driver files were given directly */
+    char vmouseVxd[PATH_MAX];
+    char msmouseVxd[PATH_MAX];
+    char vmm32Vxd[PATH_MAX];
+    char vmm32Subdir[PATH_MAX];
+    u8 *vmouseData;                 /* VMOUSE.VXD extracted from VMM32.VXD, only written once patched */
+    long vmouseSize;
+    long bytesPatched;              /* Bytes of the files read by patchTarget */
+    u32 alreadyPatched;             /* Drivers patchTarget found patched already */
+} mfTarget;
+
+/* VMOUSE.VXD and MSMOUSE.VXD */
+#define MF_TARGET_DRIVERS           (2)
+
+/* Compiles the patch plans, returns false if a patch description is broken */
+bool patchOptionsInit(mfPatchOptions *options, bool fullBackup);
+
+void targetFromWindowsDir(mfTarget *target, const char *windowsDir);
+void targetFromFiles(mfTarget *target, const char *vmouseVxd, const char *msmouseVxd);
+
+/*  Opens a raw FAT disk image and targets the Windows directory inside it.
+    The journals (and backups) are written into the image as well. */
+bool targetFromImage(mfTarget *target, const char *imagePath, const char *windowsDir, bool writable);
+
+/* Releases what the target holds, writes back an image */
+void targetClose(mfTarget *target);
+
+/* Checks that both drivers exist, extracts VMOUSE.VXD from VMM32.VXD into memory if necessary */
+bool targetPrepare(mfTarget *target);
+
+/* Patches both drivers, returns false if either failed */
+bool patchTarget(mfTarget *target, const mfPatchOptions *options);
+
+/*  Runs a patch plan on a file without writing anything, reading only the
+    pages the plan needs. MF_PATCH_OK means the file can be patched. */
+mfPatchResult patchProbeFile(const mfFileOps *ops, const char *fname, const mfPatchPlan *plan);
+
+/* Restores both drivers from their undo journals */
+bool undoTarget(const mfTarget *target);
+
+/* Decompresses VMM32.VXD chunks on the scheduler, NULL to decompress them one by one */
+void patcherSetScheduler(mfScheduler *sched);
+
+/* Looks up VMOUSE.VXD extracted from VMM32.VXD in the cache before decompressing it, NULL for no cache */
+void patcherSetCache(mfCache *cache);
+
+bool patchVmouseVxd(const char *fname, const mfPatchOptions *options);
+bool patchMsmouseVxd(const char *fname, const mfPatchOptions *options);
+
+#endif
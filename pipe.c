@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "pipe.h"
+#include "libmousefix.h"
+#include "platform.h"
+
+#define PIPE_DEFAULT_MEMBER         "VMOUSE.VXD"
+#define PIPE_READ_SIZE              (64 * 1024)
+
+static void pipeLog(void *ctx, const char *text) {
+    (void) ctx;
+    fputs(text, stderr);
+}
+
+/*  Pipes cannot seek, and the LE layout has to be known before any page can be
+    patched (growing an object moves everything behind it). The input is small,
+    so it is simply collected in one buffer. */
+static u8 *readInput(FILE *in, size_t *size) {
+    u8 *data = NULL;
+    size_t capacity = 0;
+    size_t done;
+
+    *size = 0;
+
+    for (;;) {
+        if (capacity - *size < PIPE_READ_SIZE) {
+            u8 *grown = realloc(data, capacity + PIPE_READ_SIZE * 4);
+
+            if (grown == NULL) {
+                free(data);
+                return NULL;
+            }
+
+            data = grown;
+            capacity += PIPE_READ_SIZE * 4;
+        }
+
+        done = fread(data + *size, 1, capacity - *size, in);
+        *size += done;
+
+        if (done == 0)
+            break;
+    }
+
+    if (ferror(in)) {
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+static const char *variantName(mfVariant variant) {
+    switch (variant) {
+        case MF_VARIANT_VXD_ARCHIVE:    return "VMM32.VXD (W3)";
+        case MF_VARIANT_VXD_ARCHIVE_W4: return "VMM32.VXD (W4)";
+        case MF_VARIANT_CABINET:        return "cabinet";
+        case MF_VARIANT_VXD:            return "VxD";
+        case MF_VARIANT_VMOUSE:         return "VMOUSE.VXD";
+        case MF_VARIANT_MSMOUSE:        return "MSMOUSE.VXD";
+        default:                        return "unknown file";
+    }
+}
+
+bool pipeRun(const mfPipeOptions *options) {
+    mfLibConfig config;
+    mfLib *lib;
+    u8 *input;
+    size_t inputSize;
+    uint8_t *extracted = NULL;
+    size_t extractedSize = 0;
+    uint8_t *output = NULL;
+    size_t outputSize = 0;
+    const uint8_t *driver;
+    size_t driverSize;
+    mfVariant variant;
+    mfLibResult result = MF_LIB_OK;
+    bool success = false;
+
+    assert(options != NULL);
+
+    memset(&config, 0, sizeof(config));
+    config.log = pipeLog;
+
+    stdioBinary();
+
+    lib = mfLibCreate(&config);
+    input = readInput(stdin, &inputSize);
+
+    if (lib == NULL || input == NULL) {
+        fprintf(stderr, "Error: Cannot read the input\n");
+        goto cleanup;
+    }
+
+    variant = mfLibDetect(lib, input, inputSize);
+    fprintf(stderr, "Input: %s, %lu bytes\n", variantName(variant), (unsigned long) inputSize);
+
+    driver = input;
+    driverSize = inputSize;
+
+    if (variant == MF_VARIANT_VXD_ARCHIVE || variant == MF_VARIANT_VXD_ARCHIVE_W4 || variant == MF_VARIANT_CABINET) {
+        const char *member = options->member ? options->member : PIPE_DEFAULT_MEMBER;
+
+        result = mfLibExtract(lib, input, inputSize, member, &extracted, &extractedSize);
+
+        if (result != MF_LIB_OK) {
+            fprintf(stderr, "Error: Cannot extract %s: %s\n", member, mfLibResultString(result));
+            goto cleanup;
+        }
+
+        fprintf(stderr, "Extracted %s, %lu bytes\n", member, (unsigned long) extractedSize);
+
+        driver = extracted;
+        driverSize = extractedSize;
+        variant = mfLibDetect(lib, driver, driverSize);
+    }
+
+    if (options->extractOnly) {
+        if (extracted == NULL) {
+            fprintf(stderr, "Error: The input is not an archive, nothing to extract\n");
+            goto cleanup;
+        }
+
+        output = extracted;
+        outputSize = extractedSize;
+        extracted = NULL;
+    } else if (variant == MF_VARIANT_VMOUSE) {
+        result = mfLibPatchVmouse(lib, driver, driverSize, &output, &outputSize);
+    } else if (variant == MF_VARIANT_MSMOUSE) {
+        result = mfLibPatchMsmouse(lib, driver, driverSize, &output, &outputSize);
+    } else {
+        fprintf(stderr, "Error: Not a supported VMOUSE.VXD or MSMOUSE.VXD\n");
+        goto cleanup;
+    }
+
+    if (result != MF_LIB_OK) {
+        fprintf(stderr, "Error: Cannot patch: %s\n", mfLibResultString(result));
+        goto cleanup;
+    }
+
+    if (fwrite(output, 1, outputSize, stdout) != outputSize || fflush(stdout) != 0) {
+        fprintf(stderr, "Error: Cannot write the output\n");
+        goto cleanup;
+    }
+
+    fprintf(stderr, "Wrote %lu bytes\n", (unsigned long) outputSize);
+    success = true;
+
+cleanup:
+    if (lib != NULL) {
+        mfLibFree(lib, extracted);
+        mfLibFree(lib, output);
+        mfLibDestroy(lib);
+    }
+
+    free(input);
+    return success;
+}
@@ -0,0 +1,21 @@
+#ifndef _MF_PIPE_H_
+#define _MF_PIPE_H_
+
+#include "util.h"
+
+/*  Pipeline mode: one file comes in on stdin, the result goes out on stdout
+    and everything else is written to stderr.
+
+    A driver (VMOUSE.VXD or MSMOUSE.VXD, told apart by their contents) is
+    patched. From VMM32.VXD or an install cabinet a driver is extracted and
+    patched, unless only the extraction is wanted. */
+
+typedef struct {
+    const char *member;             /* Driver to take from an archive, NULL for VMOUSE.VXD */
+    bool extractOnly;               /* Write out the extracted driver unpatched */
+} mfPipeOptions;
+
+/* Nothing is written to stdout unless the whole file could be processed */
+bool pipeRun(const mfPipeOptions *options);
+
+#endif
@@ -0,0 +1,210 @@
+#include <assert.h>
+#include <time.h>
+
+#include "platform.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+static DWORD WINAPI threadEntry(LPVOID arg) {
+    mfThread *thread = (mfThread *) arg;
+    thread->func(thread->arg);
+    return 0;
+}
+#else
+static void *threadEntry(void *arg) {
+    mfThread *thread = (mfThread *) arg;
+    thread->func(thread->arg);
+    return NULL;
+}
+#endif
+
+bool threadStart(mfThread *thread, mfThreadFunc func, void *arg) {
+    assert(thread != NULL);
+    assert(func != NULL);
+
+    thread->func = func;
+    thread->arg = arg;
+
+#ifdef _WIN32
+    thread->handle = CreateThread(NULL, 0, threadEntry, thread, 0, NULL);
+    return thread->handle != NULL;
+#else
+    return 0 == pthread_create(&thread->handle, NULL, threadEntry, thread);
+#endif
+}
+
+void threadJoin(mfThread *thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join(thread->handle, NULL);
+#endif
+}
+
+void mutexInit(mfMutex *mutex) {
+#ifdef _WIN32
+    InitializeCriticalSection(&mutex->cs);
+#else
+    pthread_mutex_init(&mutex->mutex, NULL);
+#endif
+}
+
+void mutexDestroy(mfMutex *mutex) {
+#ifdef _WIN32
+    DeleteCriticalSection(&mutex->cs);
+#else
+    pthread_mutex_destroy(&mutex->mutex);
+#endif
+}
+
+void mutexLock(mfMutex *mutex) {
+#ifdef _WIN32
+    EnterCriticalSection(&mutex->cs);
+#else
+    pthread_mutex_lock(&mutex->mutex);
+#endif
+}
+
+void mutexUnlock(mfMutex *mutex) {
+#ifdef _WIN32
+    LeaveCriticalSection(&mutex->cs);
+#else
+    pthread_mutex_unlock(&mutex->mutex);
+#endif
+}
+
+long atomicIncrement(volatile long *value) {
+#ifdef _WIN32
+    return InterlockedIncrement(value);
+#else
+    return __sync_add_and_fetch(value, 1);
+#endif
+}
+
+long atomicDecrement(volatile long *value) {
+#ifdef _WIN32
+    return InterlockedDecrement(value);
+#else
+    return __sync_sub_and_fetch(value, 1);
+#endif
+}
+
+long atomicRead(volatile long *value) {
+#ifdef _WIN32
+    return InterlockedCompareExchange(value, 0, 0);
+#else
+    return __sync_add_and_fetch(value, 0);
+#endif
+}
+
+void threadYield(void) {
+#ifdef _WIN32
+    Sleep(0);
+#else
+    sched_yield();
+#endif
+}
+
+void threadSleep(u32 milliseconds) {
+#ifdef _WIN32
+    Sleep(milliseconds);
+#else
+    struct timespec ts;
+
+    ts.tv_sec = milliseconds / 1000;
+    ts.tv_nsec = (long) (milliseconds % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+double timeNow(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double) counter.QuadPart / (double) frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#endif
+}
+
+bool timeLocal(struct tm *tm) {
+    time_t now = time(NULL);
+
+    assert(tm != NULL);
+
+#if defined(__WATCOMC__)
+    return _localtime(&now, tm) != NULL;
+#elif defined(_WIN32)
+    return localtime_s(tm, &now) == 0;
+#else
+    return localtime_r(&now, tm) != NULL;
+#endif
+}
+
+bool fileStat(const char *path, u64 *size, u64 *modified) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        return false;
+
+    *size = ((u64) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    *modified = ((u64) data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    return true;
+#else
+    struct stat st;
+
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+
+    *size = (u64) st.st_size;
+#if defined(__APPLE__)
+    *modified = (u64) st.st_mtimespec.tv_sec * 1000000000 + (u64) st.st_mtimespec.tv_nsec;
+#else
+    *modified = (u64) st.st_mtim.tv_sec * 1000000000 + (u64) st.st_mtim.tv_nsec;
+#endif
+    return true;
+#endif
+}
+
+u32 processId(void) {
+#ifdef _WIN32
+    return (u32) GetCurrentProcessId();
+#else
+    return (u32) getpid();
+#endif
+}
+
+u32 cpuCount(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u32) count : 1;
+#endif
+}
+
+void stdioBinary(void) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+}
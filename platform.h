@@ -0,0 +1,77 @@
+#ifndef _MF_PLATFORM_H_
+#define _MF_PLATFORM_H_
+
+#include <time.h>
+
+#include "util.h"
+
+/*  Minimal threading and timing layer: Win32 threads and critical sections on
+    Windows, pthreads everywhere else. Only what the batch mode needs, plus the
+    odd bit of console handling. */
+
+#ifdef _WIN32
+#include <windows.h>
+#define MF_THREAD_LOCAL             __declspec(thread)
+#else
+#include <pthread.h>
+#define MF_THREAD_LOCAL             __thread
+#endif
+
+typedef void (*mfThreadFunc)(void *arg);
+
+typedef struct {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    mfThreadFunc func;
+    void *arg;
+} mfThread;
+
+typedef struct {
+#ifdef _WIN32
+    CRITICAL_SECTION cs;
+#else
+    pthread_mutex_t mutex;
+#endif
+} mfMutex;
+
+bool threadStart(mfThread *thread, mfThreadFunc func, void *arg);
+void threadJoin(mfThread *thread);
+
+void mutexInit(mfMutex *mutex);
+void mutexDestroy(mfMutex *mutex);
+void mutexLock(mfMutex *mutex);
+void mutexUnlock(mfMutex *mutex);
+
+/* Atomically increments / decrements *value, returns the new value */
+long atomicIncrement(volatile long *value);
+long atomicDecrement(volatile long *value);
+
+/* Reads *value with a full barrier, so everything written before the value changed is visible */
+long atomicRead(volatile long *value);
+
+/* Gives up the rest of the time slice / sleeps for some milliseconds */
+void threadYield(void);
+void threadSleep(u32 milliseconds);
+
+/* Monotonic time in seconds, only useful for differences */
+double timeNow(void);
+
+/* Current local time, thread safe unlike localtime */
+bool timeLocal(struct tm *tm);
+
+/* Size and modification time (as precise as the host has it, only useful for comparisons) of a file, false if it does not exist */
+bool fileStat(const char *path, u64 *size, u64 *modified);
+
+/* ID of the running process, to name files that other processes must not touch */
+u32 processId(void);
+
+/* Number of logical processors, at least 1 */
+u32 cpuCount(void);
+
+/* Switches stdin and stdout to binary mode, so piped files are not mangled (only does something on Windows) */
+void stdioBinary(void);
+
+#endif
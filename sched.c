@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "sched.h"
+#include "platform.h"
+
+#define SCHED_INITIAL_CAPACITY      (64)
+#define SCHED_SPINS_BEFORE_SLEEP    (64)
+
+typedef struct {
+    mfTaskFunc func;
+    void *arg;
+    u32 index;
+    mfTaskGroup *group;
+} mfTask;
+
+/* Ring buffer, the owner works at the back, thieves take from the front */
+typedef struct {
+    mfMutex lock;
+    mfTask *tasks;
+    u32 capacity;
+    u32 front;
+    u32 count;
+} mfDeque;
+
+typedef struct {
+    mfScheduler *sched;
+    u32 index;
+} mfWorker;
+
+struct mfScheduler {
+    u32 workerCount;                /* Workers that are actually running */
+    u32 dequeCount;                 /* One per requested worker, plus the last one shared by outside threads */
+    mfDeque *deques;
+    mfThread *threads;
+    mfWorker *workers;
+    volatile long stop;
+};
+
+/* Which scheduler and deque the current thread works on, if it is a worker */
+static MF_THREAD_LOCAL mfScheduler *currentScheduler = NULL;
+static MF_THREAD_LOCAL u32 currentWorker = 0;
+
+static bool dequePushBack(mfDeque *deque, const mfTask *task) {
+    bool success = true;
+
+    mutexLock(&deque->lock);
+
+    if (deque->count == deque->capacity) {
+        u32 capacity = deque->capacity ? deque->capacity * 2 : SCHED_INITIAL_CAPACITY;
+        mfTask *tasks = malloc(capacity * sizeof(mfTask));
+
+        if (tasks == NULL) {
+            success = false;
+            goto cleanup;
+        }
+
+        for (u32 i = 0; i < deque->count; i++) {
+            tasks[i] = deque->tasks[(deque->front + i) % deque->capacity];
+        }
+
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->front = 0;
+    }
+
+    deque->tasks[(deque->front + deque->count) % deque->capacity] = *task;
+    deque->count++;
+
+cleanup:
+    mutexUnlock(&deque->lock);
+    return success;
+}
+
+static bool dequePopBack(mfDeque *deque, mfTask *task) {
+    bool found = false;
+
+    mutexLock(&deque->lock);
+
+    if (deque->count > 0) {
+        deque->count--;
+        *task = deque->tasks[(deque->front + deque->count) % deque->capacity];
+        found = true;
+    }
+
+    mutexUnlock(&deque->lock);
+    return found;
+}
+
+static bool dequePopFront(mfDeque *deque, mfTask *task) {
+    bool found = false;
+
+    mutexLock(&deque->lock);
+
+    if (deque->count > 0) {
+        *task = deque->tasks[deque->front];
+        deque->front = (deque->front + 1) % deque->capacity;
+        deque->count--;
+        found = true;
+    }
+
+    mutexUnlock(&deque->lock);
+    return found;
+}
+
+/* Deque of the calling thread: its own for workers, the shared one for everybody else */
+static u32 ownDeque(const mfScheduler *sched) {
+    return currentScheduler == sched ? currentWorker : sched->dequeCount - 1;
+}
+
+/* Runs one task: the newest of our own, or the oldest of somebody else's. Returns false if there was nothing to do */
+static bool runOneTask(mfScheduler *sched) {
+    u32 own = ownDeque(sched);
+    u32 dequeCount = sched->dequeCount;
+    mfTask task;
+    bool found = dequePopBack(&sched->deques[own], &task);
+
+    for (u32 i = 1; !found && i < dequeCount; i++) {
+        found = dequePopFront(&sched->deques[(own + i) % dequeCount], &task);
+    }
+
+    if (!found)
+        return false;
+
+    task.func(task.arg, task.index);
+    atomicDecrement(&task.group->pending);
+    return true;
+}
+
+static void workerMain(void *arg) {
+    mfWorker *worker = (mfWorker *) arg;
+    mfScheduler *sched = worker->sched;
+    u32 idle = 0;
+
+    currentScheduler = sched;
+    currentWorker = worker->index;
+
+    while (!atomicRead(&sched->stop)) {
+        if (runOneTask(sched)) {
+            idle = 0;
+        } else if (++idle < SCHED_SPINS_BEFORE_SLEEP) {
+            threadYield();
+        } else {
+            threadSleep(1);
+        }
+    }
+
+    currentScheduler = NULL;
+}
+
+mfScheduler *schedCreate(u32 workerCount) {
+    mfScheduler *sched = calloc(1, sizeof(mfScheduler));
+
+    if (sched == NULL)
+        return NULL;
+
+    sched->deques = calloc(workerCount + 1, sizeof(mfDeque));
+    sched->threads = calloc(workerCount ? workerCount : 1, sizeof(mfThread));
+    sched->workers = calloc(workerCount ? workerCount : 1, sizeof(mfWorker));
+
+    if (sched->deques == NULL || sched->threads == NULL || sched->workers == NULL) {
+        free(sched->deques);
+        free(sched->threads);
+        free(sched->workers);
+        free(sched);
+        return NULL;
+    }
+
+    sched->dequeCount = workerCount + 1;
+
+    for (u32 i = 0; i < sched->dequeCount; i++) {
+        mutexInit(&sched->deques[i].lock);
+    }
+
+    /*  If a thread does not start, the ones that did (and the waiting threads)
+        still get everything done. Deques of missing workers just stay empty. */
+
+    for (u32 i = 0; i < workerCount; i++) {
+        sched->workers[sched->workerCount].sched = sched;
+        sched->workers[sched->workerCount].index = sched->workerCount;
+
+        if (!threadStart(&sched->threads[sched->workerCount], workerMain, &sched->workers[sched->workerCount]))
+            break;
+
+        sched->workerCount++;
+    }
+
+    return sched;
+}
+
+void schedDestroy(mfScheduler *sched) {
+    if (sched == NULL)
+        return;
+
+    atomicIncrement(&sched->stop);
+
+    for (u32 i = 0; i < sched->workerCount; i++) {
+        threadJoin(&sched->threads[i]);
+    }
+
+    for (u32 i = 0; i < sched->dequeCount; i++) {
+        mutexDestroy(&sched->deques[i].lock);
+        free(sched->deques[i].tasks);
+    }
+
+    free(sched->deques);
+    free(sched->threads);
+    free(sched->workers);
+    free(sched);
+}
+
+u32 schedWorkerCount(const mfScheduler *sched) {
+    return sched->workerCount;
+}
+
+void schedSpawn(mfScheduler *sched, mfTaskGroup *group, mfTaskFunc func, void *arg, u32 index) {
+    mfTask task;
+
+    assert(sched != NULL);
+    assert(group != NULL);
+    assert(func != NULL);
+
+    task.func = func;
+    task.arg = arg;
+    task.index = index;
+    task.group = group;
+
+    atomicIncrement(&group->pending);
+
+    if (!dequePushBack(&sched->deques[ownDeque(sched)], &task)) {
+        /* Out of memory for the queue, just run it right away */
+        func(arg, index);
+        atomicDecrement(&group->pending);
+    }
+}
+
+void schedWait(mfScheduler *sched, mfTaskGroup *group) {
+    assert(sched != NULL);
+    assert(group != NULL);
+
+    while (atomicRead(&group->pending) > 0) {
+        if (!runOneTask(sched))
+            threadYield();
+    }
+}
+
+void schedParallelFor(mfScheduler *sched, u32 count, mfTaskFunc func, void *arg) {
+    mfTaskGroup group = {0};
+
+    for (u32 i = 0; i < count; i++) {
+        schedSpawn(sched, &group, func, arg, i);
+    }
+
+    schedWait(sched, &group);
+}
@@ -0,0 +1,42 @@
+#ifndef _MF_SCHED_H_
+#define _MF_SCHED_H_
+
+#include "util.h"
+
+/*  Work-stealing task scheduler.
+
+    Every worker thread owns a deque of tasks. It pushes and pops its own tasks
+    at the back (newest first), idle workers steal from the front of the other
+    deques (oldest first). Threads that are not workers of the scheduler put
+    their tasks into an extra shared deque.
+
+    Waiting for a task group never blocks a thread: until the group is done,
+    the waiting thread runs tasks itself, its own first, then stolen ones. So
+    tasks can spawn and wait for more tasks (e.g. a batch target decompressing
+    chunks of VMM32.VXD) and idle workers pick up those nested tasks too.
+*/
+
+typedef struct mfScheduler mfScheduler;
+
+typedef void (*mfTaskFunc)(void *arg, u32 index);
+
+typedef struct {
+    volatile long pending;          /* Tasks spawned into the group that have not finished yet */
+} mfTaskGroup;
+
+/* Starts a scheduler with the given number of worker threads. 0 is fine, then waiting threads do all the work */
+mfScheduler *schedCreate(u32 workerCount);
+void schedDestroy(mfScheduler *sched);
+
+u32 schedWorkerCount(const mfScheduler *sched);
+
+/* Queues func(arg, index) as part of group */
+void schedSpawn(mfScheduler *sched, mfTaskGroup *group, mfTaskFunc func, void *arg, u32 index);
+
+/* Runs tasks until every task of group has finished */
+void schedWait(mfScheduler *sched, mfTaskGroup *group);
+
+/* Runs func(arg, 0) ... func(arg, count - 1) in parallel and waits for all of them */
+void schedParallelFor(mfScheduler *sched, u32 count, mfTaskFunc func, void *arg);
+
+#endif
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "state.h"
+#include "platform.h"
+
+#define STATE_HEADER                "# MouseFix batch state 1"
+#define STATE_READ_SIZE             (64 * 1024)
+#define STATE_TEMP_EXTENSION        ".tmp"
+
+/* Order of the entries, so targets are found by binary search */
+static int compareTarget(const char *firstA, const char *secondA, const char *firstB, const char *secondB) {
+    int result = strcmp(firstA, firstB);
+
+    if (result != 0)
+        return result;
+
+    return strcmp(secondA ? secondA : "", secondB ? secondB : "");
+}
+
+static int compareEntries(const void *a, const void *b) {
+    const mfStateEntry *entryA = (const mfStateEntry *) a;
+    const mfStateEntry *entryB = (const mfStateEntry *) b;
+
+    return compareTarget(entryA->first, entryA->second, entryB->first, entryB->second);
+}
+
+/* Index of the entry of a target, or where it would have to be inserted */
+static long stateSearch(const mfState *state, const char *first, const char *second, bool *found) {
+    long low = 0;
+    long high = state->count;
+
+    *found = false;
+
+    while (low < high) {
+        long middle = low + (high - low) / 2;
+        int result = compareTarget(state->entries[middle].first, state->entries[middle].second, first, second);
+
+        if (result == 0) {
+            *found = true;
+            return middle;
+        }
+
+        if (result < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+/* Splits off the next tab separated field of a line, NULL at the end of the line */
+static char *nextField(char **cursor) {
+    char *field = *cursor;
+    char *tab;
+
+    if (field == NULL)
+        return NULL;
+
+    tab = strchr(field, '\t');
+
+    if (tab != NULL)
+        *tab++ = 0x00;
+
+    *cursor = tab;
+    return field;
+}
+
+static bool parseFile(const char *field, mfStateFile *file) {
+    unsigned long long size;
+    unsigned long long modified;
+    unsigned long long hash;
+
+    memset(file, 0, sizeof(mfStateFile));
+
+    if (0 == strcmp(field, "-"))
+        return true;
+
+    if (sscanf(field, "%llu %llu %llx", &size, &modified, &hash) != 3)
+        return false;
+
+    file->present = true;
+    file->size = size;
+    file->modified = modified;
+    file->hash = hash;
+    return true;
+}
+
+static bool stateAppend(mfState *state, const mfStateEntry *entry) {
+    mfStateEntry *copy;
+
+    if (state->count == state->capacity) {
+        long capacity = state->capacity ? state->capacity * 2 : 256;
+        mfStateEntry *entries = realloc(state->entries, capacity * sizeof(mfStateEntry));
+
+        if (entries == NULL)
+            return false;
+
+        state->entries = entries;
+        state->capacity = capacity;
+    }
+
+    copy = &state->entries[state->count];
+    *copy = *entry;
+    copy->first = strdup(entry->first);
+    copy->second = entry->second ? strdup(entry->second) : NULL;
+
+    if (copy->first == NULL || (entry->second != NULL && copy->second == NULL)) {
+        free(copy->first);
+        free(copy->second);
+        return false;
+    }
+
+    state->count++;
+    return true;
+}
+
+bool stateLoad(mfState *state, const char *path) {
+    long size;
+    u64 fileSize;
+    u64 modified;
+    char *text;
+    char *line;
+    u32 lineNumber = 0;
+    bool success = false;
+
+    assert(state != NULL);
+    assert(path != NULL);
+
+    memset(state, 0, sizeof(mfState));
+
+    /* The first run starts without one */
+    if (!fileStat(path, &fileSize, &modified))
+        return true;
+
+    text = (char *) openAndReadWholeFile(path, &size);
+
+    if (text == NULL) {
+        printf("Error: Cannot read state %s\n", path);
+        return false;
+    }
+
+    line = realloc(text, size + 1);
+
+    if (line == NULL)
+        goto cleanup;
+
+    text = line;
+    text[size] = 0x00;
+
+    for (line = text; line != NULL && *line != 0x00; ) {
+        char *end = strchr(line, '\n');
+        char *cursor = line;
+        char *outcome;
+        mfStateEntry entry;
+        bool valid;
+
+        if (end != NULL)
+            *end++ = 0x00;
+
+        if (strchr(line, '\r') != NULL)
+            *strchr(line, '\r') = 0x00;
+
+        lineNumber++;
+
+        if (line[0] == '#' || line[0] == 0x00) {
+            line = end;
+            continue;
+        }
+
+        memset(&entry, 0, sizeof(entry));
+        outcome = nextField(&cursor);
+        entry.first = nextField(&cursor);
+        entry.second = nextField(&cursor);
+        entry.success = 0 == strcmp(outcome, "ok");
+
+        valid = entry.first != NULL && entry.second != NULL && (entry.success || 0 == strcmp(outcome, "failed"));
+
+        for (u32 i = 0; valid && i < MF_STATE_INPUTS; i++) {
+            char *field = nextField(&cursor);
+            valid = field != NULL && parseFile(field, &entry.files[i]);
+        }
+
+        if (!valid) {
+            printf("Error: %s line %u is not a target state\n", path, lineNumber);
+            goto cleanup;
+        }
+
+        if (0 == strcmp(entry.second, "-"))
+            entry.second = NULL;
+
+        if (!stateAppend(state, &entry))
+            goto cleanup;
+
+        line = end;
+    }
+
+    qsort(state->entries, state->count, sizeof(mfStateEntry), compareEntries);
+    success = true;
+
+cleanup:
+    free(text);
+
+    if (!success)
+        stateFree(state);
+
+    return success;
+}
+
+bool stateSave(const mfState *state, const char *path) {
+    char *tempPath = malloc(strlen(path) + sizeof(STATE_TEMP_EXTENSION));
+    FILE *f;
+    bool success;
+
+    assert(state != NULL);
+
+    if (tempPath == NULL)
+        return false;
+
+    strcpy(tempPath, path);
+    strcat(tempPath, STATE_TEMP_EXTENSION);
+
+    f = fopen(tempPath, "w");
+    success = f != NULL && fprintf(f, "%s\n", STATE_HEADER) > 0;
+
+    for (long i = 0; success && i < state->count; i++) {
+        const mfStateEntry *entry = &state->entries[i];
+
+        success = fprintf(f, "%s\t%s\t%s", entry->success ? "ok" : "failed", entry->first, entry->second ? entry->second : "-") > 0;
+
+        for (u32 n = 0; success && n < MF_STATE_INPUTS; n++) {
+            const mfStateFile *file = &entry->files[n];
+
+            if (file->present)
+                success = fprintf(f, "\t%llu %llu %08x%08x", (unsigned long long) file->size, (unsigned long long) file->modified,
+                    (u32) (file->hash >> 32), (u32) file->hash) > 0;
+            else
+                success = fprintf(f, "\t-") > 0;
+        }
+
+        success = success && fprintf(f, "\n") > 0;
+    }
+
+    if (f != NULL && fclose(f) != 0)
+        success = false;
+
+    /*  Replaced only once it is complete, an interrupted run leaves the old
+        state behind. Where rename does not replace files (Windows), the old
+        one has to go first. */
+
+    if (success && rename(tempPath, path) != 0) {
+        remove(path);
+        success = rename(tempPath, path) == 0;
+    }
+
+    if (!success) {
+        printf("Error: Cannot write state %s\n", path);
+        remove(tempPath);
+    }
+
+    free(tempPath);
+    return success;
+}
+
+void stateFree(mfState *state) {
+    if (state == NULL)
+        return;
+
+    for (long i = 0; i < state->count; i++) {
+        free(state->entries[i].first);
+        free(state->entries[i].second);
+    }
+
+    free(state->entries);
+    memset(state, 0, sizeof(mfState));
+}
+
+const mfStateEntry *stateFind(const mfState *state, const char *first, const char *second) {
+    bool found;
+    long index;
+
+    assert(state != NULL);
+    assert(first != NULL);
+
+    index = stateSearch(state, first, second, &found);
+    return found ? &state->entries[index] : NULL;
+}
+
+bool stateSet(mfState *state, const mfStateEntry *entry) {
+    bool found;
+    long index;
+    mfStateEntry last;
+
+    assert(state != NULL);
+    assert(entry != NULL && entry->first != NULL);
+
+    index = stateSearch(state, entry->first, entry->second, &found);
+
+    if (found) {
+        memcpy(state->entries[index].files, entry->files, sizeof(entry->files));
+        state->entries[index].success = entry->success;
+        return true;
+    }
+
+    /* Appended, then moved to its place */
+
+    if (!stateAppend(state, entry))
+        return false;
+
+    last = state->entries[state->count - 1];
+    memmove(&state->entries[index + 1], &state->entries[index], (state->count - 1 - index) * sizeof(mfStateEntry));
+    state->entries[index] = last;
+    return true;
+}
+
+/* Hashes a file in blocks, false if it cannot be read */
+static bool hashFile(const char *path, u64 *hash) {
+    FILE *f = fopen(path, "rb");
+    u8 *buf = malloc(STATE_READ_SIZE);
+    bool success = f != NULL && buf != NULL;
+    size_t length;
+
+    *hash = 0;
+
+    while (success && (length = fread(buf, 1, STATE_READ_SIZE, f)) > 0)
+        *hash = (*hash ^ hash64(buf, length)) * 0x100000001b3ULL;
+
+    if (f != NULL && ferror(f))
+        success = false;
+
+    if (f != NULL)
+        fclose(f);
+
+    free(buf);
+    return success;
+}
+
+void stateScan(mfStateFile *files, const char *const *paths, const mfStateFile *previous) {
+    assert(files != NULL);
+    assert(paths != NULL);
+
+    for (u32 i = 0; i < MF_STATE_INPUTS; i++) {
+        mfStateFile *file = &files[i];
+
+        memset(file, 0, sizeof(mfStateFile));
+
+        if (paths[i] == NULL || paths[i][0] == 0x00 || !fileStat(paths[i], &file->size, &file->modified))
+            continue;
+
+        file->present = true;
+
+        /* A file that cannot be read gets no modification time, so it is hashed again next time */
+
+        if (previous != NULL && previous[i].present && previous[i].size == file->size && previous[i].modified == file->modified)
+            file->hash = previous[i].hash;
+        else if (!hashFile(paths[i], &file->hash))
+            file->modified = 0;
+    }
+}
+
+bool stateSameFiles(const mfStateFile *a, const mfStateFile *b) {
+    assert(a != NULL && b != NULL);
+
+    for (u32 i = 0; i < MF_STATE_INPUTS; i++) {
+        if (a[i].present != b[i].present)
+            return false;
+
+        if (a[i].present && (a[i].size != b[i].size || a[i].hash != b[i].hash))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef _MF_STATE_H_
+#define _MF_STATE_H_
+
+#include "util.h"
+
+/*  State of incremental batch runs.
+
+    For every target of a batch, the state file records size, modification
+    time and a content hash of its inputs (VMM32.VXD, VMOUSE.VXD and
+    MSMOUSE.VXD, or the disk image) as they were after the run, and whether
+    the run worked. A later run only has to look at the file metadata to skip
+    a target nothing has happened to. Files are only hashed when their
+    metadata changed, so touching a file does not make the target run again.
+
+    The file is plain text, one target per line:
+        ok|failed <TAB> first <TAB> second or - { <TAB> size mtime hash | - }
+*/
+
+#define MF_STATE_INPUTS             (3)
+
+typedef struct {
+    bool present;
+    u64 size;
+    u64 modified;
+    u64 hash;
+} mfStateFile;
+
+typedef struct {
+    char *first;                    /* Target as given to the batch */
+    char *second;                   /* NULL if there is none */
+    bool success;
+    mfStateFile files[MF_STATE_INPUTS];
+} mfStateEntry;
+
+typedef struct {
+    mfStateEntry *entries;
+    long count;
+    long capacity;
+} mfState;
+
+/* Reads a state file, a file that does not exist yet is an empty state */
+bool stateLoad(mfState *state, const char *path);
+
+/* Writes the state to a temporary file that replaces path once it is complete */
+bool stateSave(const mfState *state, const char *path);
+
+void stateFree(mfState *state);
+
+/* Entry of a target, NULL if it is not in the state */
+const mfStateEntry *stateFind(const mfState *state, const char *first, const char *second);
+
+/* Adds an entry for a target or replaces the one it has, the strings are copied */
+bool stateSet(mfState *state, const mfStateEntry *entry);
+
+/*  Gets the metadata of the input files (empty paths are missing files).
+    The hash is taken from previous where size and modification time are
+    the same, so only files that changed are read. */
+void stateScan(mfStateFile *files, const char *const *paths, const mfStateFile *previous);
+
+/* Whether two sets of inputs have the same contents */
+bool stateSameFiles(const mfStateFile *a, const mfStateFile *b);
+
+#endif
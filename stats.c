@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "stats.h"
+#include "trace.h"
+#include "platform.h"
+#include "decompress/pew.h"
+#include "decompress/ds_decompress.h"
+
+#define PROBE_STEPS                 (4)
+#define PROBE_MAX_DEPTH             (8)     /* A thread waiting for chunks may start other archives */
+
+static const char *const statNames[MF_STAT_COUNT] = {
+    "pe_read",
+    "w4_to_w3",
+    "w4_chunk_ds",
+    "w4_chunk_raw",
+    "w3_extract",
+    "signature_search",
+    "patch_apply",
+    "file_read",
+    "file_write",
+};
+
+/* From 100 microseconds for a chunk to 10 seconds for a large image, roughly three per decade */
+static const double bucketBounds[MF_STAT_BUCKETS - 1] = {
+    0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0, 10.0
+};
+
+static bool enabled = false;
+static mfMutex statsLock;
+static mfStatValue statValues[MF_STAT_COUNT];
+
+static const char *const dsTokenNames[DS_TOKEN_COUNT] = {
+    "literal_high",
+    "literal_low",
+    "offset_6",
+    "offset_8",
+    "offset_12",
+    "sector_break",
+    "end",
+};
+
+static mfMutex dsLock;
+static ds_stats_t dsTotal;
+
+/* Start times of the archive steps that are running on this thread */
+static MF_THREAD_LOCAL double probeStarts[PROBE_STEPS][PROBE_MAX_DEPTH];
+static MF_THREAD_LOCAL u32 probeDepth[PROBE_STEPS];
+
+void statsEnable(void) {
+    if (enabled)
+        return;
+
+    mutexInit(&statsLock);
+    memset(statValues, 0, sizeof(statValues));
+    enabled = true;
+}
+
+bool statsEnabled(void) {
+    return enabled;
+}
+
+double statsBegin(void) {
+    return enabled || traceEnabled() ? timeNow() : 0.0;
+}
+
+/* Accounts a stage and traces it as a span, detail may be NULL */
+static void statsAccount(mfStat stat, const char *detail, double start, u64 bytesIn, u64 bytesOut) {
+    double seconds;
+    mfStatValue *value;
+
+    assert(stat < MF_STAT_COUNT);
+
+    traceSpan(statNames[stat], detail, start, bytesIn, bytesOut);
+
+    if (!enabled)
+        return;
+
+    seconds = timeNow() - start;
+    value = &statValues[stat];
+
+    mutexLock(&statsLock);
+    value->count++;
+    value->seconds += seconds;
+    value->bytesIn += bytesIn;
+    value->bytesOut += bytesOut;
+    value->buckets[statsBucket(seconds)]++;
+
+    if (seconds > value->maxSeconds)
+        value->maxSeconds = seconds;
+
+    mutexUnlock(&statsLock);
+}
+
+void statsEnd(mfStat stat, double start, u64 bytesIn, u64 bytesOut) {
+    statsAccount(stat, NULL, start, bytesIn, bytesOut);
+}
+
+void statsGet(mfStatValue *values) {
+    assert(values != NULL);
+
+    if (!enabled) {
+        memset(values, 0, sizeof(statValues));
+        return;
+    }
+
+    mutexLock(&statsLock);
+    memcpy(values, statValues, sizeof(statValues));
+    mutexUnlock(&statsLock);
+}
+
+double statsBucketBound(u32 bucket) {
+    assert(bucket < MF_STAT_BUCKETS);
+    return bucket < MF_STAT_BUCKETS - 1 ? bucketBounds[bucket] : 0.0;
+}
+
+u32 statsBucket(double seconds) {
+    u32 bucket = 0;
+
+    while (bucket < MF_STAT_BUCKETS - 1 && seconds > bucketBounds[bucket])
+        bucket++;
+
+    return bucket;
+}
+
+const char *statsName(mfStat stat) {
+    assert(stat < MF_STAT_COUNT);
+    return statNames[stat];
+}
+
+void statsPrint(FILE *out, bool json) {
+    mfStatValue values[MF_STAT_COUNT];
+
+    assert(out != NULL);
+
+    statsGet(values);
+
+    if (json) {
+        fprintf(out, "{");
+
+        for (u32 i = 0; i < MF_STAT_COUNT; i++) {
+            fprintf(out, "%s\"%s\":{\"count\":%llu,\"seconds\":%.6f,\"max_seconds\":%.6f,\"bytes_in\":%llu,\"bytes_out\":%llu}",
+                i > 0 ? "," : "", statNames[i], (unsigned long long) values[i].count, values[i].seconds, values[i].maxSeconds,
+                (unsigned long long) values[i].bytesIn, (unsigned long long) values[i].bytesOut);
+        }
+
+        fprintf(out, "}\n");
+        return;
+    }
+
+    /* Stages that never ran are left out, the throughput is of the larger side */
+
+    fprintf(out, "\n%-18s %10s %12s %10s %14s %14s %10s\n", "Stage", "Count", "Total ms", "Max ms", "Bytes in", "Bytes out", "MB/s");
+
+    for (u32 i = 0; i < MF_STAT_COUNT; i++) {
+        u64 bytes = values[i].bytesIn > values[i].bytesOut ? values[i].bytesIn : values[i].bytesOut;
+
+        if (values[i].count == 0)
+            continue;
+
+        fprintf(out, "%-18s %10llu %12.3f %10.3f %14llu %14llu ", statNames[i], (unsigned long long) values[i].count,
+            values[i].seconds * 1000.0, values[i].maxSeconds * 1000.0,
+            (unsigned long long) values[i].bytesIn, (unsigned long long) values[i].bytesOut);
+
+        if (bytes > 0 && values[i].seconds > 0.0)
+            fprintf(out, "%10.1f\n", (double) bytes / values[i].seconds / (1024.0 * 1024.0));
+        else
+            fprintf(out, "%10s\n", "-");
+    }
+}
+
+void statsProbe(void *ctx, int step, int end, size_t index, size_t in, size_t out) {
+    double start;
+    mfStat stat;
+    char chunk[32];
+
+    (void) ctx;
+
+    if ((!enabled && !traceEnabled()) || step < 0 || step >= PROBE_STEPS)
+        return;
+
+    if (!end) {
+        if (probeDepth[step] < PROBE_MAX_DEPTH)
+            probeStarts[step][probeDepth[step]] = timeNow();
+
+        probeDepth[step]++;
+        return;
+    }
+
+    if (probeDepth[step] == 0)
+        return;
+
+    probeDepth[step]--;
+
+    if (probeDepth[step] >= PROBE_MAX_DEPTH)
+        return;
+
+    start = probeStarts[step][probeDepth[step]];
+
+    switch (step) {
+        case PE_PROBE_READ:     stat = MF_STAT_PE_READ;                                         break;
+        case PE_PROBE_W4_TO_W3: stat = MF_STAT_W4_TO_W3;                                        break;
+        case PE_PROBE_CHUNK:    stat = in == out ? MF_STAT_W4_CHUNK_RAW : MF_STAT_W4_CHUNK_DS;  break;
+        default:                stat = MF_STAT_W3_EXTRACT;                                      break;
+    }
+
+    /* Chunks are told apart in the trace, to see which ones hold up an archive */
+
+    if (step == PE_PROBE_CHUNK) {
+        snprintf(chunk, sizeof(chunk), "chunk %lu", (unsigned long) index);
+        statsAccount(stat, chunk, start, in, out);
+    } else {
+        statsAccount(stat, NULL, start, in, out);
+    }
+}
+
+/* Sink for ds_set_stats_sink, called once per decompressed chunk */
+static void statsDsSink(void *ctx, const ds_stats_t *chunk) {
+    (void) ctx;
+
+    mutexLock(&dsLock);
+    ds_stats_add(&dsTotal, chunk);
+    mutexUnlock(&dsLock);
+}
+
+bool statsDsEnable(void) {
+    if (!ds_stats_compiled())
+        return false;
+
+    mutexInit(&dsLock);
+    memset(&dsTotal, 0, sizeof(dsTotal));
+    ds_set_stats_sink(statsDsSink, NULL);
+    return true;
+}
+
+/* Prints one histogram, bucket n holds the values 2^n to 2^(n+1)-1 */
+static void statsDsHistogram(FILE *out, bool json, const char *name, const u64 *buckets, u32 count) {
+    u64 total = 0;
+
+    for (u32 i = 0; i < count; i++)
+        total += buckets[i];
+
+    if (json) {
+        fprintf(out, ",\"%s\":[", name);
+
+        for (u32 i = 0; i < count; i++)
+            fprintf(out, "%s%llu", i > 0 ? "," : "", (unsigned long long) buckets[i]);
+
+        fprintf(out, "]");
+        return;
+    }
+
+    fprintf(out, "\n%-18s %14s %8s\n", name, "Count", "%");
+
+    for (u32 i = 0; i < count; i++) {
+        char range[32];
+
+        if (buckets[i] == 0)
+            continue;
+
+        snprintf(range, sizeof(range), "%lu-%lu", 1UL << i, (2UL << i) - 1);
+        fprintf(out, "%-18s %14llu %8.2f\n", range, (unsigned long long) buckets[i], 100.0 * (double) buckets[i] / (double) total);
+    }
+}
+
+void statsDsPrint(FILE *out, bool json) {
+    ds_stats_t total;
+    u64 tokens = 0;
+
+    assert(out != NULL);
+
+    mutexLock(&dsLock);
+    total = dsTotal;
+    mutexUnlock(&dsLock);
+
+    for (u32 i = 0; i < DS_TOKEN_COUNT; i++)
+        tokens += total.tokens[i];
+
+    if (json) {
+        fprintf(out, "{\"chunks\":%llu,\"bits\":%llu,\"bits_min\":%llu,\"bits_max\":%llu,\"bytes\":%llu,\"match_bytes\":%llu,\"tokens\":{",
+            (unsigned long long) total.chunks, (unsigned long long) total.bits, (unsigned long long) total.bits_min,
+            (unsigned long long) total.bits_max, (unsigned long long) total.bytes, (unsigned long long) total.match_bytes);
+
+        for (u32 i = 0; i < DS_TOKEN_COUNT; i++)
+            fprintf(out, "%s\"%s\":%llu", i > 0 ? "," : "", dsTokenNames[i], (unsigned long long) total.tokens[i]);
+
+        fprintf(out, "}");
+        statsDsHistogram(out, true, "length", total.length, DS_LENGTH_BUCKETS);
+        statsDsHistogram(out, true, "distance", total.distance, DS_DISTANCE_BUCKETS);
+        fprintf(out, "}\n");
+        return;
+    }
+
+    fprintf(out, "\nDS chunks: %llu, %llu bytes from %llu bits (%.3f bits per byte), %llu to %llu bits per chunk\n",
+        (unsigned long long) total.chunks, (unsigned long long) total.bytes, (unsigned long long) total.bits,
+        total.bytes ? (double) total.bits / (double) total.bytes : 0.0,
+        (unsigned long long) total.bits_min, (unsigned long long) total.bits_max);
+
+    if (total.chunks == 0)
+        return;
+
+    fprintf(out, "Bytes from matches: %llu (%.2f %%)\n", (unsigned long long) total.match_bytes,
+        total.bytes ? 100.0 * (double) total.match_bytes / (double) total.bytes : 0.0);
+
+    fprintf(out, "\n%-18s %14s %8s\n", "Token", "Count", "%");
+
+    for (u32 i = 0; i < DS_TOKEN_COUNT; i++)
+        fprintf(out, "%-18s %14llu %8.2f\n", dsTokenNames[i], (unsigned long long) total.tokens[i],
+            tokens ? 100.0 * (double) total.tokens[i] / (double) tokens : 0.0);
+
+    statsDsHistogram(out, false, "Match length", total.length, DS_LENGTH_BUCKETS);
+    statsDsHistogram(out, false, "Distance", total.distance, DS_DISTANCE_BUCKETS);
+}
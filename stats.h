@@ -0,0 +1,75 @@
+#ifndef _MF_STATS_H_
+#define _MF_STATS_H_
+
+#include <stdio.h>
+
+#include "util.h"
+
+/*  Timers and counters for the stages of unpacking and patching.
+
+    Every stage counts how often it ran, how long it took in total (and at
+    most), and how many bytes went in and out. Measuring is off until
+    statsEnable is called, until then statsBegin / statsEnd cost next to
+    nothing. While a trace is open (trace.h), every stage is also written to
+    it as a span. All of it may be called from any thread. */
+
+typedef enum {
+    MF_STAT_PE_READ = 0,            /* Archive headers (pe_read) */
+    MF_STAT_W4_TO_W3,               /* Whole W4 archives decompressed, in = W4, out = W3 */
+    MF_STAT_W4_CHUNK_DS,            /* DS compressed W4 chunks, in = stored, out = decompressed */
+    MF_STAT_W4_CHUNK_RAW,           /* W4 chunks stored as they are */
+    MF_STAT_W3_EXTRACT,             /* Files extracted from W3 archives, in = W3, out = file */
+    MF_STAT_SIGNATURE_SEARCH,       /* Signature searches of a patch plan, in = bytes of the file */
+    MF_STAT_PATCH_APPLY,            /* Checking and applying the operations of a patch plan */
+    MF_STAT_FILE_READ,              /* Driver, journal and archive reads, out = bytes read */
+    MF_STAT_FILE_WRITE,             /* Writes, in = bytes written */
+    MF_STAT_COUNT
+} mfStat;
+
+/* Duration histogram buckets, see statsBucketBound */
+#define MF_STAT_BUCKETS             (12)
+
+typedef struct {
+    u64 count;
+    double seconds;
+    double maxSeconds;
+    u64 bytesIn;
+    u64 bytesOut;
+    u64 buckets[MF_STAT_BUCKETS];   /* How often it took up to each bound, not cumulative */
+} mfStatValue;
+
+/* Starts measuring, call before any other thread runs */
+void statsEnable(void);
+bool statsEnabled(void);
+
+/* Start time of a stage, 0 if neither measuring nor tracing is on */
+double statsBegin(void);
+
+/* Accounts a stage that started at start (from statsBegin) */
+void statsEnd(mfStat stat, double start, u64 bytesIn, u64 bytesOut);
+
+/* Copies all MF_STAT_COUNT values */
+void statsGet(mfStatValue *values);
+
+/* Upper bound of a histogram bucket in seconds, the last one is unbounded (returns 0) */
+double statsBucketBound(u32 bucket);
+
+/* Bucket a duration falls into */
+u32 statsBucket(double seconds);
+
+/* Short name of a stage, for tables and JSON keys */
+const char *statsName(mfStat stat);
+
+/* Prints the values as a table or as one JSON object */
+void statsPrint(FILE *out, bool json);
+
+/* Probe for pe_set_probe, turns the archive steps of decompress/pew.c into stages */
+void statsProbe(void *ctx, int step, int end, size_t index, size_t in, size_t out);
+
+/*  Token and match statistics of the DS decoder, only there if it was
+    compiled with DS_STATS. statsDsEnable fails without, call it before any
+    other thread runs. */
+bool statsDsEnable(void);
+void statsDsPrint(FILE *out, bool json);
+
+#endif
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "trace.h"
+#include "platform.h"
+#include "log.h"
+
+static bool enabled = false;
+static bool writeError = false;
+static bool firstEvent = true;
+static FILE *traceFile = NULL;
+static mfMutex traceLock;
+static double traceStart;
+static u32 tracePid;
+static volatile long threadCounter = 0;
+
+/* Small numbers instead of system thread ids, in the order threads first traced something */
+static MF_THREAD_LOCAL u32 traceThread = 0;
+
+/* Writes a string as a JSON string, the trace lock is held */
+static void writeJsonString(const char *text) {
+    fputc('"', traceFile);
+
+    for (; *text != 0x00; text++) {
+        unsigned char c = (unsigned char) *text;
+
+        if (c == '"' || c == '\\')
+            fprintf(traceFile, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(traceFile, "\\u%04x", c);
+        else
+            fputc(c, traceFile);
+    }
+
+    fputc('"', traceFile);
+}
+
+/* Starts the next event, the trace lock is held */
+static void writeSeparator(void) {
+    if (fprintf(traceFile, firstEvent ? "\n" : ",\n") < 0)
+        writeError = true;
+
+    firstEvent = false;
+}
+
+/* Id of the calling thread, it is named in the trace the first time */
+static u32 traceThreadId(void) {
+    if (traceThread != 0)
+        return traceThread;
+
+    traceThread = (u32) atomicIncrement(&threadCounter);
+
+    mutexLock(&traceLock);
+    writeSeparator();
+    fprintf(traceFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+        tracePid, traceThread, traceThread == 1 ? "main" : "worker", traceThread);
+    mutexUnlock(&traceLock);
+
+    return traceThread;
+}
+
+bool traceOpen(const char *path) {
+    assert(path != NULL);
+
+    if (enabled)
+        return true;
+
+    traceFile = fopen(path, "w");
+
+    if (traceFile == NULL) {
+        logPrintf("Error: Cannot create trace %s\n", path);
+        return false;
+    }
+
+    mutexInit(&traceLock);
+    traceStart = timeNow();
+    tracePid = processId();
+    writeError = fprintf(traceFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[") < 0;
+    firstEvent = true;
+    enabled = true;
+
+    /* The thread that opened the trace is the main thread */
+    traceThreadId();
+    return true;
+}
+
+bool traceClose(void) {
+    bool success;
+
+    if (!enabled)
+        return true;
+
+    enabled = false;
+
+    if (fprintf(traceFile, "\n]}\n") < 0)
+        writeError = true;
+
+    success = fclose(traceFile) == 0 && !writeError;
+    traceFile = NULL;
+    mutexDestroy(&traceLock);
+
+    if (!success)
+        logPrintf("Error: Cannot write trace\n");
+
+    return success;
+}
+
+bool traceEnabled(void) {
+    return enabled;
+}
+
+double traceBegin(void) {
+    return enabled ? timeNow() : 0.0;
+}
+
+void traceSpan(const char *name, const char *detail, double start, u64 bytesIn, u64 bytesOut) {
+    double end;
+    u32 thread;
+
+    assert(name != NULL);
+
+    if (!enabled)
+        return;
+
+    end = timeNow();
+    thread = traceThreadId();
+
+    /* Microseconds since the trace was opened */
+
+    mutexLock(&traceLock);
+    writeSeparator();
+    fprintf(traceFile, "{\"name\":\"%s\",\"cat\":\"mousefix\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u,\"args\":{",
+        name, (start - traceStart) * 1000000.0, (end - start) * 1000000.0, tracePid, thread);
+
+    if (detail != NULL) {
+        fprintf(traceFile, "\"detail\":");
+        writeJsonString(detail);
+        fprintf(traceFile, ",");
+    }
+
+    if (fprintf(traceFile, "\"bytes_in\":%llu,\"bytes_out\":%llu}}", (unsigned long long) bytesIn, (unsigned long long) bytesOut) < 0)
+        writeError = true;
+
+    mutexUnlock(&traceLock);
+}
@@ -0,0 +1,29 @@
+#ifndef _MF_TRACE_H_
+#define _MF_TRACE_H_
+
+#include "util.h"
+
+/*  Trace of a run in the Chrome trace event format.
+
+    Every span (a batch target, an archive step, a chunk, a patch step) ends
+    up as one complete event with the thread it ran on, so the file can be
+    loaded into chrome://tracing or Perfetto to see where threads waited or
+    had nothing to do. Events are written as they end, the file is only
+    valid JSON once traceClose has finished it. The stages of stats.h are
+    traced as well, with their names from statsName. */
+
+/* Starts tracing to path, call before any other thread runs */
+bool traceOpen(const char *path);
+
+/* Finishes the file, false if anything could not be written */
+bool traceClose(void);
+
+bool traceEnabled(void);
+
+/* Start time of a span, 0 if tracing is off */
+double traceBegin(void);
+
+/* Writes a span that started at start (from traceBegin or statsBegin), detail may be NULL */
+void traceSpan(const char *name, const char *detail, double start, u64 bytesIn, u64 bytesOut);
+
+#endif
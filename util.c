@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "util.h"
+
+long filesize(FILE *f) {
+    long cur = ftell(f);
+    long ret = 0;
+    fseek(f, 0, SEEK_END);
+    ret = ftell(f);
+    fseek(f, cur, SEEK_SET);
+    return ret;
+}
+
+u8 *openAndReadWholeFile(const char *fname, long *size) {
+    FILE *in = NULL;
+    u8 *data = NULL;
+
+    assert(fname != NULL);
+    assert(size != NULL);
+
+    in = fopen(fname, "rb");
+
+    if (in == NULL) {
+        goto error;
+    }
+
+    *size = filesize(in);
+
+    if (*size <= 0)
+        goto error;
+
+    data = calloc(*size, 1);
+
+    if (data == NULL)
+        goto error;
+
+    if (fread(data, 1, *size, in) != *size)
+        goto error;
+
+    fclose(in);
+    return data;
+
+error:
+    perror("Error reading file");
+    free(data);
+    if (in != NULL)
+        fclose(in);
+    *size = -1;
+    return NULL;
+}
+
+bool openAndWriteWholeFile(const char *fname, const u8 *data, long size) {
+    FILE *file = NULL;
+
+    assert(fname != NULL);
+    assert(data != NULL);
+    assert(size > 0);
+
+    file = fopen(fname, "wb");
+
+    if (file == NULL) {
+        goto error;
+    }
+
+    if (fwrite(data, 1, size, file) != size)
+        goto error;
+
+    fclose(file);
+    return true;
+
+error:
+    perror("Error writing file");
+
+    if (file != NULL)
+        fclose(file);
+    return false;
+}
+
+u8 *findBytes(const u8 *haystack, const u8 *needle, size_t haystackSize, size_t needleSize) {
+    const u8 *ceiling = haystack + haystackSize;
+
+    assert(haystack != NULL);
+    assert(needle != NULL);
+    assert(needleSize <= haystackSize);
+    assert(needleSize != 0);
+
+    while (haystack + needleSize <= ceiling) {
+        if (0 == memcmp(haystack, needle, needleSize)) {
+            return (u8*) haystack;
+        }
+        haystack++;
+    }
+
+    return NULL;
+}
+
+u32 crc32Update(u32 crc, const u8 *data, size_t size) {
+    /* Half-byte table, small enough to not bother generating it at runtime */
+    static const u32 crcNibbleTable[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+
+    crc = ~crc;
+
+    while (size--) {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ crcNibbleTable[crc & 0x0f];
+        crc = (crc >> 4) ^ crcNibbleTable[crc & 0x0f];
+    }
+
+    return ~crc;
+}
+
+u64 hash64(const u8 *data, size_t size) {
+    const u64 prime = 0x100000001b3ULL;
+    u64 hash = 0xcbf29ce484222325ULL ^ (u64) size;
+
+    for (; size >= 8; data += 8, size -= 8) {
+        hash = (hash ^ read64(data, 0)) * prime;
+        hash ^= hash >> 29;
+    }
+
+    while (size--)
+        hash = (hash ^ *data++) * prime;
+
+    /* Final mix, so the last bytes affect the upper bits as well */
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
@@ -0,0 +1,44 @@
+#ifndef _MF_UTIL_H_
+#define _MF_UTIL_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int16_t i16;
+typedef int32_t i32;
+
+static inline void write8 (u8 *data, u32 offset, u8  value)    { memcpy (&data[offset], (u8*) &value, sizeof(value)); }
+static inline void write16(u8 *data, u32 offset, u16 value)    { memcpy (&data[offset], (u8*) &value, sizeof(value)); }
+static inline void write32(u8 *data, u32 offset, u32 value)    { memcpy (&data[offset], (u8*) &value, sizeof(value)); }
+
+static inline u8   read8  (const u8 *data, u32 offset)         { return data[offset]; }
+static inline u16  read16 (const u8 *data, u32 offset)         { u16 v; memcpy(&v, &data[offset], sizeof(v)); return v; }
+static inline u32  read32 (const u8 *data, u32 offset)         { u32 v; memcpy(&v, &data[offset], sizeof(v)); return v; }
+static inline u64  read64 (const u8 *data, u32 offset)         { u64 v; memcpy(&v, &data[offset], sizeof(v)); return v; }
+static inline void write64(u8 *data, u32 offset, u64 value)    { memcpy (&data[offset], (u8*) &value, sizeof(value)); }
+
+long filesize(FILE *f);
+
+/* Reads a whole file into a newly allocated buffer, returns NULL and sets *size to -1 on error */
+u8 *openAndReadWholeFile(const char *fname, long *size);
+
+/* Writes a buffer to a file, replacing its contents */
+bool openAndWriteWholeFile(const char *fname, const u8 *data, long size);
+
+/* Finds a byte pattern in some data, returns NULL if not found */
+u8 *findBytes(const u8 *haystack, const u8 *needle, size_t haystackSize, size_t needleSize);
+
+/* CRC-32 (IEEE 802.3), pass 0 as crc for the first block */
+u32 crc32Update(u32 crc, const u8 *data, size_t size);
+
+/* Fast 64 bit hash (8 bytes per step), to tell files apart, not to check their integrity */
+u64 hash64(const u8 *data, size_t size);
+
+#endif
@@ -0,0 +1,832 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "vdisk.h"
+#include "log.h"
+#include "decompress/filesystem.h"
+
+#define SECTOR_SIZE                 (512)
+
+/* Marks a guest unit that has no data in the container, it reads as zeros */
+#define UNALLOCATED                 ((u64) -1)
+
+#define VHD_COOKIE                  "conectix"
+#define VHD_SPARSE_COOKIE           "cxsparse"
+#define VHD_FOOTER_SIZE             (512)
+#define VHD_DYNAMIC_HEADER_SIZE     (1024)
+#define VHD_TYPE_FIXED              (2)
+#define VHD_TYPE_DYNAMIC            (3)
+#define VHD_UNUSED_BLOCK            (0xFFFFFFFF)
+#define VHD_FIXED_UNIT              (65536)
+
+#define VMDK_MAGIC                  (0x564D444B)    /* 'KDMV' */
+#define VMDK_DESCRIPTOR_MAGIC       "# Disk DescriptorFile"
+#define VMDK_FLAG_REDUNDANT_GT      (1 << 1)
+#define VMDK_FLAG_COMPRESSED        (1 << 16)
+#define VMDK_GD_AT_END              ((u64) -1)
+#define VMDK_ZERO_GRAIN             (1)
+#define VMDK_FLAT_UNIT              (65536)
+
+#define QCOW_MAGIC                  (0x514649FB)    /* 'QFI\xfb' */
+#define QCOW_OFFSET_MASK            (0x00FFFFFFFFFFFE00ULL)
+#define QCOW_COPIED                 (1ULL << 63)    /* Refcount is exactly one, may be written in place */
+#define QCOW_COMPRESSED             (1ULL << 62)
+#define QCOW_ZERO                   (1ULL << 0)     /* Version 3: cluster reads as zeros */
+
+typedef struct mfContainer mfContainer;
+
+struct mfContainer {
+    mfBlockDevice *file;            /* The container file */
+    u32 unitSize;                   /* Guest bytes per map entry */
+
+    /*  Finds the container offset of a guest unit, UNALLOCATED if it has none.
+        With allocate, space is allocated (zero filled) for unallocated units. */
+    bool (*map)(mfContainer *c, u64 unit, bool allocate, u64 *fileOffset);
+
+    struct {
+        u64 footerOffset;
+        u8 footer[VHD_FOOTER_SIZE];
+        u64 batOffset;
+        u32 batEntries;
+        u32 sectorsPerBlock;
+        u32 bitmapSize;             /* Sector bitmap in front of each block, padded to sectors */
+    } vhd;
+
+    struct {
+        u64 dataOffset;             /* Flat extents: file offset of the first sector */
+        u32 flags;
+        u32 gtEntries;              /* Grain table entries per grain table */
+        u32 gdEntries;
+        u64 gdOffset;               /* In bytes */
+        u64 rgdOffset;
+    } vmdk;
+
+    struct {
+        u32 clusterBits;
+        u32 l2Entries;
+        u64 l1Offset;
+        u32 l1Size;
+        u64 refcountTableOffset;
+        u32 refcountTableEntries;
+        u32 refcountBits;
+    } qcow;
+};
+
+static u32 readBE32(const u8 *data, u32 offset) {
+    return ((u32) data[offset] << 24) | ((u32) data[offset + 1] << 16) | ((u32) data[offset + 2] << 8) | data[offset + 3];
+}
+
+static u64 readBE64(const u8 *data, u32 offset) {
+    return ((u64) readBE32(data, offset) << 32) | readBE32(data, offset + 4);
+}
+
+static void writeBE32(u8 *data, u32 offset, u32 value) {
+    data[offset] = (u8) (value >> 24);
+    data[offset + 1] = (u8) (value >> 16);
+    data[offset + 2] = (u8) (value >> 8);
+    data[offset + 3] = (u8) value;
+}
+
+static void writeBE64(u8 *data, u32 offset, u64 value) {
+    writeBE32(data, offset, (u32) (value >> 32));
+    writeBE32(data, offset + 4, (u32) value);
+}
+
+static u64 alignUp(u64 value, u64 alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/* Table entries are read and written one at a time, through the (usually mapped) container file */
+
+static bool fileRead32(mfBlockDevice *file, u64 offset, u32 *value, bool bigEndian) {
+    u8 buf[4];
+
+    if (!blockRead(file, offset, buf, sizeof(buf)))
+        return false;
+
+    *value = bigEndian ? readBE32(buf, 0) : read32(buf, 0);
+    return true;
+}
+
+static bool fileWrite32(mfBlockDevice *file, u64 offset, u32 value, bool bigEndian) {
+    u8 buf[4];
+
+    if (bigEndian)
+        writeBE32(buf, 0, value);
+    else
+        write32(buf, 0, value);
+
+    return blockWrite(file, offset, buf, sizeof(buf));
+}
+
+static bool fileReadBE64(mfBlockDevice *file, u64 offset, u64 *value) {
+    u8 buf[8];
+
+    if (!blockRead(file, offset, buf, sizeof(buf)))
+        return false;
+
+    *value = readBE64(buf, 0);
+    return true;
+}
+
+static bool fileWriteBE64(mfBlockDevice *file, u64 offset, u64 value) {
+    u8 buf[8];
+
+    writeBE64(buf, 0, value);
+    return blockWrite(file, offset, buf, sizeof(buf));
+}
+
+static bool fileZero(mfBlockDevice *file, u64 offset, u64 size) {
+    u8 zero[SECTOR_SIZE] = { 0, };
+
+    while (size > 0) {
+        u32 length = size < sizeof(zero) ? (u32) size : (u32) sizeof(zero);
+
+        if (!blockWrite(file, offset, zero, length))
+            return false;
+
+        offset += length;
+        size -= length;
+    }
+
+    return true;
+}
+
+/* Appends zeroed space to the end of the container file, returns its offset or 0 */
+static u64 fileAppend(mfBlockDevice *file, u64 size, u64 alignment) {
+    u64 offset = alignUp(file->size, alignment);
+
+    if (!blockResize(file, offset + size)) {
+        logPrintf("Error: Cannot grow the disk container\n");
+        return 0;
+    }
+
+    return offset;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Generic container device                                                  */
+/* ------------------------------------------------------------------------- */
+
+static bool containerAccess(mfBlockDevice *dev, u64 offset, u8 *readBuf, const u8 *writeBuf, u32 size) {
+    mfContainer *c = (mfContainer *) dev->priv;
+
+    if (offset > dev->size || size > dev->size - offset)
+        return false;
+
+    while (size > 0) {
+        u64 unit = offset / c->unitSize;
+        u32 within = (u32) (offset % c->unitSize);
+        u32 length = c->unitSize - within < size ? c->unitSize - within : size;
+        u64 fileOffset;
+
+        if (!c->map(c, unit, writeBuf != NULL, &fileOffset))
+            return false;
+
+        if (writeBuf != NULL) {
+            if (fileOffset == UNALLOCATED || !blockWrite(c->file, fileOffset + within, writeBuf, length))
+                return false;
+
+            writeBuf += length;
+        } else {
+            if (fileOffset == UNALLOCATED)
+                memset(readBuf, 0, length);
+            else if (!blockRead(c->file, fileOffset + within, readBuf, length))
+                return false;
+
+            readBuf += length;
+        }
+
+        offset += length;
+        size -= length;
+    }
+
+    return true;
+}
+
+static bool containerRead(mfBlockDevice *dev, u64 offset, void *buf, u32 size) {
+    return containerAccess(dev, offset, (u8 *) buf, NULL, size);
+}
+
+static bool containerWrite(mfBlockDevice *dev, u64 offset, const void *buf, u32 size) {
+    return dev->writable && containerAccess(dev, offset, NULL, (const u8 *) buf, size);
+}
+
+static bool containerFlush(mfBlockDevice *dev) {
+    return blockFlush(((mfContainer *) dev->priv)->file);
+}
+
+static void containerClose(mfBlockDevice *dev) {
+    mfContainer *c = (mfContainer *) dev->priv;
+
+    c->file->close(c->file);
+    free(c);
+    free(dev);
+}
+
+/* Wraps a container around its file, takes ownership of the file */
+static mfBlockDevice *containerCreate(mfContainer *c, u64 size, bool writable) {
+    mfBlockDevice *dev = calloc(1, sizeof(mfBlockDevice));
+
+    if (dev == NULL) {
+        blockClose(c->file);
+        free(c);
+        return NULL;
+    }
+
+    dev->size = size;
+    dev->writable = writable;
+    dev->read = containerRead;
+    dev->write = containerWrite;
+    dev->flush = containerFlush;
+    dev->close = containerClose;
+    dev->priv = c;
+    return dev;
+}
+
+/* ------------------------------------------------------------------------- */
+/* VHD                                                                       */
+/* ------------------------------------------------------------------------- */
+
+static bool vhdMapFixed(mfContainer *c, u64 unit, bool allocate, u64 *fileOffset) {
+    (void) allocate;
+    *fileOffset = unit * c->unitSize;
+    return true;
+}
+
+/* Moves the footer behind a new block and points the BAT entry to it */
+static bool vhdAllocateBlock(mfContainer *c, u32 block, u32 *sector) {
+    u64 blockOffset = alignUp(c->vhd.footerOffset, SECTOR_SIZE);
+    u64 footerOffset = blockOffset + c->vhd.bitmapSize + (u64) c->vhd.sectorsPerBlock * SECTOR_SIZE;
+
+    if (!blockResize(c->file, footerOffset + VHD_FOOTER_SIZE)) {
+        logPrintf("Error: Cannot grow the VHD\n");
+        return false;
+    }
+
+    /* The old footer is now part of the (empty) sector bitmap */
+
+    if (!fileZero(c->file, c->vhd.footerOffset, blockOffset + SECTOR_SIZE - c->vhd.footerOffset)
+     || !blockWrite(c->file, footerOffset, c->vhd.footer, VHD_FOOTER_SIZE)
+     || !fileWrite32(c->file, c->vhd.batOffset + (u64) block * 4, (u32) (blockOffset / SECTOR_SIZE), true))
+        return false;
+
+    c->vhd.footerOffset = footerOffset;
+    *sector = (u32) (blockOffset / SECTOR_SIZE);
+    return true;
+}
+
+/*  Units are sectors: each one has a bit in the sector bitmap of its block, a
+    clear bit means the sector was never written and reads as zeros */
+static bool vhdMapDynamic(mfContainer *c, u64 unit, bool allocate, u64 *fileOffset) {
+    u32 block = (u32) (unit / c->vhd.sectorsPerBlock);
+    u32 sectorInBlock = (u32) (unit % c->vhd.sectorsPerBlock);
+    u32 blockSector;
+    u64 bitmapByte;
+    u8 bits;
+
+    *fileOffset = UNALLOCATED;
+
+    if (block >= c->vhd.batEntries || !fileRead32(c->file, c->vhd.batOffset + (u64) block * 4, &blockSector, true))
+        return false;
+
+    if (blockSector == VHD_UNUSED_BLOCK) {
+        if (!allocate)
+            return true;
+
+        if (!vhdAllocateBlock(c, block, &blockSector))
+            return false;
+    }
+
+    bitmapByte = (u64) blockSector * SECTOR_SIZE + sectorInBlock / 8;
+
+    if (!blockRead(c->file, bitmapByte, &bits, 1))
+        return false;
+
+    *fileOffset = (u64) blockSector * SECTOR_SIZE + c->vhd.bitmapSize + (u64) sectorInBlock * SECTOR_SIZE;
+
+    if (bits & (0x80 >> (sectorInBlock % 8)))
+        return true;
+
+    if (!allocate) {
+        *fileOffset = UNALLOCATED;
+        return true;
+    }
+
+    /* The sector may hold anything, it only becomes part of the disk now */
+
+    bits |= (u8) (0x80 >> (sectorInBlock % 8));
+
+    return fileZero(c->file, *fileOffset, SECTOR_SIZE) && blockWrite(c->file, bitmapByte, &bits, 1);
+}
+
+static bool vhdChecksumValid(const u8 *data, u32 size, u32 checksumOffset) {
+    u32 sum = 0;
+
+    for (u32 i = 0; i < size; i++) {
+        if (i < checksumOffset || i >= checksumOffset + 4)
+            sum += data[i];
+    }
+
+    return ~sum == readBE32(data, checksumOffset);
+}
+
+static mfBlockDevice *vhdOpen(mfBlockDevice *file, bool writable) {
+    mfContainer *c = calloc(1, sizeof(mfContainer));
+    u8 header[VHD_DYNAMIC_HEADER_SIZE];
+    u32 diskType;
+    u32 blockSize;
+    u64 size;
+
+    if (c == NULL)
+        goto error;
+
+    c->file = file;
+    c->vhd.footerOffset = file->size - VHD_FOOTER_SIZE;
+
+    if (!blockRead(file, c->vhd.footerOffset, c->vhd.footer, VHD_FOOTER_SIZE) || 0 != memcmp(c->vhd.footer, VHD_COOKIE, 8)
+     || !vhdChecksumValid(c->vhd.footer, VHD_FOOTER_SIZE, 0x40)) {
+        logPrintf("Error: VHD footer is damaged\n");
+        goto error;
+    }
+
+    diskType = readBE32(c->vhd.footer, 0x3C);
+    size = readBE64(c->vhd.footer, 0x30);
+
+    if (diskType == VHD_TYPE_FIXED) {
+        if (size > c->vhd.footerOffset)
+            goto error;
+
+        c->unitSize = VHD_FIXED_UNIT;
+        c->map = vhdMapFixed;
+        return containerCreate(c, size, writable);
+    }
+
+    if (diskType != VHD_TYPE_DYNAMIC) {
+        logPrintf("Error: Only fixed and dynamic VHDs are supported (type %u)\n", diskType);
+        goto error;
+    }
+
+    if (!blockRead(file, readBE64(c->vhd.footer, 0x10), header, sizeof(header)) || 0 != memcmp(header, VHD_SPARSE_COOKIE, 8)
+     || !vhdChecksumValid(header, sizeof(header), 0x24)) {
+        logPrintf("Error: VHD dynamic disk header is damaged\n");
+        goto error;
+    }
+
+    blockSize = readBE32(header, 0x20);
+
+    if (blockSize < SECTOR_SIZE || blockSize % SECTOR_SIZE != 0)
+        goto error;
+
+    c->vhd.batOffset = readBE64(header, 0x10);
+    c->vhd.batEntries = readBE32(header, 0x1C);
+    c->vhd.sectorsPerBlock = blockSize / SECTOR_SIZE;
+    c->vhd.bitmapSize = (u32) alignUp((c->vhd.sectorsPerBlock + 7) / 8, SECTOR_SIZE);
+
+    if ((u64) c->vhd.batEntries * blockSize < size)
+        goto error;
+
+    c->unitSize = SECTOR_SIZE;
+    c->map = vhdMapDynamic;
+    return containerCreate(c, size, writable);
+
+error:
+    logPrintf("Error: Unsupported or damaged VHD\n");
+    blockClose(file);
+    free(c);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* VMDK                                                                      */
+/* ------------------------------------------------------------------------- */
+
+static bool vmdkMapFlat(mfContainer *c, u64 unit, bool allocate, u64 *fileOffset) {
+    (void) allocate;
+    *fileOffset = c->vmdk.dataOffset + unit * c->unitSize;
+    return true;
+}
+
+/* Appends a zeroed grain table, returns its sector */
+static u32 vmdkAllocateTable(mfContainer *c) {
+    return (u32) (fileAppend(c->file, alignUp((u64) c->vmdk.gtEntries * 4, SECTOR_SIZE), SECTOR_SIZE) / SECTOR_SIZE);
+}
+
+/* Grain tables that are not there yet are allocated for both directories */
+static bool vmdkGrainTables(mfContainer *c, u32 gdIndex, bool allocate, u32 *table, u32 *redundantTable) {
+    bool redundant = (c->vmdk.flags & VMDK_FLAG_REDUNDANT_GT) != 0;
+
+    *redundantTable = 0;
+
+    if (!fileRead32(c->file, c->vmdk.gdOffset + (u64) gdIndex * 4, table, false))
+        return false;
+
+    if (redundant && !fileRead32(c->file, c->vmdk.rgdOffset + (u64) gdIndex * 4, redundantTable, false))
+        return false;
+
+    if (*table != 0 || !allocate)
+        return true;
+
+    *table = vmdkAllocateTable(c);
+
+    if (*table == 0 || !fileWrite32(c->file, c->vmdk.gdOffset + (u64) gdIndex * 4, *table, false))
+        return false;
+
+    if (redundant) {
+        *redundantTable = vmdkAllocateTable(c);
+
+        if (*redundantTable == 0 || !fileWrite32(c->file, c->vmdk.rgdOffset + (u64) gdIndex * 4, *redundantTable, false))
+            return false;
+    }
+
+    return true;
+}
+
+static bool vmdkMapSparse(mfContainer *c, u64 unit, bool allocate, u64 *fileOffset) {
+    u32 gdIndex = (u32) (unit / c->vmdk.gtEntries);
+    u32 gtIndex = (u32) (unit % c->vmdk.gtEntries);
+    u32 table;
+    u32 redundantTable;
+    u32 grain;
+    u64 grainOffset;
+
+    *fileOffset = UNALLOCATED;
+
+    if (gdIndex >= c->vmdk.gdEntries || !vmdkGrainTables(c, gdIndex, allocate, &table, &redundantTable))
+        return false;
+
+    if (table == 0)
+        return true;
+
+    if (!fileRead32(c->file, (u64) table * SECTOR_SIZE + gtIndex * 4, &grain, false))
+        return false;
+
+    if (grain != 0 && grain != VMDK_ZERO_GRAIN) {
+        *fileOffset = (u64) grain * SECTOR_SIZE;
+        return true;
+    }
+
+    if (!allocate)
+        return true;
+
+    grainOffset = fileAppend(c->file, c->unitSize, SECTOR_SIZE);
+
+    if (grainOffset == 0 || !fileWrite32(c->file, (u64) table * SECTOR_SIZE + gtIndex * 4, (u32) (grainOffset / SECTOR_SIZE), false))
+        return false;
+
+    if (redundantTable != 0 && !fileWrite32(c->file, (u64) redundantTable * SECTOR_SIZE + gtIndex * 4, (u32) (grainOffset / SECTOR_SIZE), false))
+        return false;
+
+    *fileOffset = grainOffset;
+    return true;
+}
+
+static mfBlockDevice *vmdkOpenSparse(mfBlockDevice *file, bool writable) {
+    mfContainer *c = calloc(1, sizeof(mfContainer));
+    u8 header[SECTOR_SIZE];
+    u64 capacity;
+    u64 grainSectors;
+    u64 gdSectors;
+
+    if (c == NULL)
+        goto error;
+
+    c->file = file;
+
+    if (!blockRead(file, 0, header, sizeof(header)) || read32(header, 0) != VMDK_MAGIC)
+        goto error;
+
+    c->vmdk.flags = read32(header, 8);
+    capacity = read64(header, 12);
+    grainSectors = read64(header, 20);
+    c->vmdk.gtEntries = read32(header, 44);
+    c->vmdk.rgdOffset = read64(header, 48) * SECTOR_SIZE;
+    gdSectors = read64(header, 56);
+
+    if ((c->vmdk.flags & VMDK_FLAG_COMPRESSED) || gdSectors == VMDK_GD_AT_END) {
+        logPrintf("Error: Compressed / stream optimized VMDKs are not supported\n");
+        goto error;
+    }
+
+    if (grainSectors == 0 || grainSectors * SECTOR_SIZE > 0x10000000 || c->vmdk.gtEntries == 0)
+        goto error;
+
+    c->vmdk.gdOffset = gdSectors * SECTOR_SIZE;
+    c->vmdk.gdEntries = (u32) ((capacity + grainSectors * c->vmdk.gtEntries - 1) / (grainSectors * c->vmdk.gtEntries));
+
+    c->unitSize = (u32) (grainSectors * SECTOR_SIZE);
+    c->map = vmdkMapSparse;
+    return containerCreate(c, capacity * SECTOR_SIZE, writable);
+
+error:
+    logPrintf("Error: Unsupported or damaged VMDK\n");
+    blockClose(file);
+    free(c);
+    return NULL;
+}
+
+/*  A descriptor file lists the extents that hold the data. Only a single
+    extent is supported, which covers what monolithic images look like */
+static mfBlockDevice *vmdkOpenDescriptor(const char *path, mfBlockDevice *descriptorFile, bool writable) {
+    char text[4096];
+    u32 length = descriptorFile->size < sizeof(text) - 1 ? (u32) descriptorFile->size : sizeof(text) - 1;
+    char *line;
+    char type[16] = { 0, };
+    char name[256] = { 0, };
+    unsigned long long sectors = 0;
+    unsigned long long offset = 0;
+    u32 extents = 0;
+    char *directory;
+    char *extentPath;
+    mfBlockDevice *file;
+    mfContainer *c;
+
+    memset(text, 0, sizeof(text));
+
+    if (!blockRead(descriptorFile, 0, text, length)) {
+        blockClose(descriptorFile);
+        return NULL;
+    }
+
+    blockClose(descriptorFile);
+
+    /* Extent lines look like: RW 4192256 SPARSE "disk-s001.vmdk" [offset] */
+
+    for (line = strtok(text, "\r\n"); line != NULL; line = strtok(NULL, "\r\n")) {
+        char access[8];
+        unsigned long long lineSectors;
+        unsigned long long lineOffset = 0;
+        char lineType[16];
+        char lineName[256];
+
+        if (sscanf(line, "%7s %llu %15s \"%255[^\"]\" %llu", access, &lineSectors, lineType, lineName, &lineOffset) < 4)
+            continue;
+
+        if (strcmp(access, "RW") != 0 && strcmp(access, "RDONLY") != 0)
+            continue;
+
+        extents++;
+        sectors = lineSectors;
+        offset = lineOffset;
+        strcpy(type, lineType);
+        strcpy(name, lineName);
+    }
+
+    if (extents != 1) {
+        logPrintf("Error: VMDK descriptor %s has %u extents, only one is supported\n", path, extents);
+        return NULL;
+    }
+
+    directory = fs_dirname(path);
+    extentPath = fs_path_get(directory, name, NULL);
+    fs_path_free(directory);
+
+    if (extentPath == NULL)
+        return NULL;
+
+    file = blockOpenRaw(extentPath, writable);
+    fs_path_free(extentPath);
+
+    if (file == NULL)
+        return NULL;
+
+    if (0 == strcmp(type, "SPARSE"))
+        return vmdkOpenSparse(file, writable);
+
+    if (0 != strcmp(type, "FLAT") || (offset + sectors) * SECTOR_SIZE > file->size) {
+        logPrintf("Error: Unsupported VMDK extent type %s\n", type);
+        blockClose(file);
+        return NULL;
+    }
+
+    c = calloc(1, sizeof(mfContainer));
+
+    if (c == NULL) {
+        blockClose(file);
+        return NULL;
+    }
+
+    c->file = file;
+    c->vmdk.dataOffset = offset * SECTOR_SIZE;
+    c->unitSize = VMDK_FLAT_UNIT;
+    c->map = vmdkMapFlat;
+    return containerCreate(c, sectors * SECTOR_SIZE, writable);
+}
+
+/* ------------------------------------------------------------------------- */
+/* qcow2                                                                     */
+/* ------------------------------------------------------------------------- */
+
+static bool qcowSetRefcount(mfContainer *c, u64 hostCluster, u64 value, u32 depth) {
+    u64 entriesPerBlock = ((u64) c->unitSize * 8) / c->qcow.refcountBits;
+    u64 tableIndex = hostCluster / entriesPerBlock;
+    u64 entryOffset = c->qcow.refcountTableOffset + tableIndex * 8;
+    u64 block;
+    u64 bitOffset;
+    u8 buf[8];
+    u32 bytes = c->qcow.refcountBits / 8;
+
+    if (tableIndex >= c->qcow.refcountTableEntries || depth > 2) {
+        logPrintf("Error: qcow2 refcount table is full\n");
+        return false;
+    }
+
+    if (!fileReadBE64(c->file, entryOffset, &block))
+        return false;
+
+    block &= ~0x1FFULL;
+
+    /* A new refcount block has to count itself, it usually is in its own range */
+
+    if (block == 0) {
+        block = fileAppend(c->file, c->unitSize, c->unitSize);
+
+        if (block == 0 || !fileWriteBE64(c->file, entryOffset, block) || !qcowSetRefcount(c, block >> c->qcow.clusterBits, 1, depth + 1))
+            return false;
+    }
+
+    bitOffset = (hostCluster % entriesPerBlock) * c->qcow.refcountBits;
+
+    for (u32 i = 0; i < bytes; i++) {
+        buf[i] = (u8) (value >> (8 * (bytes - 1 - i)));
+    }
+
+    return blockWrite(c->file, block + bitOffset / 8, buf, bytes);
+}
+
+/* Appends a zeroed cluster and gives it a refcount of one, returns its offset or 0 */
+static u64 qcowAllocateCluster(mfContainer *c) {
+    u64 offset = fileAppend(c->file, c->unitSize, c->unitSize);
+
+    if (offset == 0 || !qcowSetRefcount(c, offset >> c->qcow.clusterBits, 1, 0))
+        return 0;
+
+    return offset;
+}
+
+static bool qcowMap(mfContainer *c, u64 unit, bool allocate, u64 *fileOffset) {
+    u64 l1Index = unit / c->qcow.l2Entries;
+    u64 l2EntryOffset;
+    u64 l1Entry;
+    u64 l2Entry;
+    u64 offset;
+
+    *fileOffset = UNALLOCATED;
+
+    if (l1Index >= c->qcow.l1Size || !fileReadBE64(c->file, c->qcow.l1Offset + l1Index * 8, &l1Entry))
+        return false;
+
+    if ((l1Entry & QCOW_OFFSET_MASK) == 0) {
+        if (!allocate)
+            return true;
+
+        offset = qcowAllocateCluster(c);
+
+        if (offset == 0 || !fileWriteBE64(c->file, c->qcow.l1Offset + l1Index * 8, offset | QCOW_COPIED))
+            return false;
+
+        l1Entry = offset | QCOW_COPIED;
+    } else if (allocate && !(l1Entry & QCOW_COPIED)) {
+        logPrintf("Error: qcow2 L2 table is shared, cannot write\n");
+        return false;
+    }
+
+    l2EntryOffset = (l1Entry & QCOW_OFFSET_MASK) + (unit % c->qcow.l2Entries) * 8;
+
+    if (!fileReadBE64(c->file, l2EntryOffset, &l2Entry))
+        return false;
+
+    if (l2Entry & QCOW_COMPRESSED) {
+        logPrintf("Error: Compressed qcow2 clusters are not supported\n");
+        return false;
+    }
+
+    offset = l2Entry & QCOW_OFFSET_MASK;
+
+    if (offset != 0 && !(l2Entry & QCOW_ZERO)) {
+        if (allocate && !(l2Entry & QCOW_COPIED)) {
+            logPrintf("Error: qcow2 cluster is shared, cannot write\n");
+            return false;
+        }
+
+        *fileOffset = offset;
+        return true;
+    }
+
+    if (!allocate)
+        return true;
+
+    /* Preallocated zero clusters are cleared and used, everything else gets a new cluster */
+
+    if (offset != 0 && (l2Entry & QCOW_COPIED)) {
+        if (!fileZero(c->file, offset, c->unitSize))
+            return false;
+    } else {
+        offset = qcowAllocateCluster(c);
+
+        if (offset == 0)
+            return false;
+    }
+
+    if (!fileWriteBE64(c->file, l2EntryOffset, offset | QCOW_COPIED))
+        return false;
+
+    *fileOffset = offset;
+    return true;
+}
+
+static mfBlockDevice *qcowOpen(mfBlockDevice *file, bool writable) {
+    mfContainer *c = calloc(1, sizeof(mfContainer));
+    u8 header[104];
+    u32 version;
+    u32 refcountOrder = 4;
+
+    if (c == NULL)
+        goto error;
+
+    c->file = file;
+    memset(header, 0, sizeof(header));
+
+    if (!blockRead(file, 0, header, file->size < sizeof(header) ? (u32) file->size : sizeof(header)) || readBE32(header, 0) != QCOW_MAGIC)
+        goto error;
+
+    version = readBE32(header, 4);
+    c->qcow.clusterBits = readBE32(header, 20);
+
+    if ((version != 2 && version != 3) || c->qcow.clusterBits < 9 || c->qcow.clusterBits > 21)
+        goto error;
+
+    if (readBE64(header, 8) != 0 || readBE32(header, 32) != 0 || readBE32(header, 60) != 0) {
+        logPrintf("Error: qcow2 images with backing files, encryption or snapshots are not supported\n");
+        goto error;
+    }
+
+    if (version == 3) {
+        /* Incompatible features: dirty, corrupt, external data, compression type, extended L2 */
+        if (readBE64(header, 72) != 0) {
+            logPrintf("Error: qcow2 image needs features that are not supported (or a repair)\n");
+            goto error;
+        }
+
+        refcountOrder = readBE32(header, 96);
+    }
+
+    if (refcountOrder < 3 || refcountOrder > 6) {
+        logPrintf("Error: qcow2 refcount width of %u bits is not supported\n", 1u << refcountOrder);
+        goto error;
+    }
+
+    c->unitSize = 1u << c->qcow.clusterBits;
+    c->qcow.l2Entries = c->unitSize / 8;
+    c->qcow.l1Size = readBE32(header, 36);
+    c->qcow.l1Offset = readBE64(header, 40);
+    c->qcow.refcountTableOffset = readBE64(header, 48);
+    c->qcow.refcountTableEntries = readBE32(header, 56) * (c->unitSize / 8);
+    c->qcow.refcountBits = 1u << refcountOrder;
+
+    c->map = qcowMap;
+    return containerCreate(c, readBE64(header, 24), writable);
+
+error:
+    logPrintf("Error: Unsupported or damaged qcow2 image\n");
+    blockClose(file);
+    free(c);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+mfBlockDevice *blockOpen(const char *path, bool writable) {
+    mfBlockDevice *file = blockOpenRaw(path, writable);
+    u8 head[32];
+    u8 tail[8];
+
+    if (file == NULL)
+        return NULL;
+
+    /* Descriptor files can be smaller than a sector, anything else is not a container then */
+
+    if (file->size < sizeof(head))
+        return file;
+
+    if (!blockRead(file, 0, head, sizeof(head)) || (file->size >= VHD_FOOTER_SIZE && !blockRead(file, file->size - VHD_FOOTER_SIZE, tail, sizeof(tail)))) {
+        blockClose(file);
+        return NULL;
+    }
+
+    if (file->size >= VHD_FOOTER_SIZE && 0 == memcmp(tail, VHD_COOKIE, sizeof(tail)))
+        return vhdOpen(file, writable);
+
+    if (read32(head, 0) == VMDK_MAGIC)
+        return vmdkOpenSparse(file, writable);
+
+    if (0 == memcmp(head, VMDK_DESCRIPTOR_MAGIC, strlen(VMDK_DESCRIPTOR_MAGIC)))
+        return vmdkOpenDescriptor(path, file, writable);
+
+    if (readBE32(head, 0) == QCOW_MAGIC)
+        return qcowOpen(file, writable);
+
+    return file;
+}
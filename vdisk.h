@@ -0,0 +1,24 @@
+#ifndef _MF_VDISK_H_
+#define _MF_VDISK_H_
+
+#include "util.h"
+#include "blockdev.h"
+
+/*  Virtual disk containers as block devices.
+
+    Dynamic / fixed VHD, sparse VMDK (a hosted sparse extent, or a descriptor
+    with one sparse or flat extent) and qcow2 (version 2 and 3). Only the
+    parts of the guest disk that are accessed are looked up in the container's
+    block tables. Unallocated space reads as zeros. Writing to it allocates a
+    new block / grain / cluster at the end of the container, blocks that are
+    allocated already are modified in place.
+
+    Not supported (the image is rejected): differencing VHDs, compressed or
+    stream optimized VMDKs, qcow2 images with a backing file, compression,
+    encryption or internal snapshots.
+*/
+
+/* Opens a disk image: one of the containers above, anything else is taken as a raw image. NULL on error */
+mfBlockDevice *blockOpen(const char *path, bool writable);
+
+#endif
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "version.h"
+
+#define VERSION_ROOT_KEY            "VS_VERSION_INFO"
+#define VERSION_STRINGS_KEY         "StringFileInfo"
+
+#define VS_FIXEDFILEINFO_SIGNATURE  (0xFEEF04BD)
+#define VS_FIXEDFILEINFO_SIZE       (0x34)
+
+/* 16 bit resource header: 0xFF + type ordinal, 0xFF + name ordinal (or a name), flags and size */
+#define RESOURCE_ORDINAL            (0xFF)
+
+typedef struct {
+    u32 end;                        /* Offsets relative to the VS_VERSION_INFO node */
+    const char *key;
+    u32 value;
+    u32 valueLength;
+    u32 children;
+} mfVersionNode;
+
+static u32 align4(u32 value) {
+    return (value + 3) & ~3u;
+}
+
+/* Reads the node at start, which must not go beyond limit */
+static bool readNode(const mfVersionInfo *info, u32 start, u32 limit, mfVersionNode *node) {
+    u32 keyEnd;
+
+    if (limit > info->size || start > limit || limit - start < 5)
+        return false;
+
+    node->end = start + read16(info->data, start);
+    node->valueLength = read16(info->data, start + 2);
+
+    if (node->end < start + 5 || node->end > limit)
+        return false;
+
+    node->key = (const char *) info->data + start + 4;
+
+    for (keyEnd = start + 4; keyEnd < node->end && info->data[keyEnd] != 0x00; keyEnd++)
+        ;
+
+    if (keyEnd == node->end)
+        return false;
+
+    node->value = align4(keyEnd + 1);
+    node->value = node->value < node->end ? node->value : node->end;
+    node->children = align4(node->value + node->valueLength);
+    node->children = node->children < node->end ? node->children : node->end;
+    return true;
+}
+
+/* Finds the next child of parent from *cursor on with the given key, or any key if key is NULL */
+static bool findChild(const mfVersionInfo *info, const mfVersionNode *parent, const char *key, u32 *cursor, mfVersionNode *child) {
+    while (*cursor < parent->end) {
+        if (!readNode(info, *cursor, parent->end, child))
+            return false;
+
+        *cursor = align4(child->end);
+
+        if (key == NULL || 0 == strcmp(child->key, key))
+            return true;
+    }
+
+    return false;
+}
+
+bool versionParse(mfVersionInfo *info, const u8 *resource, u32 size, u32 fileOffset) {
+    mfVersionNode root;
+    u32 start = 0;
+
+    assert(info != NULL);
+    assert(resource != NULL);
+
+    memset(info, 0, sizeof(mfVersionInfo));
+
+    /* Skip the resource header the VxD header points at, if it is there */
+
+    if (size >= 3 && resource[0] == RESOURCE_ORDINAL) {
+        start = 3;
+
+        if (start < size && resource[start] == RESOURCE_ORDINAL) {
+            start += 3;
+        } else {
+            while (start < size && resource[start] != 0x00)
+                start++;
+
+            start++;
+        }
+
+        start += 2 + 4;
+    }
+
+    if (start >= size)
+        return false;
+
+    info->data = resource + start;
+    info->size = size - start;
+    info->fileOffset = fileOffset + start;
+
+    if (!readNode(info, 0, info->size, &root) || 0 != strcmp(root.key, VERSION_ROOT_KEY))
+        return false;
+
+    if (root.valueLength >= VS_FIXEDFILEINFO_SIZE && root.value + VS_FIXEDFILEINFO_SIZE <= root.end
+     && read32(info->data, root.value) == VS_FIXEDFILEINFO_SIGNATURE) {
+        info->haveFixedInfo = true;
+        info->fileVersionMs = read32(info->data, root.value + 8);
+        info->fileVersionLs = read32(info->data, root.value + 12);
+        info->productVersionMs = read32(info->data, root.value + 16);
+        info->productVersionLs = read32(info->data, root.value + 20);
+    }
+
+    return true;
+}
+
+bool versionFindString(const mfVersionInfo *info, const char *key, mfVersionString *value) {
+    mfVersionNode root;
+    mfVersionNode strings;
+    mfVersionNode table;
+    u32 rootCursor;
+    u32 tableCursor;
+
+    assert(info != NULL && info->data != NULL);
+    assert(key != NULL);
+    assert(value != NULL);
+
+    if (!readNode(info, 0, info->size, &root))
+        return false;
+
+    rootCursor = root.children;
+
+    if (!findChild(info, &root, VERSION_STRINGS_KEY, &rootCursor, &strings))
+        return false;
+
+    /* One table per language / code page */
+
+    tableCursor = strings.children;
+
+    while (findChild(info, &strings, NULL, &tableCursor, &table)) {
+        mfVersionNode string;
+        u32 stringCursor = table.children;
+
+        if (!findChild(info, &table, key, &stringCursor, &string))
+            continue;
+
+        value->offset = info->fileOffset + string.value;
+        value->capacity = string.end - string.value;
+        value->text = (const char *) info->data + string.value;
+
+        for (value->length = 0; value->length < value->capacity && value->text[value->length] != 0x00; value->length++)
+            ;
+
+        return true;
+    }
+
+    return false;
+}
+
+void versionFormat(const mfVersionInfo *info, char *text, size_t size) {
+    assert(info != NULL);
+    assert(text != NULL && size > 0);
+
+    text[0] = 0x00;
+
+    if (info->haveFixedInfo)
+        snprintf(text, size, "%u.%02u.%04u", info->fileVersionMs >> 16, info->fileVersionMs & 0xFFFF, info->fileVersionLs & 0xFFFF);
+}
@@ -0,0 +1,45 @@
+#ifndef _MF_VERSION_H_
+#define _MF_VERSION_H_
+
+#include "util.h"
+
+/*  Version resources of VxDs.
+
+    Win9x VxDs carry a 16 bit version resource: optionally the resource header
+    (type, name, flags, size), then a tree of VS_VERSIONINFO nodes. Each node
+    is a u16 node length, a u16 value length, a zero terminated ASCII key, the
+    value and the child nodes, value and children aligned to 4 bytes. The root
+    (VS_VERSION_INFO) holds VS_FIXEDFILEINFO, the strings are in
+    StringFileInfo -> language / code page tables -> key / value nodes.
+
+    Nothing is copied, the parsed info points into the caller's buffer.
+*/
+
+typedef struct {
+    const u8 *data;                 /* The VS_VERSION_INFO node */
+    u32 size;
+    u32 fileOffset;                 /* File offset of data */
+    bool haveFixedInfo;
+    u32 fileVersionMs;
+    u32 fileVersionLs;
+    u32 productVersionMs;
+    u32 productVersionLs;
+} mfVersionInfo;
+
+typedef struct {
+    u32 offset;                     /* File offset of the value */
+    u32 capacity;                   /* Bytes of the node that are there for the value, so it can be replaced in place */
+    const char *text;
+    u32 length;                     /* Up to the terminator, or capacity if there is none */
+} mfVersionString;
+
+/* Parses a version resource read from fileOffset, returns false if it is not one */
+bool versionParse(mfVersionInfo *info, const u8 *resource, u32 size, u32 fileOffset);
+
+/* Finds a string of the StringFileInfo block (the first language that has it), false if there is none */
+bool versionFindString(const mfVersionInfo *info, const char *key, mfVersionString *value);
+
+/* Formats the file version the way Windows 9x shows it (4.10.2222), empty without VS_FIXEDFILEINFO */
+void versionFormat(const mfVersionInfo *info, char *text, size_t size);
+
+#endif